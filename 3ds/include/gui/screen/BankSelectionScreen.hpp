@@ -27,6 +27,7 @@
 #ifndef BANKSELECTIONSCREEN_HPP
 #define BANKSELECTIONSCREEN_HPP
 
+#include "banks.hpp"
 #include "Hid.hpp"
 #include "Screen.hpp"
 #include <string>
@@ -43,8 +44,13 @@ public:
 private:
     void renameBank();
     void resizeBank();
+    void searchBanks();
+    void restoreBank();
+    int matches(const std::string& bank) const;
     Hid<HidDirection::VERTICAL, HidDirection::HORIZONTAL> hid;
     std::vector<std::pair<std::string, int>> strings;
+    // Slots matching the last search, if there has been one
+    std::optional<std::vector<Banks::SearchResult>> results;
     int& storageBox;
     bool finished = false;
 };
@@ -29,6 +29,7 @@
 
 #include "Directory.hpp"
 #include "File.hpp"
+#include "TreeCopy.hpp"
 #include "utils.hpp"
 #include <3ds.h>
 
@@ -59,11 +60,13 @@ public:
         FS_MediaType mediatype, u32 lowid, u32 highid, bool pxi, u32 pathWord4 = 0);
     static Archive extdata(u32 extdata, bool pxi);
 
-    // As these do manual directory traversal, an FS_Path overload is not possible
-    static Result moveDir(
-        Archive& src, const std::u16string& dir, Archive& dst, const std::u16string& dest);
-    static Result copyDir(
-        Archive& src, const std::u16string& dir, Archive& dst, const std::u16string& dest);
+    // As these do manual directory traversal, an FS_Path overload is not possible. Between
+    // archives, the tree is listed up front and its files copied several at a time; see TreeCopy
+    // for progress reporting and resuming. Without a manifest, a failed copy is removed again.
+    static Result moveDir(Archive& src, const std::u16string& dir, Archive& dst,
+        const std::u16string& dest, const TreeCopy::Options& options = {});
+    static Result copyDir(Archive& src, const std::u16string& dir, Archive& dst,
+        const std::u16string& dest, const TreeCopy::Options& options = {});
     Result deleteDir(const std::u16string& path);
 
     static Result moveFile(Archive& src, FS_Path file, Archive& dst, FS_Path dest);
@@ -73,11 +76,16 @@ public:
     Result createFile(FS_Path file, u32 attributes, u64 size);
     std::unique_ptr<File> file(FS_Path file, u32 flags, u32 attributes = 0);
     Result deleteFile(FS_Path file);
+    // As directory() and file(), except that the result is returned rather than kept for result(),
+    // so they can be used from several threads at once
+    Result openDirectory(FS_Path path, std::unique_ptr<Directory>& out) const;
+    Result openFile(FS_Path file, u32 flags, std::unique_ptr<File>& out, u32 attributes = 0) const;
 
-    static Result moveDir(
-        Archive& src, const std::string& dir, Archive& dst, const std::string& dest)
+    static Result moveDir(Archive& src, const std::string& dir, Archive& dst,
+        const std::string& dest, const TreeCopy::Options& options = {})
     {
-        return moveDir(src, StringUtils::UTF8toUTF16(dir), dst, StringUtils::UTF8toUTF16(dest));
+        return moveDir(
+            src, StringUtils::UTF8toUTF16(dir), dst, StringUtils::UTF8toUTF16(dest), options);
     }
 
     static Result moveFile(
@@ -93,10 +101,11 @@ public:
         return moveFile(src, StringUtils::UTF8toUTF16(file), dst, StringUtils::UTF8toUTF16(dest));
     }
 
-    static Result copyDir(
-        Archive& src, const std::string& dir, Archive& dst, const std::string& dest)
+    static Result copyDir(Archive& src, const std::string& dir, Archive& dst,
+        const std::string& dest, const TreeCopy::Options& options = {})
     {
-        return copyDir(src, StringUtils::UTF8toUTF16(dir), dst, StringUtils::UTF8toUTF16(dest));
+        return copyDir(
+            src, StringUtils::UTF8toUTF16(dir), dst, StringUtils::UTF8toUTF16(dest), options);
     }
 
     static Result copyFile(
@@ -132,6 +141,11 @@ public:
         return directory(StringUtils::UTF8toUTF16(path));
     }
 
+    Result openDirectory(const std::u16string& path, std::unique_ptr<Directory>& out) const
+    {
+        return openDirectory(fsMakePath(PATH_UTF16, path.c_str()), out);
+    }
+
     Result deleteDir(const std::string& path) { return deleteDir(StringUtils::UTF8toUTF16(path)); }
 
     Result createFile(const std::u16string& path, u32 attributes, u64 size)
@@ -154,6 +168,12 @@ public:
         return file(StringUtils::UTF8toUTF16(path), flags, attributes);
     }
 
+    Result openFile(const std::u16string& path, u32 flags, std::unique_ptr<File>& out,
+        u32 attributes = 0) const
+    {
+        return openFile(fsMakePath(PATH_UTF16, path.c_str()), flags, out, attributes);
+    }
+
     Result deleteFile(const std::u16string& path)
     {
         return deleteFile(fsMakePath(PATH_UTF16, path.c_str()));
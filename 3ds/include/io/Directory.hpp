@@ -43,6 +43,7 @@ public:
     bool loaded(void) const;
     std::u16string item(size_t index) const;
     bool folder(size_t index) const;
+    u64 size(size_t index) const;
     size_t count(void) const;
 
 private:
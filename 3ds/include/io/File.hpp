@@ -29,6 +29,7 @@
 
 #include "utils.hpp"
 #include <3ds.h>
+#include <atomic>
 #include <string>
 #include <variant>
 
@@ -56,6 +57,15 @@ public:
     void seek(s64 offset, int from);
     Result resize(u64 size);
 
+    // Positional reads and writes. They leave offset() and result() alone, so several threads can
+    // use them on the same file at once. done receives the number of bytes moved.
+    Result readAt(u64 offset, void* buf, u32 size, u32* done = nullptr) const;
+    Result writeAt(u64 offset, const void* buf, u32 size, u32* done = nullptr);
+    // By default every write goes straight to the card. With this off, writes are flushed once by
+    // flush() or close() instead. Files opened through FSPXI are always flushed on every write.
+    void flushOnWrite(bool flush) { mFlushOnWrite = flush; }
+    Result flush();
+
     // Not for general use! Only meant for very specific, necessary direct calls.
     std::variant<Handle, FSPXI_File> getRawHandle() const;
 
@@ -64,6 +74,8 @@ private:
     u64 mSize;
     u64 mOffset;
     Result mResult;
+    bool mFlushOnWrite = true;
+    std::atomic<bool> mUnflushed = false;
 };
 
 #endif
@@ -72,6 +72,9 @@ extern "C" {
 #define SPI_FLG_WIP 1
 #define SPI_FLG_WEL 2
 
+// Largest amount of save data moved by a single read command
+#define SPI_BULK_BLOCK_SIZE 0x10000
+
 extern u8* fill_buf;
 
 typedef enum
@@ -112,6 +115,10 @@ u32 SPIGetCapacity(CardType type);
 
 Result SPIWriteSaveData(CardType type, u32 offset, void* data, u32 size);
 Result SPIReadSaveData(CardType type, u32 offset, void* data, u32 size);
+// Like SPIWriteSaveData, but reads the chip back first and only programs the pages whose contents
+// differ. Runs of changed pages are written together. pagesWritten, if not NULL, receives how many
+// pages had to be programmed.
+Result SPIUpdateSaveData(CardType type, u32 offset, const void* data, u32 size, u32* pagesWritten);
 
 Result SPIEraseSector(CardType type, u32 offset);
 
@@ -48,6 +48,8 @@ void backupBridgeChanges(void);
 namespace TitleLoader
 {
     void scanTitles(void);
+    // Runs scanTitles on a worker once any scan started this way before has finished
+    void scanTitlesAsync(void);
     bool scanCard(void);
     bool cardWasUpdated(void);
     void scanSaves(void);
@@ -64,6 +66,9 @@ namespace TitleLoader
     void init(void);
     void exit(void);
     std::string savePath(void);
+    // Rearranges the loaded save's boxes: slot i ends up with what was in slot order[i], and every
+    // slot past the end of order is emptied
+    void permuteSaveSlots(const std::vector<int>& order);
     void reloadTitleIds(void);
 
     // Title lists
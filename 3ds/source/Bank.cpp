@@ -31,6 +31,7 @@
 #include "gui.hpp"
 #include "io.hpp"
 #include "nlohmann/json.hpp"
+#include "parallel.hpp"
 #include "pkx/PB7.hpp"
 #include "pkx/PK1.hpp"
 #include "pkx/PK2.hpp"
@@ -41,12 +42,17 @@
 #include "pkx/PK7.hpp"
 #include "pkx/PK8.hpp"
 #include "utils/VersionTables.hpp"
+#include "utils/format.hpp"
 #include <format>
+#include <set>
 
 #define BANK(paths) (paths).first
 #define JSON(paths) (paths).second
 #define ARCHIVE (Configuration::getInstance().useExtData() ? Archive::data() : Archive::sd())
 #define OTHERARCHIVE (Configuration::getInstance().useExtData() ? Archive::sd() : Archive::data())
+// Journals and indexes always live on the SD card, where they don't count against the 200 files
+// extdata has room for. A journal is still tied to its bank by the epoch in the bank's header
+#define BANKDATA Archive::sd()
 
 class BankException : public std::exception
 {
@@ -62,28 +68,49 @@ private:
     std::string string;
 };
 
-Bank::Bank(const std::string& name, int maxBoxes) : bankName(name)
+namespace
 {
-    load(maxBoxes);
-}
+    // FNV-1a; only needs to catch torn or stale journal records, not malicious ones
+    u32 checksum(const u8* data, size_t size, u32 hash = 0x811C9DC5)
+    {
+        for (size_t i = 0; i < size; i++)
+        {
+            hash = (hash ^ data[i]) * 0x01000193;
+        }
+        return hash;
+    }
 
-Bank::~Bank()
-{
-    if (entries)
+    std::string hashName(const std::array<u8, 32>& hash)
     {
-        delete[] entries;
+        static constexpr char HEX[] = "0123456789abcdef";
+        std::string ret;
+        for (u8 byte : hash)
+        {
+            ret += HEX[byte >> 4];
+            ret += HEX[byte & 0xF];
+        }
+        return ret;
     }
 }
 
+Bank::Bank(const std::string& name, int maxBoxes) : bankName(name)
+{
+    load(maxBoxes);
+}
+
 void Bank::load(int maxBoxes)
 {
-    bool create = false;
-    if (entries)
-    {
-        delete[] entries;
-        entries = nullptr;
-    }
-    needsCheck = false;
+    bool create   = false;
+    needsFullSave = false;
+    backedByFile  = false;
+    indexStale    = true;
+    journalCount  = 0;
+    journalOverlay.clear();
+    boxHeaders.clear();
+    // Nothing but a version 4 bank file can have a journal written against it
+    header.journalEpoch = 0;
+    journalEpoch        = 0;
+    std::fill_n(header.padding, sizeof(header.padding), 0xFF);
     if (name() == "pksm_1" && io::exists("/3ds/PKSM/bank/bank.bin"))
     {
         convertFromBankBin();
@@ -93,6 +120,23 @@ void Bank::load(int maxBoxes)
         auto paths    = this->paths();
         bool needSave = false;
         auto in       = ARCHIVE.file(BANK(paths), FS_OPEN_READ);
+        if (!in)
+        {
+            // A rewrite that got as far as deleting the old bank but not renaming the new one into
+            // its place. The header is written last, so a temporary file that has it is complete
+            const std::string tmpPath = BANK(paths) + ".tmp";
+            if (auto tmp = ARCHIVE.file(tmpPath, FS_OPEN_READ))
+            {
+                char magic[8] = {};
+                tmp->read(magic, sizeof(magic));
+                tmp->close();
+                if (!memcmp(magic, BANK_MAGIC.data(), 8) &&
+                    R_SUCCEEDED(Archive::moveFile(ARCHIVE, tmpPath, ARCHIVE, BANK(paths))))
+                {
+                    in = ARCHIVE.file(BANK(paths), FS_OPEN_READ);
+                }
+            }
+        }
         if (in)
         {
             Gui::waitFrame(i18n::localize("BANK_LOAD"));
@@ -103,7 +147,8 @@ void Bank::load(int maxBoxes)
                 Gui::warn(i18n::localize("BANK_CORRUPT"));
                 in->close();
                 createBank(maxBoxes);
-                needSave = true;
+                needSave      = true;
+                needsFullSave = true;
             }
             else
             {
@@ -116,48 +161,116 @@ void Bank::load(int maxBoxes)
                 };
 
                 static_assert(sizeof(G7Entry) == 264);
+                u32 dataOffset   = LEGACY_HEADER_SIZE;
+                size_t entrySize = sizeof(BankEntry);
                 if (header.version == 1)
                 {
                     header.boxes =
-                        (size - (sizeof(BankHeader) - sizeof(u32))) / sizeof(G7Entry) / 30;
+                        (size - (LEGACY_HEADER_SIZE - sizeof(u32))) / sizeof(G7Entry) / 30;
                     maxBoxes = header.boxes;
                     extern nlohmann::json g_banks;
                     g_banks[bankName] = maxBoxes;
                     Banks::saveJson();
-                    entries        = new BankEntry[boxes() * 30];
-                    header.version = BANK_VERSION;
-                    needSave       = true;
-
-                    for (int i = 0; i < boxes() * 30; i++)
-                    {
-                        in->read(entries + i, sizeof(G7Entry));
-                        std::fill_n((u8*)(entries + i) + sizeof(G7Entry),
-                            sizeof(BankEntry) - sizeof(G7Entry), 0xFF);
-                    }
-                    in->close();
+                    dataOffset = LEGACY_HEADER_SIZE - sizeof(u32);
+                    entrySize  = sizeof(G7Entry);
                 }
                 else if (header.version == 2)
                 {
                     in->read(&header.boxes, sizeof(u32));
-                    entries        = new BankEntry[boxes() * 30];
+                    entrySize = sizeof(G7Entry);
+                }
+                else if (header.version == 3)
+                {
+                    in->read(&header.boxes, sizeof(u32));
+                }
+                else if (header.version == BANK_VERSION)
+                {
+                    in->read((char*)&header + offsetof(BankHeader, boxes),
+                        sizeof(BankHeader) - offsetof(BankHeader, boxes));
+                }
+
+                if (header.version != 0 && header.version < BANK_VERSION)
+                {
+                    // The original is kept as it was, since nothing can convert a bank back
+                    Archive::sd().createDir(backupPath(), 0);
+                    const std::string originalPath =
+                        backupPath() + "/v" + std::to_string(header.version) + ".bnk";
+                    Result backedUp =
+                        Archive::copyFile(ARCHIVE, BANK(paths), Archive::sd(), originalPath);
+                    if (R_FAILED(backedUp))
+                    {
+                        Gui::error(i18n::localize("BACKUP_FAIL_SAVE_1"), backedUp);
+                        Archive::sd().deleteFile(originalPath);
+                    }
+
                     header.version = BANK_VERSION;
-                    needSave       = true;
+                    resetResidency();
+                    resetDirtyState();
 
-                    for (int i = 0; i < boxes() * 30; i++)
+                    const std::string tmpPath = BANK(paths) + ".tmp";
+                    bool converted            = R_SUCCEEDED(backedUp) &&
+                                                convertBank(*in, dataOffset, entrySize, tmpPath);
+                    if (!converted)
                     {
-                        in->read(entries + i, sizeof(G7Entry));
-                        std::fill_n((u8*)(entries + i) + sizeof(G7Entry),
-                            sizeof(BankEntry) - sizeof(G7Entry), 0xFF);
+                        // Couldn't write the converted bank, so convert it in memory instead
+                        in->seek(dataOffset, SEEK_SET);
+                        for (int box = 0; box < boxes(); box++)
+                        {
+                            readLegacyBox(*in, entrySize, makeResident(box));
+                        }
                     }
+                    // The old file has to be closed before it can be replaced
                     in->close();
+                    if (converted)
+                    {
+                        Result res = Archive::moveFile(ARCHIVE, tmpPath, ARCHIVE, BANK(paths));
+                        if (R_FAILED(res))
+                        {
+                            Gui::error(i18n::localize("BANK_SAVE_ERROR"), res);
+                            auto tmp = ARCHIVE.file(tmpPath, FS_OPEN_READ);
+                            for (int box = 0; box < boxes(); box++)
+                            {
+                                if (!readBox(tmp.get(), box, makeResident(box)))
+                                {
+                                    unreadableBoxes.insert(box);
+                                }
+                            }
+                            if (tmp)
+                            {
+                                tmp->close();
+                            }
+                            converted = false;
+                        }
+                        else
+                        {
+                            backedByFile = true;
+                        }
+                    }
+
+                    if (!converted)
+                    {
+                        // Everything stays resident until it can be saved. Without a copy of the
+                        // original, that waits until the user saves it themselves
+                        boxHeaders.clear();
+                        backedByFile  = false;
+                        needSave      = R_SUCCEEDED(backedUp);
+                        needsFullSave = true;
+                    }
                 }
                 else if (header.version == BANK_VERSION)
                 {
-                    in->read(&header.boxes, sizeof(u32));
-                    entries = new BankEntry[boxes() * 30];
-
-                    in->read(entries, size - sizeof(BankHeader));
+                    // Boxes are only read in once they're actually looked at
+                    boxHeaders.resize(boxes());
+                    in->read(boxHeaders.data(), sizeof(BoxHeader) * boxHeaders.size());
                     in->close();
+                    backedByFile = true;
+                    journalEpoch = header.journalEpoch;
+
+                    resetResidency();
+                    resetDirtyState();
+                    replayJournal();
+                    indexStale = !indexUsable(bankName, boxes(), nullptr);
+                    seedSavedHashes();
                 }
                 else
                 {
@@ -166,8 +279,9 @@ void Bank::load(int maxBoxes)
                     Gui::waitFrame(i18n::localize("BANK_CREATE"));
                     in->close();
                     createBank(maxBoxes);
-                    needSave = true;
-                    create   = true;
+                    needSave      = true;
+                    needsFullSave = true;
+                    create        = true;
                 }
             }
         }
@@ -175,14 +289,20 @@ void Bank::load(int maxBoxes)
         {
             Gui::waitFrame(i18n::localize("BANK_CREATE"));
             createBank(maxBoxes);
-            needSave = true;
-            create   = true;
+            needSave      = true;
+            needsFullSave = true;
+            create        = true;
+        }
+
+        if (needsFullSave)
+        {
+            resetDirtyState();
         }
 
         auto json = ARCHIVE.file(JSON(paths), FS_OPEN_READ);
         if (json)
         {
-            size_t jsonSize = in->size();
+            size_t jsonSize = json->size();
             char* jsonData  = new char[jsonSize + 1];
             json->read(jsonData, jsonSize);
             json->close();
@@ -193,7 +313,8 @@ void Bank::load(int maxBoxes)
             if (boxNames->is_discarded())
             {
                 createJSON();
-                needSave = true;
+                needSave   = true;
+                namesDirty = true;
             }
             else
             {
@@ -204,13 +325,15 @@ void Bank::load(int maxBoxes)
                     {
                         needSave = true;
                     }
+                    namesDirty = true;
                 }
             }
         }
         else
         {
             createJSON();
-            needSave = true;
+            needSave   = true;
+            namesDirty = true;
         }
 
         if (boxes() != maxBoxes)
@@ -229,214 +352,1316 @@ void Bank::load(int maxBoxes)
                 save();
             }
         }
-        else
-        {
-            prevHash = pksm::crypto::sha256({(u8*)entries, sizeof(BankEntry) * boxes() * 30});
-            std::string nameData = boxNames->dump(2);
-            prevNameHash         = pksm::crypto::sha256({(u8*)nameData.data(), nameData.size()});
-        }
     }
 }
 
 bool Bank::saveWithoutBackup() const
 {
-    auto paths = this->paths();
+    return writeBank(nullptr);
+}
+
+bool Bank::writeBank(const std::vector<int>* order) const
+{
+    if (!boxesReadable())
+    {
+        return false;
+    }
+
     Gui::waitFrame(i18n::localize("BANK_SAVE"));
-    ARCHIVE.deleteFile(BANK(paths));
-    ARCHIVE.createFile(BANK(paths), 0, sizeof(BankHeader) + sizeof(BankEntry) * boxes() * 30);
-    auto out = ARCHIVE.file(BANK(paths), FS_OPEN_WRITE);
+    // A permutation can only be applied by rewriting the whole file
+    const bool full = needsFullSave || order;
+    if (full)
+    {
+        if (!saveFull(order))
+        {
+            return false;
+        }
+        // Resident boxes are no longer the only copy of anything, so reading the index back in
+        // below doesn't have to keep every box in memory
+        needsFullSave = false;
+        if (order)
+        {
+            // Slots were moved around on disk, so what's in memory no longer matches any of it
+            resetResidency();
+            cleanBoxHashes.clear();
+        }
+    }
+    else if (dirtyCount > 0 && !saveJournal())
+    {
+        return false;
+    }
+
+    if (full || namesDirty)
+    {
+        saveJSON();
+    }
+
+    // The index only helps searching, so failing to write it isn't worth failing the save over
+    if (full || indexStale)
+    {
+        rebuildIndex();
+    }
+    else if (dirtyCount > 0)
+    {
+        updateIndex();
+    }
+
+    // Remember what's on disk now, so the next backup knows which boxes it can skip. Boxes that
+    // weren't changed are the same as they were, even after a full rewrite
+    for (const auto& [box, hash] : cleanBoxHashes)
+    {
+        savedBoxHashes[box] = boxHash(box);
+    }
+
+    resetDirtyState();
+    evictBoxes();
+    return true;
+}
+
+bool Bank::saveFull(const std::vector<int>* order) const
+{
+    // The rewrite has to be in the same archive as the bank to be renamed over it, so in extdata
+    // this takes one of its 200 file slots, on top of the bank and its box names, until it's done
+    auto paths                = this->paths();
+    const std::string tmpPath = BANK(paths) + ".tmp";
+    std::vector<BoxHeader> newHeaders(boxes());
+    ARCHIVE.deleteFile(tmpPath);
+    ARCHIVE.createFile(tmpPath, 0,
+        sizeof(BankHeader) + sizeof(BoxHeader) * boxes() + sizeof(BankEntry) * boxes() * 30);
+    auto out = ARCHIVE.file(tmpPath, FS_OPEN_WRITE);
+    if (!out)
+    {
+        Gui::error(i18n::localize("BANK_SAVE_ERROR"), ARCHIVE.result());
+        return false;
+    }
+    // Only moved over the bank once closed, which flushes it
+    out->flushOnWrite(false);
+
+    // Boxes that aren't resident are streamed over from the current bank file one at a time. The
+    // box headers are only known at the end, so they go in last
+    auto in = backedByFile ? ARCHIVE.file(BANK(paths), FS_OPEN_READ) : nullptr;
+    if (backedByFile && !in)
+    {
+        Gui::error(i18n::localize("BANK_SAVE_ERROR"), ARCHIVE.result());
+        out->close();
+        ARCHIVE.deleteFile(tmpPath);
+        return false;
+    }
+    auto buffer = std::unique_ptr<BankEntry[]>(new BankEntry[30]);
+    // Entries are picked out of the file one run at a time when permuting, which can't be checked
+    // against the box checksums, so every box they could come from is checked up front instead
+    int badBox = -1;
+    for (int box = 0; order && box < boxes() && badBox == -1; box++)
+    {
+        if (!residentBoxes[box] && !readBox(in.get(), box, buffer.get()))
+        {
+            badBox = box;
+        }
+    }
+    out->seek(sizeof(BankHeader) + sizeof(BoxHeader) * boxes(), SEEK_SET);
+    for (int box = 0; box < boxes() && badBox == -1; box++)
+    {
+        const BankEntry* source = residentBoxes[box].get();
+        bool read               = true;
+        if (order)
+        {
+            read   = gatherBox(in.get(), *order, box, buffer.get());
+            source = buffer.get();
+        }
+        else if (!source)
+        {
+            read   = readBox(in.get(), box, buffer.get());
+            source = buffer.get();
+        }
+        if (!read)
+        {
+            badBox = box;
+            break;
+        }
+        newHeaders[box] = boxHeader(source);
+        if (out->write(source, sizeof(BankEntry) * 30) != sizeof(BankEntry) * 30)
+        {
+            Gui::error(i18n::localize("BANK_SAVE_ERROR"), out->result());
+            if (in)
+            {
+                in->close();
+            }
+            out->close();
+            ARCHIVE.deleteFile(tmpPath);
+            return false;
+        }
+    }
+    if (badBox != -1)
+    {
+        Gui::warn(pksm::format(i18n::localize("BANK_BOX_UNREADABLE"), badBox + 1));
+        if (in)
+        {
+            in->close();
+        }
+        out->close();
+        ARCHIVE.deleteFile(tmpPath);
+        return false;
+    }
+    if (in)
+    {
+        in->close();
+    }
+    // Whatever the journal holds is superseded by the rewrite, so the new file doesn't name it
+    BankHeader newHeader   = header;
+    newHeader.journalEpoch = 0;
+    out->seek(0, SEEK_SET);
+    out->write(&newHeader, sizeof(BankHeader));
+    out->write(newHeaders.data(), sizeof(BoxHeader) * newHeaders.size());
+    out->close();
+    if (R_FAILED(out->result()))
+    {
+        Gui::error(i18n::localize("BANK_SAVE_ERROR"), out->result());
+        ARCHIVE.deleteFile(tmpPath);
+        return false;
+    }
+
+    // Until the new file is in place, the old one and its journal are still the bank
+    Result res = Archive::moveFile(ARCHIVE, tmpPath, ARCHIVE, BANK(paths));
+    if (R_FAILED(res))
+    {
+        Gui::error(i18n::localize("BANK_SAVE_ERROR"), res);
+        return false;
+    }
+    boxHeaders   = std::move(newHeaders);
+    backedByFile = true;
+    journalEpoch = 0;
+
+    BANKDATA.deleteFile(journalPath());
+    journalOverlay.clear();
+    journalCount = 0;
+    return true;
+}
+
+bool Bank::saveJournal() const
+{
+    if (journalCount + dirtyCount > JOURNAL_CAPACITY)
+    {
+        return compactJournal();
+    }
+
+    const std::string path = journalPath();
+    if (journalCount == 0)
+    {
+        JournalHeader journalHeader;
+        std::copy(JOURNAL_MAGIC.begin(), JOURNAL_MAGIC.end(), journalHeader.MAGIC);
+        journalHeader.version = JOURNAL_VERSION;
+        journalHeader.boxes   = boxes();
+        // Keep new epochs distinct from anything a previous journal may have left on disk. Zero
+        // means the bank has no journal
+        journalHeader.epoch = u32(osGetTime());
+        if (journalHeader.epoch == journalEpoch || journalHeader.epoch == 0)
+        {
+            journalHeader.epoch = std::max(journalEpoch + 1, 1u);
+        }
+        std::fill_n(journalHeader.padding, sizeof(journalHeader.padding), 0xFF);
+
+        BANKDATA.deleteFile(path);
+        // Allocated at full size up front, so appending never has to grow the file
+        if (R_FAILED(BANKDATA.createFile(
+                path, 0, sizeof(JournalHeader) + sizeof(JournalRecord) * JOURNAL_CAPACITY)))
+        {
+            return compactJournal();
+        }
+        auto out = BANKDATA.file(path, FS_OPEN_WRITE);
+        if (!out || out->write(&journalHeader, sizeof(JournalHeader)) != sizeof(JournalHeader))
+        {
+            if (out)
+            {
+                out->close();
+            }
+            BANKDATA.deleteFile(path);
+            return compactJournal();
+        }
+        out->close();
+
+        // Records only count once the bank file says they belong to it
+        auto bank = ARCHIVE.file(BANK(paths()), FS_OPEN_WRITE);
+        if (!bank)
+        {
+            BANKDATA.deleteFile(path);
+            return compactJournal();
+        }
+        bank->seek(offsetof(BankHeader, journalEpoch), SEEK_SET);
+        bank->write(&journalHeader.epoch, sizeof(u32));
+        bank->close();
+        if (R_FAILED(bank->result()))
+        {
+            BANKDATA.deleteFile(path);
+            return compactJournal();
+        }
+        journalEpoch = journalHeader.epoch;
+    }
+
+    auto records  = std::unique_ptr<JournalRecord[]>(new JournalRecord[dirtyCount]);
+    u32 numRecord = 0;
+    for (int i = 0; i < boxes() * 30; i++)
+    {
+        if (dirtySlots[i])
+        {
+            JournalRecord& record = records[numRecord++];
+            record.index          = i;
+            record.epoch          = journalEpoch;
+            std::fill_n(record.padding, sizeof(record.padding), 0xFF);
+            record.entry    = residentBoxes[i / 30][i % 30];
+            record.checksum = journalChecksum(record);
+        }
+    }
+
+    auto out = BANKDATA.file(path, FS_OPEN_WRITE);
     if (out)
     {
-        out->write(&header, sizeof(BankHeader));
-        out->write(entries, sizeof(BankEntry) * boxes() * 30);
+        out->seek(sizeof(JournalHeader) + sizeof(JournalRecord) * journalCount, SEEK_SET);
+        u32 written = out->write(records.get(), sizeof(JournalRecord) * numRecord);
         out->close();
+        if (written == sizeof(JournalRecord) * numRecord)
+        {
+            for (u32 i = 0; i < numRecord; i++)
+            {
+                journalOverlay.insert_or_assign(records[i].index, records[i].entry);
+            }
+            journalCount += numRecord;
+            return true;
+        }
+    }
 
-        std::string jsonData = boxNames->dump(2);
-        ARCHIVE.deleteFile(JSON(paths));
-        ARCHIVE.createFile(JSON(paths), 0, jsonData.size() + 1);
-        out = ARCHIVE.file(JSON(paths), FS_OPEN_WRITE, jsonData.size() + 1);
-        if (out)
-        {
-            out->write(jsonData.data(), jsonData.size() + 1);
-            prevHash     = pksm::crypto::sha256({(u8*)entries, sizeof(BankEntry) * boxes() * 30});
-            prevNameHash = pksm::crypto::sha256({(u8*)jsonData.data(), jsonData.size()});
-            out->close();
+    // Couldn't append; write straight into the bank instead
+    return compactJournal();
+}
+
+bool Bank::compactJournal() const
+{
+    auto paths = this->paths();
+
+    // Box headers have to match what the boxes will look like once everything is written
+    std::vector<BoxHeader> newHeaders = boxHeaders;
+    {
+        auto in     = ARCHIVE.file(BANK(paths), FS_OPEN_READ);
+        auto buffer = std::unique_ptr<BankEntry[]>(new BankEntry[30]);
+        bool read   = true;
+        for (int box = 0; box < boxes() && read; box++)
+        {
+            bool changed = false;
+            for (int slot = 0; slot < 30 && !changed; slot++)
+            {
+                changed = dirtySlots[box * 30 + slot] || journalOverlay.contains(box * 30 + slot);
+            }
+            if (!changed)
+            {
+                continue;
+            }
+            if (residentBoxes[box])
+            {
+                newHeaders[box] = boxHeader(residentBoxes[box].get());
+            }
+            else if ((read = readBox(in.get(), box, buffer.get())))
+            {
+                newHeaders[box] = boxHeader(buffer.get());
+            }
+            else
+            {
+                // Headers worked out from an empty box would make the real one look corrupt
+                Gui::warn(pksm::format(i18n::localize("BANK_BOX_UNREADABLE"), box + 1));
+            }
         }
-        else
+        if (in)
+        {
+            in->close();
+        }
+        if (!read)
+        {
+            return false;
+        }
+    }
+
+    auto out = ARCHIVE.file(BANK(paths), FS_OPEN_WRITE);
+    if (!out)
+    {
+        Gui::error(i18n::localize("BANK_SAVE_ERROR"), ARCHIVE.result());
+        return false;
+    }
+
+    for (int box = 0; box < boxes(); box++)
+    {
+        const BankEntry* resident = residentBoxes[box].get();
+        for (int slot = 0; slot < 30;)
         {
-            Gui::error(i18n::localize("BANK_NAME_ERROR"), ARCHIVE.result());
+            int index = box * 30 + slot;
+            if (!dirtySlots[index] && !journalOverlay.contains(index))
+            {
+                slot++;
+                continue;
+            }
+
+            const BankEntry* source;
+            int end = slot + 1;
+            if (resident)
+            {
+                // Write runs of adjacent changed slots with a single call each
+                while (end < 30 &&
+                       (dirtySlots[box * 30 + end] || journalOverlay.contains(box * 30 + end)))
+                {
+                    end++;
+                }
+                source = resident + slot;
+            }
+            else
+            {
+                // Evicted since it was journaled, so the journal has the only copy
+                source = &journalOverlay.at(index);
+            }
+
+            out->seek(entryOffset(index), SEEK_SET);
+            out->write(source, sizeof(BankEntry) * (end - slot));
+            if (R_FAILED(out->result()))
+            {
+                Gui::error(i18n::localize("BANK_SAVE_ERROR"), out->result());
+                out->close();
+                return false;
+            }
+            slot = end;
         }
-        needsCheck = false;
+    }
+    // Until this is written the journal is still needed, and readBox still gets the right data
+    const u32 noJournal = 0;
+    out->seek(offsetof(BankHeader, journalEpoch), SEEK_SET);
+    out->write(&noJournal, sizeof(u32));
+    out->seek(sizeof(BankHeader), SEEK_SET);
+    out->write(newHeaders.data(), sizeof(BoxHeader) * newHeaders.size());
+    out->close();
+    if (R_FAILED(out->result()))
+    {
+        Gui::error(i18n::localize("BANK_SAVE_ERROR"), out->result());
+        return false;
+    }
+    boxHeaders   = std::move(newHeaders);
+    journalEpoch = 0;
+
+    BANKDATA.deleteFile(journalPath());
+    journalOverlay.clear();
+    journalCount = 0;
+    return true;
+}
+
+bool Bank::saveJSON() const
+{
+    auto paths           = this->paths();
+    std::string jsonData = boxNames->dump(2);
+    ARCHIVE.deleteFile(JSON(paths));
+    ARCHIVE.createFile(JSON(paths), 0, jsonData.size() + 1);
+    auto out = ARCHIVE.file(JSON(paths), FS_OPEN_WRITE, jsonData.size() + 1);
+    if (out)
+    {
+        out->write(jsonData.data(), jsonData.size() + 1);
+        out->close();
         return true;
     }
     else
     {
-        Gui::error(i18n::localize("BANK_SAVE_ERROR"), ARCHIVE.result());
+        Gui::error(i18n::localize("BANK_NAME_ERROR"), ARCHIVE.result());
         return false;
     }
 }
 
-bool Bank::save() const
+void Bank::replayJournal()
+{
+    journalOverlay.clear();
+    std::optional<u32> records = readJournal(bankName, boxes(), journalEpoch, journalOverlay);
+    if (!records)
+    {
+        BANKDATA.deleteFile(journalPath());
+    }
+    journalCount = records.value_or(0);
+}
+
+std::optional<u32> Bank::readJournal(const std::string& bankName, int boxes, u32 epoch,
+    std::unordered_map<int, BankEntry>& overlay)
+{
+    auto in = BANKDATA.file(journalPath(bankName), FS_OPEN_READ);
+    if (!in)
+    {
+        return 0;
+    }
+
+    JournalHeader journalHeader;
+    if (in->read(&journalHeader, sizeof(JournalHeader)) != sizeof(JournalHeader) ||
+        memcmp(journalHeader.MAGIC, JOURNAL_MAGIC.data(), JOURNAL_MAGIC.size()) ||
+        journalHeader.version != JOURNAL_VERSION || (int)journalHeader.boxes != boxes ||
+        epoch == 0 || journalHeader.epoch != epoch)
+    {
+        in->close();
+        return std::nullopt;
+    }
+
+    u32 numRecords = std::min(
+        u32((in->size() - sizeof(JournalHeader)) / sizeof(JournalRecord)), JOURNAL_CAPACITY);
+    auto records = std::unique_ptr<JournalRecord[]>(new JournalRecord[numRecords]);
+    numRecords   = in->read(records.get(), sizeof(JournalRecord) * numRecords) /
+                 sizeof(JournalRecord);
+    in->close();
+
+    // The first record that doesn't check out marks the end of what was actually written
+    u32 replayed = 0;
+    for (u32 i = 0; i < numRecords; i++)
+    {
+        const JournalRecord& record = records[i];
+        if (record.epoch != epoch || record.index >= u32(boxes * 30) ||
+            record.checksum != journalChecksum(record))
+        {
+            break;
+        }
+        overlay.insert_or_assign(record.index, record.entry);
+        replayed++;
+    }
+    return replayed;
+}
+
+u32 Bank::journalChecksum(const JournalRecord& record)
+{
+    u32 hash = checksum((const u8*)&record.index, sizeof(record.index));
+    hash     = checksum((const u8*)&record.epoch, sizeof(record.epoch), hash);
+    return checksum((const u8*)&record.entry, sizeof(record.entry), hash);
+}
+
+void Bank::resetDirtyState() const
+{
+    dirtySlots.assign(boxes() * 30, false);
+    cleanBoxHashes.clear();
+    dirtyCount = 0;
+    namesDirty = false;
+}
+
+std::array<u8, 32> Bank::boxHash(int box) const
+{
+    return pksm::crypto::sha256({(u8*)boxEntries(box), sizeof(BankEntry) * 30});
+}
+
+void Bank::resetResidency() const
+{
+    residentBoxes.clear();
+    residentBoxes.resize(boxes());
+    decodedBoxes.clear();
+    unreadableBoxes.clear();
+    savedBoxHashes.assign(boxes(), std::nullopt);
+    boxLastUse.assign(boxes(), 0);
+    residentCount = 0;
+}
+
+Bank::BankEntry* Bank::makeResident(int box) const
+{
+    if (!residentBoxes[box])
+    {
+        residentBoxes[box] = std::unique_ptr<BankEntry[]>(new BankEntry[30]);
+        residentCount++;
+    }
+    boxLastUse[box] = ++useCounter;
+    return residentBoxes[box].get();
+}
+
+Bank::BankEntry* Bank::boxEntries(int box) const
+{
+    if (residentBoxes[box])
+    {
+        boxLastUse[box] = ++useCounter;
+        return residentBoxes[box].get();
+    }
+
+    BankEntry* entries = makeResident(box);
+    auto in            = backedByFile ? ARCHIVE.file(BANK(paths()), FS_OPEN_READ) : nullptr;
+    bool read          = readBox(in.get(), box, entries);
+    Result res         = in ? in->result() : ARCHIVE.result();
+    if (in)
+    {
+        in->close();
+    }
+    if (read)
+    {
+        unreadableBoxes.erase(box);
+    }
+    else if (unreadableBoxes.insert(box).second)
+    {
+        // This can happen mid-frame, which error copes with
+        Gui::error(pksm::format(i18n::localize("BANK_BOX_UNREADABLE"), box + 1), res);
+    }
+    evictBoxes();
+    return entries;
+}
+
+bool Bank::readBox(File* in, int box, BankEntry* out) const
+{
+    bool good = true;
+    // Empty boxes, and boxes past the end of the file after the bank has grown, aren't read at all
+    if ((size_t)box < boxHeaders.size() && boxHeaders[box].occupied > 0)
+    {
+        good = false;
+        // A second read catches anything that went wrong in the first one
+        for (int attempt = 0; in && attempt < 2 && !good; attempt++)
+        {
+            in->seek(entryOffset(box * 30), SEEK_SET);
+            good = in->read(out, sizeof(BankEntry) * 30) == sizeof(BankEntry) * 30 &&
+                   boxHeader(out).checksum == boxHeaders[box].checksum;
+        }
+    }
+    // Half of a box is no better than none of it
+    if (!good || (size_t)box >= boxHeaders.size() || boxHeaders[box].occupied == 0)
+    {
+        std::fill_n((u8*)out, sizeof(BankEntry) * 30, 0xFF);
+    }
+
+    if (!journalOverlay.empty())
+    {
+        for (int slot = 0; slot < 30; slot++)
+        {
+            if (auto found = journalOverlay.find(box * 30 + slot); found != journalOverlay.end())
+            {
+                out[slot] = found->second;
+            }
+        }
+    }
+    return good;
+}
+
+bool Bank::boxesReadable() const
+{
+    if (unreadableBoxes.empty())
+    {
+        return true;
+    }
+
+    auto in = backedByFile ? ARCHIVE.file(BANK(paths()), FS_OPEN_READ) : nullptr;
+    for (auto it = unreadableBoxes.begin(); it != unreadableBoxes.end();)
+    {
+        int box = *it;
+        // Evicted ones get read again when they're needed. Edited ones have no real contents left
+        // to merge the edits into, so they can never be saved
+        if (!residentBoxes[box])
+        {
+            it = unreadableBoxes.erase(it);
+        }
+        else if (!cleanBoxHashes.contains(box) && readBox(in.get(), box, residentBoxes[box].get()))
+        {
+            decodedBoxes.erase(box);
+            it = unreadableBoxes.erase(it);
+        }
+        else
+        {
+            it++;
+        }
+    }
+    if (in)
+    {
+        in->close();
+    }
+
+    if (!unreadableBoxes.empty())
+    {
+        Gui::warn(
+            pksm::format(i18n::localize("BANK_BOX_UNREADABLE"), *unreadableBoxes.begin() + 1));
+        return false;
+    }
+    return true;
+}
+
+Bank::BoxHeader Bank::boxHeader(const BankEntry* entries)
+{
+    BoxHeader ret;
+    ret.occupied = std::count_if(entries, entries + 30,
+        [](const BankEntry& entry) { return entry.gen != pksm::Generation::UNUSED; });
+    ret.checksum = checksum((const u8*)entries, sizeof(BankEntry) * 30);
+    return ret;
+}
+
+size_t Bank::entryOffset(int index) const
+{
+    return sizeof(BankHeader) + sizeof(BoxHeader) * boxHeaders.size() + sizeof(BankEntry) * index;
+}
+
+int Bank::occupiedSlots(int box) const
+{
+    // A box that isn't in memory and has nothing journaled is described by its header
+    bool journaled = false;
+    for (int slot = 0; slot < 30 && !journaled && !journalOverlay.empty(); slot++)
+    {
+        journaled = journalOverlay.contains(box * 30 + slot);
+    }
+    if (!residentBoxes[box] && !journaled)
+    {
+        return (size_t)box < boxHeaders.size() ? boxHeaders[box].occupied : 0;
+    }
+    return boxHeader(boxEntries(box)).occupied;
+}
+
+void Bank::readLegacyBox(File& in, size_t entrySize, BankEntry* out)
+{
+    auto buffer = std::unique_ptr<u8[]>(new u8[entrySize * 30]);
+    u32 read    = in.read(buffer.get(), entrySize * 30);
+    for (int slot = 0; slot < 30; slot++)
+    {
+        if ((slot + 1) * entrySize <= read)
+        {
+            std::copy_n(buffer.get() + slot * entrySize, entrySize, (u8*)(out + slot));
+            std::fill_n((u8*)(out + slot) + entrySize, sizeof(BankEntry) - entrySize, 0xFF);
+        }
+        else
+        {
+            std::fill_n((u8*)(out + slot), sizeof(BankEntry), 0xFF);
+        }
+    }
+}
+
+bool Bank::convertBank(File& in, u32 dataOffset, size_t entrySize, const std::string& outPath)
+{
+    Gui::waitFrame(i18n::localize("BANK_CONVERT"));
+    std::vector<BoxHeader> newHeaders(boxes());
+    ARCHIVE.deleteFile(outPath);
+    ARCHIVE.createFile(outPath, 0,
+        sizeof(BankHeader) + sizeof(BoxHeader) * boxes() + sizeof(BankEntry) * boxes() * 30);
+    auto out = ARCHIVE.file(outPath, FS_OPEN_WRITE);
+    if (!out)
+    {
+        return false;
+    }
+    out->flushOnWrite(false);
+
+    // Straight from the old file to the new one, CONVERT_BOXES boxes per read and write
+    auto entries = std::unique_ptr<BankEntry[]>(new BankEntry[CONVERT_BOXES * 30]);
+    in.seek(dataOffset, SEEK_SET);
+    out->seek(sizeof(BankHeader) + sizeof(BoxHeader) * boxes(), SEEK_SET);
+    for (int box = 0; box < boxes(); box += CONVERT_BOXES)
+    {
+        int count = std::min(CONVERT_BOXES, boxes() - box);
+        if (entrySize == sizeof(BankEntry))
+        {
+            u32 read = in.read(entries.get(), sizeof(BankEntry) * 30 * count);
+            std::fill_n((u8*)entries.get() + read, sizeof(BankEntry) * 30 * count - read, 0xFF);
+        }
+        else
+        {
+            for (int i = 0; i < count; i++)
+            {
+                readLegacyBox(in, entrySize, entries.get() + i * 30);
+            }
+        }
+        for (int i = 0; i < count; i++)
+        {
+            newHeaders[box + i] = boxHeader(entries.get() + i * 30);
+        }
+        if (out->write(entries.get(), sizeof(BankEntry) * 30 * count) !=
+            sizeof(BankEntry) * 30 * count)
+        {
+            out->close();
+            ARCHIVE.deleteFile(outPath);
+            return false;
+        }
+    }
+
+    out->seek(0, SEEK_SET);
+    out->write(&header, sizeof(BankHeader));
+    out->write(newHeaders.data(), sizeof(BoxHeader) * newHeaders.size());
+    out->close();
+    if (R_FAILED(out->result()))
+    {
+        ARCHIVE.deleteFile(outPath);
+        return false;
+    }
+
+    boxHeaders = std::move(newHeaders);
+    return true;
+}
+
+void Bank::evictBoxes() const
+{
+    // Until a full rewrite has happened, resident boxes may be the only copy of their contents
+    if (needsFullSave)
+    {
+        return;
+    }
+
+    while (residentCount > MAX_RESIDENT_BOXES)
+    {
+        int oldest = -1;
+        for (int box = 0; box < boxes(); box++)
+        {
+            // Boxes with unsaved changes have to stay, as does the one that was just handed out
+            if (residentBoxes[box] && !cleanBoxHashes.contains(box) &&
+                boxLastUse[box] != useCounter &&
+                (oldest == -1 || boxLastUse[box] < boxLastUse[oldest]))
+            {
+                oldest = box;
+            }
+        }
+        if (oldest == -1)
+        {
+            break;
+        }
+        residentBoxes[oldest] = nullptr;
+        decodedBoxes.erase(oldest);
+        residentCount--;
+    }
+}
+
+bool Bank::save() const
+{
+    return backupBeforeSave() && saveWithoutBackup();
+}
+
+bool Bank::backupBeforeSave() const
+{
+    if (Configuration::getInstance().autoBackup())
+    {
+        if (!backup() && !Gui::showChoiceMessage(i18n::localize("BACKUP_FAIL_SAVE_1") + '\n' +
+                                                 i18n::localize("BACKUP_FAIL_SAVE_2")))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void Bank::resize(int boxes)
+{
+    if (this->boxes() != boxes)
+    {
+        Gui::showResizeStorage();
+        // Nothing is copied: boxes past the end of the file simply read back as empty
+        for (int box = boxes; box < this->boxes(); box++)
+        {
+            if (residentBoxes[box])
+            {
+                residentCount--;
+            }
+            decodedBoxes.erase(box);
+        }
+        std::erase_if(
+            journalOverlay, [boxes](const auto& pair) { return pair.first >= boxes * 30; });
+        // Changes are kept but stop being tracked, so boxes that have them aren't as saved any more
+        for (const auto& [box, hash] : cleanBoxHashes)
+        {
+            savedBoxHashes[box] = std::nullopt;
+        }
+        residentBoxes.resize(boxes);
+        boxLastUse.resize(boxes, 0);
+        savedBoxHashes.resize(boxes);
+
+        header.boxes = boxes;
+        resetDirtyState();
+        needsFullSave = true;
+
+        for (int i = boxNames->size(); i < boxes; i++)
+        {
+            (*boxNames)[i] = i18n::localize("STORAGE") + " " + std::to_string(i + 1);
+        }
+
+        save();
+    }
+}
+
+std::unique_ptr<pksm::PKX> Bank::pkm(int box, int slot) const
+{
+    return decode(boxEntries(box)[slot]);
+}
+
+std::shared_ptr<const pksm::PKX> Bank::pkmView(int box, int slot) const
+{
+    auto found = decodedBoxes.find(box);
+    if (found == decodedBoxes.end())
+    {
+        found = decodedBoxes.try_emplace(box).first;
+    }
+
+    std::shared_ptr<const pksm::PKX>& view = found->second[slot];
+    if (!view)
+    {
+        view = decode(boxEntries(box)[slot]);
+    }
+    else
+    {
+        boxLastUse[box] = ++useCounter;
+    }
+    return view;
+}
+
+std::unique_ptr<pksm::PKX> Bank::decode(BankEntry& entry)
+{
+    std::unique_ptr<pksm::PKX> ret = nullptr;
+    switch (entry.gen)
+    {
+        case pksm::Generation::ONE:
+        {
+            u8 jpEnd = entry.data[pksm::PK1::JP_LENGTH_WITH_NAMES - 1];
+            if (jpEnd == 0x50 || jpEnd == 0)
+            {
+                ret = pksm::PKX::getPKM<pksm::Generation::ONE>(
+                    entry.data, pksm::PK1::JP_LENGTH_WITH_NAMES);
+            }
+            else
+            {
+                ret = pksm::PKX::getPKM<pksm::Generation::ONE>(
+                    entry.data, pksm::PK1::INT_LENGTH_WITH_NAMES);
+            }
+        }
+        break;
+        case pksm::Generation::TWO:
+        {
+            u8 jpEnd = entry.data[pksm::PK2::JP_LENGTH_WITH_NAMES - 1];
+            if (jpEnd == 0x50 || jpEnd == 0)
+            {
+                ret = pksm::PKX::getPKM<pksm::Generation::TWO>(
+                    entry.data, pksm::PK2::JP_LENGTH_WITH_NAMES);
+            }
+            else
+            {
+                ret = pksm::PKX::getPKM<pksm::Generation::TWO>(
+                    entry.data, pksm::PK2::INT_LENGTH_WITH_NAMES);
+            }
+        }
+        break;
+        case pksm::Generation::THREE:
+            ret = pksm::PKX::getPKM<pksm::Generation::THREE>(entry.data, pksm::PK3::BOX_LENGTH);
+            break;
+        case pksm::Generation::FOUR:
+            ret = pksm::PKX::getPKM<pksm::Generation::FOUR>(entry.data, pksm::PK4::BOX_LENGTH);
+            break;
+        case pksm::Generation::FIVE:
+            ret = pksm::PKX::getPKM<pksm::Generation::FIVE>(entry.data, pksm::PK5::BOX_LENGTH);
+            break;
+        case pksm::Generation::SIX:
+            ret = pksm::PKX::getPKM<pksm::Generation::SIX>(entry.data, pksm::PK6::BOX_LENGTH);
+            break;
+        case pksm::Generation::SEVEN:
+            ret = pksm::PKX::getPKM<pksm::Generation::SEVEN>(entry.data, pksm::PK7::BOX_LENGTH);
+            break;
+        case pksm::Generation::LGPE:
+            ret = pksm::PKX::getPKM<pksm::Generation::LGPE>(entry.data, pksm::PB7::BOX_LENGTH);
+            break;
+        case pksm::Generation::EIGHT:
+            ret = pksm::PKX::getPKM<pksm::Generation::EIGHT>(entry.data, pksm::PK8::BOX_LENGTH);
+            break;
+        default:
+            break;
+    }
+
+    if (ret)
+    {
+        return ret;
+    }
+    else if (entry.gen == pksm::Generation::UNUSED)
+    {
+        return pksm::PKX::getPKM<pksm::Generation::SEVEN>(nullptr, pksm::PK7::BOX_LENGTH);
+    }
+
+    throw BankException(u32(entry.gen));
+}
+
+void Bank::pkm(const pksm::PKX& pkm, int box, int slot)
+{
+    int index = box * 30 + slot;
+    // Remember what the box looked like before its first change so hasChanged can tell when it's
+    // been put back the way it was
+    if (!cleanBoxHashes.contains(box))
+    {
+        cleanBoxHashes.emplace(box, boxHash(box));
+    }
+
+    BankEntry newEntry;
+    if (pkm.species() == pksm::Species::None)
+    {
+        std::fill_n((char*)&newEntry, sizeof(BankEntry), 0xFF);
+    }
+    else
+    {
+        newEntry.gen = pkm.generation();
+        std::ranges::copy(
+            pkm.rawData().subspan(0, std::min((u32)sizeof(BankEntry::data), pkm.getLength())),
+            newEntry.data);
+        if (pkm.getLength() < sizeof(BankEntry::data))
+        {
+            std::fill_n(
+                newEntry.data + pkm.getLength(), sizeof(BankEntry::data) - pkm.getLength(), 0xFF);
+        }
+        std::fill_n(newEntry.padding, sizeof(BankEntry::padding), 0xFF);
+    }
+    boxEntries(box)[slot] = newEntry;
+    if (auto found = decodedBoxes.find(box); found != decodedBoxes.end())
+    {
+        found->second[slot] = nullptr;
+    }
+    if (!dirtySlots[index])
+    {
+        dirtySlots[index] = true;
+        dirtyCount++;
+    }
+}
+
+bool Bank::permute(const std::vector<int>& order)
+{
+    // Like a resize this is written out straight away, since holding the result until the next
+    // save would mean keeping nearly every box in memory
+    return backupBeforeSave() && writeBank(&order);
+}
+
+bool Bank::gatherBox(File* in, const std::vector<int>& order, int box, BankEntry* out) const
+{
+    for (int slot = 0; slot < 30;)
+    {
+        size_t index = box * 30 + slot;
+        int from     = index < order.size() ? order[index] : -1;
+        if (from == -1 || (size_t)from / 30 >= boxHeaders.size() ||
+            boxHeaders[from / 30].occupied == 0 || residentBoxes[from / 30] ||
+            journalOverlay.contains(from))
+        {
+            // Resident boxes and the journal have the latest version of an entry, and anything
+            // else not in the file is empty. All of that is where readBox would find it
+            if (from == -1)
+            {
+                std::fill_n((u8*)(out + slot), sizeof(BankEntry), 0xFF);
+            }
+            else if (residentBoxes[from / 30])
+            {
+                out[slot] = residentBoxes[from / 30][from % 30];
+            }
+            else if (auto found = journalOverlay.find(from); found != journalOverlay.end())
+            {
+                out[slot] = found->second;
+            }
+            else
+            {
+                std::fill_n((u8*)(out + slot), sizeof(BankEntry), 0xFF);
+            }
+            slot++;
+            continue;
+        }
+
+        // Entries that sit next to each other in the file, as they do in a mostly sorted bank, are
+        // read with a single call
+        int end = slot + 1;
+        while (end < 30 && index + (end - slot) < order.size())
+        {
+            int next = order[index + (end - slot)];
+            if (next != from + (end - slot) || next % 30 == 0 || journalOverlay.contains(next))
+            {
+                break;
+            }
+            end++;
+        }
+        if (!in)
+        {
+            return false;
+        }
+        in->seek(entryOffset(from), SEEK_SET);
+        if (in->read(out + slot, sizeof(BankEntry) * (end - slot)) !=
+            sizeof(BankEntry) * (end - slot))
+        {
+            return false;
+        }
+        slot = end;
+    }
+    return true;
+}
+
+bool Bank::backup() const
+{
+    Gui::waitFrame(i18n::localize("BANK_BACKUP"));
+    auto paths = this->paths();
+    Archive::sd().createDir(backupPath(), 0);
+
+    // Blocks that the newest backup already has don't need to be looked at, let alone written
+    std::vector<u32> previousChecksums;
+    std::vector<std::array<u8, 32>> previous = readBackup(0, nullptr, &previousChecksums);
+    std::vector<std::array<u8, 32>> hashes(boxes());
+    std::vector<u32> checksums(boxes());
+    auto in     = backedByFile ? ARCHIVE.file(BANK(paths), FS_OPEN_READ) : nullptr;
+    auto buffer = std::unique_ptr<BankEntry[]>(new BankEntry[30]);
+    for (int box = 0; box < boxes(); box++)
+    {
+        if (savedBoxHashes[box] && (size_t)box < previousChecksums.size() &&
+            *savedBoxHashes[box] == previous[box])
+        {
+            hashes[box]    = previous[box];
+            checksums[box] = previousChecksums[box];
+            continue;
+        }
+
+        // What's on disk, which isn't necessarily what's in memory
+        if (!readBox(in.get(), box, buffer.get()))
+        {
+            if (in)
+            {
+                in->close();
+            }
+            return false;
+        }
+        hashes[box]         = pksm::crypto::sha256({(u8*)buffer.get(), sizeof(BankEntry) * 30});
+        checksums[box]      = boxHeader(buffer.get()).checksum;
+        savedBoxHashes[box] = hashes[box];
+
+        // Blocks only ever get their name once they've been written completely, but one that
+        // somehow got cut short is replaced rather than trusted
+        const std::string path = blockPath(hashes[box]);
+        if (auto block = Archive::sd().file(path, FS_OPEN_READ))
+        {
+            u64 size = block->size();
+            block->close();
+            if (size == sizeof(BankEntry) * 30)
+            {
+                continue;
+            }
+        }
+        const std::string tmpPath = backupPath() + "/new.blk";
+        Archive::sd().deleteFile(tmpPath);
+        Archive::sd().createFile(tmpPath, 0, sizeof(BankEntry) * 30);
+        auto block   = Archive::sd().file(tmpPath, FS_OPEN_WRITE);
+        bool written = block &&
+                       block->write(buffer.get(), sizeof(BankEntry) * 30) == sizeof(BankEntry) * 30;
+        if (block)
+        {
+            block->close();
+            written = written && R_SUCCEEDED(block->result());
+        }
+        if (!written || R_FAILED(Archive::moveFile(Archive::sd(), tmpPath, Archive::sd(), path)))
+        {
+            Archive::sd().deleteFile(tmpPath);
+            if (in)
+            {
+                in->close();
+            }
+            return false;
+        }
+    }
+    if (in)
+    {
+        in->close();
+    }
+
+    std::string jsonData;
+    if (auto json = ARCHIVE.file(JSON(paths), FS_OPEN_READ))
+    {
+        jsonData.resize(json->size());
+        json->read(jsonData.data(), jsonData.size());
+        json->close();
+    }
+
+    // The new generation is written out completely before any old one goes away
+    const std::string tmpPath = backupPath() + "/new.gen";
+    BackupHeader backupHeader{};
+    std::copy(BACKUP_MAGIC.begin(), BACKUP_MAGIC.end(), backupHeader.MAGIC);
+    backupHeader.version  = BACKUP_VERSION;
+    backupHeader.boxes    = boxes();
+    backupHeader.jsonSize = jsonData.size();
+    Archive::sd().deleteFile(tmpPath);
+    Archive::sd().createFile(tmpPath, 0,
+        sizeof(BackupHeader) + (sizeof(std::array<u8, 32>) + sizeof(u32)) * boxes() +
+            jsonData.size());
+    auto out = Archive::sd().file(tmpPath, FS_OPEN_WRITE);
+    if (!out)
+    {
+        return false;
+    }
+    out->flushOnWrite(false);
+    out->write(&backupHeader, sizeof(BackupHeader));
+    out->write(hashes.data(), sizeof(std::array<u8, 32>) * hashes.size());
+    out->write(checksums.data(), sizeof(u32) * checksums.size());
+    out->write(jsonData.data(), jsonData.size());
+    out->close();
+    if (R_FAILED(out->result()))
+    {
+        Archive::sd().deleteFile(tmpPath);
+        return false;
+    }
+
+    std::vector<std::array<u8, 32>> dropped = readBackup(BACKUP_GENERATIONS - 1, nullptr, nullptr);
+    Archive::sd().deleteFile(backupPath(BACKUP_GENERATIONS - 1));
+    for (int generation = BACKUP_GENERATIONS - 2; generation >= 0; generation--)
+    {
+        Archive::moveFile(
+            Archive::sd(), backupPath(generation), Archive::sd(), backupPath(generation + 1));
+    }
+    if (R_FAILED(Archive::moveFile(Archive::sd(), tmpPath, Archive::sd(), backupPath(0))))
+    {
+        return false;
+    }
+
+    // Only blocks of the generation that just went away can have stopped being used
+    if (!dropped.empty())
+    {
+        std::set<std::array<u8, 32>> referenced;
+        for (int generation = 0; generation < BACKUP_GENERATIONS; generation++)
+        {
+            for (const auto& hash : readBackup(generation, nullptr, nullptr))
+            {
+                referenced.insert(hash);
+            }
+        }
+        for (const auto& hash : dropped)
+        {
+            if (!referenced.contains(hash))
+            {
+                Archive::sd().deleteFile(blockPath(hash));
+            }
+        }
+    }
+    return true;
+}
+
+bool Bank::restoreBackup(int generation)
 {
-    if (Configuration::getInstance().autoBackup())
+    std::string jsonData;
+    std::vector<std::array<u8, 32>> hashes = readBackup(generation, &jsonData, nullptr);
+    if (hashes.empty())
     {
-        if (!backup() && !Gui::showChoiceMessage(i18n::localize("BACKUP_FAIL_SAVE_1") + '\n' +
-                                                 i18n::localize("BACKUP_FAIL_SAVE_2")))
+        return false;
+    }
+    for (const auto& hash : hashes)
+    {
+        if (auto block = Archive::sd().file(blockPath(hash), FS_OPEN_READ))
+        {
+            u64 size = block->size();
+            block->close();
+            if (size != sizeof(BankEntry) * 30)
+            {
+                return false;
+            }
+        }
+        else
         {
             return false;
         }
     }
-    return saveWithoutBackup();
-}
 
-void Bank::resize(int boxes)
-{
-    if (this->boxes() != boxes)
+    // Everything stays resident until it's been written out as a whole new bank
+    Gui::waitFrame(i18n::localize("BANK_SAVE"));
+    const int oldBoxes = boxes();
+    header.boxes       = hashes.size();
+    resetResidency();
+    resetDirtyState();
+    for (int box = 0; box < boxes(); box++)
     {
-        Gui::showResizeStorage();
-        BankEntry* newEntries = new BankEntry[boxes * 30];
-        std::copy(entries, entries + std::min(boxes, this->boxes()) * 30, newEntries);
-        delete[] entries;
-        if (boxes > this->boxes())
+        // A block is named by its hash, so anything that doesn't match it has been damaged
+        auto block         = Archive::sd().file(blockPath(hashes[box]), FS_OPEN_READ);
+        BankEntry* entries = makeResident(box);
+        bool read          = false;
+        if (block)
         {
-            std::fill_n((u8*)(newEntries + this->boxes() * 30),
-                (boxes - this->boxes()) * 30 * sizeof(BankEntry), 0xFF);
+            read = block->read(entries, sizeof(BankEntry) * 30) == sizeof(BankEntry) * 30 &&
+                   pksm::crypto::sha256({(u8*)entries, sizeof(BankEntry) * 30}) == hashes[box];
+            block->close();
         }
-        entries = newEntries;
-
-        header.boxes = boxes;
-
-        for (int i = boxNames->size(); i < boxes; i++)
+        if (!read)
         {
-            (*boxNames)[i] = i18n::localize("STORAGE") + " " + std::to_string(i + 1);
+            // Back to what's actually on disk
+            load(oldBoxes);
+            return false;
         }
+        // Exactly what the backup has, so the next one can skip it
+        savedBoxHashes[box] = hashes[box];
+    }
 
-        save();
+    boxNames = std::make_unique<nlohmann::json>(nlohmann::json::parse(jsonData, nullptr, false));
+    if (boxNames->is_discarded() || !boxNames->is_array())
+    {
+        createJSON();
+    }
+    for (int i = boxNames->size(); i < boxes(); i++)
+    {
+        (*boxNames)[i] = i18n::localize("STORAGE") + " " + std::to_string(i + 1);
     }
+
+    extern nlohmann::json g_banks;
+    g_banks[bankName] = boxes();
+    Banks::saveJson();
+    needsFullSave = true;
+    indexStale    = true;
+    return saveWithoutBackup();
 }
 
-std::unique_ptr<pksm::PKX> Bank::pkm(int box, int slot) const
+std::vector<std::array<u8, 32>> Bank::readBackup(
+    int generation, std::string* jsonData, std::vector<u32>* checksums) const
 {
-    int index = box * 30 + slot;
+    std::vector<std::array<u8, 32>> hashes;
+    auto in = Archive::sd().file(backupPath(generation), FS_OPEN_READ);
+    if (!in)
+    {
+        return hashes;
+    }
 
-    std::unique_ptr<pksm::PKX> ret = nullptr;
-    switch (entries[index].gen)
+    BackupHeader backupHeader;
+    if (in->read(&backupHeader, sizeof(BackupHeader)) == sizeof(BackupHeader) &&
+        !memcmp(backupHeader.MAGIC, BACKUP_MAGIC.data(), BACKUP_MAGIC.size()) &&
+        (backupHeader.version == 1 || backupHeader.version == BACKUP_VERSION))
     {
-        case pksm::Generation::ONE:
+        hashes.resize(backupHeader.boxes);
+        if (in->read(hashes.data(), sizeof(std::array<u8, 32>) * hashes.size()) !=
+            sizeof(std::array<u8, 32>) * hashes.size())
         {
-            u8 jpEnd = entries[index].data[pksm::PK1::JP_LENGTH_WITH_NAMES - 1];
-            if (jpEnd == 0x50 || jpEnd == 0)
-            {
-                ret = pksm::PKX::getPKM<pksm::Generation::ONE>(
-                    entries[index].data, pksm::PK1::JP_LENGTH_WITH_NAMES);
-            }
-            else
-            {
-                ret = pksm::PKX::getPKM<pksm::Generation::ONE>(
-                    entries[index].data, pksm::PK1::INT_LENGTH_WITH_NAMES);
-            }
+            hashes.clear();
         }
-        break;
-        case pksm::Generation::TWO:
+        else
         {
-            u8 jpEnd = entries[index].data[pksm::PK2::JP_LENGTH_WITH_NAMES - 1];
-            if (jpEnd == 0x50 || jpEnd == 0)
+            // Version 1 didn't have box checksums, so nothing can be matched up with the bank
+            std::vector<u32> boxChecksums;
+            if (backupHeader.version == BACKUP_VERSION)
             {
-                ret = pksm::PKX::getPKM<pksm::Generation::TWO>(
-                    entries[index].data, pksm::PK2::JP_LENGTH_WITH_NAMES);
+                boxChecksums.resize(backupHeader.boxes);
+                if (in->read(boxChecksums.data(), sizeof(u32) * boxChecksums.size()) !=
+                    sizeof(u32) * boxChecksums.size())
+                {
+                    boxChecksums.clear();
+                }
             }
-            else
+            if (jsonData)
             {
-                ret = pksm::PKX::getPKM<pksm::Generation::TWO>(
-                    entries[index].data, pksm::PK2::INT_LENGTH_WITH_NAMES);
+                jsonData->resize(backupHeader.jsonSize);
+                in->read(jsonData->data(), jsonData->size());
+            }
+            if (checksums)
+            {
+                *checksums = std::move(boxChecksums);
             }
         }
-        break;
-        case pksm::Generation::THREE:
-            ret = pksm::PKX::getPKM<pksm::Generation::THREE>(
-                entries[index].data, pksm::PK3::BOX_LENGTH);
-            break;
-        case pksm::Generation::FOUR:
-            ret = pksm::PKX::getPKM<pksm::Generation::FOUR>(
-                entries[index].data, pksm::PK4::BOX_LENGTH);
-            break;
-        case pksm::Generation::FIVE:
-            ret = pksm::PKX::getPKM<pksm::Generation::FIVE>(
-                entries[index].data, pksm::PK5::BOX_LENGTH);
-            break;
-        case pksm::Generation::SIX:
-            ret = pksm::PKX::getPKM<pksm::Generation::SIX>(
-                entries[index].data, pksm::PK6::BOX_LENGTH);
-            break;
-        case pksm::Generation::SEVEN:
-            ret = pksm::PKX::getPKM<pksm::Generation::SEVEN>(
-                entries[index].data, pksm::PK7::BOX_LENGTH);
-            break;
-        case pksm::Generation::LGPE:
-            ret = pksm::PKX::getPKM<pksm::Generation::LGPE>(
-                entries[index].data, pksm::PB7::BOX_LENGTH);
-            break;
-        case pksm::Generation::EIGHT:
-            ret = pksm::PKX::getPKM<pksm::Generation::EIGHT>(
-                entries[index].data, pksm::PK8::BOX_LENGTH);
-            break;
-        default:
-            break;
     }
+    in->close();
+    return hashes;
+}
 
-    if (ret)
-    {
-        return ret;
-    }
-    else if (entries[index].gen == pksm::Generation::UNUSED)
+void Bank::seedSavedHashes() const
+{
+    // A box whose checksum on disk is what it was when the newest backup was taken, and that has
+    // nothing journaled over it, still has the contents that backup has
+    std::vector<u32> checksums;
+    std::vector<std::array<u8, 32>> hashes = readBackup(0, nullptr, &checksums);
+    for (int box = 0; box < boxes() && (size_t)box < checksums.size() &&
+                      (size_t)box < boxHeaders.size();
+         box++)
     {
-        return pksm::PKX::getPKM<pksm::Generation::SEVEN>(nullptr, pksm::PK7::BOX_LENGTH);
+        bool journaled = false;
+        for (int slot = 0; slot < 30 && !journaled && !journalOverlay.empty(); slot++)
+        {
+            journaled = journalOverlay.contains(box * 30 + slot);
+        }
+        if (!journaled && boxHeaders[box].checksum == checksums[box])
+        {
+            savedBoxHashes[box] = hashes[box];
+        }
     }
+}
 
-    throw BankException(u32(entries[index].gen));
+std::string Bank::backupPath() const
+{
+    return "/3ds/PKSM/backups/banks/" + bankName;
 }
 
-void Bank::pkm(const pksm::PKX& pkm, int box, int slot)
+std::string Bank::backupPath(int generation) const
 {
-    int index = box * 30 + slot;
-    BankEntry newEntry;
-    if (pkm.species() == pksm::Species::None)
-    {
-        std::fill_n((char*)&newEntry, sizeof(BankEntry), 0xFF);
-        entries[index] = newEntry;
-        needsCheck     = true;
-        return;
-    }
-    newEntry.gen = pkm.generation();
-    std::ranges::copy(
-        pkm.rawData().subspan(0, std::min((u32)sizeof(BankEntry::data), pkm.getLength())),
-        newEntry.data);
-    if (pkm.getLength() < sizeof(BankEntry::data))
-    {
-        std::fill_n(
-            newEntry.data + pkm.getLength(), sizeof(BankEntry::data) - pkm.getLength(), 0xFF);
-    }
-    entries[index] = newEntry;
-    needsCheck     = true;
+    return backupPath() + "/" + std::to_string(generation) + ".gen";
 }
 
-bool Bank::backup() const
+std::string Bank::blockPath(const std::array<u8, 32>& hash) const
 {
-    Gui::waitFrame(i18n::localize("BANK_BACKUP"));
-    auto paths = this->paths();
-    Archive::copyFile(Archive::sd(), "/3ds/PKSM/backups/" + bankName + ".bnk.bak", Archive::sd(),
-        "/3ds/PKSM/backups/" + bankName + ".bnk.bak.old");
-    Archive::copyFile(Archive::sd(), "/3ds/PKSM/backups/" + bankName + ".json.bak", Archive::sd(),
-        "/3ds/PKSM/backups/" + bankName + ".json.bak.old");
-    Result res = Archive::copyFile(
-        ARCHIVE, BANK(paths), Archive::sd(), "/3ds/PKSM/backups/" + bankName + ".bnk.bak");
-    if (R_FAILED(res))
-    {
-        return false;
-    }
-    Archive::copyFile(
-        ARCHIVE, JSON(paths), Archive::sd(), "/3ds/PKSM/backups/" + bankName + ".json.bak");
-    return true;
+    return backupPath() + "/" + hashName(hash) + ".blk";
 }
 
 std::string Bank::boxName(int box) const
@@ -446,8 +1671,13 @@ std::string Bank::boxName(int box) const
 
 void Bank::boxName(const std::string& name, int box)
 {
+    if (!namesDirty)
+    {
+        std::string jsonData = boxNames->dump(2);
+        cleanNameHash        = pksm::crypto::sha256({(u8*)jsonData.data(), jsonData.size()});
+        namesDirty           = true;
+    }
     (*boxNames)[box] = name;
-    needsCheck       = true;
 }
 
 void Bank::createJSON()
@@ -464,33 +1694,63 @@ void Bank::createBank(int maxBoxes)
     std::copy(BANK_MAGIC.data(), BANK_MAGIC.data() + BANK_MAGIC.size(), header.MAGIC);
     header.version = BANK_VERSION;
     header.boxes   = maxBoxes;
-    if (entries)
-    {
-        delete[] entries;
-    }
-    entries = new BankEntry[maxBoxes * 30];
-    std::fill_n((u8*)entries, sizeof(BankEntry) * boxes() * 30, 0xFF);
+    // Not backed by a file yet, so every box starts out empty
+    backedByFile = false;
+    boxHeaders.clear();
+    resetResidency();
 }
 
 bool Bank::hasChanged() const
 {
-    if (!needsCheck)
+    if (needsFullSave)
     {
-        return false;
+        return true;
     }
-    auto hash = pksm::crypto::sha256({(u8*)entries, sizeof(BankEntry) * boxes() * 30});
-    if (hash != prevHash)
+
+    // Only boxes that have been written to since the last save need a look, so this stays cheap
+    // no matter how big the bank is. Those boxes are all pinned in memory, so hashing them can be
+    // spread over the workers.
+    std::vector<int> changedBoxes;
+    std::vector<BankEntry*> changedEntries;
+    for (const auto& [box, hash] : cleanBoxHashes)
     {
-        return true;
+        changedBoxes.emplace_back(box);
+        changedEntries.emplace_back(boxEntries(box));
     }
-    std::string jsonData = boxNames->dump(2);
-    hash                 = pksm::crypto::sha256({(u8*)jsonData.data(), jsonData.size()});
-    if (hash != prevNameHash)
+    std::vector<std::array<u8, 32>> hashes(changedBoxes.size());
+    Threads::parallelFor(0, changedBoxes.size(), 1,
+        [&](size_t i)
+        {
+            hashes[i] = pksm::crypto::sha256({(u8*)changedEntries[i], sizeof(BankEntry) * 30});
+        });
+
+    for (size_t i = 0; i < changedBoxes.size(); i++)
     {
-        return true;
+        const int box = changedBoxes[i];
+        if (hashes[i] == cleanBoxHashes[box])
+        {
+            for (int slot = box * 30; slot < (box + 1) * 30; slot++)
+            {
+                if (dirtySlots[slot])
+                {
+                    dirtySlots[slot] = false;
+                    dirtyCount--;
+                }
+            }
+            cleanBoxHashes.erase(box);
+        }
+    }
+
+    if (namesDirty)
+    {
+        std::string jsonData = boxNames->dump(2);
+        if (pksm::crypto::sha256({(u8*)jsonData.data(), jsonData.size()}) == cleanNameHash)
+        {
+            namesDirty = false;
+        }
     }
-    needsCheck = false;
-    return false;
+
+    return dirtyCount > 0 || namesDirty;
 }
 
 void Bank::convertFromBankBin()
@@ -505,16 +1765,21 @@ void Bank::convertFromBankBin()
         (inStream->size() / pksm::PK6::BOX_LENGTH) % 30 == 0 &&
         R_SUCCEEDED(outStream->resize(inStream->size())))
     {
+        // One small write per slot; flushed once when the stream is closed
+        outStream->flushOnWrite(false);
         size_t oldSize = inStream->size();
         std::array<u8, pksm::PK6::BOX_LENGTH> pkmData;
         // ANOTHER CONVERSION SECTION
-        entries = new BankEntry[oldSize / pksm::PK6::BOX_LENGTH];
         std::copy(BANK_MAGIC.data(), BANK_MAGIC.data() + BANK_MAGIC.size(), header.MAGIC);
         header.version = BANK_VERSION;
         header.boxes   = oldSize / pksm::PK6::BOX_LENGTH / 30;
         extern nlohmann::json g_banks;
         g_banks["pksm_1"] = header.boxes;
-        std::fill_n((u8*)entries, sizeof(BankEntry) * boxes() * 30, 0xFF);
+        backedByFile      = false;
+        needsFullSave     = true;
+        boxHeaders.clear();
+        resetResidency();
+        resetDirtyState();
         boxNames = std::make_unique<nlohmann::json>(nlohmann::json::array());
 
         for (int box = 0; box < std::min((int)(oldSize / (pksm::PK6::BOX_LENGTH * 30)), boxes());
@@ -600,10 +1865,11 @@ int Bank::boxes() const
 
 bool Bank::setName(const std::string& name)
 {
-    auto oldPaths       = paths();
-    std::string oldName = bankName;
-    bankName            = name;
-    auto newPaths       = paths();
+    auto oldPaths          = paths();
+    std::string oldJournal = journalPath();
+    std::string oldName    = bankName;
+    bankName               = name;
+    auto newPaths          = paths();
     if (R_FAILED(Archive::moveFile(ARCHIVE, BANK(oldPaths), ARCHIVE, BANK(newPaths))))
     {
         bankName = oldName;
@@ -620,10 +1886,28 @@ bool Bank::setName(const std::string& name)
         }
         return false;
     }
+    if (journalCount > 0)
+    {
+        if (R_FAILED(Archive::moveFile(BANKDATA, oldJournal, BANKDATA, journalPath())))
+        {
+            // The journal can't follow the bank, so fold it in before anything is lost
+            compactJournal();
+            BANKDATA.deleteFile(oldJournal);
+        }
+    }
+    if (R_FAILED(Archive::moveFile(BANKDATA, indexPath(oldName), BANKDATA, indexPath())))
+    {
+        indexStale = true;
+    }
     return true;
 }
 
 std::pair<std::string, std::string> Bank::paths() const
+{
+    return paths(bankName);
+}
+
+std::pair<std::string, std::string> Bank::paths(const std::string& bankName)
 {
     if (Configuration::getInstance().useExtData())
     {
@@ -634,3 +1918,279 @@ std::pair<std::string, std::string> Bank::paths() const
         return {"/3ds/PKSM/banks/" + bankName + ".bnk", "/3ds/PKSM/banks/" + bankName + ".json"};
     }
 }
+
+std::string Bank::indexPath() const
+{
+    return indexPath(bankName);
+}
+
+std::string Bank::indexPath(const std::string& bankName)
+{
+    return "/3ds/PKSM/bankdata/" + bankName + ".idx";
+}
+
+u32 Bank::otNameHash(const std::string& otName)
+{
+    return checksum((const u8*)otName.data(), otName.size());
+}
+
+bool Bank::indexUsable(const std::string& bankName, int boxes, std::vector<IndexEntry>* entries)
+{
+    auto in = BANKDATA.file(indexPath(bankName), FS_OPEN_READ);
+    if (!in)
+    {
+        return false;
+    }
+
+    IndexHeader indexHeader;
+    bool usable = in->read(&indexHeader, sizeof(IndexHeader)) == sizeof(IndexHeader) &&
+                  !memcmp(indexHeader.MAGIC, INDEX_MAGIC.data(), INDEX_MAGIC.size()) &&
+                  indexHeader.version == INDEX_VERSION && (int)indexHeader.boxes == boxes &&
+                  indexHeader.complete;
+    if (usable && entries)
+    {
+        entries->resize(boxes * 30);
+        usable = in->read(entries->data(), sizeof(IndexEntry) * entries->size()) ==
+                 sizeof(IndexEntry) * entries->size();
+    }
+    in->close();
+    return usable;
+}
+
+std::vector<Bank::IndexEntry> Bank::readIndex(const std::string& bankName, int boxes)
+{
+    std::vector<IndexEntry> ret;
+    if (!indexUsable(bankName, boxes, &ret))
+    {
+        ret.clear();
+    }
+    return ret;
+}
+
+Bank::IndexEntry Bank::indexEntry(BankEntry& bankEntry)
+{
+    IndexEntry entry{};
+    // Not pkmView: rebuilding would otherwise leave the whole bank decoded in memory
+    auto pkm = decode(bankEntry);
+    if (pkm->species() != pksm::Species::None)
+    {
+        entry.species    = u16(pkm->species());
+        entry.form       = pkm->alternativeForm();
+        entry.TID        = pkm->TID();
+        entry.SID        = pkm->SID();
+        entry.level      = pkm->level();
+        entry.flags      = INDEX_PRESENT | (pkm->shiny() ? INDEX_SHINY : 0);
+        entry.otNameHash = otNameHash(pkm->otName());
+        for (pksm::Stat stat : {pksm::Stat::HP, pksm::Stat::ATK, pksm::Stat::DEF, pksm::Stat::SPD,
+                 pksm::Stat::SPATK, pksm::Stat::SPDEF})
+        {
+            entry.ivTotal += pkm->iv(stat);
+        }
+    }
+    return entry;
+}
+
+bool Bank::rebuildIndex() const
+{
+    const std::string path = indexPath();
+    BANKDATA.deleteFile(path);
+    BANKDATA.createFile(path, 0, sizeof(IndexHeader) + sizeof(IndexEntry) * boxes() * 30);
+    auto out = BANKDATA.file(path, FS_OPEN_WRITE);
+    if (!out)
+    {
+        indexStale = true;
+        return false;
+    }
+
+    // The header goes in last so that an index that was only partly written is never trusted
+    std::array<IndexEntry, 30> entries;
+    out->seek(sizeof(IndexHeader), SEEK_SET);
+    for (int box = 0; box < boxes(); box++)
+    {
+        if (occupiedSlots(box) == 0)
+        {
+            entries.fill(IndexEntry{});
+        }
+        else
+        {
+            // Decoding goes through PKSM-Core's PKX classes, which aren't known to be safe to use
+            // from several threads at once, so it stays on this one
+            BankEntry* data = boxEntries(box);
+            for (int slot = 0; slot < 30; slot++)
+            {
+                entries[slot] = indexEntry(data[slot]);
+            }
+        }
+        out->write(entries.data(), sizeof(entries));
+    }
+
+    IndexHeader indexHeader{};
+    std::copy(INDEX_MAGIC.begin(), INDEX_MAGIC.end(), indexHeader.MAGIC);
+    indexHeader.version  = INDEX_VERSION;
+    indexHeader.boxes    = boxes();
+    indexHeader.complete = 1;
+    out->seek(0, SEEK_SET);
+    out->write(&indexHeader, sizeof(IndexHeader));
+    out->close();
+
+    indexStale = R_FAILED(out->result());
+    return !indexStale;
+}
+
+bool Bank::buildIndex(const std::string& bankName, int boxes)
+{
+    auto in = ARCHIVE.file(BANK(paths(bankName)), FS_OPEN_READ);
+    if (!in)
+    {
+        return false;
+    }
+
+    // Older banks get converted, and indexed along the way, when they're next loaded
+    BankHeader bankHeader;
+    if (in->read(&bankHeader, sizeof(BankHeader)) != sizeof(BankHeader) ||
+        memcmp(bankHeader.MAGIC, BANK_MAGIC.data(), BANK_MAGIC.size()) ||
+        bankHeader.version != BANK_VERSION)
+    {
+        in->close();
+        return false;
+    }
+    std::vector<BoxHeader> fileHeaders(bankHeader.boxes);
+    if (in->read(fileHeaders.data(), sizeof(BoxHeader) * fileHeaders.size()) !=
+        sizeof(BoxHeader) * fileHeaders.size())
+    {
+        in->close();
+        return false;
+    }
+    std::unordered_map<int, BankEntry> overlay;
+    readJournal(bankName, boxes, bankHeader.journalEpoch, overlay);
+
+    const std::string path = indexPath(bankName);
+    BANKDATA.deleteFile(path);
+    BANKDATA.createFile(path, 0, sizeof(IndexHeader) + sizeof(IndexEntry) * boxes * 30);
+    auto out = BANKDATA.file(path, FS_OPEN_WRITE);
+    if (!out)
+    {
+        in->close();
+        return false;
+    }
+
+    // Same as rebuildIndex, except that boxes come straight from the file one at a time and are
+    // never kept, so searching doesn't have to load every bank it looks through
+    auto buffer = std::unique_ptr<BankEntry[]>(new BankEntry[30]);
+    std::array<IndexEntry, 30> entries;
+    bool good = true;
+    out->seek(sizeof(IndexHeader), SEEK_SET);
+    for (int box = 0; box < boxes && good; box++)
+    {
+        bool occupied = (size_t)box < fileHeaders.size() && fileHeaders[box].occupied > 0;
+        if (occupied)
+        {
+            const size_t offset = sizeof(BankHeader) + sizeof(BoxHeader) * fileHeaders.size() +
+                                  sizeof(BankEntry) * box * 30;
+            good = false;
+            for (int attempt = 0; attempt < 2 && !good; attempt++)
+            {
+                in->seek(offset, SEEK_SET);
+                good = in->read(buffer.get(), sizeof(BankEntry) * 30) == sizeof(BankEntry) * 30 &&
+                       boxHeader(buffer.get()).checksum == fileHeaders[box].checksum;
+            }
+        }
+        else
+        {
+            std::fill_n((u8*)buffer.get(), sizeof(BankEntry) * 30, 0xFF);
+        }
+        for (int slot = 0; slot < 30; slot++)
+        {
+            if (auto found = overlay.find(box * 30 + slot); found != overlay.end())
+            {
+                buffer[slot] = found->second;
+                occupied     = true;
+            }
+        }
+
+        if (occupied)
+        {
+            for (int slot = 0; slot < 30; slot++)
+            {
+                entries[slot] = indexEntry(buffer[slot]);
+            }
+        }
+        else
+        {
+            entries.fill(IndexEntry{});
+        }
+        out->write(entries.data(), sizeof(entries));
+    }
+    in->close();
+
+    // A box that couldn't be read leaves the index incomplete, so it isn't trusted
+    IndexHeader indexHeader{};
+    std::copy(INDEX_MAGIC.begin(), INDEX_MAGIC.end(), indexHeader.MAGIC);
+    indexHeader.version  = INDEX_VERSION;
+    indexHeader.boxes    = boxes;
+    indexHeader.complete = good ? 1 : 0;
+    out->seek(0, SEEK_SET);
+    out->write(&indexHeader, sizeof(IndexHeader));
+    out->close();
+    return good && R_SUCCEEDED(out->result());
+}
+
+bool Bank::updateIndex() const
+{
+    auto out = BANKDATA.file(indexPath(), FS_OPEN_WRITE);
+    if (!out)
+    {
+        return rebuildIndex();
+    }
+
+    // Marked incomplete while it's being changed, in case it never gets finished
+    IndexHeader indexHeader{};
+    std::copy(INDEX_MAGIC.begin(), INDEX_MAGIC.end(), indexHeader.MAGIC);
+    indexHeader.version = INDEX_VERSION;
+    indexHeader.boxes   = boxes();
+    out->write(&indexHeader, sizeof(IndexHeader));
+
+    // Runs of changed slots within a box go out in a single write
+    std::array<IndexEntry, 30> entries;
+    for (int box = 0; box < boxes(); box++)
+    {
+        for (int slot = 0; slot < 30;)
+        {
+            if (!dirtySlots[box * 30 + slot])
+            {
+                slot++;
+                continue;
+            }
+            int end = slot;
+            while (end < 30 && dirtySlots[box * 30 + end])
+            {
+                entries[end] = indexEntry(boxEntries(box)[end]);
+                end++;
+            }
+            out->seek(sizeof(IndexHeader) + sizeof(IndexEntry) * (box * 30 + slot), SEEK_SET);
+            out->write(entries.data() + slot, sizeof(IndexEntry) * (end - slot));
+            slot = end;
+        }
+    }
+
+    indexHeader.complete = 1;
+    out->seek(0, SEEK_SET);
+    out->write(&indexHeader, sizeof(IndexHeader));
+    out->close();
+
+    if (R_FAILED(out->result()))
+    {
+        return rebuildIndex();
+    }
+    return true;
+}
+
+std::string Bank::journalPath() const
+{
+    return journalPath(bankName);
+}
+
+std::string Bank::journalPath(const std::string& bankName)
+{
+    return "/3ds/PKSM/bankdata/" + bankName + ".jnl";
+}
@@ -30,7 +30,9 @@
 #include "banks.hpp"
 #include "Button.hpp"
 #include "Configuration.hpp"
+#include "DownloadQueue.hpp"
 #include "fetch.hpp"
+#include "future.hpp"
 #include "gui.hpp"
 #include "i18n_ext.hpp"
 #include "io.hpp"
@@ -47,7 +49,6 @@
 #include "website.h"
 #include <3ds.h>
 #include <array>
-#include <atomic>
 #include <format>
 #include <malloc.h>
 #include <stdio.h>
@@ -57,9 +58,9 @@ namespace
 {
     u32 old_time_limit;
     Handle hbldrHandle;
-    std::atomic_flag moveIcon     = ATOMIC_FLAG_INIT;
-    std::atomic_flag doCartScan   = ATOMIC_FLAG_INIT;
-    std::atomic_flag continueI18N = ATOMIC_FLAG_INIT;
+    Threads::CancellationToken iconCancel;
+    Threads::CancellationToken cartScanCancel;
+    Threads::CancellationToken i18nCancel;
 
     struct asset
     {
@@ -115,43 +116,39 @@ namespace
 
     Result downloadAdditionalAssets(void)
     {
-        Result res = 0;
+        DownloadQueue queue;
+        bool downloadNeeded = false;
 
         for (const auto& item : assets)
         {
-            bool downloadAsset = true;
             if (io::exists(item.path))
             {
                 if (matchSha256HashFromFile(item.path, item.hash))
                 {
-                    downloadAsset = false;
-                }
-                else
-                {
-                    std::remove(item.path.c_str());
+                    continue;
                 }
+                std::remove(item.path.c_str());
             }
-            if (downloadAsset)
+            queue.add({.url = item.url, .path = item.path, .sha256 = item.hash});
+            downloadNeeded = true;
+        }
+
+        if (downloadNeeded)
+        {
+            u32 status;
+            ACU_GetWifiStatus(&status);
+            if (status == 0)
             {
-                u32 status;
-                ACU_GetWifiStatus(&status);
-                if (status == 0)
-                {
-                    return -1;
-                }
-                Result res1 = Fetch::download(item.url, item.path);
-                if (R_FAILED(res1))
-                {
-                    return res1;
-                }
+                return -1;
             }
+            return queue.run();
         }
-        return res;
+        return 0;
     }
 
     Result consoleDisplayError(const std::string& message, Result res)
     {
-        moveIcon.clear();
+        iconCancel.cancel();
         consoleInit(GFX_TOP, nullptr);
 
         std::format_to(Printerator{}, "\x1b[2;16H\x1b[34mPKSM v{:d}.{:d}.{:d}-{:s}\x1b[0m",
@@ -187,14 +184,26 @@ namespace
         return rc;
     }
 
+    void showCopyProgress(const TreeCopy::Progress& progress)
+    {
+        Gui::showRestoreProgress(progress.bytesDone / 1024, progress.bytesTotal / 1024);
+    }
+
     void backupExtData()
     {
-        Archive::copyDir(Archive::data(), u"/", Archive::sd(), u"/3ds/PKSM/extDataBackup");
+        TreeCopy::Options options;
+        options.progress = showCopyProgress;
+        Archive::copyDir(Archive::data(), u"/", Archive::sd(), u"/3ds/PKSM/extDataBackup", options);
     }
 
     void backupBanks()
     {
-        Archive::copyDir(Archive::sd(), u"/3ds/PKSM/banks", Archive::sd(), u"/3ds/PKSM/banksBkp");
+        TreeCopy::Options options;
+        // The banks are on the SD card, so an interrupted backup can be picked up again safely
+        options.manifestPath = "/3ds/PKSM/cache/banksBkp.copy";
+        options.progress     = showCopyProgress;
+        Archive::copyDir(
+            Archive::sd(), u"/3ds/PKSM/banks", Archive::sd(), u"/3ds/PKSM/banksBkp", options);
     }
 
     bool update(std::string execPath)
@@ -225,7 +234,7 @@ namespace
             if (auto fetch = Fetch::init(
                     WEBSITE_URL "api/v2/patreon/update-check/PKSM", true, &retString, headers, ""))
             {
-                moveIcon.clear();
+                iconCancel.cancel();
                 Gui::waitFrame(i18n::localize("UPDATE_CHECKING"));
                 auto res = Fetch::perform(fetch);
                 if (res.index() == 1)
@@ -287,9 +296,9 @@ namespace
         }
         else if (auto fetch =
                      Fetch::init("https://api.github.com/repos/FlagBrew/PKSM/releases/latest", true,
-                         &retString, nullptr, ""))
+                         &retString, nullptr, "", true))
         {
-            moveIcon.clear();
+            iconCancel.cancel();
             Gui::waitFrame(i18n::localize("UPDATE_CHECKING"));
             auto res = Fetch::perform(fetch);
             if (res.index() == 1)
@@ -495,12 +504,12 @@ namespace
         return false;
     }
 
-    void cartScan()
+    void cartScan(const Threads::CancellationToken& cancel)
     {
         bool oldCardIn;
         FSUSER_CardSlotIsInserted(&oldCardIn);
 
-        while (doCartScan.test_and_set())
+        while (!cancel.cancelled())
         {
             bool cardIn = false;
 
@@ -515,7 +524,7 @@ namespace
                     {
                         FSUSER_CardSlotPowerOn(&power);
                     }
-                    while (!power && doCartScan.test_and_set())
+                    while (!power && !cancel.cancelled())
                     {
                         FSUSER_CardSlotGetCardIFPowerStatus(&power);
                     }
@@ -538,7 +547,7 @@ namespace
         }
     }
 
-    void iconThread()
+    void iconThread(const Threads::CancellationToken& cancel)
     {
         int x = 176, y = 96;
         u16 w, h;
@@ -546,7 +555,7 @@ namespace
         bool left = pksm::randomNumber(0, 1) ? true : false;
         u8 yMag   = pksm::randomNumber(0, 1) + 1;
         u8 xMag   = pksm::randomNumber(0, 1) + 1;
-        while (moveIcon.test_and_set())
+        while (!cancel.cancelled())
         {
             int xOff = 0;
             std::fill_n(gfxGetFramebuffer(GFX_TOP, GFX_LEFT, &w, &h), 240 * 400 * 3, 0);
@@ -590,7 +599,7 @@ namespace
         }
     }
 
-    void i18nThread()
+    void i18nThread(const Threads::CancellationToken& cancel)
     {
         static constexpr pksm::Language languages[] = {pksm::Language::JPN, pksm::Language::ENG,
             pksm::Language::FRE, pksm::Language::ITA, pksm::Language::GER, pksm::Language::SPA,
@@ -598,14 +607,11 @@ namespace
             pksm::Language::PT, pksm::Language::RU, pksm::Language::RO};
         for (const auto& i : languages)
         {
-            if (continueI18N.test_and_set())
-            {
-                i18n::init(i);
-            }
-            else
+            if (cancel.cancelled())
             {
                 return;
             }
+            i18n::init(i);
         }
     }
 
@@ -719,141 +725,46 @@ namespace
             fclose(timestamp);
         }
 
-        struct giftCurlData
-        {
-            giftCurlData(FILE* file, const std::string& fileName)
-                : fileName(fileName), file(file), response(0), prevDownload(0), addedToTotal(false)
-            {
-            }
-
-            std::string fileName;
-            FILE* file;
-            pksm::crypto::SHA256 shaContext;
-            long response;
-            u32 prevDownload;
-            bool addedToTotal;
-        };
-
-        curl_write_callback giftWriteFunc = [](char* data, size_t size, size_t nitems, void* out)
-        {
-            giftCurlData* writeMe = (giftCurlData*)out;
-
-            if (data)
-            {
-                writeMe->shaContext.update({(u8*)data, size * nitems});
-
-                return fwrite(data, size, nitems, writeMe->file);
-            }
-            else
-            {
-                return size * nitems;
-            }
-        };
-
         static constexpr std::array<pksm::Generation, 4> mgGens = {pksm::Generation::FOUR,
             pksm::Generation::FIVE, pksm::Generation::SIX, pksm::Generation::SEVEN};
 
-        std::atomic<size_t> filesDone = 0;
-        size_t filesToDownload        = 0;
-        std::vector<giftCurlData> curlVars;
-        curlVars.reserve(mgGens.size() * 2);
-
         Gui::waitFrame(i18n::localize("MYSTERY_GIFT_CHECK"));
 
+        // Each file's checksum is fetched first, and the file itself only if that doesn't match
+        // what we already have
+        DownloadQueue queue;
         for (const auto& gen : mgGens)
         {
             for (const std::string& fileName :
                 {"sheet" + (std::string)gen + ".json.bz2", "data" + (std::string)gen + ".bin.bz2"})
             {
-                decltype(pksm::crypto::sha256({})) checksum = readGiftChecksum(fileName);
-
-                std::vector<u8> recvChecksum;
-                if (auto fetch = Fetch::init(
-                        CDN_URL "assets/gifts/" + fileName + ".sha", true, nullptr, nullptr, ""))
+                DownloadQueue::Item item;
+                item.url         = CDN_URL "assets/gifts/" + fileName;
+                item.path        = "/3ds/PKSM/mysterygift/" + fileName;
+                item.checksumUrl = item.url + ".sha";
+                item.localHash   = readGiftChecksum(fileName);
+                item.onFinish    =
+                    [checksumPath = item.path + ".sha"](Result res, const DownloadQueue::Hash& sha)
                 {
-                    fetch->setopt(
-                        CURLOPT_WRITEFUNCTION, (curl_write_callback)[](char* buffer, size_t size,
-                                                   size_t items, void* userThing) {
-                            std::vector<u8>* recv = (std::vector<u8>*)userThing;
-                            recv->insert(recv->end(), (u8*)buffer, (u8*)buffer + size * items);
-                            return size * items;
-                        });
-                    fetch->setopt(CURLOPT_WRITEDATA, &recvChecksum);
-
-                    Fetch::perform(fetch);
-
-                    long response;
-
-                    fetch->getinfo(CURLINFO_RESPONSE_CODE, &response);
-                    if (response == 200)
+                    if (R_SUCCEEDED(res))
                     {
-                        if (memcmp(recvChecksum.data(), checksum.data(),
-                                std::min(checksum.size(), recvChecksum.size())))
+                        FILE* f = fopen(checksumPath.c_str(), "wb");
+                        if (f)
                         {
-                            if ((fetch = Fetch::init(CDN_URL "assets/gifts/" + fileName, true,
-                                     nullptr, nullptr, "")))
-                            {
-                                std::string outPath = "/3ds/PKSM/mysterygift/" + fileName;
-                                FILE* outFile       = fopen(outPath.c_str(), "wb");
-
-                                if (outFile)
-                                {
-                                    curlVars.emplace_back(outFile, outPath);
-                                    fetch->setopt(CURLOPT_WRITEFUNCTION, giftWriteFunc);
-                                    fetch->setopt(CURLOPT_WRITEDATA, &curlVars.back());
-
-                                    if (Fetch::performAsync(fetch,
-                                            [progress = curlVars.end() - 1, &filesDone](
-                                                CURLcode code, std::shared_ptr<Fetch> fetch)
-                                            {
-                                                filesDone++;
-                                                fclose(progress->file);
-                                                fetch->getinfo(
-                                                    CURLINFO_RESPONSE_CODE, &progress->response);
-                                            }) != CURLM_OK)
-                                    {
-                                        filesDone++;
-                                        fclose(outFile);
-                                    }
-                                    else
-                                    {
-                                        filesToDownload++;
-                                    }
-                                }
-                            }
+                            fwrite(sha.data(), 1, sha.size(), f);
+                            fclose(f);
                         }
                     }
-                }
+                };
+                queue.add(std::move(item));
             }
         }
 
-        while (filesDone != filesToDownload)
-        {
-            Gui::waitFrame(pksm::format(
-                i18n::localize("MYSTERY_GIFT_DOWNLOAD"), (size_t)filesDone, filesToDownload));
-            svcSleepThread(50'000'000);
-        }
-
-        for (auto& info : curlVars)
-        {
-            std::string shaFile = info.fileName + ".sha";
-            if (info.response != 200)
-            {
-                remove(info.fileName.c_str());
-                remove(shaFile.c_str());
-            }
-            else
+        queue.run(
+            [](size_t done, size_t total)
             {
-                decltype(pksm::crypto::sha256({})) checksum = info.shaContext.finish();
-
-                FILE* f = fopen(shaFile.c_str(), "wb");
-                if (f)
-                {
-                    fwrite(checksum.data(), 1, checksum.size(), f);
-                    fclose(f);
-                }
-            }
-        }
+                Gui::waitFrame(pksm::format(i18n::localize("MYSTERY_GIFT_DOWNLOAD"), done, total));
+            });
     }
 }
 
@@ -865,8 +776,7 @@ Result App::init(const std::string& execPath)
     gfxInitDefault();
     Threads::init(0, 2);
 
-    moveIcon.test_and_set();
-    Threads::create(iconThread);
+    Threads::create(iconThread, iconCancel);
 
     if (R_FAILED(res = svcConnectToPort(&hbldrHandle, "hb:ldr")))
     {
@@ -938,7 +848,7 @@ Result App::init(const std::string& execPath)
     }
 
     i18n::addCallbacks(i18n::initGui, i18n::exitGui);
-    moveIcon.clear();
+    iconCancel.cancel();
     i18n::init(Configuration::getInstance().language());
 
     PkmUtils::initDefaults();
@@ -974,14 +884,13 @@ Result App::init(const std::string& execPath)
 
     TitleLoader::init();
 
-    Threads::executeTask(TitleLoader::scanTitles);
+    // Titles are scanned in the background while the save folders are, which shows a message
+    TitleLoader::scanTitlesAsync();
     TitleLoader::scanSaves();
 
-    doCartScan.test_and_set();
-    Threads::create(cartScan);
+    Threads::create(cartScan, cartScanCancel);
 
-    continueI18N.test_and_set();
-    Threads::executeTask(i18nThread);
+    Threads::async(i18nCancel, i18nThread, i18nCancel);
 
     Gui::setScreen(std::make_unique<TitleLoadScreen>());
     // uncomment when needing to debug with GDB
@@ -992,8 +901,8 @@ Result App::init(const std::string& execPath)
 
 Result App::exit(void)
 {
-    moveIcon.clear();
-    continueI18N.clear();
+    iconCancel.cancel();
+    i18nCancel.cancel();
     svcCloseHandle(hbldrHandle);
     TitleLoader::exit();
     Gui::exit();
@@ -1002,7 +911,7 @@ Result App::exit(void)
     socExit();
     nsExit();
     acExit();
-    doCartScan.clear();
+    cartScanCancel.cancel();
     Threads::exit();
     i18n::exit();
     amExit();
@@ -27,6 +27,7 @@
 #include "banks.hpp"
 #include "Archive.hpp"
 #include "Configuration.hpp"
+#include "gui.hpp"
 #include "nlohmann/json.hpp"
 
 // Public on purpose: banks being converted need to set their size
@@ -154,8 +155,12 @@ void Banks::removeBank(const std::string& name)
         }
         Archive::sd().deleteFile("/3ds/PKSM/banks/" + name + ".bnk");
         Archive::sd().deleteFile("/3ds/PKSM/banks/" + name + ".json");
+        Archive::sd().deleteFile("/3ds/PKSM/banks/" + name + ".bnk.tmp");
         Archive::data().deleteFile("/banks/" + name + ".bnk");
         Archive::data().deleteFile("/banks/" + name + ".json");
+        Archive::data().deleteFile("/banks/" + name + ".bnk.tmp");
+        Archive::sd().deleteFile(Bank::journalPath(name));
+        Archive::sd().deleteFile(Bank::indexPath(name));
         for (auto i = g_banks.begin(); i != g_banks.end(); i++)
         {
             if (i.key() == name)
@@ -178,6 +183,43 @@ std::vector<std::pair<std::string, int>> Banks::bankNames()
     return ret;
 }
 
+std::vector<Banks::SearchResult> Banks::search(const SearchQuery& query)
+{
+    const u32 otNameHash = query.otName ? Bank::otNameHash(*query.otName) : 0;
+    auto matches         = [&](const Bank::IndexEntry& entry)
+    {
+        return (entry.flags & Bank::INDEX_PRESENT) &&
+               (!query.species || entry.species == u16(*query.species)) &&
+               (!query.form || entry.form == *query.form) &&
+               (!query.shiny || bool(entry.flags & Bank::INDEX_SHINY) == *query.shiny) &&
+               (!query.otName || entry.otNameHash == otNameHash) &&
+               (!query.TID || entry.TID == *query.TID) && (!query.SID || entry.SID == *query.SID) &&
+               entry.level >= query.minLevel && entry.level <= query.maxLevel &&
+               entry.ivTotal >= query.minIvTotal && entry.ivTotal <= query.maxIvTotal;
+    };
+
+    std::vector<SearchResult> ret;
+    for (const auto& [name, boxes] : bankNames())
+    {
+        auto entries = Bank::readIndex(name, boxes);
+        // Banks that predate the index, or whose index didn't get finished, get a new one. That
+        // goes for the loaded bank too, since the index has to match what's saved
+        if (entries.empty() && Bank::buildIndex(name, boxes))
+        {
+            entries = Bank::readIndex(name, boxes);
+        }
+
+        for (size_t i = 0; i < entries.size(); i++)
+        {
+            if (matches(entries[i]))
+            {
+                ret.emplace_back(name, i / 30, i % 30);
+            }
+        }
+    }
+    return ret;
+}
+
 void Banks::renameBank(const std::string& oldName, const std::string& newName)
 {
     if (oldName != newName && g_banks.contains(oldName))
@@ -199,6 +241,10 @@ void Banks::renameBank(const std::string& oldName, const std::string& newName)
                 "/3ds/PKSM/banks/" + newName + ".bnk");
             Archive::moveFile(Archive::sd(), "/3ds/PKSM/banks/" + oldName + ".json", Archive::sd(),
                 "/3ds/PKSM/banks/" + newName + ".json");
+            Archive::moveFile(Archive::sd(), Bank::journalPath(oldName), Archive::sd(),
+                Bank::journalPath(newName));
+            Archive::moveFile(Archive::sd(), Bank::indexPath(oldName), Archive::sd(),
+                Bank::indexPath(newName));
         }
         g_banks[newName] = g_banks[oldName];
         g_banks.erase(oldName);
@@ -221,32 +267,31 @@ void Banks::setBankSize(const std::string& name, int size)
 
 Result Banks::swapSD(bool toSD)
 {
-    Result res = 0;
-    if (toSD)
+    Archive& src              = toSD ? Archive::data() : Archive::sd();
+    Archive& dst              = toSD ? Archive::sd() : Archive::data();
+    const std::string srcDir  = toSD ? "/banks" : "/3ds/PKSM/banks";
+    const std::string dstDir  = toSD ? "/3ds/PKSM/banks" : "/banks";
+    const std::string srcJson = toSD ? "/banks.json" : "/3ds/PKSM/banks.json";
+    const std::string dstJson = toSD ? "/3ds/PKSM/banks.json" : "/banks.json";
+
+    TreeCopy::Options options;
+    options.progress = [](const TreeCopy::Progress& progress)
+    { Gui::showRestoreProgress(progress.bytesDone / 1024, progress.bytesTotal / 1024); };
+    if (!toSD)
     {
-        if (R_FAILED(res = Archive::moveDir(
-                         Archive::data(), "/banks", Archive::sd(), "/3ds/PKSM/banks")))
-        {
-            return res;
-        }
-        if (R_FAILED(res = Archive::moveFile(
-                         Archive::data(), "/banks.json", Archive::sd(), "/3ds/PKSM/banks.json")))
-        {
-            return res;
-        }
+        // Only files on the SD card can be checked for changes, so only this way can resume
+        options.manifestPath = "/3ds/PKSM/cache/banks.move";
     }
-    else
+
+    // Nothing is removed from where the banks were until all of them made it over, so that they
+    // can go on being used from there if something fails
+    Result res;
+    if (R_FAILED(res = Archive::copyDir(src, srcDir, dst, dstDir, options)) ||
+        R_FAILED(res = Archive::copyFile(src, srcJson, dst, dstJson)))
     {
-        if (R_FAILED(res = Archive::moveDir(
-                         Archive::sd(), "/3ds/PKSM/banks", Archive::data(), "/banks")))
-        {
-            return res;
-        }
-        if (R_FAILED(res = Archive::moveFile(
-                         Archive::sd(), "/3ds/PKSM/banks.json", Archive::data(), "/banks.json")))
-        {
-            return res;
-        }
+        return res;
     }
-    return res;
+    src.deleteDir(srcDir);
+    src.deleteFile(srcJson);
+    return 0;
 }
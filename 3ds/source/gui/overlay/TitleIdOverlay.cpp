@@ -31,7 +31,6 @@
 #include "gui.hpp"
 #include "loader.hpp"
 #include "Species.hpp"
-#include "thread.hpp"
 #include <array>
 
 namespace
@@ -106,7 +105,7 @@ void TitleIdOverlay::update(touchPosition* touch)
     if (kDown & KEY_B)
     {
         TitleLoader::reloadTitleIds();
-        Threads::executeTask(TitleLoader::scanTitles);
+        TitleLoader::scanTitlesAsync();
         parent->removeOverlay();
         return;
     }
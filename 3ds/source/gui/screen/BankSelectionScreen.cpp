@@ -30,6 +30,7 @@
 #include "gui.hpp"
 #include "i18n_ext.hpp"
 #include "utils/format.hpp"
+#include "utils/utils.hpp"
 #include <algorithm>
 
 BankSelectionScreen::BankSelectionScreen(int& storageBox)
@@ -52,9 +53,14 @@ BankSelectionScreen::BankSelectionScreen(int& storageBox)
 void BankSelectionScreen::drawBottom() const
 {
     Gui::sprite(ui_sheet_part_info_bottom_idx, 0, 0);
-    Gui::text(i18n::localize("X_RENAME") + "\n" + i18n::localize("Y_RESIZE") + "\n" +
-                  i18n::localize("START_DELETE"),
-        160, 120, FONT_SIZE_18, COLOR_BLACK, TextPosX::CENTER, TextPosY::CENTER);
+    std::string text = i18n::localize("X_RENAME") + "\n" + i18n::localize("Y_RESIZE") + "\n" +
+                       i18n::localize("START_DELETE") + "\n" + i18n::localize("SELECT_SEARCH") +
+                       "\n" + i18n::localize("R_RESTORE");
+    if (results)
+    {
+        text += "\n\n" + pksm::format(i18n::localize("BANK_SEARCH_RESULTS"), results->size());
+    }
+    Gui::text(text, 160, 120, FONT_SIZE_18, COLOR_BLACK, TextPosX::CENTER, TextPosY::CENTER);
 }
 
 void BankSelectionScreen::drawTop() const
@@ -75,8 +81,10 @@ void BankSelectionScreen::drawTop() const
             Gui::text(strings[hid.page() * hid.maxVisibleEntries() + i].first, x,
                 (i % (hid.maxVisibleEntries() / 2)) * 12, FONT_SIZE_9, COLOR_WHITE, TextPosX::LEFT,
                 TextPosY::TOP);
-            Gui::text(std::to_string(strings[hid.page() * hid.maxVisibleEntries() + i].second),
-                x + 192, (i % (hid.maxVisibleEntries() / 2)) * 12, FONT_SIZE_9, COLOR_WHITE,
+            // After a search, how many matches each bank has instead of its size
+            const auto& bank = strings[hid.page() * hid.maxVisibleEntries() + i];
+            Gui::text(std::to_string(results ? matches(bank.first) : bank.second), x + 192,
+                (i % (hid.maxVisibleEntries() / 2)) * 12, FONT_SIZE_9, COLOR_WHITE,
                 TextPosX::RIGHT, TextPosY::TOP);
         }
         else
@@ -105,6 +113,16 @@ void BankSelectionScreen::update(touchPosition* touch)
                 storageBox = 0;
             }
         }
+        // Open the bank at its first match
+        if (results && Banks::bank->name() == res.first)
+        {
+            auto found = std::find_if(results->begin(), results->end(),
+                [&res](const Banks::SearchResult& result) { return result.bank == res.first; });
+            if (found != results->end() && found->box < Banks::bank->boxes())
+            {
+                storageBox = found->box;
+            }
+        }
         Gui::screenBack();
         return;
     }
@@ -121,6 +139,14 @@ void BankSelectionScreen::update(touchPosition* touch)
     {
         resizeBank();
     }
+    else if (downKeys & KEY_SELECT)
+    {
+        searchBanks();
+    }
+    else if (downKeys & KEY_R)
+    {
+        restoreBank();
+    }
     else if (downKeys & KEY_START)
     {
         if (hid.fullIndex() == strings.size() - 1)
@@ -189,3 +215,109 @@ void BankSelectionScreen::resizeBank()
         strings[hid.fullIndex()].second = num;
     }
 }
+
+void BankSelectionScreen::searchBanks()
+{
+    SwkbdState state;
+    swkbdInit(&state, SWKBD_TYPE_NORMAL, 2, 20);
+    swkbdSetHintText(&state, i18n::localize("BANK_SEARCH").c_str());
+    swkbdSetValidation(&state, SWKBD_ANYTHING, 0, 0);
+    char input[25]  = {0};
+    SwkbdButton ret = swkbdInputText(&state, input, sizeof(input));
+    input[24]       = '\0';
+    if (ret != SWKBD_BUTTON_CONFIRM)
+    {
+        return;
+    }
+    std::string search(input);
+    if (search.empty())
+    {
+        results = std::nullopt;
+        return;
+    }
+
+    // Searching goes by what's saved
+    if (Banks::bank->hasChanged() && Gui::showChoiceMessage(i18n::localize("BANK_SAVE_CHANGES")))
+    {
+        Banks::bank->save();
+    }
+
+    // A species name searches for that species, and anything else for an OT name
+    Banks::SearchQuery query;
+    std::string lowerSearch = search;
+    StringUtils::toLower(lowerSearch);
+    for (u16 species = 1; species <= u16(pksm::Species::Calyrex); species++)
+    {
+        std::string name =
+            i18n::species(Configuration::getInstance().language(), pksm::Species{species});
+        StringUtils::toLower(name);
+        if (name == lowerSearch)
+        {
+            query.species = pksm::Species{species};
+            break;
+        }
+    }
+    if (!query.species)
+    {
+        query.otName = search;
+    }
+
+    Gui::waitFrame(i18n::localize("BANK_SEARCHING"));
+    results = Banks::search(query);
+}
+
+void BankSelectionScreen::restoreBank()
+{
+    // The new bank entry doesn't have anything to restore
+    if (hid.fullIndex() == strings.size() - 1)
+    {
+        return;
+    }
+
+    SwkbdState state;
+    swkbdInit(&state, SWKBD_TYPE_NUMPAD, 2, 1);
+    swkbdSetFeatures(&state, SWKBD_FIXED_WIDTH);
+    swkbdSetHintText(&state, i18n::localize("BANK_RESTORE").c_str());
+    swkbdSetValidation(&state, SWKBD_NOTEMPTY_NOTBLANK, 0, 0);
+    char input[2]   = {0};
+    SwkbdButton ret = swkbdInputText(&state, input, sizeof(input));
+    input[1]        = '\0';
+    if (ret != SWKBD_BUTTON_CONFIRM)
+    {
+        return;
+    }
+    int generation = std::max(1, std::min(std::stoi(input), Bank::BACKUP_GENERATIONS));
+
+    const auto& res = strings[hid.fullIndex()];
+    if (!Gui::showChoiceMessage(
+            pksm::format(i18n::localize("BANK_CONFIRM_RESTORE"), generation, res.first)))
+    {
+        return;
+    }
+    if (res.first != Banks::bank->name())
+    {
+        if (Banks::bank->hasChanged() &&
+            Gui::showChoiceMessage(i18n::localize("BANK_SAVE_CHANGES")))
+        {
+            Banks::bank->save();
+        }
+        if (!Banks::loadBank(res.first, res.second))
+        {
+            return;
+        }
+    }
+    storageBox = 0;
+    if (!Banks::bank->restoreBackup(generation - 1))
+    {
+        Gui::warn(i18n::localize("BANK_RESTORE_FAIL"));
+    }
+    // Restoring can change how many boxes the bank has
+    strings[hid.fullIndex()].second = Banks::bank->boxes();
+    results                         = std::nullopt;
+}
+
+int BankSelectionScreen::matches(const std::string& bank) const
+{
+    return std::count_if(results->begin(), results->end(),
+        [&bank](const Banks::SearchResult& result) { return result.bank == bank; });
+}
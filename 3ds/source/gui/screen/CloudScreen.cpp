@@ -109,7 +109,7 @@ CloudScreen::CloudScreen(int storageBox, std::shared_ptr<pksm::PKFilter> filter)
 
 void CloudScreen::drawBottom() const
 {
-    if (!access.good())
+    if (!access.good() && !access.loading())
     {
         return;
     }
@@ -133,7 +133,7 @@ void CloudScreen::drawBottom() const
         u16 x = 4;
         for (u8 column = 0; column < 6; column++)
         {
-            auto pokemon = Banks::bank->pkm(storageBox, row * 6 + column);
+            auto pokemon = Banks::bank->pkmView(storageBox, row * 6 + column);
             if (pokemon->species() != pksm::Species::None)
             {
                 float blend = *pokemon == *filter ? 0.0f : 0.5f;
@@ -178,7 +178,9 @@ void CloudScreen::drawBottom() const
 
 void CloudScreen::drawTop() const
 {
-    if (!access.good())
+    // Checked first so that a page arriving mid-frame is not drawn before it is validated
+    bool loading = access.loading();
+    if (!loading && !access.good())
     {
         return;
     }
@@ -187,6 +189,13 @@ void CloudScreen::drawTop() const
     Gui::backgroundAnimatedTop();
     Gui::sprite(ui_sheet_bar_arc_top_green_idx, 0, 0);
 
+    if (loading)
+    {
+        Gui::text(i18n::localize("PLEASE_WAIT"), 200, 120, FONT_SIZE_14, COLOR_WHITE,
+            TextPosX::CENTER, TextPosY::CENTER);
+        return;
+    }
+
     Gui::sprite(ui_sheet_textbox_pksm_idx, 261, 3);
     Gui::text("GPSS", 394, 7, FONT_SIZE_14, COLOR_WHITE, TextPosX::RIGHT, TextPosY::TOP);
 
@@ -225,7 +234,7 @@ void CloudScreen::drawTop() const
         u16 x = 45;
         for (u8 column = 0; column < 6; column++)
         {
-            auto pkm = access.pkm(row * 6 + column);
+            auto pkm = access.pkmView(row * 6 + column);
             if (pkm->species() != pksm::Species::None)
             {
                 float blend = *pkm == *filter ? 0.0f : 0.5f;
@@ -343,6 +352,11 @@ void CloudScreen::drawTop() const
 
 void CloudScreen::update(touchPosition* touch)
 {
+    access.update();
+    if (access.loading())
+    {
+        return;
+    }
     if (!access.good())
     {
         if (access.currentPageError() != 0)
@@ -985,11 +985,17 @@ void ConfigScreen::update(touchPosition* touch)
 
 void ConfigScreen::back()
 {
-    Configuration::getInstance().save();
     if (useExtDataChanged)
     {
-        Banks::swapSD(!Configuration::getInstance().useExtData());
+        // The source is only removed once the move is through, so a failed move keeps using it
+        if (Result res = Banks::swapSD(!Configuration::getInstance().useExtData()); R_FAILED(res))
+        {
+            Configuration::getInstance().useExtData(!Configuration::getInstance().useExtData());
+            Gui::error(i18n::localize("BANK_MOVE_FAIL"), res);
+        }
+        useExtDataChanged = false;
     }
+    Configuration::getInstance().save();
     if (showBackupsChanged || titleIdsChanged)
     {
         TitleLoader::scanSaves();
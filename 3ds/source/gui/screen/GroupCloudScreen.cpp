@@ -108,7 +108,7 @@ GroupCloudScreen::GroupCloudScreen(int storageBox, std::shared_ptr<pksm::PKFilte
 
 void GroupCloudScreen::drawBottom() const
 {
-    if (!access.good())
+    if (!access.good() && !access.loading())
     {
         return;
     }
@@ -132,7 +132,7 @@ void GroupCloudScreen::drawBottom() const
         u16 x = 4;
         for (u8 column = 0; column < 6; column++)
         {
-            std::shared_ptr<pksm::PKX> pokemon = Banks::bank->pkm(storageBox, row * 6 + column);
+            auto pokemon = Banks::bank->pkmView(storageBox, row * 6 + column);
             if (pokemon->species() != pksm::Species::None)
             {
                 float blend = *pokemon == *filter ? 0.0f : 0.5f;
@@ -191,7 +191,9 @@ void GroupCloudScreen::drawBottom() const
 
 void GroupCloudScreen::drawTop() const
 {
-    if (!access.good())
+    // Checked first so that a page arriving mid-frame is not drawn before it is validated
+    bool loading = access.loading();
+    if (!loading && !access.good())
     {
         return;
     }
@@ -200,6 +202,13 @@ void GroupCloudScreen::drawTop() const
     Gui::backgroundAnimatedTop();
     Gui::sprite(ui_sheet_bar_arc_top_green_idx, 0, 0);
 
+    if (loading)
+    {
+        Gui::text(i18n::localize("PLEASE_WAIT"), 200, 120, FONT_SIZE_14, COLOR_WHITE,
+            TextPosX::CENTER, TextPosY::CENTER);
+        return;
+    }
+
     Gui::sprite(ui_sheet_textbox_pksm_idx, 261, 3);
     Gui::text("GPSS", 394, 7, FONT_SIZE_14, COLOR_WHITE, TextPosX::RIGHT, TextPosY::TOP);
 
@@ -238,7 +247,7 @@ void GroupCloudScreen::drawTop() const
         u16 x = 45;
         for (u8 column = 0; column < 6; column++)
         {
-            auto pkm = access.pkm(row, column);
+            auto pkm = access.pkmView(row, column);
             if (pkm->species() != pksm::Species::None)
             {
                 float blend = *pkm == *filter ? 0.0f : 0.5f;
@@ -363,6 +372,11 @@ void GroupCloudScreen::drawTop() const
 
 void GroupCloudScreen::update(touchPosition* touch)
 {
+    access.update();
+    if (access.loading())
+    {
+        return;
+    }
     if (!access.good())
     {
         if (access.currentPageError() != 0)
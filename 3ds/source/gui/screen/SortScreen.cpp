@@ -34,6 +34,132 @@
 #include "pkx/PKX.hpp"
 #include "sav/Sav.hpp"
 #include "SortOverlay.hpp"
+#include <map>
+#include <numeric>
+
+namespace
+{
+    using SortType = SortScreen::SortType;
+
+    bool isStringSort(SortType type)
+    {
+        return type == SortType::SPECIESNAME || type == SortType::NICKNAME ||
+               type == SortType::OTNAME;
+    }
+
+    u32 sortKey(const pksm::PKX& pkm, SortType type)
+    {
+        switch (type)
+        {
+            case SortType::DEX:
+                return u16(pkm.species());
+            case SortType::FORM:
+                return pkm.alternativeForm();
+            case SortType::TYPE1:
+                return u8(pkm.type1());
+            case SortType::TYPE2:
+                return u8(pkm.type2());
+            case SortType::HP:
+                return pkm.stat(pksm::Stat::HP);
+            case SortType::ATK:
+                return pkm.stat(pksm::Stat::ATK);
+            case SortType::DEF:
+                return pkm.stat(pksm::Stat::DEF);
+            case SortType::SATK:
+                return pkm.stat(pksm::Stat::SPATK);
+            case SortType::SDEF:
+                return pkm.stat(pksm::Stat::SPDEF);
+            case SortType::SPE:
+                return pkm.stat(pksm::Stat::SPD);
+            case SortType::NATURE:
+                return u8(pkm.nature());
+            case SortType::LEVEL:
+                return pkm.level();
+            case SortType::TID:
+                return pkm.TID();
+            case SortType::HPIV:
+                return pkm.iv(pksm::Stat::HP);
+            case SortType::ATKIV:
+                return pkm.iv(pksm::Stat::ATK);
+            case SortType::DEFIV:
+                return pkm.iv(pksm::Stat::DEF);
+            case SortType::SATKIV:
+                return pkm.iv(pksm::Stat::SPATK);
+            case SortType::SDEFIV:
+                return pkm.iv(pksm::Stat::SPDEF);
+            case SortType::SPEIV:
+                return pkm.iv(pksm::Stat::SPD);
+            case SortType::HIDDENPOWER:
+                return u8(pkm.hpType());
+            case SortType::FRIENDSHIP:
+                return pkm.currentFriendship();
+            case SortType::SHINY:
+                // Shiny Pokemon go first
+                return pkm.shiny() ? 0 : 1;
+            default:
+                return 0;
+        }
+    }
+
+    // One sort type's keys, one per Pokemon in the order they were added. String keys are stood in
+    // for by their position among all the distinct strings, so comparing keys gives the same
+    // result as comparing the strings themselves. Those positions are only known once every
+    // Pokemon has been added.
+    struct KeyColumn
+    {
+        SortType type;
+        std::vector<u32> keys;
+        std::map<std::string, u32> ranks;
+        std::vector<const u32*> slotRanks;
+        // Species names only have to be looked up once per species
+        std::map<u16, const u32*> speciesRanks;
+    };
+
+    void addKey(KeyColumn& column, const pksm::PKX& pkm)
+    {
+        if (!isStringSort(column.type))
+        {
+            column.keys.emplace_back(sortKey(pkm, column.type));
+        }
+        else if (column.type == SortType::SPECIESNAME)
+        {
+            u16 species = u16(pkm.species());
+            auto found  = column.speciesRanks.find(species);
+            if (found == column.speciesRanks.end())
+            {
+                std::string name = pkm.species().localize(Configuration::getInstance().language());
+                const u32* rank  = &column.ranks.try_emplace(std::move(name)).first->second;
+                found            = column.speciesRanks.emplace(species, rank).first;
+            }
+            column.slotRanks.emplace_back(found->second);
+        }
+        else
+        {
+            std::string name = column.type == SortType::NICKNAME ? pkm.nickname() : pkm.otName();
+            column.slotRanks.emplace_back(&column.ranks.try_emplace(std::move(name)).first->second);
+        }
+    }
+
+    void finishColumn(KeyColumn& column)
+    {
+        if (isStringSort(column.type))
+        {
+            u32 rank = 0;
+            for (auto& [string, stringRank] : column.ranks)
+            {
+                stringRank = rank++;
+            }
+            column.keys.reserve(column.slotRanks.size());
+            for (const u32* slotRank : column.slotRanks)
+            {
+                column.keys.emplace_back(*slotRank);
+            }
+            column.ranks.clear();
+            column.slotRanks.clear();
+            column.speciesRanks.clear();
+        }
+    }
+}
 
 SortScreen::SortScreen(bool storage) : storage(storage)
 {
@@ -148,15 +274,40 @@ void SortScreen::sort()
         {
             sortTypes.push_back(SortType::DEX);
         }
-        std::vector<std::shared_ptr<pksm::PKX>> sortMe;
+        // Every key is read once up front into one column per sort type, so comparisons are just
+        // integer compares instead of virtual calls and string building. Each Pokemon is dropped
+        // as soon as its keys have been taken.
+        std::vector<KeyColumn> columns;
+        for (const auto& type : sortTypes)
+        {
+            if (type != SortType::NONE)
+            {
+                columns.push_back(KeyColumn{type});
+            }
+        }
+        std::vector<int> slots;
+        auto addPkm = [&columns, &slots](const pksm::PKX& pkm, int slot)
+        {
+            for (auto& column : columns)
+            {
+                addKey(column, pkm);
+            }
+            slots.push_back(slot);
+        };
         if (storage)
         {
             for (int i = 0; i < Banks::bank->boxes() * 30; i++)
             {
-                std::shared_ptr<pksm::PKX> pkm = Banks::bank->pkm(i / 30, i % 30);
+                // Empty boxes don't even have to be read
+                if (i % 30 == 0 && Banks::bank->occupiedSlots(i / 30) == 0)
+                {
+                    i += 29;
+                    continue;
+                }
+                std::unique_ptr<pksm::PKX> pkm = Banks::bank->pkm(i / 30, i % 30);
                 if (pkm->species() != pksm::Species::None)
                 {
-                    sortMe.push_back(pkm);
+                    addPkm(*pkm, i);
                 }
             }
         }
@@ -168,306 +319,47 @@ void SortScreen::sort()
                                : 30;
             for (int i = 0; i < TitleLoader::save->maxSlot(); i++)
             {
-                std::shared_ptr<pksm::PKX> pkm =
+                std::unique_ptr<pksm::PKX> pkm =
                     TitleLoader::save->pkm(i / maxPkmInBox, i % maxPkmInBox);
                 if (pkm->species() != pksm::Species::None)
                 {
-                    sortMe.push_back(pkm);
+                    addPkm(*pkm, i);
                 }
             }
         }
-        std::stable_sort(sortMe.begin(), sortMe.end(),
-            [this](const std::shared_ptr<pksm::PKX>& pkm1, const std::shared_ptr<pksm::PKX>& pkm2)
+        for (auto& column : columns)
+        {
+            finishColumn(column);
+        }
+
+        std::vector<u32> order(slots.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(),
+            [&columns](u32 index1, u32 index2)
             {
-                for (const auto& type : sortTypes)
+                for (const auto& column : columns)
                 {
-                    switch (type)
+                    if (column.keys[index1] != column.keys[index2])
                     {
-                        case SortType::DEX:
-                            if (pkm1->species() < pkm2->species())
-                            {
-                                return true;
-                            }
-                            if (pkm2->species() < pkm1->species())
-                            {
-                                return false;
-                            }
-                            break;
-                        case SortType::FORM:
-                            if (pkm1->alternativeForm() < pkm2->alternativeForm())
-                            {
-                                return true;
-                            }
-                            if (pkm2->alternativeForm() < pkm1->alternativeForm())
-                            {
-                                return false;
-                            }
-                            break;
-                        case SortType::TYPE1:
-                            if (pkm1->type1() < pkm2->type1())
-                            {
-                                return true;
-                            }
-                            if (pkm2->type1() < pkm1->type1())
-                            {
-                                return false;
-                            }
-                            break;
-                        case SortType::TYPE2:
-                            if (pkm1->type2() < pkm2->type2())
-                            {
-                                return true;
-                            }
-                            if (pkm2->type2() < pkm1->type2())
-                            {
-                                return false;
-                            }
-                            break;
-                        case SortType::HP:
-                            if (pkm1->stat(pksm::Stat::HP) < pkm2->stat(pksm::Stat::HP))
-                            {
-                                return true;
-                            }
-                            if (pkm2->stat(pksm::Stat::HP) < pkm1->stat(pksm::Stat::HP))
-                            {
-                                return false;
-                            }
-                            break;
-                        case SortType::ATK:
-                            if (pkm1->stat(pksm::Stat::ATK) < pkm2->stat(pksm::Stat::ATK))
-                            {
-                                return true;
-                            }
-                            if (pkm2->stat(pksm::Stat::ATK) < pkm1->stat(pksm::Stat::ATK))
-                            {
-                                return false;
-                            }
-                            break;
-                        case SortType::DEF:
-                            if (pkm1->stat(pksm::Stat::DEF) < pkm2->stat(pksm::Stat::DEF))
-                            {
-                                return true;
-                            }
-                            if (pkm2->stat(pksm::Stat::DEF) < pkm1->stat(pksm::Stat::DEF))
-                            {
-                                return false;
-                            }
-                            break;
-                        case SortType::SATK:
-                            if (pkm1->stat(pksm::Stat::SPATK) < pkm2->stat(pksm::Stat::SPATK))
-                            {
-                                return true;
-                            }
-                            if (pkm2->stat(pksm::Stat::SPATK) < pkm1->stat(pksm::Stat::SPATK))
-                            {
-                                return false;
-                            }
-                            break;
-                        case SortType::SDEF:
-                            if (pkm1->stat(pksm::Stat::SPDEF) < pkm2->stat(pksm::Stat::SPDEF))
-                            {
-                                return true;
-                            }
-                            if (pkm2->stat(pksm::Stat::SPDEF) < pkm1->stat(pksm::Stat::SPDEF))
-                            {
-                                return false;
-                            }
-                            break;
-                        case SortType::SPE:
-                            if (pkm1->stat(pksm::Stat::SPDEF) < pkm2->stat(pksm::Stat::SPD))
-                            {
-                                return true;
-                            }
-                            if (pkm2->stat(pksm::Stat::SPDEF) < pkm1->stat(pksm::Stat::SPD))
-                            {
-                                return false;
-                            }
-                            break;
-                        case SortType::NATURE:
-                            if (pkm1->nature() < pkm2->nature())
-                            {
-                                return true;
-                            }
-                            if (pkm2->nature() < pkm1->nature())
-                            {
-                                return false;
-                            }
-                            break;
-                        case SortType::LEVEL:
-                            if (pkm1->level() < pkm2->level())
-                            {
-                                return true;
-                            }
-                            if (pkm2->level() < pkm1->level())
-                            {
-                                return false;
-                            }
-                            break;
-                        case SortType::TID:
-                            if (pkm1->TID() < pkm2->TID())
-                            {
-                                return true;
-                            }
-                            if (pkm2->TID() < pkm1->TID())
-                            {
-                                return false;
-                            }
-                            break;
-                        case SortType::HPIV:
-                            if (pkm1->iv(pksm::Stat::HP) < pkm2->iv(pksm::Stat::HP))
-                            {
-                                return true;
-                            }
-                            if (pkm2->iv(pksm::Stat::HP) < pkm1->iv(pksm::Stat::HP))
-                            {
-                                return false;
-                            }
-                            break;
-                        case SortType::ATKIV:
-                            if (pkm1->iv(pksm::Stat::ATK) < pkm2->iv(pksm::Stat::ATK))
-                            {
-                                return true;
-                            }
-                            if (pkm2->iv(pksm::Stat::ATK) < pkm1->iv(pksm::Stat::ATK))
-                            {
-                                return false;
-                            }
-                            break;
-                        case SortType::DEFIV:
-                            if (pkm1->iv(pksm::Stat::DEF) < pkm2->iv(pksm::Stat::DEF))
-                            {
-                                return true;
-                            }
-                            if (pkm2->iv(pksm::Stat::DEF) < pkm1->iv(pksm::Stat::DEF))
-                            {
-                                return false;
-                            }
-                            break;
-                        case SortType::SATKIV:
-                            if (pkm1->iv(pksm::Stat::SPATK) < pkm2->iv(pksm::Stat::SPATK))
-                            {
-                                return true;
-                            }
-                            if (pkm2->iv(pksm::Stat::SPATK) < pkm1->iv(pksm::Stat::SPATK))
-                            {
-                                return false;
-                            }
-                            break;
-                        case SortType::SDEFIV:
-                            if (pkm1->iv(pksm::Stat::SPDEF) < pkm2->iv(pksm::Stat::SPDEF))
-                            {
-                                return true;
-                            }
-                            if (pkm2->iv(pksm::Stat::SPDEF) < pkm1->iv(pksm::Stat::SPDEF))
-                            {
-                                return false;
-                            }
-                            break;
-                        case SortType::SPEIV:
-                            if (pkm1->iv(pksm::Stat::SPD) < pkm2->iv(pksm::Stat::SPD))
-                            {
-                                return true;
-                            }
-                            if (pkm2->iv(pksm::Stat::SPD) < pkm1->iv(pksm::Stat::SPD))
-                            {
-                                return false;
-                            }
-                            break;
-                        case SortType::HIDDENPOWER:
-                            if (pkm1->hpType() < pkm2->hpType())
-                            {
-                                return true;
-                            }
-                            if (pkm2->hpType() < pkm1->hpType())
-                            {
-                                return false;
-                            }
-                            break;
-                        case SortType::FRIENDSHIP:
-                            if (pkm1->currentFriendship() < pkm2->currentFriendship())
-                            {
-                                return true;
-                            }
-                            if (pkm2->currentFriendship() < pkm1->currentFriendship())
-                            {
-                                return false;
-                            }
-                            break;
-                        case SortType::NICKNAME:
-                            if (pkm1->nickname() < pkm2->nickname())
-                            {
-                                return true;
-                            }
-                            if (pkm2->nickname() < pkm1->nickname())
-                            {
-                                return false;
-                            }
-                            break;
-                        case SortType::SPECIESNAME:
-                            if (pkm1->species().localize(Configuration::getInstance().language()) <
-                                pkm2->species().localize(Configuration::getInstance().language()))
-                            {
-                                return true;
-                            }
-                            if (pkm2->species().localize(Configuration::getInstance().language()) <
-                                pkm1->species().localize(Configuration::getInstance().language()))
-                            {
-                                return false;
-                            }
-                            break;
-                        case SortType::OTNAME:
-                            if (pkm1->otName() < pkm2->otName())
-                            {
-                                return true;
-                            }
-                            if (pkm2->otName() < pkm1->otName())
-                            {
-                                return false;
-                            }
-                            break;
-                        case SortType::SHINY:
-                            if (pkm1->shiny() && !pkm2->shiny())
-                            {
-                                return true;
-                            }
-                            if (pkm2->shiny() && !pkm1->shiny())
-                            {
-                                return false;
-                            }
-                            break;
-                        default:
-                            break;
+                        return column.keys[index1] < column.keys[index2];
                     }
                 }
                 return false;
             });
 
+        // Only the raw slots get moved around, so nothing has to be encoded again
+        std::vector<int> permutation(order.size());
+        for (size_t i = 0; i < order.size(); i++)
+        {
+            permutation[i] = slots[order[i]];
+        }
         if (storage)
         {
-            for (size_t i = 0; i < sortMe.size(); i++)
-            {
-                Banks::bank->pkm(*sortMe[i], i / 30, i % 30);
-            }
-            for (int i = sortMe.size(); i < Banks::bank->boxes() * 30; i++)
-            {
-                Banks::bank->pkm(*TitleLoader::save->emptyPkm(), i / 30, i % 30);
-            }
+            Banks::bank->permute(permutation);
         }
         else
         {
-            u8 maxPkmInBox = (TitleLoader::save->generation() <= pksm::Generation::TWO &&
-                                 TitleLoader::save->language() != pksm::Language::JPN)
-                               ? 20
-                               : 30;
-            for (size_t i = 0; i < sortMe.size(); i++)
-            {
-                TitleLoader::save->pkm(*sortMe[i], i / maxPkmInBox, i % maxPkmInBox, false);
-            }
-            for (int i = sortMe.size(); i < TitleLoader::save->maxSlot(); i++)
-            {
-                TitleLoader::save->pkm(
-                    *TitleLoader::save->emptyPkm(), i / maxPkmInBox, i % maxPkmInBox, false);
-            }
+            TitleLoader::permuteSaveSlots(permutation);
         }
     }
 }
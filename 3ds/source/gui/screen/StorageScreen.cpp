@@ -457,7 +457,7 @@ void StorageScreen::drawTop() const
             {
                 Gui::drawSolidRect(x, y, 34, 30, COLOR_GREEN_HIGHLIGHT);
             }
-            auto pkm = Banks::bank->pkm(storageBox, row * 6 + column);
+            auto pkm = Banks::bank->pkmView(storageBox, row * 6 + column);
             if (pkm->species() != pksm::Species::None)
             {
                 float blend = *pkm == *filter ? 0.0f : 0.5f;
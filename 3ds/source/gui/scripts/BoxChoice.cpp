@@ -208,7 +208,7 @@ void BoxChoice::drawTop() const
             u16 x = 45;
             for (u8 column = 0; column < 6; column++)
             {
-                auto pkm = Banks::bank->pkm(storageBox, row * 6 + column);
+                auto pkm = Banks::bank->pkmView(storageBox, row * 6 + column);
                 if (pkm->species() != pksm::Species::None)
                 {
                     Gui::pkm(*pkm, x, y);
@@ -25,6 +25,7 @@
  */
 
 #include "Archive.hpp"
+#include "ChunkPipeline.hpp"
 #include "csvc.h"
 #include "Directory.hpp"
 #include "File.hpp"
@@ -32,17 +33,157 @@
 #include "smdh.hpp"
 #include "STDirectory.hpp"
 #include <array>
+#include <functional>
 #include <sys/stat.h>
 
 namespace
 {
-    constexpr u64 MOVE_BUFFER_SIZE = 16 * 1024;
+    // Two of these are in flight per copy: one being read while the other is written
+    constexpr u32 MOVE_BUFFER_SIZE = 64 * 1024;
 
     constexpr FS_ExtSaveDataInfo PKSM_ARCHIVE_DATA = {MEDIATYPE_SD, 0, 0, UNIQUE_ID, 0};
 
     Archive sdArchive;
     Archive dataArchive;
 
+    // The next chunk is read from in while the last one is written to out, and out is flushed once
+    // at the end instead of on every write
+    Result copyContents(
+        File& in, File& out, u64 size, const std::function<void(u64)>& progress = nullptr)
+    {
+        out.flushOnWrite(false);
+        Result res = ChunkPipeline::copy(
+            size,
+            [&in](u64 offset, void* buffer, u32 size) -> Result
+            {
+                u32 read   = 0;
+                Result res = in.readAt(offset, buffer, size, &read);
+                return R_SUCCEEDED(res) && read != size ? -1 : res;
+            },
+            [&out, &progress](u64 offset, const void* buffer, u32 size) -> Result
+            {
+                u32 written = 0;
+                Result res  = out.writeAt(offset, buffer, size, &written);
+                if (progress)
+                {
+                    progress(offset + written);
+                }
+                return R_SUCCEEDED(res) && written != size ? -1 : res;
+            },
+            MOVE_BUFFER_SIZE);
+        Result flushed = out.flush();
+        return R_FAILED(res) ? res : flushed;
+    }
+
+    // Runs on several TreeCopy workers at once, so nothing here may go through result()
+    Result copyFileWithProgress(Archive& src, FS_Path file, Archive& dst, FS_Path dest,
+        const std::function<void(u64)>& progress)
+    {
+        std::unique_ptr<File> stream;
+        Result res = src.openFile(file, FS_OPEN_READ, stream);
+        if (stream)
+        {
+            u64 target = stream->size();
+            dst.deleteFile(dest);
+            dst.createFile(dest, 0, target);
+            std::unique_ptr<File> out;
+            res = dst.openFile(dest, FS_OPEN_WRITE, out);
+            if (out)
+            {
+                res = copyContents(*stream, *out, target, progress);
+                out->close();
+            }
+            stream->close();
+        }
+
+        if (R_FAILED(res))
+        {
+            dst.deleteFile(dest);
+        }
+        return res;
+    }
+
+    bool alreadyExists(Result res)
+    {
+        return res == (long)0xC82044BE || res == (long)0xC82044B9;
+    }
+
+    // Copies between two archives for copyDir and moveDir. Files on the SD card are stamped with
+    // their modification time so that a resumed copy can tell which of them changed; files in
+    // other archives have no such thing and are always copied again.
+    TreeCopy::Backend treeBackend(
+        Archive& src, const std::u16string& dir, Archive& dst, const std::u16string& dest)
+    {
+        std::u16string srcDir = dir.back() == u'/' ? dir : dir + u'/';
+        std::u16string dstDir = dest.back() == u'/' ? dest : dest + u'/';
+        auto srcPath          = [dir, srcDir](const std::u16string& path)
+        { return path.empty() ? dir : srcDir + path; };
+        auto dstPath = [dest, dstDir](const std::u16string& path)
+        { return path.empty() ? dest : dstDir + path; };
+
+        TreeCopy::Backend backend;
+        backend.list = [&src, srcPath](const std::u16string& folder,
+                           std::vector<TreeCopy::Entry>& out) -> Result
+        {
+            std::unique_ptr<Directory> d;
+            if (Result res = src.openDirectory(srcPath(folder), d); R_FAILED(res))
+            {
+                return res;
+            }
+            bool stamped = &src == &Archive::sd();
+            for (size_t i = 0; i < d->count(); i++)
+            {
+                TreeCopy::Entry& entry = out.emplace_back();
+                entry.path             = d->item(i);
+                entry.folder           = d->folder(i);
+                entry.size             = d->size(i);
+                if (stamped && !entry.folder)
+                {
+                    std::u16string path = srcPath(folder.empty() ? entry.path
+                                                                 : folder + u'/' + entry.path);
+                    archive_getmtime(StringUtils::UTF16toUTF8(path).c_str(), &entry.stamp);
+                }
+            }
+            return 0;
+        };
+        backend.listDestination = [&dst, dstPath](const std::u16string& folder,
+                                      std::vector<TreeCopy::Entry>& out) -> Result
+        {
+            std::unique_ptr<Directory> d;
+            if (Result res = dst.openDirectory(dstPath(folder), d); R_FAILED(res))
+            {
+                return res;
+            }
+            for (size_t i = 0; i < d->count(); i++)
+            {
+                TreeCopy::Entry& entry = out.emplace_back();
+                entry.path             = d->item(i);
+                entry.folder           = d->folder(i);
+                entry.size             = d->size(i);
+            }
+            return 0;
+        };
+        backend.remove = [&dst, dstPath](const TreeCopy::Entry& entry) -> Result
+        {
+            return entry.folder ? dst.deleteDir(dstPath(entry.path))
+                                : dst.deleteFile(dstPath(entry.path));
+        };
+        backend.makeFolder = [&dst, dstPath](const std::u16string& folder) -> Result
+        {
+            Result res = dst.createDir(dstPath(folder), 0);
+            return alreadyExists(res) ? 0 : res;
+        };
+        backend.copyFile = [&src, &dst, srcPath, dstPath](const TreeCopy::Entry& file,
+                               const std::function<void(u64)>& progress) -> Result
+        {
+            std::u16string from = srcPath(file.path);
+            std::u16string to   = dstPath(file.path);
+            return copyFileWithProgress(src, fsMakePath(PATH_UTF16, from.c_str()), dst,
+                fsMakePath(PATH_UTF16, to.c_str()), progress);
+        };
+        return backend;
+    }
+
     void moveOldBackups()
     {
         STDirectory d("/3ds/PKSM/backup");
@@ -186,67 +327,36 @@ Archive& Archive::operator=(Archive&& other)
     return *this;
 }
 
-Result Archive::moveDir(
-    Archive& src, const std::u16string& dir, Archive& dst, const std::u16string& dest)
+Result Archive::moveDir(Archive& src, const std::u16string& dir, Archive& dst,
+    const std::u16string& dest, const TreeCopy::Options& options)
 {
     Result res;
 
-    dst.deleteDir(dest);
-
     if (src.mHandle == dst.mHandle && !src.mPXI && !dst.mPXI)
     {
+        dst.deleteDir(dest);
         res = FSUSER_RenameDirectory(src.mHandle, fsMakePath(PATH_UTF16, dir.c_str()), dst.mHandle,
             fsMakePath(PATH_UTF16, dest.c_str()));
         return res;
     }
     else if (src.mHandle == dst.mHandle && src.mPXI && dst.mPXI)
     {
+        dst.deleteDir(dest);
         res = FSPXI_RenameDirectory(fspxiHandle, src.mHandle, fsMakePath(PATH_UTF16, dir.c_str()),
             dst.mHandle, fsMakePath(PATH_UTF16, dest.c_str()));
         return res;
     }
     else
     {
-        if (R_FAILED(res = dst.createDir(dest, 0)) && res != (long)0xC82044BE &&
-            res != (long)0xC82044B9)
+        // The source is only removed once everything has made it over
+        if (R_FAILED(res = copyDir(src, dir, dst, dest, options)))
         {
             return res;
         }
-        auto d                = src.directory(dir);
-        std::u16string srcDir = dir.back() == u'/' ? dir : dir + u'/';
-        std::u16string dstDir = dest.back() == u'/' ? dest : dest + u'/';
-        if (d)
-        {
-            for (size_t i = 0; i < d->count(); i++)
-            {
-                if (d->folder(i))
-                {
-                    if (R_FAILED(res = moveDir(src, srcDir + d->item(i), dst, dstDir + d->item(i))))
-                    {
-                        dst.deleteDir(dest);
-                        return res;
-                    }
-                }
-                else
-                {
-                    if (R_FAILED(
-                            res = moveFile(src, srcDir + d->item(i), dst, dstDir + d->item(i))))
-                    {
-                        dst.deleteDir(dest);
-                        return res;
-                    }
-                }
-            }
-        }
-        else
-        {
-            dst.deleteDir(dest);
-            return src.result();
-        }
 
         res = src.deleteDir(dir);
 
-        if (res == (long)0xC82044BE || res == (long)0xC82044B9)
+        if (alreadyExists(res))
         {
             return 0;
         }
@@ -255,52 +365,19 @@ Result Archive::moveDir(
     }
 }
 
-Result Archive::copyDir(
-    Archive& src, const std::u16string& dir, Archive& dst, const std::u16string& dest)
+Result Archive::copyDir(Archive& src, const std::u16string& dir, Archive& dst,
+    const std::u16string& dest, const TreeCopy::Options& options)
 {
-    Result res;
-    dst.deleteDir(dest);
-    if (R_FAILED(res = dst.createDir(dest, 0)) && res != (long)0xC82044BE &&
-        res != (long)0xC82044B9)
-    {
-        return res;
-    }
-    auto d                = src.directory(dir);
-    std::u16string srcDir = dir.back() == u'/' ? dir : dir + u'/';
-    std::u16string dstDir = dest.back() == u'/' ? dest : dest + u'/';
-    if (d)
-    {
-        for (size_t i = 0; i < d->count(); i++)
-        {
-            if (d->folder(i))
-            {
-                if (R_FAILED(res = copyDir(src, srcDir + d->item(i), dst, dstDir + d->item(i))))
-                {
-                    dst.deleteDir(dest);
-                    return res;
-                }
-            }
-            else
-            {
-                if (R_FAILED(res = copyFile(src, srcDir + d->item(i), dst, dstDir + d->item(i))))
-                {
-                    dst.deleteDir(dest);
-                    return res;
-                }
-            }
-        }
-    }
-    else
+    if (!TreeCopy::resumable(options.manifestPath))
     {
         dst.deleteDir(dest);
-        return src.result();
     }
 
-    if (res == (long)0xC82044BE || res == (long)0xC82044B9)
+    Result res = TreeCopy::run(treeBackend(src, dir, dst, dest), options);
+    if (R_FAILED(res) && options.manifestPath.empty())
     {
-        return 0;
+        dst.deleteDir(dest);
     }
-
     return res;
 }
 
@@ -330,24 +407,9 @@ Result Archive::moveFile(Archive& src, FS_Path file, Archive& dst, FS_Path dest)
             auto out   = dst.file(dest, FS_OPEN_WRITE);
             if (out)
             {
-                size_t written = 0;
-                u8* data       = new u8[MOVE_BUFFER_SIZE];
-                while (written < target)
-                {
-                    stream->read(data, std::min(MOVE_BUFFER_SIZE, target - written));
-                    if (R_FAILED(res = stream->result()))
-                    {
-                        break;
-                    }
-                    written += out->write(data, std::min(MOVE_BUFFER_SIZE, target - written));
-                    if (R_FAILED(res = out->result()))
-                    {
-                        break;
-                    }
-                }
+                res = copyContents(*stream, *out, target);
                 stream->close();
                 out->close();
-                delete[] data;
                 if (R_SUCCEEDED(res))
                 {
                     src.deleteFile(file);
@@ -371,85 +433,49 @@ Result Archive::moveFile(Archive& src, FS_Path file, Archive& dst, FS_Path dest)
 
 Result Archive::copyFile(Archive& src, FS_Path file, Archive& dst, FS_Path dest)
 {
-    Result res  = 0;
-    auto stream = src.file(file, FS_OPEN_READ);
-    if (stream)
-    {
-        u64 target = stream->size();
-        dst.deleteFile(dest);
-        dst.createFile(dest, 0, target);
-        auto out = dst.file(dest, FS_OPEN_WRITE);
-        if (out)
-        {
-            size_t written = 0;
-            u8* data       = new u8[MOVE_BUFFER_SIZE];
-            while (written < target)
-            {
-                stream->read(data, std::min(MOVE_BUFFER_SIZE, target - written));
-                if (R_FAILED(res = stream->result()))
-                {
-                    break;
-                }
-                written += out->write(data, std::min(MOVE_BUFFER_SIZE, target - written));
-                if (R_FAILED(res = out->result()))
-                {
-                    break;
-                }
-            }
-            stream->close();
-            out->close();
-            delete[] data;
-        }
-        else
-        {
-            res = dst.result();
-            stream->close();
-        }
-    }
-    else
-    {
-        res = src.result();
-    }
-
-    if (R_FAILED(res))
-    {
-        dst.deleteFile(dest);
-    }
-    return res;
+    return copyFileWithProgress(src, file, dst, dest, nullptr);
 }
 
 Result Archive::createFile(FS_Path file, u32 attributes, u64 size)
 {
     if (mPXI)
     {
-        return mResult = FSPXI_CreateFile(fspxiHandle, mHandle, file, attributes, size);
+        return FSPXI_CreateFile(fspxiHandle, mHandle, file, attributes, size);
     }
     else
     {
-        return mResult = FSUSER_CreateFile(mHandle, file, attributes, size);
+        return FSUSER_CreateFile(mHandle, file, attributes, size);
     }
 }
 
 std::unique_ptr<File> Archive::file(FS_Path file, u32 flags, u32 attributes)
 {
+    std::unique_ptr<File> ret;
+    mResult = openFile(file, flags, ret, attributes);
+    return ret;
+}
+
+Result Archive::openFile(FS_Path file, u32 flags, std::unique_ptr<File>& out, u32 attributes) const
+{
+    Result res;
+    out = nullptr;
     if (mPXI)
     {
         FSPXI_File f;
-        if (R_SUCCEEDED(
-                mResult = FSPXI_OpenFile(fspxiHandle, &f, mHandle, file, flags, attributes)))
+        if (R_SUCCEEDED(res = FSPXI_OpenFile(fspxiHandle, &f, mHandle, file, flags, attributes)))
         {
-            return std::unique_ptr<File>(new File(f));
+            out = std::unique_ptr<File>(new File(f));
         }
     }
     else
     {
         Handle f;
-        if (R_SUCCEEDED(mResult = FSUSER_OpenFile(&f, mHandle, file, flags, attributes)))
+        if (R_SUCCEEDED(res = FSUSER_OpenFile(&f, mHandle, file, flags, attributes)))
         {
-            return std::unique_ptr<File>(new File(f));
+            out = std::unique_ptr<File>(new File(f));
         }
     }
-    return nullptr;
+    return res;
 }
 
 Result Archive::deleteFile(FS_Path file)
@@ -478,23 +504,32 @@ Result Archive::createDir(FS_Path file, u32 attributes)
 
 std::unique_ptr<Directory> Archive::directory(FS_Path dir)
 {
+    std::unique_ptr<Directory> ret;
+    mResult = openDirectory(dir, ret);
+    return ret;
+}
+
+Result Archive::openDirectory(FS_Path dir, std::unique_ptr<Directory>& out) const
+{
+    Result res;
+    out = nullptr;
     if (mPXI)
     {
         FSPXI_Directory d;
-        if (R_SUCCEEDED(mResult = FSPXI_OpenDirectory(fspxiHandle, &d, mHandle, dir)))
+        if (R_SUCCEEDED(res = FSPXI_OpenDirectory(fspxiHandle, &d, mHandle, dir)))
         {
-            return std::unique_ptr<Directory>(new Directory(d));
+            out = std::unique_ptr<Directory>(new Directory(d));
         }
     }
     else
     {
         Handle d;
-        if (R_SUCCEEDED(mResult = FSUSER_OpenDirectory(&d, mHandle, dir)))
+        if (R_SUCCEEDED(res = FSUSER_OpenDirectory(&d, mHandle, dir)))
         {
-            return std::unique_ptr<Directory>(new Directory(d));
+            out = std::unique_ptr<Directory>(new Directory(d));
         }
     }
-    return nullptr;
+    return res;
 }
 
 Result Archive::deleteDir(const std::u16string& dir)
@@ -612,9 +647,13 @@ Result Archive::init(const std::string& execPath)
     mkdir("/3ds/PKSM/assets", 777);
     mkdir("/3ds/PKSM/backups", 777);
     mkdir("/3ds/PKSM/backups/bridge", 777);
+    mkdir("/3ds/PKSM/backups/banks", 777);
+    mkdir("/3ds/PKSM/cache", 777);
+    mkdir("/3ds/PKSM/cache/http", 777);
     mkdir("/3ds/PKSM/defaults", 777);
     mkdir("/3ds/PKSM/dumps", 777);
     mkdir("/3ds/PKSM/banks", 777);
+    mkdir("/3ds/PKSM/bankdata", 777);
     mkdir("/3ds/PKSM/songs", 777);
     mkdir("/3ds/PKSM/mysterygift", 777);
     Archive::data().createDir(fsMakePath(PATH_UTF16, u"/banks"), 0);
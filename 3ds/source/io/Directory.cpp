@@ -105,6 +105,11 @@ bool Directory::folder(size_t index) const
     return index < list.size() ? list[index].attributes == FS_ATTRIBUTE_DIRECTORY : false;
 }
 
+u64 Directory::size(size_t index) const
+{
+    return index < list.size() ? list[index].fileSize : 0;
+}
+
 size_t Directory::count(void) const
 {
     return list.size();
@@ -26,6 +26,7 @@
 
 #include "File.hpp"
 #include "internal_fspxi.hpp"
+#include <algorithm>
 #include <array>
 
 File::File(Handle handle) : mHandle(handle), mOffset(0)
@@ -40,14 +41,21 @@ File::File(FSPXI_File handle) : mHandle(handle), mOffset(0)
 
 Result File::close(void)
 {
+    Result res = flush();
     switch (mHandle.index())
     {
         case 0:
-            return mResult = FSFILE_Close(std::get<0>(mHandle));
+            mResult = FSFILE_Close(std::get<0>(mHandle));
+            break;
         case 1:
-            return mResult = FSPXI_CloseFile(fspxiHandle, std::get<1>(mHandle));
+            mResult = FSPXI_CloseFile(fspxiHandle, std::get<1>(mHandle));
+            break;
     }
-    return -1; // Cannot happen
+    if (R_FAILED(res))
+    {
+        mResult = res;
+    }
+    return mResult;
 }
 
 Result File::result(void) const
@@ -62,43 +70,73 @@ u64 File::size(void) const
 
 u32 File::read(void* buf, u32 sz)
 {
-    u32 rd = 0;
+    u32 rd  = 0;
+    mResult = readAt(mOffset, buf, sz, &rd);
+    mOffset += rd;
+    return rd;
+}
+
+u32 File::write(const void* buf, u32 sz)
+{
+    u32 wt  = 0;
+    mResult = writeAt(mOffset, buf, sz, &wt);
+    mOffset += wt;
+    return wt;
+}
+
+Result File::readAt(u64 offset, void* buf, u32 sz, u32* done) const
+{
+    u32 rd     = 0;
+    Result res = -1;
     switch (mHandle.index())
     {
         case 0:
-            mResult = FSFILE_Read(std::get<0>(mHandle), &rd, mOffset, buf, sz);
+            res = FSFILE_Read(std::get<0>(mHandle), &rd, offset, buf, sz);
             break;
         case 1:
-            mResult = FSPXI_ReadFile(fspxiHandle, std::get<1>(mHandle), &rd, mOffset, buf, sz);
+            res = FSPXI_ReadFile(fspxiHandle, std::get<1>(mHandle), &rd, offset, buf, sz);
             break;
     }
-
-    if (R_FAILED(mResult))
+    if (done)
     {
-        if (rd > sz)
-        {
-            rd = sz;
-        }
+        *done = std::min(rd, sz);
     }
-    mOffset += rd;
-    return rd;
+    return res;
 }
 
-u32 File::write(const void* buf, u32 sz)
+Result File::writeAt(u64 offset, const void* buf, u32 sz, u32* done)
 {
-    u32 wt = 0;
+    u32 wt     = 0;
+    Result res = -1;
     switch (mHandle.index())
     {
         case 0:
-            mResult = FSFILE_Write(std::get<0>(mHandle), &wt, mOffset, buf, sz, FS_WRITE_FLUSH);
+            res = FSFILE_Write(
+                std::get<0>(mHandle), &wt, offset, buf, sz, mFlushOnWrite ? FS_WRITE_FLUSH : 0);
+            if (!mFlushOnWrite)
+            {
+                mUnflushed = true;
+            }
             break;
         case 1:
-            mResult = FSPXI_WriteFile(
-                fspxiHandle, std::get<1>(mHandle), &wt, mOffset, buf, sz, FS_WRITE_FLUSH);
+            res = FSPXI_WriteFile(
+                fspxiHandle, std::get<1>(mHandle), &wt, offset, buf, sz, FS_WRITE_FLUSH);
             break;
     }
-    mOffset += wt;
-    return wt;
+    if (done)
+    {
+        *done = wt;
+    }
+    return res;
+}
+
+Result File::flush(void)
+{
+    if (mHandle.index() == 0 && mUnflushed.exchange(false))
+    {
+        return mResult = FSFILE_Flush(std::get<0>(mHandle));
+    }
+    return 0;
 }
 
 bool File::eof(void) const
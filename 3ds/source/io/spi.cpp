@@ -43,6 +43,7 @@
  */
 
 #include "spi.hpp"
+#include <memory>
 
 u8* fill_buf = NULL;
 
@@ -370,6 +371,81 @@ Result SPIReadSaveData(CardType type, u32 offset, void* data, u32 size)
     return SPIWriteRead(type, cmd, cmdSize, data, size, NULL, 0);
 }
 
+Result SPIUpdateSaveData(CardType type, u32 offset, const void* data, u32 size, u32* pagesWritten)
+{
+    if (pagesWritten)
+    {
+        *pagesWritten = 0;
+    }
+    if (size == 0)
+    {
+        return 0;
+    }
+    u32 pageSize = SPIGetPageSize(type);
+    u32 capacity = SPIGetCapacity(type);
+    if (pageSize == 0 || type == FLASH_8MB || offset >= capacity)
+    {
+        return 0xC8E13404;
+    }
+
+    size = (size <= capacity - offset) ? size : capacity - offset;
+
+    const u8* src = (const u8*)data - offset;
+    u32 end       = offset + size;
+    u32 blockSize = (capacity < SPI_BULK_BLOCK_SIZE) ? capacity : SPI_BULK_BLOCK_SIZE;
+    std::unique_ptr<u8[]> current(new u8[blockSize]);
+
+    for (u32 pos = offset; pos < end;)
+    {
+        // Blocks are aligned to the chip, so pages never straddle two of them
+        u32 blockEnd = ((pos / blockSize) + 1) * blockSize;
+        blockEnd     = (blockEnd < end) ? blockEnd : end;
+
+        Result res = SPIReadSaveData(type, pos, current.get(), blockEnd - pos);
+        if (res)
+        {
+            return res;
+        }
+
+        u32 runStart = blockEnd;
+        for (u32 page = pos; page < blockEnd;)
+        {
+            u32 pageEnd = ((page / pageSize) + 1) * pageSize;
+            pageEnd     = (pageEnd < blockEnd) ? pageEnd : blockEnd;
+
+            bool changed = memcmp(current.get() + (page - pos), src + page, pageEnd - page) != 0;
+            if (changed)
+            {
+                if (runStart == blockEnd)
+                {
+                    runStart = page;
+                }
+                if (pagesWritten)
+                {
+                    ++*pagesWritten;
+                }
+            }
+            // Write out the run of changed pages that just ended
+            if (runStart != blockEnd && (!changed || pageEnd == blockEnd))
+            {
+                u32 runEnd = changed ? pageEnd : page;
+                if ((res = SPIWriteSaveData(
+                         type, runStart, (void*)(src + runStart), runEnd - runStart)))
+                {
+                    return res;
+                }
+                runStart = blockEnd;
+            }
+
+            page = pageEnd;
+        }
+
+        pos = blockEnd;
+    }
+
+    return 0;
+}
+
 Result SPIEraseSector(CardType type, u32 offset)
 {
     u8 cmd[4] = {SPI_FLASH_CMD_SE, (u8)(offset >> 16), (u8)(offset >> 8), (u8)offset};
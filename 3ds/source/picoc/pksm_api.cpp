@@ -2373,13 +2373,14 @@ void pksm_base64_decode(
     char* in     = (char*)Param[2]->Val->Pointer;
     int inSize   = Param[3]->Val->Integer;
 
-    auto data = base64_decode({in, (size_t)inSize});
+    std::span<const u8> data{(const u8*)in, (size_t)inSize};
+    size_t size = base64_decoded_size(data);
 
-    *outSize = data.size();
-    *out     = (u8*)malloc(data.size());
+    *outSize = size;
+    *out     = (u8*)malloc(size);
     if (*out)
     {
-        std::copy(data.begin(), data.end(), *out);
+        base64_decode_into(data, {*out, size});
     }
 }
 
@@ -2391,10 +2392,15 @@ void pksm_base64_encode(
     u8* in       = (u8*)Param[2]->Val->Pointer;
     int inSize   = Param[3]->Val->Integer;
 
-    auto data = base64_encode({in, (size_t)inSize});
+    size_t size = base64_encoded_size(inSize);
 
-    *outSize = data.size();
-    *out     = (char*)strToRet(data);
+    *outSize = size;
+    *out     = (char*)malloc(size + 1);
+    if (*out)
+    {
+        base64_encode_into({in, (size_t)inSize}, {*out, size});
+        (*out)[size] = '\0';
+    }
 }
 
 void fetch_web_content(
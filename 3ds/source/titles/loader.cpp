@@ -35,7 +35,10 @@
 #include "sav/Sav.hpp"
 #include "Title.hpp"
 #include "utils/crypto.hpp"
+#include "utils/future.hpp"
+#include "utils/parallel.hpp"
 #include <3ds.h>
+#include <algorithm>
 #include <atomic>
 #include <format>
 #include <sys/stat.h>
@@ -59,8 +62,6 @@ namespace
         u8 padding4[0x198];  // Get it to the proper size
     };
 
-    std::unordered_map<std::u16string, std::shared_ptr<Directory>> directories;
-
     constexpr char langIds[8] = {
         'E', // USA
         'S', // Spain
@@ -85,7 +86,10 @@ namespace
     };
 
     std::atomic<bool> cartWasUpdated = false;
-    std::atomic_flag continueScan;
+    // Cancelled by exit. Scans check it between titles and save folders
+    Threads::CancellationToken scanCancel;
+    // The title scan running or last run in the background. Only touched from the main thread
+    Threads::Future<void> titleScan;
 
     std::array<u64, 12> vcTitleIds = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
     std::array<u64, 8> ctrTitleIds = {0, 0, 0, 0, 0, 0, 0, 0};
@@ -160,159 +164,85 @@ namespace
         return "main";
     }
 
-    std::string idToSaveName(std::u16string_view id)
-    {
-        if (id.size() == 3 || id.size() == 4)
-        {
-            if (id.substr(0, 3) == u"ADA")
-            {
-                return "POKEMON D.sav";
-            }
-            if (id.substr(0, 3) == u"APA")
-            {
-                return "POKEMON P.sav";
-            }
-            if (id.substr(0, 3) == u"CPU")
-            {
-                return "POKEMON PL.sav";
-            }
-            if (id.substr(0, 3) == u"IPK")
-            {
-                return "POKEMON HG.sav";
-            }
-            if (id.substr(0, 3) == u"IPG")
-            {
-                return "POKEMON SS.sav";
-            }
-            if (id.substr(0, 3) == u"IRB")
-            {
-                return "POKEMON B.sav";
-            }
-            if (id.substr(0, 3) == u"IRA")
-            {
-                return "POKEMON W.sav";
-            }
-            if (id.substr(0, 3) == u"IRE")
-            {
-                return "POKEMON B2.sav";
-            }
-            if (id.substr(0, 3) == u"IRD")
-            {
-                return "POKEMON W2.sav";
-            }
-        }
-        for (size_t i = 0; i < 7; i++)
-        {
-            const auto& tid          = vcTitleIds[i];
-            std::u16string chkPrefix = Title::tidToCheckpointPrefix<std::u16string>(tid);
-            if (chkPrefix == id)
-            {
-                return "sav.dat";
-            }
-        }
-        for (size_t i = 7; i < vcTitleIds.size(); i++)
-        {
-            const auto& tid          = vcTitleIds[i];
-            std::u16string chkPrefix = Title::tidToCheckpointPrefix<std::u16string>(tid);
-            if (chkPrefix == id)
-            {
-                return "00000001.sav";
-            }
-        }
-        return "main";
-    }
-
     bool saveIsFile;
     std::string saveFileName;
     std::shared_ptr<Title> loadedTitle;
 
-    std::vector<std::string> scanDirectoryFor(const std::u16string& dir, const std::u16string& id)
+    // A game folder in a save root, looked into for one ID's saves
+    struct SaveProbe
     {
-        if (directories.count(dir) == 0)
-        {
-            std::shared_ptr<Directory> d = Archive::sd().directory(dir);
-            if (d && d->loaded())
-            {
-                directories.emplace(dir, d);
-            }
-            else
-            {
-                return {};
-            }
-        }
-        else
+        std::string id;
+        std::u16string folder;
+        std::vector<std::string> saves;
+    };
+
+    // A folder that Checkpoint-style game folders are kept in
+    struct SaveRoot
+    {
+        std::u16string path;
+        std::vector<std::u16string> folders;
+        std::vector<SaveProbe> probes;
+    };
+
+    SaveRoot listSaveRoot(const std::u16string& path)
+    {
+        SaveRoot ret{path, {}, {}};
+        std::unique_ptr<Directory> directory = Archive::sd().directory(path);
+        if (directory && directory->loaded())
         {
-            // Attempt to re-read directory
-            if (!directories[dir]->loaded())
+            for (size_t i = 0; i < directory->count(); i++)
             {
-                std::shared_ptr<Directory> d = Archive::sd().directory(dir);
-                if (d && d->loaded())
+                if (directory->folder(i))
                 {
-                    directories[dir] = d;
-                }
-                else
-                {
-                    return {};
+                    ret.folders.emplace_back(directory->item(i));
                 }
             }
         }
-        std::vector<std::string> ret;
-        auto& directory = directories[dir];
-        if (directory->loaded())
+        return ret;
+    }
+
+    // Safe to run on several threads at once, as it doesn't touch the archive's recorded result
+    void probeSaveFolder(const std::u16string& root, SaveProbe& probe)
+    {
+        std::u16string folderPath = root + u"/" + probe.folder;
+        std::string saveName      = idToSaveName(probe.id);
+        std::unique_ptr<Directory> subdir;
+        if (R_SUCCEEDED(Archive::sd().openDirectory(folderPath, subdir)) && subdir->loaded())
         {
-            for (size_t j = 0; j < directory->count(); j++)
+            for (size_t k = 0; k < subdir->count(); k++)
             {
-                if (directory->folder(j))
+                if (subdir->folder(k))
                 {
-                    std::u16string fileName = directory->item(j);
-                    if (fileName.substr(0, id.size()) == id)
+                    std::string savePath =
+                        StringUtils::UTF16toUTF8(folderPath + u"/" + subdir->item(k) + u"/") +
+                        saveName;
+                    if (io::exists(savePath))
                     {
-                        auto subdir = Archive::sd().directory(dir + u"/" + fileName);
-                        if (subdir && subdir->loaded())
-                        {
-                            for (size_t k = 0; k < subdir->count(); k++)
-                            {
-                                if (subdir->folder(k))
-                                {
-                                    std::string savePath =
-                                        StringUtils::UTF16toUTF8(
-                                            dir + u"/" + fileName + u"/" + subdir->item(k) + u"/") +
-                                        idToSaveName(id);
-                                    if (io::exists(savePath))
-                                    {
-                                        ret.emplace_back(savePath);
-                                    }
-                                }
-                            }
-                        }
+                        probe.saves.emplace_back(savePath);
                     }
                 }
             }
         }
-        return ret;
     }
 
-    std::vector<std::string> scanDirectoryFor(const std::u16string& dir, const std::string& id)
-    {
-        return scanDirectoryFor(dir, StringUtils::UTF8toUTF16(id));
-    }
+    // Large enough to hash the biggest GBA save (1 Mbit) in two reads
+    constexpr u32 GBA_HASH_BLOCK_SIZE = 0x10000;
+
+    // Hashes from this far into a header up to the end of the save that follows it
+    constexpr u32 GBA_HASH_START = 0x30;
 
     // file must be at header address. On return, will be at the end of the save described by the
-    // header.
-    std::array<u8, 32> calcGbaSaveSHA256(File& file, const GbaHeader& header)
+    // header. block must hold GBA_HASH_BLOCK_SIZE bytes, and is reused between calls.
+    std::array<u8, 32> calcGbaSaveSHA256(File& file, const GbaHeader& header, u8* block)
     {
-        static constexpr size_t READBLOCK_SIZE = 0x1000;
-
         pksm::crypto::SHA256 context;
-        file.seek(0x30, SEEK_CUR);
-        size_t sha_end_idx              = header.saveSize + 0x200 - 0x30;
-        std::unique_ptr<u8[]> readblock = std::unique_ptr<u8[]>(new u8[READBLOCK_SIZE]);
-        size_t read                     = 0;
-        for (size_t i = 0; i < sha_end_idx; i += read)
+        file.seek(GBA_HASH_START, SEEK_CUR);
+        size_t sha_end_idx = header.saveSize + sizeof(GbaHeader) - GBA_HASH_START;
+        for (size_t i = 0; i < sha_end_idx; i += GBA_HASH_BLOCK_SIZE)
         {
-            size_t readSize = std::min(sha_end_idx - i, READBLOCK_SIZE);
-            read            = file.read(readblock.get(), readSize);
-            context.update({readblock.get(), readSize});
+            u32 readSize = std::min<size_t>(sha_end_idx - i, GBA_HASH_BLOCK_SIZE);
+            file.read(block, readSize);
+            context.update({block, readSize});
         }
 
         return context.finish();
@@ -321,31 +251,79 @@ namespace
     // Who the hell came up with this shit? Nintendo, please fire whatever employee thought this
     // was a good idea CMAC = AES-CMAC(SHA256("CTR-SIGN" + titleID + SHA256("CTR-SAV0" +
     // SHA256(0x30..0x200 + the entire save itself)))) FSPXI_CalcSavegameMAC does the AES-CMAC,
-    // CTR-SIGN, and the CTR-SAV0 step
-    std::array<u8, 0x10> calcGbaCMAC(
-        const File& file, const GbaHeader& header, const std::array<u8, 32> hashData)
+    // CTR-SIGN, and the CTR-SAV0 step. It's asked until two answers in a row agree. On failure,
+    // cmac is zeroed, which never matches a stored CMAC.
+    Result calcGbaCMAC(
+        const File& file, const std::array<u8, 32>& hashData, std::array<u8, 0x10>& cmac)
+    {
+        Result res = FSPXI_CalcSavegameMAC(fspxiHandle, std::get<1>(file.getRawHandle()),
+            hashData.data(), hashData.size(), cmac.data(), cmac.size());
+        for (int tries = 1; R_SUCCEEDED(res) && tries < 10; tries++)
+        {
+            std::array<u8, 0x10> prev = cmac;
+
+            res = FSPXI_CalcSavegameMAC(fspxiHandle, std::get<1>(file.getRawHandle()),
+                hashData.data(), hashData.size(), cmac.data(), cmac.size());
+            if (R_SUCCEEDED(res) && prev == cmac)
+            {
+                return res;
+            }
+        }
+
+        cmac.fill(0);
+        return R_FAILED(res) ? res : -1;
+    }
+
+    // Writes a header with an updated CMAC and the save after it at offset. The hash is taken
+    // from what's about to be written rather than read back, so the save is only touched once,
+    // and nothing is written unless the CMAC could be worked out. Whatever part of the slot the
+    // save doesn't cover is still read from the file.
+    Result writeGbaSlot(File& out, u64 offset, GbaHeader& header, pksm::Sav& sav)
     {
-        std::array<u8, 0x10> prev;
-        std::array<u8, 0x10> ret;
+        if (sav.getLength() <= sav.getEntireLengthIncludingFooter() - 8)
+        {
+            std::copy_n(sav.rawData().get() + sav.getLength(), 8, header.arm7Registers);
+        }
+
+        pksm::crypto::SHA256 context;
+        context.update({reinterpret_cast<const u8*>(&header) + GBA_HASH_START,
+            sizeof(GbaHeader) - GBA_HASH_START});
 
-        int tries = 10;
-        Result res;
-        do
+        size_t hashed = std::min<size_t>(sav.getLength(), header.saveSize);
+        context.update({sav.rawData().get(), hashed});
+        if (hashed < header.saveSize)
         {
-            --tries;
-            prev = ret;
-            res  = FSPXI_CalcSavegameMAC(fspxiHandle, std::get<1>(file.getRawHandle()),
-                 hashData.data(), hashData.size(), ret.data(), ret.size());
+            std::unique_ptr<u8[]> block(new u8[GBA_HASH_BLOCK_SIZE]);
+            while (hashed < header.saveSize)
+            {
+                u32 readSize = std::min<size_t>(header.saveSize - hashed, GBA_HASH_BLOCK_SIZE);
+                out.readAt(offset + sizeof(GbaHeader) + hashed, block.get(), readSize);
+                context.update({block.get(), readSize});
+                hashed += readSize;
+            }
         }
-        while (R_SUCCEEDED(res) && prev != ret && tries > 0);
 
-        return ret;
+        // The CMAC comes before the hashed part of the header, so it can go in before writing
+        std::array<u8, 16> cmac;
+        Result res = calcGbaCMAC(out, context.finish(), cmac);
+        if (R_FAILED(res))
+        {
+            out.close();
+            return res;
+        }
+        std::copy(cmac.begin(), cmac.end(), header.cmac);
+
+        out.seek(offset, SEEK_SET);
+        out.write(&header, sizeof(GbaHeader));
+        out.write(sav.rawData().get(), sav.getLength());
+        out.close();
+        return out.result();
     }
 }
 
 void TitleLoader::init(void)
 {
-    continueScan.test_and_set();
+    scanCancel = Threads::CancellationToken{};
 
     reloadTitleIds();
 }
@@ -382,7 +360,7 @@ void TitleLoader::scanTitles(void)
     ctrTitles.lock()->clear();
     vcTitles.lock()->clear();
 
-    if (continueScan.test())
+    if (!scanCancel.cancelled())
     {
         scanCard();
     }
@@ -393,7 +371,7 @@ void TitleLoader::scanTitles(void)
 
     // get title count
     res = AM_GetTitleCount(MEDIATYPE_SD, &count);
-    if (R_FAILED(res) || !continueScan.test())
+    if (R_FAILED(res) || scanCancel.cancelled())
     {
         return;
     }
@@ -402,14 +380,14 @@ void TitleLoader::scanTitles(void)
     std::vector<u64> ids(count);
     u64* p = ids.data();
     res    = AM_GetTitleList(NULL, MEDIATYPE_SD, count, p);
-    if (R_FAILED(res) || !continueScan.test())
+    if (R_FAILED(res) || scanCancel.cancelled())
     {
         return;
     }
 
     for (const u64& id : ctrTitleIds)
     {
-        if (continueScan.test())
+        if (!scanCancel.cancelled())
         {
             if (std::find(ids.begin(), ids.end(), id) != ids.end())
             {
@@ -428,7 +406,7 @@ void TitleLoader::scanTitles(void)
 
     for (const u64& id : vcTitleIds)
     {
-        if (continueScan.test())
+        if (!scanCancel.cancelled())
         {
             if (std::find(ids.begin(), ids.end(), id) != ids.end())
             {
@@ -448,80 +426,133 @@ void TitleLoader::scanTitles(void)
     // Titles are already sorted by GameVersion
 }
 
+void TitleLoader::scanTitlesAsync(void)
+{
+    // One scan at a time, since each one starts by clearing the lists the last one filled
+    if (titleScan.valid())
+    {
+        titleScan = titleScan.then(scanTitles);
+    }
+    else
+    {
+        titleScan = Threads::async(scanCancel, scanTitles);
+    }
+}
+
 void TitleLoader::scanSaves(void)
 {
     Gui::waitFrame(i18n::localize("SCAN_SAVES"));
-    auto scan = [](auto& tids)
+
+    // The same ID can come up more than once if title IDs are configured to overlap
+    std::vector<std::string> ids;
+    auto addId = [&ids](std::string id)
+    {
+        if (std::find(ids.begin(), ids.end(), id) == ids.end())
+        {
+            ids.emplace_back(std::move(id));
+        }
+    };
+    auto addTitleIds = [&addId](const auto& tids)
     {
         for (const auto& tid : tids)
         {
-            if (!continueScan.test())
-            {
-                return;
-            }
-            std::string id                 = std::format("0x{:05X}", ((u32)tid) >> 8);
-            std::vector<std::string> saves = scanDirectoryFor(u"/3ds/Checkpoint/saves", id);
-            if (Configuration::getInstance().showBackups())
+            addId(std::format("0x{:05X}", ((u32)tid) >> 8));
+        }
+    };
+    addTitleIds(vcTitleIds);
+    addTitleIds(ctrTitleIds);
+    addTitleIds(nxTitleIds);
+    for (size_t game = 0; game < 9; game++)
+    {
+        for (size_t lang = 0; lang < 8; lang++)
+        {
+            addId(std::string(dsIds[game]) + langIds[lang]);
+        }
+    }
+
+    std::vector<std::u16string> rootPaths = {u"/3ds/Checkpoint/saves"};
+    if (Configuration::getInstance().showBackups())
+    {
+        rootPaths.emplace_back(u"/3ds/PKSM/backups");
+    }
+
+    std::vector<SaveRoot> roots;
+    // Indices into roots and their probes of the folders that have to be looked into
+    std::vector<std::pair<size_t, size_t>> pending;
+    for (const auto& rootPath : rootPaths)
+    {
+        if (scanCancel.cancelled())
+        {
+            return;
+        }
+        SaveRoot& root = roots.emplace_back(listSaveRoot(rootPath));
+
+        // Each root is listed once; IDs are then matched against its folders' name prefixes
+        std::unordered_map<std::u16string, std::vector<size_t>> index;
+        for (size_t i = 0; i < root.folders.size(); i++)
+        {
+            for (size_t length : {size_t(4), size_t(7)})
             {
-                std::vector<std::string> moreSaves = scanDirectoryFor(u"/3ds/PKSM/backups", id);
-                saves.insert(saves.end(), moreSaves.begin(), moreSaves.end());
+                if (root.folders[i].size() >= length)
+                {
+                    index[root.folders[i].substr(0, length)].emplace_back(i);
+                }
             }
-            if (!continueScan.test())
+        }
+
+        for (const auto& id : ids)
+        {
+            auto found = index.find(StringUtils::UTF8toUTF16(id));
+            if (found == index.end())
             {
-                return;
+                continue;
             }
-            auto extraSaves = Configuration::getInstance().extraSaves(id);
-            if (!extraSaves.empty())
+            for (size_t folder : found->second)
             {
-                for (const auto& save : extraSaves)
-                {
-                    if (io::exists(save))
-                    {
-                        saves.emplace_back(save);
-                    }
-                }
+                root.probes.emplace_back(SaveProbe{id, root.folders[folder], {}});
+                pending.emplace_back(roots.size() - 1, root.probes.size() - 1);
             }
-            sdSaves.lock().get()[id] = std::move(saves);
         }
-    };
+    }
 
+    Threads::parallelFor(0, pending.size(), 1,
+        [&roots, &pending](size_t i)
+        {
+            if (!scanCancel.cancelled())
+            {
+                SaveRoot& root = roots[pending[i].first];
+                probeSaveFolder(root.path, root.probes[pending[i].second]);
+            }
+        });
+    if (scanCancel.cancelled())
     {
-        sdSaves.lock()->clear();
+        return;
     }
 
-    scan(vcTitleIds);
-    scan(ctrTitleIds);
-    scan(nxTitleIds);
-
-    for (size_t game = 0; game < 9; game++)
+    std::unordered_map<std::string, std::vector<std::string>> found;
+    for (const auto& id : ids)
     {
-        for (size_t lang = 0; lang < 8; lang++)
+        std::vector<std::string>& saves = found[id];
+        for (const auto& root : roots)
         {
-            if (!continueScan.test())
+            for (const auto& probe : root.probes)
             {
-                return;
-            }
-            std::string id                 = std::string(dsIds[game]) + langIds[lang];
-            std::vector<std::string> saves = scanDirectoryFor(u"/3ds/Checkpoint/saves", id);
-            if (Configuration::getInstance().showBackups())
-            {
-                std::vector<std::string> moreSaves = scanDirectoryFor(u"/3ds/PKSM/backups", id);
-                saves.insert(saves.end(), moreSaves.begin(), moreSaves.end());
-            }
-            auto extraSaves = Configuration::getInstance().extraSaves(id);
-            if (!extraSaves.empty())
-            {
-                for (const auto& save : extraSaves)
+                if (probe.id == id)
                 {
-                    if (io::exists(save))
-                    {
-                        saves.emplace_back(save);
-                    }
+                    saves.insert(saves.end(), probe.saves.begin(), probe.saves.end());
                 }
             }
-            sdSaves.lock().get()[id] = std::move(saves);
+        }
+
+        for (const auto& save : Configuration::getInstance().extraSaves(id))
+        {
+            if (io::exists(save))
+            {
+                saves.emplace_back(save);
+            }
         }
     }
+    sdSaves.lock().get() = std::move(found);
 }
 
 void TitleLoader::backupSave(const std::string& id)
@@ -600,6 +631,7 @@ bool TitleLoader::load(const std::shared_ptr<Title>& title)
                     0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
                     0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
                 std::unique_ptr<GbaHeader> header1 = std::make_unique<GbaHeader>();
+                std::unique_ptr<u8[]> block(new u8[GBA_HASH_BLOCK_SIZE]);
                 in->read(header1.get(), sizeof(GbaHeader));
                 // Save uninitialized; we'd get garbage that probably goes out of bounds
                 if (!memcmp(header1.get(), ZEROS, sizeof(ZEROS)))
@@ -639,8 +671,9 @@ bool TitleLoader::load(const std::shared_ptr<Title>& title)
                     {
                         // Seek back to the beginning of this header
                         in->seek(-0x200, SEEK_CUR);
-                        std::array<u8, 32> hash = calcGbaSaveSHA256(*in, *header1);
-                        std::array<u8, 16> cmac = calcGbaCMAC(*in, *header1, hash);
+                        std::array<u8, 32> hash = calcGbaSaveSHA256(*in, *header1, block.get());
+                        std::array<u8, 16> cmac;
+                        calcGbaCMAC(*in, hash, cmac);
                         bool invalid = (bool)memcmp(cmac.data(), header1->cmac, cmac.size());
 
                         if (invalid)
@@ -676,14 +709,15 @@ bool TitleLoader::load(const std::shared_ptr<Title>& title)
 
                     // Check the first CMAC
                     in->seek(0, SEEK_SET);
-                    std::array<u8, 32> hash = calcGbaSaveSHA256(*in, *header1);
-                    std::array<u8, 16> cmac = calcGbaCMAC(*in, *header1, hash);
-                    bool firstInvalid       = (bool)memcmp(cmac.data(), header1->cmac, cmac.size());
+                    std::array<u8, 32> hash = calcGbaSaveSHA256(*in, *header1, block.get());
+                    std::array<u8, 16> cmac;
+                    calcGbaCMAC(*in, hash, cmac);
+                    bool firstInvalid = (bool)memcmp(cmac.data(), header1->cmac, cmac.size());
 
                     // Check the second CMAC
                     in->seek(sizeof(GbaHeader) + header1->saveSize, SEEK_SET);
-                    hash               = calcGbaSaveSHA256(*in, *header2);
-                    cmac               = calcGbaCMAC(*in, *header2, hash);
+                    hash = calcGbaSaveSHA256(*in, *header2, block.get());
+                    calcGbaCMAC(*in, hash, cmac);
                     bool secondInvalid = (bool)memcmp(cmac.data(), header2->cmac, cmac.size());
 
                     if (firstInvalid)
@@ -787,7 +821,7 @@ bool TitleLoader::load(const std::shared_ptr<Title>& title)
         }
 
         std::shared_ptr<u8[]> data = std::shared_ptr<u8[]>(new u8[cap]);
-        u32 sectorSize             = (cap < 0x10000) ? cap : 0x10000;
+        u32 sectorSize             = (cap < SPI_BULK_BLOCK_SIZE) ? cap : SPI_BULK_BLOCK_SIZE;
 
         for (u32 i = 0; i < cap / sectorSize; ++i)
         {
@@ -910,17 +944,19 @@ void TitleLoader::saveToTitle(bool ask)
             }
             else
             {
-                res          = 0;
-                u32 pageSize = SPIGetPageSize(title->SPICardType());
-                for (u32 i = 0; i < save->getLength() / pageSize; ++i)
+                res = 0;
+                // Pages that already hold the right data are left alone, which is most of them
+                // after a typical edit
+                for (u32 pos = 0; pos < save->getLength(); pos += SPI_BULK_BLOCK_SIZE)
                 {
-                    res = SPIWriteSaveData(title->SPICardType(), pageSize * i,
-                        &save->rawData()[pageSize * i], pageSize);
+                    u32 size = std::min<u32>(SPI_BULK_BLOCK_SIZE, save->getLength() - pos);
+                    res      = SPIUpdateSaveData(
+                        title->SPICardType(), pos, &save->rawData()[pos], size, nullptr);
                     if (R_FAILED(res))
                     {
                         break;
                     }
-                    Gui::showRestoreProgress((pageSize * (i + 1)) / 1024, save->getLength() / 1024);
+                    Gui::showRestoreProgress((pos + size) / 1024, save->getLength() / 1024);
                 }
             }
         }
@@ -959,6 +995,7 @@ void TitleLoader::saveToTitle(bool ask)
 
                         if (out)
                         {
+                            res = 0;
                             if (title->gba())
                             {
                                 static constexpr u8 ZEROS[0x20]   = {0};
@@ -1002,27 +1039,9 @@ void TitleLoader::saveToTitle(bool ask)
                                         {
                                             // Doesn't matter whether this CMAC is valid or not. We
                                             // just need to update it
-                                            out->seek(0, SEEK_SET);
                                             // Increment save count
                                             header1->savesMade++;
-                                            if (save->getLength() <=
-                                                save->getEntireLengthIncludingFooter() - 8)
-                                            {
-                                                std::copy_n(
-                                                    save->rawData().get() + save->getLength(), 8,
-                                                    header1->arm7Registers);
-                                            }
-                                            out->write(header1.get(), sizeof(GbaHeader));
-                                            out->write(save->rawData().get(), save->getLength());
-
-                                            out->seek(0, SEEK_SET);
-                                            std::array<u8, 32> hash =
-                                                calcGbaSaveSHA256(*out, *header1);
-                                            std::array<u8, 16> cmac =
-                                                calcGbaCMAC(*out, *header1, hash);
-                                            out->seek(offsetof(GbaHeader, cmac), SEEK_SET);
-                                            out->write(cmac.data(), cmac.size());
-                                            out->close();
+                                            res = writeGbaSlot(*out, 0, *header1, *save);
                                         }
                                     }
                                     // Otherwise, compare the top and bottom save counts. If we
@@ -1032,20 +1051,23 @@ void TitleLoader::saveToTitle(bool ask)
                                     {
                                         std::unique_ptr<GbaHeader> header2 =
                                             std::make_unique<GbaHeader>();
+                                        std::unique_ptr<u8[]> block(new u8[GBA_HASH_BLOCK_SIZE]);
                                         out->seek(header1->saveSize, SEEK_CUR);
                                         out->read(header2.get(), sizeof(GbaHeader));
 
                                         // Check the first CMAC
                                         out->seek(0, SEEK_SET);
-                                        std::array<u8, 32> hash = calcGbaSaveSHA256(*out, *header1);
-                                        std::array<u8, 16> cmac = calcGbaCMAC(*out, *header1, hash);
+                                        std::array<u8, 32> hash =
+                                            calcGbaSaveSHA256(*out, *header1, block.get());
+                                        std::array<u8, 16> cmac;
+                                        calcGbaCMAC(*out, hash, cmac);
                                         bool firstInvalid =
                                             (bool)memcmp(cmac.data(), header1->cmac, cmac.size());
 
                                         // Check the second CMAC
                                         out->seek(sizeof(GbaHeader) + header1->saveSize, SEEK_SET);
-                                        hash = calcGbaSaveSHA256(*out, *header2);
-                                        cmac = calcGbaCMAC(*out, *header2, hash);
+                                        hash = calcGbaSaveSHA256(*out, *header2, block.get());
+                                        calcGbaCMAC(*out, hash, cmac);
                                         bool secondInvalid =
                                             (bool)memcmp(cmac.data(), header2->cmac, cmac.size());
 
@@ -1055,23 +1077,7 @@ void TitleLoader::saveToTitle(bool ask)
                                             // save number for simplicity; whether or not the second
                                             // save was valid to begin with is immaterial
                                             header1->savesMade = header2->savesMade + 1;
-                                            out->seek(0, SEEK_SET);
-                                            if (save->getLength() <=
-                                                save->getEntireLengthIncludingFooter() - 8)
-                                            {
-                                                std::copy_n(
-                                                    save->rawData().get() + save->getLength(), 8,
-                                                    header1->arm7Registers);
-                                            }
-                                            out->write(header1.get(), sizeof(GbaHeader));
-                                            out->write(save->rawData().get(), save->getLength());
-                                            out->seek(0, SEEK_SET);
-
-                                            hash = calcGbaSaveSHA256(*out, *header1);
-                                            cmac = calcGbaCMAC(*out, *header1, hash);
-                                            out->seek(offsetof(GbaHeader, cmac), SEEK_SET);
-                                            out->write(cmac.data(), cmac.size());
-                                            out->close();
+                                            res = writeGbaSlot(*out, 0, *header1, *save);
                                         }
                                         else
                                         {
@@ -1081,51 +1087,15 @@ void TitleLoader::saveToTitle(bool ask)
                                                 header2->savesMade == header1->savesMade + 1)
                                             {
                                                 header1->savesMade = header2->savesMade + 1;
-                                                out->seek(0, SEEK_SET);
-                                                if (save->getLength() <=
-                                                    save->getEntireLengthIncludingFooter() - 8)
-                                                {
-                                                    std::copy_n(
-                                                        save->rawData().get() + save->getLength(),
-                                                        8, header1->arm7Registers);
-                                                }
-                                                out->write(header1.get(), sizeof(GbaHeader));
-                                                out->write(
-                                                    save->rawData().get(), save->getLength());
-                                                out->seek(0, SEEK_SET);
-
-                                                hash = calcGbaSaveSHA256(*out, *header1);
-                                                cmac = calcGbaCMAC(*out, *header1, hash);
-                                                out->seek(offsetof(GbaHeader, cmac), SEEK_SET);
-                                                out->write(cmac.data(), cmac.size());
-                                                out->close();
+                                                res = writeGbaSlot(*out, 0, *header1, *save);
                                             }
                                             // Otherwise, save over the second save
                                             else
                                             {
-                                                out->seek(sizeof(GbaHeader) + header1->saveSize,
-                                                    SEEK_SET);
                                                 header2->savesMade = header1->savesMade + 1;
-                                                if (save->getLength() <=
-                                                    save->getEntireLengthIncludingFooter() - 8)
-                                                {
-                                                    std::copy_n(
-                                                        save->rawData().get() + save->getLength(),
-                                                        8, header2->arm7Registers);
-                                                }
-                                                out->write(header2.get(), sizeof(GbaHeader));
-                                                out->write(
-                                                    save->rawData().get(), save->getLength());
-                                                out->seek(sizeof(GbaHeader) + header1->saveSize,
-                                                    SEEK_SET);
-
-                                                hash = calcGbaSaveSHA256(*out, *header1);
-                                                cmac = calcGbaCMAC(*out, *header1, hash);
-                                                out->seek(sizeof(GbaHeader) + header1->saveSize +
-                                                              offsetof(GbaHeader, cmac),
-                                                    SEEK_SET);
-                                                out->write(cmac.data(), cmac.size());
-                                                out->close();
+                                                res = writeGbaSlot(*out,
+                                                    sizeof(GbaHeader) + header1->saveSize,
+                                                    *header2, *save);
                                             }
                                         }
                                     }
@@ -1139,6 +1109,13 @@ void TitleLoader::saveToTitle(bool ask)
                             {
                                 out->write(save->rawData().get(), save->getLength());
                             }
+                            if (title->gba() && R_FAILED(res))
+                            {
+                                out->close();
+                                archive.close();
+                                Gui::error(i18n::localize("GBA_CMAC_FAIL"), res);
+                                return;
+                            }
                             if (!title->gba() && R_FAILED(res = archive.commit()))
                             {
                                 out->close();
@@ -1221,6 +1198,59 @@ void TitleLoader::saveChanges()
     save->beginEditing();
 }
 
+void TitleLoader::permuteSaveSlots(const std::vector<int>& order)
+{
+    const pksm::Generation gen = save->generation();
+    const u8 maxPkmInBox =
+        (gen <= pksm::Generation::TWO && save->language() != pksm::Language::JPN) ? 20 : 30;
+
+    // Gen 4 through 7 box slots are fixed size, sit next to each other within a box, and don't
+    // depend on where they're stored, so they can be moved around as raw bytes. Everything else
+    // has to be decoded and encoded again
+    if (gen != pksm::Generation::FOUR && gen != pksm::Generation::FIVE &&
+        gen != pksm::Generation::SIX && gen != pksm::Generation::SEVEN)
+    {
+        std::vector<std::unique_ptr<pksm::PKX>> pkms;
+        pkms.reserve(order.size());
+        for (int slot : order)
+        {
+            pkms.emplace_back(save->pkm(slot / maxPkmInBox, slot % maxPkmInBox));
+        }
+        auto empty = save->emptyPkm();
+        for (int i = 0; i < save->maxSlot(); i++)
+        {
+            save->pkm(size_t(i) < pkms.size() ? *pkms[i] : *empty, i / maxPkmInBox,
+                i % maxPkmInBox, false);
+        }
+        return;
+    }
+
+    const u32 slotSize = save->boxOffset(0, 1) - save->boxOffset(0, 0);
+    u8* data           = save->rawData().get();
+    auto slotData      = [&](int slot) { return data + save->boxOffset(slot / 30, slot % 30); };
+
+    std::vector<u8> moved(order.size() * slotSize);
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        std::copy_n(slotData(order[i]), slotSize, moved.data() + i * slotSize);
+    }
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        std::copy_n(moved.data() + i * slotSize, slotSize, slotData(i));
+    }
+
+    // Only the first empty slot gets encoded; the rest are copies of it
+    const int firstEmpty = order.size();
+    if (firstEmpty < save->maxSlot())
+    {
+        save->pkm(*save->emptyPkm(), firstEmpty / 30, firstEmpty % 30, false);
+        for (int i = firstEmpty + 1; i < save->maxSlot(); i++)
+        {
+            std::copy_n(slotData(firstEmpty), slotSize, slotData(i));
+        }
+    }
+}
+
 std::string TitleLoader::savePath()
 {
     if (saveIsFile)
@@ -1232,7 +1262,12 @@ std::string TitleLoader::savePath()
 
 void TitleLoader::exit()
 {
-    continueScan.clear();
+    scanCancel.cancel();
+    // The lists can't be cleared out from under a scan that's still going
+    if (titleScan.valid())
+    {
+        titleScan.wait();
+    }
     ctrTitles.lock()->clear();
     vcTitles.lock()->clear();
     cardTitle   = nullptr;
@@ -1299,7 +1334,7 @@ bool TitleLoader::scanCard()
                 ret                            = true;
                 CardType spiCardType           = title->SPICardType();
                 u32 saveSize                   = SPIGetCapacity(spiCardType);
-                u32 sectorSize                 = (saveSize < 0x10000) ? saveSize : 0x10000;
+                u32 sectorSize                 = std::min<u32>(saveSize, SPI_BULK_BLOCK_SIZE);
                 std::shared_ptr<u8[]> saveFile = std::shared_ptr<u8[]>(new u8[saveSize]);
                 for (u32 i = 0; i < saveSize / sectorSize; ++i)
                 {
@@ -26,10 +26,12 @@
 
 #include "thread.hpp"
 #include "DataMutex.hpp"
+#include "MPMCQueue.hpp"
 #include "SmallVector.hpp"
 #include <3ds.h>
 #include <algorithm>
 #include <atomic>
+#include <deque>
 #include <vector>
 
 namespace
@@ -95,17 +97,55 @@ namespace
         void* arg;
     };
 
-    DataMutex<std::vector<Task>> workerTasks;
+    // Most tasks go through the lock-free ring. If a burst fills it, the rest spill over into a
+    // locked deque so that executeTask never has to block or drop anything.
+    MPMCQueue<Task, 1024> workerTasks;
+    DataMutex<std::deque<Task>> overflowTasks;
+    std::atomic<u32> overflowCount = 0;
     LightSemaphore moreTasks;
-    std::atomic<u8> numWorkers  = 0;
-    std::atomic<u8> freeWorkers = 0;
-    u8 maxWorkers               = 0;
-    u8 minWorkers               = 0;
+    std::atomic<u8> numWorkers    = 0;
+    std::atomic<u8> freeWorkers   = 0;
+    std::atomic<bool> exitWorkers = false;
+    u8 maxWorkers                 = 0;
+    u8 minWorkers                 = 0;
+    // On a New 3DS every other worker goes on core 2, which is otherwise left idle. Cleared from
+    // whichever thread first fails to use it, while cores() may be reading it anywhere
+    std::atomic<bool> extraCore    = false;
+    std::atomic<u8> workersSpawned = 0;
+
+    void pushTask(const Task& task)
+    {
+        if (!workerTasks.push(task))
+        {
+            overflowTasks.lock()->emplace_back(task);
+            overflowCount++;
+        }
+    }
+
+    bool popTask(Task& task)
+    {
+        if (workerTasks.pop(task))
+        {
+            return true;
+        }
+        if (overflowCount > 0)
+        {
+            auto tasks = overflowTasks.lock();
+            if (!tasks->empty())
+            {
+                task = tasks->front();
+                tasks->pop_front();
+                overflowCount--;
+                return true;
+            }
+        }
+        return false;
+    }
 
     void taskWorkerThread()
     {
         numWorkers++;
-        while (true)
+        while (!exitWorkers)
         {
             if (LightSemaphore_TryAcquire(&moreTasks, 1))
             {
@@ -121,23 +161,15 @@ namespace
                 }
             }
 
-            Task t = std::invoke(
-                []
-                {
-                    auto tasks = workerTasks.lock();
-                    if (tasks->size() == 0)
-                    {
-                        return Task{nullptr, nullptr};
-                    }
-                    else
-                    {
-                        Task ret = tasks.get()[0];
-                        tasks->erase(tasks->begin());
-                        return ret;
-                    }
-                });
+            // Holding a semaphore count means a task has been queued, but its producer may still
+            // be in the middle of writing it. Give it the core instead of spinning.
+            Task t{};
+            while (!exitWorkers && !popTask(t))
+            {
+                svcSleepThread(1000);
+            }
 
-            if (!t.entrypoint)
+            if (exitWorkers)
             {
                 break;
             }
@@ -146,6 +178,43 @@ namespace
         }
         numWorkers--;
     }
+
+    bool createThread(void (*entrypoint)(void*), void* arg, size_t stackSize, int processor)
+    {
+        auto lockedThreads = threads.lock();
+        if (lockedThreads->first.size() >= Threads::MAX_THREADS)
+        {
+            return false;
+        }
+        s32 prio = 0;
+        svcGetThreadPriority(&prio, CUR_THREAD_HANDLE);
+        Thread thread = threadCreate(entrypoint, arg, stackSize, prio - 1, processor, false);
+
+        if (thread)
+        {
+            lockedThreads->first.emplace_back(thread);
+            lockedThreads->second.emplace_back(threadGetHandle(thread));
+            svcSignalEvent(lockedThreads->second[1]);
+            return true;
+        }
+
+        return false;
+    }
+
+    bool spawnWorker()
+    {
+        auto func = Threads::internal::getFuncAndArg(taskWorkerThread);
+        if (extraCore && workersSpawned++ % 2 == 1)
+        {
+            if (createThread(func.first, func.second, Threads::WORKER_STACK, 2))
+            {
+                return true;
+            }
+            // Not allowed to use it after all
+            extraCore = false;
+        }
+        return createThread(func.first, func.second, Threads::WORKER_STACK, -2);
+    }
 }
 
 bool Threads::init(u8 min, u8 max)
@@ -174,10 +243,13 @@ bool Threads::init(u8 min, u8 max)
         return false;
     }
 
+    bool isNew3DS = false;
+    APT_CheckNew3DS(&isNew3DS);
+    extraCore = isNew3DS;
     LightSemaphore_Init(&moreTasks, 0, 10000);
     for (int i = 0; i < minWorkers; i++)
     {
-        if (!Threads::create(WORKER_STACK, taskWorkerThread))
+        if (!spawnWorker())
         {
             return false;
         }
@@ -187,40 +259,30 @@ bool Threads::init(u8 min, u8 max)
 
 bool Threads::create(void (*entrypoint)(void*), void* arg, std::optional<size_t> stackSize)
 {
-    auto lockedThreads = threads.lock();
-    if (lockedThreads->first.size() >= Threads::MAX_THREADS)
-    {
-        return false;
-    }
-    s32 prio = 0;
-    svcGetThreadPriority(&prio, CUR_THREAD_HANDLE);
-    Thread thread =
-        threadCreate(entrypoint, arg, stackSize.value_or(DEFAULT_STACK), prio - 1, -2, false);
-
-    if (thread)
-    {
-        lockedThreads->first.emplace_back(thread);
-        lockedThreads->second.emplace_back(threadGetHandle(thread));
-        svcSignalEvent(lockedThreads->second[1]);
-        return true;
-    }
-
-    return false;
+    return createThread(entrypoint, arg, stackSize.value_or(DEFAULT_STACK), -2);
 }
 
 void Threads::executeTask(void (*task)(void*), void* arg)
 {
-    workerTasks.lock()->emplace_back(task, arg);
+    pushTask(Task{task, arg});
     LightSemaphore_Release(&moreTasks, 1);
     if (numWorkers < maxWorkers && freeWorkers == 0)
     {
-        Threads::create(WORKER_STACK, taskWorkerThread);
+        spawnWorker();
     }
 }
 
+u8 Threads::cores()
+{
+    return extraCore ? 2 : 1;
+}
+
 void Threads::exit(void)
 {
-    workerTasks.lock()->clear();
+    exitWorkers = true;
+    workerTasks.clear();
+    overflowTasks.lock()->clear();
+    overflowCount = 0;
     LightSemaphore_Release(&moreTasks, numWorkers);
     svcSignalEvent(threads.lock()->second[0]);
     threadJoin(reaperThread, U64_MAX);
@@ -31,42 +31,129 @@
 #include "nlohmann/json_fwd.hpp"
 #include "pkx/PKX.hpp"
 #include "utils/crypto.hpp"
+#include <optional>
+#include <unordered_map>
+#include <unordered_set>
+
+class File;
 
 class Bank
 {
 public:
+    // One record per slot of a bank's search index, which lives next to the bank as a .idx file
+    struct IndexEntry
+    {
+        u16 species;
+        u16 form;
+        u16 TID;
+        u16 SID;
+        u8 level;
+        u8 ivTotal;
+        u8 flags;
+        u8 padding;
+        u32 otNameHash;
+    };
+
+    static_assert(sizeof(IndexEntry) == 16);
+
+    static constexpr u8 INDEX_PRESENT = 1 << 0;
+    static constexpr u8 INDEX_SHINY   = 1 << 1;
+    // Number of backups kept of each bank, newest first
+    static constexpr int BACKUP_GENERATIONS = 5;
+
     Bank(const std::string& name, int maxBoxes);
-    ~Bank();
     std::unique_ptr<pksm::PKX> pkm(int box, int slot) const;
+    // Shared, read-only view of a slot for drawing. Decoded once and kept until the slot is written
+    std::shared_ptr<const pksm::PKX> pkmView(int box, int slot) const;
     void pkm(const pksm::PKX& pkm, int box, int slot);
+    // Moves raw entries around without decoding them: slot i ends up with what was in slot
+    // order[i], and every slot past the end of order is emptied. Saves the bank, box by box
+    bool permute(const std::vector<int>& order);
     void resize(int boxes);
     void load(int maxBoxes);
     bool save() const;
     bool saveWithoutBackup() const;
+    // Backups are kept as the last BACKUP_GENERATIONS states of the bank on disk. Boxes are stored
+    // as blocks named by their hash, so a box that's the same across backups is only stored once
     bool backup() const;
+    bool restoreBackup(int generation);
     std::string boxName(int box) const;
     std::pair<std::string, std::string> paths() const;
+    static std::pair<std::string, std::string> paths(const std::string& bankName);
+    std::string journalPath() const;
+    static std::string journalPath(const std::string& bankName);
+    std::string indexPath() const;
+    static std::string indexPath(const std::string& bankName);
+    // Reads a bank's search index without loading the bank. Empty if it's missing or out of date
+    static std::vector<IndexEntry> readIndex(const std::string& bankName, int boxes);
+    static u32 otNameHash(const std::string& otName);
+    bool rebuildIndex() const;
+    // Writes the index of a bank as of its last save from its files alone, without loading it
+    static bool buildIndex(const std::string& bankName, int boxes);
     void boxName(const std::string& name, int box);
     bool hasChanged() const;
     int boxes() const;
+    int occupiedSlots(int box) const;
     const std::string& name() const;
     bool setName(const std::string& name);
 
 private:
-    static constexpr int BANK_VERSION            = 3;
-    static constexpr std::string_view BANK_MAGIC = "PKSMBANK";
+    static constexpr int BANK_VERSION               = 4;
+    static constexpr std::string_view BANK_MAGIC    = "PKSMBANK";
+    static constexpr int JOURNAL_VERSION            = 1;
+    static constexpr std::string_view JOURNAL_MAGIC = "PKSMJRNL";
+    static constexpr int INDEX_VERSION              = 1;
+    static constexpr std::string_view INDEX_MAGIC   = "PKSMBIDX";
+    static constexpr int BACKUP_VERSION             = 2;
+    static constexpr std::string_view BACKUP_MAGIC  = "PKSMBBAK";
+    // Maximum number of records a journal can hold before it gets folded back into the bank
+    static constexpr u32 JOURNAL_CAPACITY = 256;
+    // Boxes kept in memory at once, not counting ones with unsaved changes
+    static constexpr u32 MAX_RESIDENT_BOXES = 8;
+    // Boxes read and written at once when converting a bank from an older version
+    static constexpr int CONVERT_BOXES = 8;
     void createJSON();
     void createBank(int maxBoxes);
     void convertFromBankBin();
+    void resetDirtyState() const;
+    std::array<u8, 32> boxHash(int box) const;
+    void replayJournal();
+    bool backupBeforeSave() const;
+    // Saves the bank, with order applied as permute describes if there is one
+    bool writeBank(const std::vector<int>* order) const;
+    bool saveFull(const std::vector<int>* order) const;
+    bool saveJournal() const;
+    bool compactJournal() const;
+    bool saveJSON() const;
+    bool updateIndex() const;
+    static bool indexUsable(
+        const std::string& bankName, int boxes, std::vector<IndexEntry>* entries);
+    // Box hashes of a backup generation, or nothing if there isn't a valid one. Checksums get the
+    // checksum of each box as it was backed up, if the generation has them
+    std::vector<std::array<u8, 32>> readBackup(
+        int generation, std::string* jsonData, std::vector<u32>* checksums) const;
+    // Marks boxes that are still as the newest backup has them, so the next backup can skip them
+    void seedSavedHashes() const;
+    std::string backupPath() const;
+    std::string backupPath(int generation) const;
+    std::string blockPath(const std::array<u8, 32>& hash) const;
+    void resetResidency() const;
+    void evictBoxes() const;
 
+    // A journal is only replayed over the bank file whose header names its epoch, so one left
+    // behind by a rewrite that didn't finish can't be applied to a newer bank
     struct BankHeader
     {
         char MAGIC[8];
         u32 version;
         u32 boxes;
+        u32 journalEpoch;
+        u8 padding[4];
     };
 
-    static_assert(sizeof(BankHeader) == 16);
+    static_assert(sizeof(BankHeader) == 24);
+    // Version 3 and older headers end after the box count
+    static constexpr u32 LEGACY_HEADER_SIZE = 16;
 
     struct BankEntry
     {
@@ -76,13 +163,118 @@ private:
     };
 
     static_assert(sizeof(BankEntry) == 0x150);
+
+    // Version 4 banks have one of these per box between the bank header and the entries
+    struct BoxHeader
+    {
+        u32 occupied;
+        u32 checksum;
+    };
+
+    static_assert(sizeof(BoxHeader) == 8);
+
+    struct JournalHeader
+    {
+        char MAGIC[8];
+        u32 version;
+        u32 boxes;
+        u32 epoch;
+        u8 padding[4];
+    };
+
+    static_assert(sizeof(JournalHeader) == 24);
+
+    // Records are only ever appended. The epoch ties a record to the journal it was written for,
+    // so anything left over from a previous journal is ignored on replay
+    struct JournalRecord
+    {
+        u32 index;
+        u32 epoch;
+        u32 checksum;
+        u8 padding[4];
+        BankEntry entry;
+    };
+
+    static_assert(sizeof(JournalRecord) == 0x160);
+
+    // The index is only trusted when its header says it was completely written
+    struct IndexHeader
+    {
+        char MAGIC[8];
+        u32 version;
+        u32 boxes;
+        u32 complete;
+        u8 padding[4];
+    };
+
+    static_assert(sizeof(IndexHeader) == 24);
+
+    // Followed by the hash of every box, the checksum of every box and then the box names. Version
+    // 1 doesn't have the checksums
+    struct BackupHeader
+    {
+        char MAGIC[8];
+        u32 version;
+        u32 boxes;
+        u32 jsonSize;
+        u8 padding[4];
+    };
+
+    static_assert(sizeof(BackupHeader) == 24);
+
+    static u32 journalChecksum(const JournalRecord& record);
+    // Number of records read into overlay, or nothing if the journal doesn't belong to the bank
+    static std::optional<u32> readJournal(const std::string& bankName, int boxes, u32 epoch,
+        std::unordered_map<int, BankEntry>& overlay);
+
+    // Pointer to a box's 30 entries, reading the box in from the bank file if it isn't resident
+    BankEntry* boxEntries(int box) const;
+    BankEntry* makeResident(int box) const;
+    // False if the box couldn't be read back intact, in which case out is left empty
+    bool readBox(File* in, int box, BankEntry* out) const;
+    // What a permutation puts in a box. False if an entry couldn't be read from the bank file
+    bool gatherBox(File* in, const std::vector<int>& order, int box, BankEntry* out) const;
+    // Retries unedited boxes that couldn't be read, and warns if any are still unreadable
+    bool boxesReadable() const;
+    static std::unique_ptr<pksm::PKX> decode(BankEntry& entry);
+    static IndexEntry indexEntry(BankEntry& entry);
+    static BoxHeader boxHeader(const BankEntry* entries);
+    // Offset of an entry in the bank file as it currently is on disk
+    size_t entryOffset(int index) const;
+    static void readLegacyBox(File& in, size_t entrySize, BankEntry* out);
+    bool convertBank(File& in, u32 dataOffset, size_t entrySize, const std::string& outPath);
+
     std::unique_ptr<nlohmann::json> boxNames;
-    mutable std::array<u8, 32> prevHash;
-    mutable std::array<u8, 32> prevNameHash;
     std::string bankName;
     BankHeader header;
-    BankEntry* entries      = nullptr;
-    mutable bool needsCheck = false;
+    // Boxes currently in memory, null for ones that only live in the bank file
+    mutable std::vector<std::unique_ptr<BankEntry[]>> residentBoxes;
+    mutable std::vector<u32> boxLastUse;
+    // Box headers of the bank file on disk, which may have fewer boxes than the bank after a resize
+    mutable std::vector<BoxHeader> boxHeaders;
+    // Decoded slots of resident boxes, dropped along with the box they belong to
+    mutable std::unordered_map<int, std::array<std::shared_ptr<const pksm::PKX>, 30>> decodedBoxes;
+    // Latest version of every slot that has been journaled but not yet written to the bank file
+    mutable std::unordered_map<int, BankEntry> journalOverlay;
+    // Boxes shown empty because they couldn't be read. Saving would write that over their contents
+    mutable std::unordered_set<int> unreadableBoxes;
+    // Slots changed since the last save
+    mutable std::vector<bool> dirtySlots;
+    // Hashes of boxes as they are on disk, where known, so backups can skip unchanged boxes
+    mutable std::vector<std::optional<std::array<u8, 32>>> savedBoxHashes;
+    // Hashes of boxes and names as they were before they were first changed since the last save
+    mutable std::unordered_map<int, std::array<u8, 32>> cleanBoxHashes;
+    mutable std::array<u8, 32> cleanNameHash;
+    mutable u32 dirtyCount     = 0;
+    mutable u32 journalCount   = 0;
+    mutable u32 residentCount  = 0;
+    mutable u32 useCounter     = 0;
+    mutable bool namesDirty    = false;
+    mutable bool needsFullSave = false;
+    mutable bool backedByFile  = false;
+    mutable bool indexStale    = true;
+    // Epoch of the journal the bank file on disk names, or zero if it has none
+    mutable u32 journalEpoch = 0;
 };
 
 #endif
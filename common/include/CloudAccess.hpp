@@ -27,10 +27,9 @@
 #ifndef CLOUDACCESS_HPP
 #define CLOUDACCESS_HPP
 
+#include "CloudPageCache.hpp"
 #include "enums/Generation.hpp"
-#include "nlohmann/json_fwd.hpp"
 #include "pkx/PKX.hpp"
-#include <atomic>
 #include <memory>
 #include <optional>
 
@@ -43,7 +42,12 @@ public:
         POPULAR
     };
 
-    CloudAccess();
+    // Number of pages on each side of the current one that are downloaded ahead of time
+    static constexpr int DEFAULT_PREFETCH = 2;
+
+    explicit CloudAccess(int prefetch = DEFAULT_PREFETCH);
+    // Shared with the page; use pkm for a copy that can be changed
+    std::shared_ptr<const pksm::PKX> pkmView(size_t slot) const;
     std::unique_ptr<pksm::PKX> pkm(size_t slot) const;
     bool isLegal(size_t slot) const;
     // Gets the Pokémon and increments the server-side download counter
@@ -92,31 +96,41 @@ public:
     void filterToGen(pksm::Generation g);
     void removeGenFilter();
 
-    bool good() const { return isGood; }
+    int prefetchPages() const { return prefetch; }
+
+    void prefetchPages(int pages);
+
+    // Finishes moving to a page once it has downloaded. Call once per frame.
+    void update();
+
+    // The first page and pages reached by changing sort or filter settings load in the background
+    bool loading() const { return !current->downloaded.ready(); }
+
+    bool good() const { return current->downloaded.ready() && current->data != nullptr; }
 
     int currentPageError() const { return current->siteJsonErrorCode; }
 
     static std::pair<std::string, std::string> makeURL(int page, SortType type, bool ascend,
         bool legal, pksm::Generation low, pksm::Generation high, bool LGPE);
-    nlohmann::json grabPage(int page);
 
 private:
-    struct Page
-    {
-        ~Page();
-        std::unique_ptr<nlohmann::json> data;
-        std::atomic<bool> available        = false;
-        std::atomic<int> siteJsonErrorCode = 0;
-    };
+    using Page = CloudPageCache::Page;
 
     void refreshPages();
-    static void downloadCloudPage(std::shared_ptr<Page> page, int number, SortType type,
-        bool ascend, bool legal, pksm::Generation low, pksm::Generation high, bool LGPE);
-    static bool pageIsGood(const nlohmann::json& json);
-    std::shared_ptr<Page> current, next, prev;
+    std::optional<int> changePage(int number);
+    // Packs the sort and filter settings into a cache key
+    u32 query() const;
+    static void readPage(Page& page, const std::string& json);
+    static Threads::Future<void> downloadCloudPage(std::shared_ptr<Page> page, int number,
+        SortType type, bool ascend, bool legal, pksm::Generation low, pksm::Generation high,
+        bool LGPE);
+    CloudPageCache cache;
+    std::shared_ptr<Page> current;
     int pageNumber;
+    int prefetch;
+    // Whether update() has handled the current page since it arrived
+    bool settled             = false;
     SortType sort            = LATEST;
-    bool isGood              = false;
     bool ascend              = true;
     bool legal               = false;
     pksm::Generation lowGen  = pksm::Generation::ONE;
@@ -0,0 +1,88 @@
+/*
+ *   This file is part of PKSM
+ *   Copyright (C) 2016-2022 Bernardo Giordano, Admiral Fish, piepie62
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *   Additional Terms 7.b and 7.c of GPLv3 apply to this file:
+ *       * Requiring preservation of specified reasonable legal notices or
+ *         author attributions in that material or in the Appropriate Legal
+ *         Notices displayed by works containing it.
+ *       * Prohibiting misrepresentation of the origin of that material,
+ *         or requiring that modified versions of such material be marked in
+ *         reasonable ways as different from the original version.
+ */
+
+#ifndef CLOUDPAGE_HPP
+#define CLOUDPAGE_HPP
+
+#include "enums/Generation.hpp"
+#include "pkx/PKX.hpp"
+#include "utils/coretypes.h"
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// One page of GPSS search results, decoded from the site's JSON with a SAX pass so that no DOM is
+// ever built. Pokémon data is base64-decoded while the document is being read, and turned into a
+// PKX the first time it's looked at.
+struct CloudPage
+{
+    enum class Layout
+    {
+        POKEMON, // api/v2/gpss/search/pokemon
+        BUNDLES  // api/v2/gpss/search/bundles
+    };
+
+    struct Pokemon
+    {
+        std::vector<u8> data;
+        // Download code; used to bump the server-side download counter
+        std::string code;
+        pksm::Generation gen = pksm::Generation::UNUSED;
+        bool legal           = false;
+
+        // Decoded once and kept with the page, so that drawing and filtering a page that has
+        // already been seen doesn't allocate. Never null: undecodable data gives an empty PK7.
+        std::shared_ptr<const pksm::PKX> view() const;
+
+    private:
+        // Only touched from the UI thread, after the page has finished downloading
+        mutable std::shared_ptr<const pksm::PKX> decoded;
+    };
+
+    struct Group
+    {
+        std::string code;
+        std::vector<Pokemon> pokemon;
+    };
+
+    int total = 0;
+    int pages = 0;
+    // Filled for Layout::POKEMON
+    std::vector<Pokemon> pokemon;
+    // Filled for Layout::BUNDLES
+    std::vector<Group> groups;
+
+    // Returns nullptr if the document is malformed or missing required fields. In that case,
+    // errorCode receives the site's error code if the document carried one, and is left untouched
+    // otherwise.
+    static std::unique_ptr<CloudPage> parse(std::string_view json, Layout layout, int& errorCode);
+
+    // Stands in for empty and undecodable slots
+    static const std::shared_ptr<const pksm::PKX>& emptyPkm();
+};
+
+#endif
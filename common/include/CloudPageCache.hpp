@@ -0,0 +1,88 @@
+/*
+ *   This file is part of PKSM
+ *   Copyright (C) 2016-2022 Bernardo Giordano, Admiral Fish, piepie62
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *   Additional Terms 7.b and 7.c of GPLv3 apply to this file:
+ *       * Requiring preservation of specified reasonable legal notices or
+ *         author attributions in that material or in the Appropriate Legal
+ *         Notices displayed by works containing it.
+ *       * Prohibiting misrepresentation of the origin of that material,
+ *         or requiring that modified versions of such material be marked in
+ *         reasonable ways as different from the original version.
+ */
+
+#ifndef CLOUDPAGECACHE_HPP
+#define CLOUDPAGECACHE_HPP
+
+#include "CloudPage.hpp"
+#include "utils/coretypes.h"
+#include "utils/future.hpp"
+#include <atomic>
+#include <functional>
+#include <list>
+#include <memory>
+
+// Least-recently-used cache of GPSS pages. A page is identified by its number and a query value
+// that the owner packs its sort and filter settings into, so going back to earlier settings finds
+// the pages that were already downloaded for them. Only meant to be used from one thread; the
+// pages themselves are filled in by the fetch thread.
+class CloudPageCache
+{
+public:
+    struct Page
+    {
+        std::unique_ptr<CloudPage> data;
+        std::atomic<int> siteJsonErrorCode = 0;
+        // Ready once the download has finished, whether or not it succeeded
+        Threads::Future<void> downloaded;
+    };
+
+    // Starts downloading the given page number into the given Page, using the owner's current
+    // settings. Returns a future that becomes ready once done, whether or not it succeeded.
+    using Loader = std::function<Threads::Future<void>(std::shared_ptr<Page> page, int number)>;
+
+    static constexpr size_t DEFAULT_CAPACITY = 12;
+
+    explicit CloudPageCache(Loader loader, size_t capacity = DEFAULT_CAPACITY);
+
+    // Returns the cached page, or starts downloading it. A page whose download failed is
+    // downloaded again.
+    std::shared_ptr<Page> get(u32 query, int number);
+    // Makes sure the pages up to radius away from number, wrapping around, are cached or on their
+    // way. Nearer pages are treated as more recently used than farther ones.
+    void prefetch(u32 query, int number, int pages, int radius);
+    // Forgets every page of a query except keep
+    void invalidate(u32 query, const std::shared_ptr<Page>& keep = nullptr);
+    void clear() { entries.clear(); }
+
+    size_t capacity() const { return maxEntries; }
+    void capacity(size_t entries);
+
+private:
+    struct Entry
+    {
+        u32 query;
+        int number;
+        std::shared_ptr<Page> page;
+    };
+
+    Loader loader;
+    // Most recently used first
+    std::list<Entry> entries;
+    size_t maxEntries;
+};
+
+#endif
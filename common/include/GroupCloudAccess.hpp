@@ -27,10 +27,9 @@
 #ifndef GROUPCLOUDACCESS_HPP
 #define GROUPCLOUDACCESS_HPP
 
+#include "CloudPageCache.hpp"
 #include "enums/Generation.hpp"
-#include "nlohmann/json_fwd.hpp"
 #include "pkx/PKX.hpp"
-#include <atomic>
 #include <memory>
 #include <optional>
 
@@ -38,10 +37,15 @@ class GroupCloudAccess
 {
 public:
     static constexpr int NUM_GROUPS = 5;
-    GroupCloudAccess();
+    // Number of pages on each side of the current one that are downloaded ahead of time
+    static constexpr int DEFAULT_PREFETCH = 2;
+
+    explicit GroupCloudAccess(int prefetch = DEFAULT_PREFETCH);
     std::vector<std::unique_ptr<pksm::PKX>> group(size_t groupIndex) const;
     std::vector<std::unique_ptr<pksm::PKX>> fetchGroup(size_t groupIndex) const;
     long group(std::vector<std::unique_ptr<pksm::PKX>> pokemon);
+    // Shared with the page; use pkm for a copy that can be changed
+    std::shared_ptr<const pksm::PKX> pkmView(size_t groupIndex, size_t pkm) const;
     std::unique_ptr<pksm::PKX> pkm(size_t groupIndex, size_t pkm) const;
     std::unique_ptr<pksm::PKX> fetchPkm(size_t groupIndex, size_t pkm) const;
     bool isLegal(size_t groupIndex, size_t pkm) const;
@@ -64,31 +68,40 @@ public:
         }
     }
 
-    bool good() const { return isGood; }
+    int prefetchPages() const { return prefetch; }
+
+    void prefetchPages(int pages);
+
+    // Finishes moving to a page once it has downloaded. Call once per frame.
+    void update();
+
+    // The first page and pages reached by changing filter settings load in the background
+    bool loading() const { return !current->downloaded.ready(); }
+
+    bool good() const { return current->downloaded.ready() && current->data != nullptr; }
 
     int currentPageError() const { return current->siteJsonErrorCode; }
 
-    nlohmann::json grabPage(int page);
     static std::pair<std::string, std::string> makeURL(
         int page, bool legal, pksm::Generation low, pksm::Generation high, bool LGPE);
 
 private:
-    struct Page
-    {
-        ~Page();
-        std::unique_ptr<nlohmann::json> data;
-        std::atomic<bool> available        = false;
-        std::atomic<int> siteJsonErrorCode = 0;
-    };
+    using Page = CloudPageCache::Page;
 
     void refreshPages();
-    static void downloadGroupPage(std::shared_ptr<Page> page, int number, bool legal,
-        pksm::Generation low, pksm::Generation high, bool LGPE);
-    static bool pageIsGood(const nlohmann::json& page);
-    std::shared_ptr<Page> current, next, prev;
+    std::optional<int> changePage(int number);
+    // Packs the filter settings into a cache key
+    u32 query() const;
+    static void readPage(Page& page, const std::string& json);
+    static Threads::Future<void> downloadGroupPage(std::shared_ptr<Page> page, int number,
+        bool legal, pksm::Generation low, pksm::Generation high, bool LGPE);
+    CloudPageCache cache;
+    std::shared_ptr<Page> current;
     int pageNumber;
-    bool isGood = false;
-    bool legal  = false;
+    int prefetch;
+    // Whether update() has handled the current page since it arrived
+    bool settled = false;
+    bool legal   = false;
     // Currently not changeable
     pksm::Generation high = pksm::Generation::EIGHT;
     pksm::Generation low  = pksm::Generation::ONE;
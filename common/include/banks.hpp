@@ -39,6 +39,28 @@ class Bank;
 
 namespace Banks
 {
+    // Unset fields match anything
+    struct SearchQuery
+    {
+        std::optional<pksm::Species> species;
+        std::optional<u16> form;
+        std::optional<bool> shiny;
+        std::optional<std::string> otName;
+        std::optional<u16> TID;
+        std::optional<u16> SID;
+        u8 minLevel   = 1;
+        u8 maxLevel   = 100;
+        u8 minIvTotal = 0;
+        u8 maxIvTotal = 186;
+    };
+
+    struct SearchResult
+    {
+        std::string bank;
+        int box;
+        int slot;
+    };
+
     inline std::unique_ptr<Bank> bank = nullptr;
     Result init();
     Result swapSD(bool toSD);
@@ -48,6 +70,8 @@ namespace Banks
     void renameBank(const std::string& oldName, const std::string& newName);
     void setBankSize(const std::string& name, int size);
     std::vector<std::pair<std::string, int>> bankNames();
+    // Searches every bank as of its last save through the banks' indexes, without loading them
+    std::vector<SearchResult> search(const SearchQuery& query);
 }
 
 #endif
@@ -0,0 +1,55 @@
+/*
+ *   This file is part of PKSM
+ *   Copyright (C) 2016-2022 Bernardo Giordano, Admiral Fish, piepie62, Allen Lydiard
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *   Additional Terms 7.b and 7.c of GPLv3 apply to this file:
+ *       * Requiring preservation of specified reasonable legal notices or
+ *         author attributions in that material or in the Appropriate Legal
+ *         Notices displayed by works containing it.
+ *       * Prohibiting misrepresentation of the origin of that material,
+ *         or requiring that modified versions of such material be marked in
+ *         reasonable ways as different from the original version.
+ */
+
+#ifndef CHUNKPIPELINE_HPP
+#define CHUNKPIPELINE_HPP
+
+#include "types.h"
+#include <functional>
+
+// Copies data in fixed-size chunks through a small ring of buffers, reading ahead on a worker
+// thread so that reading chunk N+1 overlaps writing chunk N. What's on either end is up to the
+// caller, so the same code drives FS file handles on the 3DS and plain POSIX files elsewhere. If no
+// worker is free to read ahead, the calling thread does the reading itself, so this is safe to call
+// from worker threads too.
+namespace ChunkPipeline
+{
+    // Fills buffer with size bytes from offset. Calls for different chunks may overlap, though
+    // never two for the same buffer.
+    using ReadFunc = std::function<Result(u64 offset, void* buffer, u32 size)>;
+    // Writes size bytes from buffer at offset. Only called from the calling thread, in order.
+    using WriteFunc = std::function<Result(u64 offset, const void* buffer, u32 size)>;
+
+    inline constexpr u32 DEFAULT_CHUNK_SIZE = 0x10000;
+    inline constexpr size_t DEFAULT_BUFFERS = 2;
+
+    // Copies size bytes, stopping at the first failure of read or write. Returns that failure, or
+    // 0.
+    Result copy(u64 size, const ReadFunc& read, const WriteFunc& write,
+        u32 chunkSize = DEFAULT_CHUNK_SIZE, size_t buffers = DEFAULT_BUFFERS);
+}
+
+#endif
@@ -0,0 +1,76 @@
+/*
+ *   This file is part of PKSM
+ *   Copyright (C) 2016-2022 Bernardo Giordano, Admiral Fish, piepie62, Allen Lydiard
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *   Additional Terms 7.b and 7.c of GPLv3 apply to this file:
+ *       * Requiring preservation of specified reasonable legal notices or
+ *         author attributions in that material or in the Appropriate Legal
+ *         Notices displayed by works containing it.
+ *       * Prohibiting misrepresentation of the origin of that material,
+ *         or requiring that modified versions of such material be marked in
+ *         reasonable ways as different from the original version.
+ */
+
+#ifndef DOWNLOADQUEUE_HPP
+#define DOWNLOADQUEUE_HPP
+
+#include "types.h"
+#include <array>
+#include <functional>
+#include <optional>
+#include <string>
+#include <vector>
+
+// Runs a batch of downloads through Fetch's multi thread, keeping at most maxTransfers of them (and
+// their checksum probes) in flight at once. Files are streamed into "<path>.part" while being
+// hashed and only moved into place once complete, so an interrupted download is picked up again
+// with an HTTP range request the next time it's queued.
+class DownloadQueue
+{
+public:
+    using Hash = std::array<u8, 32>;
+
+    struct Item
+    {
+        std::string url;
+        std::string path;
+        // If set, a file at path with this hash is left alone, and a download that doesn't hash to
+        // it fails
+        std::optional<Hash> sha256 = std::nullopt;
+        // If set, fetched before anything else and its 32-byte body used as sha256
+        std::string checksumUrl = "";
+        // Hash of the file currently at path, if the caller already knows it, so it doesn't have to
+        // be read back
+        std::optional<Hash> localHash = std::nullopt;
+        // Called from the thread in run() after this item was actually downloaded (or failed to),
+        // with the hash of what was received. Not called for items that were already up to date.
+        std::function<void(Result, const Hash&)> onFinish = nullptr;
+    };
+
+    explicit DownloadQueue(size_t maxTransfers = 4) : maxTransfers(maxTransfers) {}
+
+    void add(Item item);
+
+    // Blocks until every item is finished, calling progress(done, total) from this thread whenever
+    // that changes. Returns the first failure, or 0.
+    Result run(const std::function<void(size_t, size_t)>& progress = nullptr);
+
+private:
+    std::vector<Item> items;
+    size_t maxTransfers;
+};
+
+#endif
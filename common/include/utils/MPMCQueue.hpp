@@ -0,0 +1,141 @@
+/*
+ *   This file is part of PKSM
+ *   Copyright (C) 2016-2022 Bernardo Giordano, Admiral Fish, piepie62
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *   Additional Terms 7.b and 7.c of GPLv3 apply to this file:
+ *       * Requiring preservation of specified reasonable legal notices or
+ *         author attributions in that material or in the Appropriate Legal
+ *         Notices displayed by works containing it.
+ *       * Prohibiting misrepresentation of the origin of that material,
+ *         or requiring that modified versions of such material be marked in
+ *         reasonable ways as different from the original version.
+ */
+
+#ifndef MPMCQUEUE_HPP
+#define MPMCQUEUE_HPP
+
+#include "coretypes.h"
+#include <array>
+#include <atomic>
+#include <type_traits>
+
+// Bounded lock-free multi-producer multi-consumer queue. Every cell carries a sequence number
+// that tells producers and consumers whose turn it is, so a push or pop is a single CAS on the
+// shared position plus one store to the cell. Only 32-bit atomics are used, which the ARM11
+// supports natively.
+template <typename T, size_t Capacity>
+    requires std::is_trivially_copyable_v<T> && (Capacity >= 2) &&
+             ((Capacity & (Capacity - 1)) == 0) && (Capacity < (size_t(1) << 31))
+class MPMCQueue
+{
+public:
+    MPMCQueue() noexcept
+    {
+        for (size_t i = 0; i < Capacity; i++)
+        {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    MPMCQueue(const MPMCQueue&)            = delete;
+    MPMCQueue& operator=(const MPMCQueue&) = delete;
+
+    // Returns false if the queue is full
+    bool push(const T& value) noexcept
+    {
+        Cell* cell;
+        u32 pos = enqueuePos.load(std::memory_order_relaxed);
+        while (true)
+        {
+            cell     = &cells[pos & MASK];
+            s32 diff = s32(cell->sequence.load(std::memory_order_acquire) - pos);
+            if (diff == 0)
+            {
+                if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+        cell->data = value;
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Returns false if the queue is empty, or if the oldest push has claimed its cell but not yet
+    // finished writing it
+    bool pop(T& out) noexcept
+    {
+        Cell* cell;
+        u32 pos = dequeuePos.load(std::memory_order_relaxed);
+        while (true)
+        {
+            cell     = &cells[pos & MASK];
+            s32 diff = s32(cell->sequence.load(std::memory_order_acquire) - (pos + 1));
+            if (diff == 0)
+            {
+                if (dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = dequeuePos.load(std::memory_order_relaxed);
+            }
+        }
+        out = cell->data;
+        cell->sequence.store(pos + Capacity, std::memory_order_release);
+        return true;
+    }
+
+    // Drops everything currently queued. Not safe against concurrent pushes.
+    void clear() noexcept
+    {
+        T dummy{};
+        while (pop(dummy)) {}
+    }
+
+private:
+    // ARM11 cache lines are 32 bytes; keep the two positions apart so producers and consumers
+    // don't bounce the same line
+    static constexpr size_t CACHE_LINE = 32;
+    static constexpr u32 MASK          = Capacity - 1;
+
+    struct Cell
+    {
+        std::atomic<u32> sequence;
+        T data;
+    };
+
+    std::array<Cell, Capacity> cells;
+    alignas(CACHE_LINE) std::atomic<u32> enqueuePos = 0;
+    alignas(CACHE_LINE) std::atomic<u32> dequeuePos = 0;
+};
+
+#endif
@@ -0,0 +1,102 @@
+/*
+ *   This file is part of PKSM
+ *   Copyright (C) 2016-2022 Bernardo Giordano, Admiral Fish, piepie62, Allen Lydiard
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *   Additional Terms 7.b and 7.c of GPLv3 apply to this file:
+ *       * Requiring preservation of specified reasonable legal notices or
+ *         author attributions in that material or in the Appropriate Legal
+ *         Notices displayed by works containing it.
+ *       * Prohibiting misrepresentation of the origin of that material,
+ *         or requiring that modified versions of such material be marked in
+ *         reasonable ways as different from the original version.
+ */
+
+#ifndef TREECOPY_HPP
+#define TREECOPY_HPP
+
+#include "types.h"
+#include <functional>
+#include <string>
+#include <vector>
+
+// Copies a directory tree in two passes: the whole tree is listed and its folders created first,
+// then the files are copied several at a time. The ends are reached through a Backend, so the
+// same engine copies between 3DS archives and between host folders.
+namespace TreeCopy
+{
+    struct Entry
+    {
+        // Relative to the root being copied, '/'-separated and without a leading '/'. Backend::list
+        // only fills in the entry's own name; the engine prefixes its folder.
+        std::u16string path;
+        u64 size    = 0;
+        bool folder = false;
+        // Anything that changes whenever the file does, such as its modification time. 0 if the
+        // source can't tell, in which case the file is always copied again when resuming.
+        u64 stamp = 0;
+    };
+
+    struct Progress
+    {
+        u64 bytesDone     = 0;
+        u64 bytesTotal    = 0;
+        size_t filesDone  = 0;
+        size_t filesTotal = 0;
+        // Over what was copied by this run so far; 0 until there's something to go by
+        u64 bytesPerSecond = 0;
+        // At that rate; -1 while unknown
+        s64 secondsLeft = -1;
+    };
+
+    struct Backend
+    {
+        // Appends the contents of a source folder to out
+        std::function<Result(const std::u16string& folder, std::vector<Entry>& out)> list;
+        // Creates a destination folder. One that already exists must not be an error.
+        std::function<Result(const std::u16string& folder)> makeFolder;
+        // Copies one file, replacing whatever is at the destination, and calls progress with the
+        // number of bytes copied so far as it goes. Called for several files at once.
+        std::function<Result(const Entry& file, const std::function<void(u64)>& progress)>
+            copyFile;
+        // Optional, and only used when resuming. Lists a destination folder the way list does a
+        // source one, and removes a destination file or a folder with everything in it, so that
+        // what has left the source since the last run is removed, and what has left the
+        // destination is copied again.
+        std::function<Result(const std::u16string& folder, std::vector<Entry>& out)>
+            listDestination = nullptr;
+        std::function<Result(const Entry& entry)> remove = nullptr;
+    };
+
+    struct Options
+    {
+        // Most files copied at once; the number of cores is also a limit
+        size_t maxParallel = 2;
+        // If set, finished files are recorded there as they're done, and a later run with the same
+        // manifest skips those that haven't changed since. Removed once the copy succeeds.
+        std::string manifestPath = "";
+        // Called from the calling thread only, at most a few times a second and once at the end
+        std::function<void(const Progress&)> progress = nullptr;
+    };
+
+    // Whether run() would pick up an interrupted copy from this manifest
+    bool resumable(const std::string& manifestPath);
+
+    // Returns the first failure, or 0. Stops starting new files after a failure, and leaves what
+    // was already copied in place.
+    Result run(const Backend& backend, const Options& options);
+}
+
+#endif
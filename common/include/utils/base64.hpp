@@ -42,4 +42,22 @@ inline std::vector<u8> base64_decode(const std::string_view& data)
 
 std::string base64_encode(std::span<const u8> data);
 
+// Number of bytes data decodes to, or 0 if its length isn't a multiple of four
+size_t base64_decoded_size(std::span<const u8> data);
+
+constexpr size_t base64_encoded_size(size_t size)
+{
+    return 4 * ((size + 2) / 3);
+}
+
+// Allocation-free versions of the above. They return the number of bytes or characters written,
+// which is 0 if out is too small to hold all of it. Encoding doesn't null-terminate.
+size_t base64_decode_into(std::span<const u8> data, std::span<u8> out);
+size_t base64_encode_into(std::span<const u8> data, std::span<char> out);
+
+inline size_t base64_decode_into(const std::string_view& data, std::span<u8> out)
+{
+    return base64_decode_into(std::span<const u8>{(const u8*)data.data(), data.size()}, out);
+}
+
 #endif
@@ -36,6 +36,7 @@ extern "C" {
 #include <functional>
 #include <memory>
 #include <string>
+#include <type_traits>
 #include <variant>
 #include <vector>
 
@@ -44,16 +45,26 @@ extern "C" {
 class Fetch
 {
 public:
+    // With useCache, a response written to writeData that carries an ETag or Last-Modified header
+    // is kept on the SD card, and the next request for the same URL asks the server whether it
+    // changed. A 304 answer fills writeData from the cache and reports status 200, so callers
+    // don't need to handle it. Callers using it must not replace the write function. Only GETs
+    // are cached: a server answers a conditional POST with 412, not 304, so useCache is ignored
+    // when there is post data.
     [[nodiscard]] static std::shared_ptr<Fetch> init(const std::string& url, bool ssl,
-        std::string* writeData, struct curl_slist* headers, const std::string& postdata);
+        std::string* writeData, struct curl_slist* headers, const std::string& postdata,
+        bool useCache = false);
     static Result download(const std::string& url, const std::string& path,
         const std::string& postData = "", curl_xferinfo_callback progress = nullptr,
         void* progressInfo = nullptr);
 
+    // onComplete runs on a separate completion thread, so it may take its time without holding up
+    // other transfers. It must not wait on another transfer's completion.
     static CURLMcode performAsync(std::shared_ptr<Fetch> fetch,
         std::function<void(CURLcode, std::shared_ptr<Fetch>)> onComplete = nullptr,
         std::function<void(std::shared_ptr<Fetch>)> onCancel             = nullptr);
     static std::variant<CURLMcode, CURLcode> perform(std::shared_ptr<Fetch> fetch);
+    // Doesn't wait: the transfer is removed, and onCancel called, on the multi thread
     static void cancelAsync(std::shared_ptr<Fetch> fetch);
 
     static Result initMulti();
@@ -68,6 +79,14 @@ public:
     template <typename T>
     CURLcode getinfo(CURLINFO info, T outvar)
     {
+        if constexpr (std::is_same_v<T, long*>)
+        {
+            if (info == CURLINFO_RESPONSE_CODE && cache && cache->hit)
+            {
+                *outvar = 200;
+                return CURLE_OK;
+            }
+        }
         return curl_easy_getinfo(curl.get(), info, outvar);
     }
 
@@ -82,7 +101,31 @@ private:
     Fetch& operator=(Fetch&&)      = default;
     std::unique_ptr<CURL, decltype(curl_easy_cleanup)*> curl;
 
+    struct ResponseCache
+    {
+        std::string path;
+        std::string* writeData;
+        // Validators of the response currently being received
+        std::string etag;
+        std::string lastModified;
+        // The caller's headers plus If-None-Match/If-Modified-Since
+        std::unique_ptr<curl_slist, decltype(curl_slist_free_all)*> headers{
+            nullptr, &curl_slist_free_all};
+        bool hadEntry = false;
+        // Whether the response came from the cache
+        bool hit      = false;
+    };
+
+    std::unique_ptr<ResponseCache> cache;
+
+    void setupCache(const std::string& url, std::string* writeData, struct curl_slist* headers);
+    // Runs on the completion thread before the completion callback
+    void finishCache(CURLcode result);
+    static size_t cacheHeaderCallback(char* buffer, size_t size, size_t nitems, void* userdata);
+
     static void multiMainThread();
+    // Runs finishCache and the completion callbacks of finished transfers, in the order they finish
+    static void completionThread();
 };
 
 #endif
@@ -0,0 +1,376 @@
+/*
+ *   This file is part of PKSM
+ *   Copyright (C) 2016-2022 Bernardo Giordano, Admiral Fish, piepie62
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *   Additional Terms 7.b and 7.c of GPLv3 apply to this file:
+ *       * Requiring preservation of specified reasonable legal notices or
+ *         author attributions in that material or in the Appropriate Legal
+ *         Notices displayed by works containing it.
+ *       * Prohibiting misrepresentation of the origin of that material,
+ *         or requiring that modified versions of such material be marked in
+ *         reasonable ways as different from the original version.
+ */
+
+#ifndef FUTURE_HPP
+#define FUTURE_HPP
+
+#include "thread.hpp"
+#include <atomic>
+#include <memory>
+#include <optional>
+#include <type_traits>
+#include <variant>
+#include <vector>
+
+namespace Threads
+{
+    // Shared flag used to ask queued work to stop. Tasks started through async() with a token are
+    // skipped if it's cancelled before they start, and continuations inherit their parent's token.
+    // Long-running tasks can take a copy and poll cancelled() themselves.
+    class CancellationToken
+    {
+    public:
+        CancellationToken() : flag(std::make_shared<std::atomic<bool>>(false)) {}
+
+        void cancel() const { *flag = true; }
+
+        bool cancelled() const { return *flag; }
+
+    private:
+        std::shared_ptr<std::atomic<bool>> flag;
+    };
+
+    template <typename T>
+    class Future;
+
+    namespace internal
+    {
+        template <typename T>
+        using future_value_t = std::conditional_t<std::is_void_v<T>, std::monostate, T>;
+
+        template <typename T>
+        class FutureState
+        {
+        public:
+            explicit FutureState(CancellationToken token) : token(std::move(token)) {}
+
+            template <typename... Args>
+            void setValue(Args&&... args)
+            {
+                value.emplace(std::forward<decltype(args)>(args)...);
+                finish();
+            }
+
+            void setCancelled()
+            {
+                wasCancelled = true;
+                finish();
+            }
+
+            bool ready() const { return stage.load(std::memory_order_acquire) == READY; }
+
+            bool cancelled() const { return ready() && wasCancelled; }
+
+            void wait() const
+            {
+                u8 current;
+                while ((current = stage.load(std::memory_order_acquire)) != READY)
+                {
+                    stage.wait(current, std::memory_order_acquire);
+                }
+            }
+
+            // Runs func once this state is ready: inline on the thread that finishes it, or on a
+            // worker if it's already finished. Only one continuation may be attached.
+            void onReady(std::pair<void (*)(void*), void*> func)
+            {
+                continuation = func;
+                u8 expected  = PENDING;
+                if (!stage.compare_exchange_strong(expected, CONTINUED, std::memory_order_acq_rel))
+                {
+                    executeTask(func.first, func.second);
+                }
+            }
+
+            CancellationToken token;
+            std::optional<future_value_t<T>> value;
+
+        private:
+            static constexpr u8 PENDING   = 0;
+            static constexpr u8 CONTINUED = 1;
+            static constexpr u8 READY     = 2;
+
+            void finish()
+            {
+                u8 previous = stage.exchange(READY, std::memory_order_acq_rel);
+                stage.notify_all();
+                if (previous == CONTINUED)
+                {
+                    continuation.first(continuation.second);
+                }
+            }
+
+            std::atomic<u8> stage                          = PENDING;
+            bool wasCancelled                              = false;
+            std::pair<void (*)(void*), void*> continuation = {nullptr, nullptr};
+        };
+
+        template <typename T, typename Func, typename... Args>
+        void complete(FutureState<T>& state, Func& func, Args&&... args)
+        {
+            if constexpr (std::is_void_v<T>)
+            {
+                std::invoke(func, std::forward<decltype(args)>(args)...);
+                state.setValue();
+            }
+            else
+            {
+                state.setValue(std::invoke(func, std::forward<decltype(args)>(args)...));
+            }
+        }
+
+        template <typename T, typename Func>
+        struct then_result
+        {
+            using type = std::invoke_result_t<Func&, T&&>;
+        };
+
+        template <typename Func>
+        struct then_result<void, Func>
+        {
+            using type = std::invoke_result_t<Func&>;
+        };
+
+        template <typename T, typename Func>
+        using then_result_t = typename then_result<T, Func>::type;
+    } // namespace internal
+
+    template <typename T>
+    class Future
+    {
+    public:
+        using value_type = T;
+
+        Future() = default;
+
+        explicit Future(std::shared_ptr<internal::FutureState<T>> state) : state(std::move(state))
+        {
+        }
+
+        Future(Future&&)            = default;
+        Future& operator=(Future&&) = default;
+
+        Future(const Future&)            = delete;
+        Future& operator=(const Future&) = delete;
+
+        bool valid() const { return state != nullptr; }
+
+        // True once the task has either produced a value or been cancelled
+        bool ready() const { return state->ready(); }
+
+        bool cancelled() const { return state->cancelled(); }
+
+        void wait() const { state->wait(); }
+
+        void cancel() const { state->token.cancel(); }
+
+        const CancellationToken& token() const { return state->token; }
+
+        // Waits for the value and moves it out, leaving this future invalid. Must not be called if
+        // the task was cancelled.
+        T get()
+        {
+            state->wait();
+            std::shared_ptr<internal::FutureState<T>> done = std::move(state);
+            if constexpr (!std::is_void_v<T>)
+            {
+                return std::move(*done->value);
+            }
+        }
+
+        // Queues func to run with this future's value once it's ready and returns a future for its
+        // result. Consumes this future. If this future is cancelled, so is the returned one.
+        template <typename Func>
+        Future<internal::then_result_t<T, std::decay_t<Func>>> then(Func&& func)
+        {
+            using result_type = internal::then_result_t<T, std::decay_t<Func>>;
+            auto next   = std::make_shared<internal::FutureState<result_type>>(state->token);
+            auto parent = std::move(state);
+            parent->onReady(internal::getFuncAndArg(
+                +[](std::shared_ptr<internal::FutureState<T>> parent,
+                     std::shared_ptr<internal::FutureState<result_type>> next,
+                     std::decay_t<Func> func)
+                {
+                    if (parent->cancelled() || next->token.cancelled())
+                    {
+                        next->setCancelled();
+                    }
+                    else if constexpr (std::is_void_v<T>)
+                    {
+                        internal::complete(*next, func);
+                    }
+                    else
+                    {
+                        internal::complete(*next, func, std::move(*parent->value));
+                    }
+                },
+                parent, next, std::decay_t<Func>(std::forward<decltype(func)>(func))));
+            return Future<result_type>(std::move(next));
+        }
+
+    private:
+        template <typename U>
+        friend Future<std::conditional_t<std::is_void_v<U>, void, std::vector<U>>> when_all(
+            std::vector<Future<U>> futures);
+
+        std::shared_ptr<internal::FutureState<T>> state;
+    };
+
+    // The producing end of a future, for work that completes outside of async(), like a download
+    // finishing on the fetch thread. Copies share one state, so a promise can be captured by value.
+    template <typename T>
+    class Promise
+    {
+    public:
+        Promise() : state(std::make_shared<internal::FutureState<T>>(CancellationToken{})) {}
+
+        // Only take one future from a promise; a state has a single continuation
+        Future<T> future() const { return Future<T>(state); }
+
+        template <typename... Args>
+        void setValue(Args&&... args) const
+        {
+            state->setValue(std::forward<decltype(args)>(args)...);
+        }
+
+        void setCancelled() const { state->setCancelled(); }
+
+    private:
+        std::shared_ptr<internal::FutureState<T>> state;
+    };
+
+    // Runs entrypoint(args...) on a worker thread and returns a future for its result. The task is
+    // skipped, and the future marked cancelled, if token is cancelled before it starts.
+    template <typename EPFunc, typename... Args>
+    Future<std::invoke_result_t<std::decay_t<EPFunc>&, std::decay_t<Args>&...>> async(
+        const CancellationToken& token, EPFunc&& entrypoint, Args&&... args)
+    {
+        using result_type = std::invoke_result_t<std::decay_t<EPFunc>&, std::decay_t<Args>&...>;
+        auto state        = std::make_shared<internal::FutureState<result_type>>(token);
+        executeTask(
+            +[](std::shared_ptr<internal::FutureState<result_type>> state,
+                 std::decay_t<EPFunc> func, std::decay_t<Args>... args)
+            {
+                if (state->token.cancelled())
+                {
+                    state->setCancelled();
+                }
+                else
+                {
+                    internal::complete(*state, func, args...);
+                }
+            },
+            state, std::decay_t<EPFunc>(std::forward<decltype(entrypoint)>(entrypoint)),
+            std::forward<decltype(args)>(args)...);
+        return Future<result_type>(std::move(state));
+    }
+
+    template <typename EPFunc, typename... Args>
+    Future<std::invoke_result_t<std::decay_t<EPFunc>&, std::decay_t<Args>&...>> async(
+        EPFunc&& entrypoint, Args&&... args)
+        requires(!std::same_as<std::remove_cvref_t<EPFunc>, CancellationToken>)
+    {
+        return async(CancellationToken{}, std::forward<decltype(entrypoint)>(entrypoint),
+            std::forward<decltype(args)>(args)...);
+    }
+
+    // Returns a future that becomes ready once all of futures are, holding their values in order.
+    // It's cancelled if any of them was.
+    template <typename T>
+    Future<std::conditional_t<std::is_void_v<T>, void, std::vector<T>>> when_all(
+        std::vector<Future<T>> futures)
+    {
+        using result_type = std::conditional_t<std::is_void_v<T>, void, std::vector<T>>;
+
+        struct Gather
+        {
+            std::shared_ptr<internal::FutureState<result_type>> out;
+            std::vector<std::optional<internal::future_value_t<T>>> values;
+            std::atomic<size_t> remaining;
+            std::atomic<bool> anyCancelled = false;
+
+            void finish()
+            {
+                if (anyCancelled)
+                {
+                    out->setCancelled();
+                }
+                else if constexpr (std::is_void_v<T>)
+                {
+                    out->setValue();
+                }
+                else
+                {
+                    std::vector<T> ret;
+                    ret.reserve(values.size());
+                    for (auto& value : values)
+                    {
+                        ret.emplace_back(std::move(*value));
+                    }
+                    out->setValue(std::move(ret));
+                }
+            }
+        };
+
+        auto out    = std::make_shared<internal::FutureState<result_type>>(CancellationToken{});
+        auto gather = std::make_shared<Gather>();
+        gather->out = out;
+        gather->values.resize(futures.size());
+        gather->remaining = futures.size();
+
+        if (futures.empty())
+        {
+            gather->finish();
+        }
+
+        for (size_t i = 0; i < futures.size(); i++)
+        {
+            auto child = std::move(futures[i].state);
+            child->onReady(internal::getFuncAndArg(
+                +[](std::shared_ptr<Gather> gather,
+                     std::shared_ptr<internal::FutureState<T>> child, size_t index)
+                {
+                    if (child->cancelled())
+                    {
+                        gather->anyCancelled = true;
+                    }
+                    else
+                    {
+                        gather->values[index] = std::move(child->value);
+                    }
+                    if (--gather->remaining == 0)
+                    {
+                        gather->finish();
+                    }
+                },
+                gather, child, i));
+        }
+
+        return Future<result_type>(std::move(out));
+    }
+}
+
+#endif
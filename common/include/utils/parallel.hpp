@@ -0,0 +1,171 @@
+/*
+ *   This file is part of PKSM
+ *   Copyright (C) 2016-2022 Bernardo Giordano, Admiral Fish, piepie62
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *   Additional Terms 7.b and 7.c of GPLv3 apply to this file:
+ *       * Requiring preservation of specified reasonable legal notices or
+ *         author attributions in that material or in the Appropriate Legal
+ *         Notices displayed by works containing it.
+ *       * Prohibiting misrepresentation of the origin of that material,
+ *         or requiring that modified versions of such material be marked in
+ *         reasonable ways as different from the original version.
+ */
+
+#ifndef PARALLEL_HPP
+#define PARALLEL_HPP
+
+#include "thread.hpp"
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace Threads
+{
+    namespace internal
+    {
+        // ARM11 cache lines are 32 bytes
+        inline constexpr size_t CACHE_LINE = 32;
+
+        // Chunks are handed out from a shared counter. The job is reference counted so that
+        // helpers which only get scheduled after every chunk is done find nothing left and leave
+        // without touching the caller's stack.
+        struct ParallelJob
+        {
+            ParallelJob(size_t chunks, void (*runChunk)(void*, size_t), void* context)
+                : chunks(chunks), chunksLeft(chunks), runChunk(runChunk), context(context)
+            {
+            }
+
+            void work()
+            {
+                size_t chunk;
+                while ((chunk = nextChunk.fetch_add(1)) < chunks)
+                {
+                    runChunk(context, chunk);
+                    if (chunksLeft.fetch_sub(1) == 1)
+                    {
+                        chunksLeft.notify_all();
+                    }
+                }
+            }
+
+            const size_t chunks;
+            std::atomic<size_t> nextChunk = 0;
+            std::atomic<size_t> chunksLeft;
+            void (*const runChunk)(void*, size_t);
+            void* const context;
+        };
+
+        // Runs runChunk(context, i) for every i in [0, chunks) on up to cores() threads, the
+        // calling thread included, and returns once all of them are done
+        inline void runParallel(size_t chunks, void (*runChunk)(void*, size_t), void* context)
+        {
+            if (chunks == 0)
+            {
+                return;
+            }
+
+            auto job       = std::make_shared<ParallelJob>(chunks, runChunk, context);
+            size_t helpers = std::min(size_t(cores()), chunks) - 1;
+            for (size_t i = 0; i < helpers; i++)
+            {
+                executeTask([job] { job->work(); });
+            }
+
+            job->work();
+
+            size_t left;
+            while ((left = job->chunksLeft.load()) != 0)
+            {
+                job->chunksLeft.wait(left);
+            }
+        }
+
+        inline size_t chunkCount(size_t begin, size_t end, size_t grain)
+        {
+            grain = std::max(grain, size_t(1));
+            return end > begin ? (end - begin + grain - 1) / grain : 0;
+        }
+    } // namespace internal
+
+    // Calls func(i) for every i in [begin, end). The range is cut into chunks of grain indices
+    // which are spread over the worker pool, with the calling thread doing its share; this returns
+    // once every call has finished. func must be safe to call concurrently and must not throw.
+    template <typename Func>
+    void parallelFor(size_t begin, size_t end, size_t grain, Func&& func)
+    {
+        struct Context
+        {
+            size_t begin;
+            size_t end;
+            size_t grain;
+            std::remove_reference_t<Func>& func;
+        } context{begin, end, std::max(grain, size_t(1)), func};
+
+        internal::runParallel(
+            internal::chunkCount(begin, end, grain),
+            +[](void* rawContext, size_t chunk)
+            {
+                Context& context = *reinterpret_cast<Context*>(rawContext);
+                size_t first     = context.begin + chunk * context.grain;
+                size_t last      = std::min(first + context.grain, context.end);
+                for (size_t i = first; i < last; i++)
+                {
+                    std::invoke(context.func, i);
+                }
+            },
+            &context);
+    }
+
+    // Folds map(i) for every i in [begin, end) together with reduce, starting from identity. Each
+    // chunk of grain indices is folded on its own and the chunk results are then combined in
+    // order, so reduce only needs to be associative. The same rules as parallelFor apply to map and
+    // reduce.
+    template <typename T, typename Map, typename Reduce>
+    T parallelReduce(size_t begin, size_t end, size_t grain, T identity, Map&& map, Reduce&& reduce)
+    {
+        // Each chunk's result gets a cache line to itself. Besides keeping workers off each
+        // other's lines, this keeps std::vector<bool> from packing them into shared words.
+        struct alignas(internal::CACHE_LINE) Partial
+        {
+            T value;
+        };
+
+        grain = std::max(grain, size_t(1));
+        std::vector<Partial> partials(internal::chunkCount(begin, end, grain), Partial{identity});
+        parallelFor(0, partials.size(), 1,
+            [&](size_t chunk)
+            {
+                size_t first = begin + chunk * grain;
+                size_t last  = std::min(first + grain, end);
+                T& partial   = partials[chunk].value;
+                for (size_t i = first; i < last; i++)
+                {
+                    partial = std::invoke(reduce, std::move(partial), std::invoke(map, i));
+                }
+            });
+
+        for (Partial& partial : partials)
+        {
+            identity = std::invoke(reduce, std::move(identity), std::move(partial.value));
+        }
+        return identity;
+    }
+}
+
+#endif
@@ -54,6 +54,9 @@ namespace Threads
         std::optional<size_t> stackSize = std::nullopt);
     // Executes task on a worker thread with stack size of 0x8000 (if settable).
     void executeTask(void (*task)(void*), void* arg);
+    // Number of cores worker threads are spread across, and so how many tasks can really run at
+    // the same time.
+    u8 cores();
 
     namespace internal
     {
@@ -53,11 +53,8 @@ namespace
     }
 }
 
-CloudAccess::Page::~Page() {}
-
-
-void CloudAccess::downloadCloudPage(std::shared_ptr<Page> page, int number, SortType type,
-    bool ascend, bool legal, pksm::Generation low, pksm::Generation high, bool LGPE)
+Threads::Future<void> CloudAccess::downloadCloudPage(std::shared_ptr<Page> page, int number,
+    SortType type, bool ascend, bool legal, pksm::Generation low, pksm::Generation high, bool LGPE)
 {
     std::string* retData = new std::string;
 
@@ -69,141 +66,86 @@ void CloudAccess::downloadCloudPage(std::shared_ptr<Page> page, int number, Sort
 
     auto fetch = Fetch::init(url, true, retData, headers, postData);
     fetch->setopt(CURLOPT_TIMEOUT, 10L);
+    Threads::Promise<void> downloaded;
     Fetch::performAsync(fetch,
-        [page, retData, headers](CURLcode code, std::shared_ptr<Fetch> fetch)
+        [page, retData, headers, downloaded](CURLcode code, std::shared_ptr<Fetch> fetch)
         {
             if (code == CURLE_OK)
             {
                 long status_code;
                 fetch->getinfo(CURLINFO_RESPONSE_CODE, &status_code);
-                switch (status_code)
+                // Error responses carry the site's error code in the same kind of document
+                if (status_code == 200 || status_code == 401)
                 {
-                    case 200:
-                        page->data = std::make_unique<nlohmann::json>(
-                            nlohmann::json::parse(*retData, nullptr, false));
-                        if (!page->data || !pageIsGood(*page->data))
-                        {
-                            page->data = nullptr;
-                        }
-                        break;
-                    case 401:
-                    {
-                        nlohmann::json retJson = nlohmann::json::parse(*retData, nullptr, false);
-                        if (retJson.contains("code") && retJson["code"].is_number_integer())
-                        {
-                            page->siteJsonErrorCode = retJson["code"].get<int>();
-                        }
-                    }
-                    break;
-                    default:
-                        break;
+                    readPage(*page, *retData);
                 }
             }
             delete retData;
-            page->available = true;
             curl_slist_free_all(headers);
+            downloaded.setValue();
         });
+    return downloaded.future();
 }
 
-CloudAccess::CloudAccess() : pageNumber(1)
+CloudAccess::CloudAccess(int prefetch)
+    : cache([this](std::shared_ptr<Page> page, int number)
+          {
+              return downloadCloudPage(
+                  page, number, sort, ascend, legal, lowGen, highGen, showLGPE);
+          }),
+      pageNumber(1)
 {
+    prefetchPages(prefetch);
     refreshPages();
 }
 
+void CloudAccess::readPage(Page& page, const std::string& json)
+{
+    int error              = 0;
+    page.data              = CloudPage::parse(json, CloudPage::Layout::POKEMON, error);
+    page.siteJsonErrorCode = error;
+}
+
+u32 CloudAccess::query() const
+{
+    return u32(sort) | u32(ascend) << 1 | u32(legal) << 2 | u32(showLGPE) << 3 |
+           (u32(lowGen) & 0xFF) << 4 | (u32(highGen) & 0xFF) << 12;
+}
+
 void CloudAccess::refreshPages()
 {
-    current            = std::make_shared<Page>();
-    current->data      = std::make_unique<nlohmann::json>(grabPage(pageNumber));
-    current->available = true;
-    if (current->data)
+    current = cache.get(query(), pageNumber);
+    settled = false;
+}
+
+void CloudAccess::update()
+{
+    if (settled || loading())
     {
-        if (pageIsGood(*current->data))
-        {
-            isGood = true;
-        }
-        else
-        {
-            isGood = false;
-            if (current->data->contains("code") && (*current->data)["code"].is_number_integer())
-            {
-                current->siteJsonErrorCode = (*current->data)["code"].get<int>();
-                current->data              = nullptr;
-            }
-        }
+        return;
     }
-    if (isGood && pageNumber >= pages())
+    settled = true;
+    if (good())
     {
-        pageNumber         = pages();
-        current->data      = std::make_unique<nlohmann::json>(grabPage(pages()));
-        current->available = true;
-        if (current->data)
+        // There may be fewer results than when the page number was chosen
+        if (pages() > 0 && pageNumber > pages())
         {
-            if (pageIsGood(*current->data))
-            {
-                isGood = true;
-            }
-            else
-            {
-                isGood = false;
-                if (current->data->contains("code") && (*current->data)["code"].is_number_integer())
-                {
-                    current->siteJsonErrorCode = (*current->data)["code"].get<int>();
-                    current->data              = nullptr;
-                }
-            }
-        }
-    }
-    if (isGood)
-    {
-        if (pages() > 1)
-        {
-            int page = (pageNumber % pages()) + 1;
-            next     = std::make_shared<Page>();
-            downloadCloudPage(next, page, sort, ascend, legal, lowGen, highGen, showLGPE);
-            if (pages() > 2)
-            {
-                page = pageNumber - 1 == 0 ? pages() : pageNumber - 1;
-                prev = std::make_shared<Page>();
-                downloadCloudPage(prev, page, sort, ascend, legal, lowGen, highGen, showLGPE);
-            }
-            else
-            {
-                prev = next;
-            }
+            pageNumber = pages();
+            refreshPages();
         }
         else
         {
-            next = prev = current;
+            cache.prefetch(query(), pageNumber, pages(), prefetch);
         }
     }
 }
 
-nlohmann::json CloudAccess::grabPage(int num)
+void CloudAccess::prefetchPages(int pages)
 {
-    std::string retData;
-    const auto [url, postData] = makeURL(num, sort, ascend, legal, lowGen, highGen, showLGPE);
-
-    struct curl_slist* headers = NULL;
-    headers = curl_slist_append(headers, "Content-Type: application/json;charset=UTF-8");
-    headers = curl_slist_append(headers, "pksm-mode: yes");
-
-    auto fetch = Fetch::init(url, true, &retData, headers, postData);
-    fetch->setopt(CURLOPT_TIMEOUT, 10L);
-    auto res   = Fetch::perform(fetch);
-    curl_slist_free_all(headers);
-
-    if (res.index() == 0)
-    {
-        return {};
-    }
-    else if (std::get<1>(res) == CURLE_OK)
-    {
-        return nlohmann::json::parse(retData, nullptr, false);
-    }
-    else
-    {
-        return {};
-    }
+    prefetch = std::max(pages, 0);
+    // Leave room for the window of the previous sort or filter settings, so that switching back
+    // to them doesn't download everything again
+    cache.capacity(std::max(CloudPageCache::DEFAULT_CAPACITY, size_t(prefetch) * 4 + 2));
 }
 
 std::pair<std::string, std::string> CloudAccess::makeURL(int num, SortType type, bool ascend,
@@ -249,43 +191,38 @@ std::pair<std::string, std::string> CloudAccess::makeURL(int num, SortType type,
     return {Configuration::getInstance().apiUrl() + "api/v2/gpss/search/pokemon?page=" + std::to_string(num), post_data.dump()};
 }
 
-std::unique_ptr<pksm::PKX> CloudAccess::pkm(size_t slot) const
+std::shared_ptr<const pksm::PKX> CloudAccess::pkmView(size_t slot) const
 {
-    if (slot < (*current->data)["pokemon"].size())
+    if (slot < current->data->pokemon.size())
     {
-        std::string b64Data  = (*current->data)["pokemon"][slot]["base_64"].get<std::string>();
-        pksm::Generation gen = pksm::Generation::fromString(
-            (*current->data)["pokemon"][slot]["generation"].get<std::string>());
-        // Legal info: needs thought
-        auto retData = base64_decode(b64Data);
-
-        auto ret = pksm::PKX::getPKM(gen, retData.data(), retData.size());
-        if (ret)
-        {
-            return ret;
-        }
+        return current->data->pokemon[slot].view();
     }
-    return pksm::PKX::getPKM<pksm::Generation::SEVEN>(nullptr, pksm::PK7::BOX_LENGTH);
+    return CloudPage::emptyPkm();
+}
+
+std::unique_ptr<pksm::PKX> CloudAccess::pkm(size_t slot) const
+{
+    return pkmView(slot)->clone();
 }
 
 bool CloudAccess::isLegal(size_t slot) const
 {
-    if (slot < (*current->data)["pokemon"].size())
+    if (slot < current->data->pokemon.size())
     {
-        return (*current->data)["pokemon"][slot]["legal"].get<bool>();
+        return current->data->pokemon[slot].legal;
     }
     return false;
 }
 
 std::unique_ptr<pksm::PKX> CloudAccess::fetchPkm(size_t slot) const
 {
-    if (slot < (*current->data)["pokemon"].size())
+    if (slot < current->data->pokemon.size())
     {
         auto ret = pkm(slot);
 
         if (auto fetch =
                 Fetch::init(Configuration::getInstance().apiUrl() + "api/v2/gpss/download/pokemon/" +
-                                (*current->data)["pokemon"][slot]["code"].get<std::string>(),
+                                current->data->pokemon[slot].code,
                     true, nullptr, nullptr, ""))
         {
             Fetch::performAsync(fetch);
@@ -298,57 +235,43 @@ std::unique_ptr<pksm::PKX> CloudAccess::fetchPkm(size_t slot) const
 
 std::optional<int> CloudAccess::nextPage()
 {
-    next->available.wait(false);
-    if (!next->data || next->data->is_discarded())
+    if (!settled)
     {
-        isGood = false;
-        return next->siteJsonErrorCode;
+        return std::nullopt;
     }
-    // Update data
-    pageNumber = (pageNumber % pages()) + 1;
-    prev       = current;
-    current    = next;
-    next       = std::make_shared<Page>();
-
-    // Download next page in the background
-    int nextPage = (pageNumber % pages()) + 1;
-    downloadCloudPage(next, nextPage, sort, ascend, legal, lowGen, highGen, showLGPE);
-
-    // If there's a mon number desync, also download the previous page again
-    if ((*current->data)["total"] != (*prev->data)["total"])
+    return changePage((pageNumber % pages()) + 1);
+}
+
+std::optional<int> CloudAccess::prevPage()
+{
+    if (!settled)
     {
-        int prevPage = pageNumber - 1 == 0 ? pages() : pageNumber - 1;
-        downloadCloudPage(prev, prevPage, sort, ascend, legal, lowGen, highGen, showLGPE);
+        return std::nullopt;
     }
-
-    return std::nullopt;
+    return changePage(pageNumber - 1 == 0 ? pages() : pageNumber - 1);
 }
 
-std::optional<int> CloudAccess::prevPage()
+std::optional<int> CloudAccess::changePage(int number)
 {
-    prev->available.wait(false);
-    if (!prev->data || prev->data->is_discarded())
+    auto page = cache.get(query(), number);
+    page->downloaded.wait();
+    if (!page->data)
     {
-        isGood = false;
-        return prev->siteJsonErrorCode;
+        return page->siteJsonErrorCode;
     }
-    // Update data
-    pageNumber = pageNumber - 1 == 0 ? pages() : pageNumber - 1;
-    next       = current;
-    current    = prev;
-    prev       = std::make_shared<Page>();
-
-    // Download the next page in the background
-    int prevPage = pageNumber - 1 == 0 ? pages() : pageNumber - 1;
-    downloadCloudPage(prev, prevPage, sort, ascend, legal, lowGen, highGen, showLGPE);
-
-    // If there's a mon number desync, also download the next page again
-    if ((*current->data)["total"] != (*next->data)["total"])
+
+    // If there's a mon number desync, the other pages downloaded with these settings are stale
+    bool desync = page->data->total != current->data->total;
+    pageNumber  = number;
+    current     = page;
+    if (desync)
     {
-        int nextPage = (pageNumber % pages()) + 1;
-        downloadCloudPage(next, nextPage, sort, ascend, legal, lowGen, highGen, showLGPE);
+        cache.invalidate(query(), current);
     }
 
+    // Download the pages around this one in the background
+    cache.prefetch(query(), pageNumber, pages(), prefetch);
+
     return std::nullopt;
 }
 
@@ -389,6 +312,8 @@ long CloudAccess::pkm(std::unique_ptr<pksm::PKX> mon)
         if (res.index() == 1 && std::get<1>(res) == CURLE_OK)
         {
             fetch->getinfo(CURLINFO_RESPONSE_CODE, &ret);
+            // Every cached page may have shifted around the new upload
+            cache.clear();
             refreshPages();
         }
     }
@@ -398,7 +323,7 @@ long CloudAccess::pkm(std::unique_ptr<pksm::PKX> mon)
 
 int CloudAccess::pages() const
 {
-    return (*current->data)["pages"].get<int>();
+    return current->data->pages;
 }
 
 void CloudAccess::filterToGen(pksm::Generation g)
@@ -422,33 +347,3 @@ void CloudAccess::removeGenFilter()
     highGen  = pksm::Generation::EIGHT;
     showLGPE = true;
 }
-
-bool CloudAccess::pageIsGood(const nlohmann::json& page)
-{
-    // clang-format off
-    if (!page.is_object() ||
-        !page.contains("total") || !page["total"].is_number_integer() ||
-        !page.contains("pokemon") || !page["pokemon"].is_array() ||
-        !page.contains("pages") || !page["pages"].is_number_integer())
-    // clang-format on
-    {
-        return false;
-    }
-    else
-    {
-        for (auto& json : page["pokemon"])
-        {
-            // clang-format off
-            if (!json.is_object() ||
-                !json.contains("base_64") || !json["base_64"].is_string() ||
-                !json.contains("generation") || !json["generation"].is_string() ||
-                !json.contains("legal") || !json["legal"].is_boolean() ||
-                !json.contains("code") || !json["code"].is_string())
-            // clang-format on
-            {
-                return false;
-            }
-        }
-    }
-    return true;
-}
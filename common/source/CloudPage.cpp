@@ -0,0 +1,489 @@
+/*
+ *   This file is part of PKSM
+ *   Copyright (C) 2016-2022 Bernardo Giordano, Admiral Fish, piepie62
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *   Additional Terms 7.b and 7.c of GPLv3 apply to this file:
+ *       * Requiring preservation of specified reasonable legal notices or
+ *         author attributions in that material or in the Appropriate Legal
+ *         Notices displayed by works containing it.
+ *       * Prohibiting misrepresentation of the origin of that material,
+ *         or requiring that modified versions of such material be marked in
+ *         reasonable ways as different from the original version.
+ */
+
+#include "CloudPage.hpp"
+#include "base64.hpp"
+#include "nlohmann/json.hpp"
+#include "pkx/PK7.hpp"
+#include <algorithm>
+#include <limits>
+#include <optional>
+
+namespace
+{
+    enum class Field : u8
+    {
+        NONE,
+        TOTAL,
+        PAGES,
+        ERROR_CODE,
+        LIST,
+        BASE_64,
+        GENERATION,
+        LEGAL,
+        CODE,
+        COUNT,
+        DOWNLOAD_CODES,
+        POKEMONS
+    };
+
+    enum class Frame : u8
+    {
+        DOCUMENT,
+        ROOT,
+        LIST,
+        ENTRY,
+        BUNDLE,
+        BUNDLE_POKEMON_LIST,
+        BUNDLE_POKEMON,
+        BUNDLE_CODES,
+        SKIP
+    };
+
+    // Required members of each object type
+    constexpr u8 ROOT_TOTAL = 1 << 0;
+    constexpr u8 ROOT_PAGES = 1 << 1;
+    constexpr u8 ROOT_LIST  = 1 << 2;
+    constexpr u8 ROOT_ALL   = ROOT_TOTAL | ROOT_PAGES | ROOT_LIST;
+
+    constexpr u8 MON_BASE_64    = 1 << 0;
+    constexpr u8 MON_GENERATION = 1 << 1;
+    constexpr u8 MON_LEGAL      = 1 << 2;
+    constexpr u8 MON_CODE       = 1 << 3;
+    constexpr u8 MON_ALL        = MON_BASE_64 | MON_GENERATION | MON_LEGAL | MON_CODE;
+    // Bundled Pokémon get their codes from the bundle, and legality is optional
+    constexpr u8 BUNDLE_MON_ALL = MON_BASE_64 | MON_GENERATION;
+
+    constexpr u8 BUNDLE_CODE  = 1 << 0;
+    constexpr u8 BUNDLE_COUNT = 1 << 1;
+    constexpr u8 BUNDLE_CODES = 1 << 2;
+    constexpr u8 BUNDLE_MONS  = 1 << 3;
+    constexpr u8 BUNDLE_ALL   = BUNDLE_CODE | BUNDLE_COUNT | BUNDLE_CODES | BUNDLE_MONS;
+
+    int clampInt(std::int64_t v)
+    {
+        return int(std::clamp<std::int64_t>(
+            v, std::numeric_limits<int>::min(), std::numeric_limits<int>::max()));
+    }
+
+    // Walks the document once, keeping only the members PKSM uses. Anything it doesn't know about
+    // is skipped without being stored, and a required member with the wrong type stops the parse.
+    class PageReader : public nlohmann::json::json_sax_t
+    {
+    public:
+        PageReader(CloudPage& page, CloudPage::Layout layout) : page(page), layout(layout)
+        {
+            frames.reserve(8);
+            frames.push_back(Frame::DOCUMENT);
+        }
+
+        bool good() const { return valid && complete; }
+
+        std::optional<int> errorCode() const { return siteError; }
+
+        bool null() override { return unexpected(); }
+
+        bool boolean(bool val) override
+        {
+            if (field == Field::LEGAL && (top() == Frame::ENTRY || top() == Frame::BUNDLE_POKEMON))
+            {
+                mon().legal  = val;
+                monSeen     |= MON_LEGAL;
+                field        = Field::NONE;
+                return true;
+            }
+            return unexpected();
+        }
+
+        bool number_integer(number_integer_t val) override { return integer(val); }
+
+        bool number_unsigned(number_unsigned_t val) override
+        {
+            return integer(std::int64_t(std::min<number_unsigned_t>(
+                val, number_unsigned_t(std::numeric_limits<std::int64_t>::max()))));
+        }
+
+        bool number_float(number_float_t, const string_t&) override { return unexpected(); }
+
+        bool string(string_t& val) override
+        {
+            switch (top())
+            {
+                case Frame::ENTRY:
+                case Frame::BUNDLE_POKEMON:
+                    switch (field)
+                    {
+                        case Field::BASE_64:
+                            mon().data  = base64_decode(val);
+                            monSeen    |= MON_BASE_64;
+                            break;
+                        case Field::GENERATION:
+                            mon().gen  = pksm::Generation::fromString(val);
+                            monSeen   |= MON_GENERATION;
+                            break;
+                        case Field::CODE:
+                            mon().code  = std::move(val);
+                            monSeen    |= MON_CODE;
+                            break;
+                        default:
+                            return unexpected();
+                    }
+                    field = Field::NONE;
+                    return true;
+                case Frame::BUNDLE:
+                    if (field == Field::CODE)
+                    {
+                        page.groups.back().code  = std::move(val);
+                        bundleSeen              |= BUNDLE_CODE;
+                        field                    = Field::NONE;
+                        return true;
+                    }
+                    return unexpected();
+                case Frame::BUNDLE_CODES:
+                    codes.emplace_back(std::move(val));
+                    return true;
+                default:
+                    return unexpected();
+            }
+        }
+
+        bool binary(binary_t&) override { return unexpected(); }
+
+        bool start_object(std::size_t) override
+        {
+            switch (top())
+            {
+                case Frame::DOCUMENT:
+                    frames.push_back(Frame::ROOT);
+                    return true;
+                case Frame::LIST:
+                    if (layout == CloudPage::Layout::POKEMON)
+                    {
+                        page.pokemon.emplace_back();
+                        monSeen = 0;
+                        frames.push_back(Frame::ENTRY);
+                    }
+                    else
+                    {
+                        page.groups.emplace_back();
+                        bundleSeen = 0;
+                        bundleSize = 0;
+                        codes.clear();
+                        frames.push_back(Frame::BUNDLE);
+                    }
+                    return true;
+                case Frame::BUNDLE_POKEMON_LIST:
+                    page.groups.back().pokemon.emplace_back();
+                    monSeen = 0;
+                    frames.push_back(Frame::BUNDLE_POKEMON);
+                    return true;
+                default:
+                    return nested();
+            }
+        }
+
+        bool key(string_t& val) override
+        {
+            field = Field::NONE;
+            switch (top())
+            {
+                case Frame::ROOT:
+                    if (val == "total")
+                    {
+                        field = Field::TOTAL;
+                    }
+                    else if (val == "pages")
+                    {
+                        field = Field::PAGES;
+                    }
+                    else if (val == "code" || val == "error_code")
+                    {
+                        field = Field::ERROR_CODE;
+                    }
+                    else if (val == (layout == CloudPage::Layout::POKEMON ? "pokemon" : "bundles"))
+                    {
+                        field = Field::LIST;
+                    }
+                    break;
+                case Frame::ENTRY:
+                case Frame::BUNDLE_POKEMON:
+                    if (val == "base_64")
+                    {
+                        field = Field::BASE_64;
+                    }
+                    else if (val == "generation")
+                    {
+                        field = Field::GENERATION;
+                    }
+                    else if (val == (top() == Frame::ENTRY ? "legal" : "legality"))
+                    {
+                        field = Field::LEGAL;
+                    }
+                    else if (top() == Frame::ENTRY && val == "code")
+                    {
+                        field = Field::CODE;
+                    }
+                    break;
+                case Frame::BUNDLE:
+                    if (val == "download_code")
+                    {
+                        field = Field::CODE;
+                    }
+                    else if (val == "count")
+                    {
+                        field = Field::COUNT;
+                    }
+                    else if (val == "download_codes")
+                    {
+                        field = Field::DOWNLOAD_CODES;
+                    }
+                    else if (val == "pokemons")
+                    {
+                        field = Field::POKEMONS;
+                    }
+                    break;
+                default:
+                    break;
+            }
+            return true;
+        }
+
+        bool end_object() override
+        {
+            Frame closed = top();
+            frames.pop_back();
+            switch (closed)
+            {
+                case Frame::ROOT:
+                    complete = (rootSeen & ROOT_ALL) == ROOT_ALL;
+                    break;
+                case Frame::ENTRY:
+                    valid = valid && (monSeen & MON_ALL) == MON_ALL;
+                    break;
+                case Frame::BUNDLE_POKEMON:
+                    valid = valid && (monSeen & BUNDLE_MON_ALL) == BUNDLE_MON_ALL;
+                    break;
+                case Frame::BUNDLE:
+                    valid = valid && (bundleSeen & BUNDLE_ALL) == BUNDLE_ALL;
+                    finishBundle();
+                    break;
+                default:
+                    break;
+            }
+            field = Field::NONE;
+            return valid;
+        }
+
+        bool start_array(std::size_t) override
+        {
+            switch (top())
+            {
+                case Frame::ROOT:
+                    if (field == Field::LIST)
+                    {
+                        rootSeen |= ROOT_LIST;
+                        frames.push_back(Frame::LIST);
+                        field = Field::NONE;
+                        return true;
+                    }
+                    return nested();
+                case Frame::BUNDLE:
+                    if (field == Field::DOWNLOAD_CODES)
+                    {
+                        bundleSeen |= BUNDLE_CODES;
+                        frames.push_back(Frame::BUNDLE_CODES);
+                        field = Field::NONE;
+                        return true;
+                    }
+                    else if (field == Field::POKEMONS)
+                    {
+                        bundleSeen |= BUNDLE_MONS;
+                        frames.push_back(Frame::BUNDLE_POKEMON_LIST);
+                        field = Field::NONE;
+                        return true;
+                    }
+                    return nested();
+                default:
+                    return nested();
+            }
+        }
+
+        bool end_array() override
+        {
+            frames.pop_back();
+            field = Field::NONE;
+            return true;
+        }
+
+        bool parse_error(
+            std::size_t, const std::string&, const nlohmann::detail::exception&) override
+        {
+            valid = false;
+            return false;
+        }
+
+    private:
+        Frame top() const { return frames.back(); }
+
+        CloudPage::Pokemon& mon()
+        {
+            return top() == Frame::ENTRY ? page.pokemon.back() : page.groups.back().pokemon.back();
+        }
+
+        bool integer(std::int64_t val)
+        {
+            if (top() == Frame::ROOT)
+            {
+                switch (field)
+                {
+                    case Field::TOTAL:
+                        page.total  = clampInt(val);
+                        rootSeen   |= ROOT_TOTAL;
+                        break;
+                    case Field::PAGES:
+                        page.pages  = clampInt(val);
+                        rootSeen   |= ROOT_PAGES;
+                        break;
+                    case Field::ERROR_CODE:
+                        siteError = clampInt(val);
+                        break;
+                    default:
+                        return unexpected();
+                }
+                field = Field::NONE;
+                return true;
+            }
+            else if (top() == Frame::BUNDLE && field == Field::COUNT)
+            {
+                bundleSize  = size_t(std::max<std::int64_t>(val, 0));
+                bundleSeen |= BUNDLE_COUNT;
+                field       = Field::NONE;
+                return true;
+            }
+            return unexpected();
+        }
+
+        // A scalar that isn't one of the members we're looking for. Harmless unless it's standing
+        // in for one of them or sits in an array that should only hold objects or strings.
+        bool unexpected()
+        {
+            switch (top())
+            {
+                case Frame::SKIP:
+                    return true;
+                case Frame::DOCUMENT:
+                case Frame::LIST:
+                case Frame::BUNDLE_POKEMON_LIST:
+                case Frame::BUNDLE_CODES:
+                    valid = false;
+                    break;
+                default:
+                    if (field != Field::NONE && field != Field::ERROR_CODE)
+                    {
+                        valid = false;
+                    }
+                    break;
+            }
+            field = Field::NONE;
+            return valid;
+        }
+
+        // Same as above, but for an object or array, whose contents are then ignored
+        bool nested()
+        {
+            if (top() != Frame::SKIP && !unexpected())
+            {
+                return false;
+            }
+            frames.push_back(Frame::SKIP);
+            return true;
+        }
+
+        void finishBundle()
+        {
+            auto& mons = page.groups.back().pokemon;
+            if (mons.size() > bundleSize)
+            {
+                mons.resize(bundleSize);
+            }
+            for (size_t i = 0; i < std::min(mons.size(), codes.size()); i++)
+            {
+                mons[i].code = std::move(codes[i]);
+            }
+            codes.clear();
+        }
+
+        CloudPage& page;
+        CloudPage::Layout layout;
+        std::vector<Frame> frames;
+        std::vector<std::string> codes;
+        std::optional<int> siteError;
+        size_t bundleSize = 0;
+        Field field       = Field::NONE;
+        u8 rootSeen       = 0;
+        u8 monSeen        = 0;
+        u8 bundleSeen     = 0;
+        bool valid        = true;
+        bool complete     = false;
+    };
+}
+
+std::unique_ptr<CloudPage> CloudPage::parse(std::string_view json, Layout layout, int& errorCode)
+{
+    auto ret = std::make_unique<CloudPage>();
+    PageReader reader(*ret, layout);
+    nlohmann::json::sax_parse(json.begin(), json.end(), &reader);
+    if (!reader.good())
+    {
+        if (auto code = reader.errorCode())
+        {
+            errorCode = *code;
+        }
+        return nullptr;
+    }
+    return ret;
+}
+
+std::shared_ptr<const pksm::PKX> CloudPage::Pokemon::view() const
+{
+    if (!decoded)
+    {
+        // Not directAccess, so getPKM copies the data and never writes through the pointer
+        decoded = pksm::PKX::getPKM(gen, const_cast<u8*>(data.data()), data.size());
+        if (!decoded)
+        {
+            decoded = emptyPkm();
+        }
+    }
+    return decoded;
+}
+
+const std::shared_ptr<const pksm::PKX>& CloudPage::emptyPkm()
+{
+    static const std::shared_ptr<const pksm::PKX> empty =
+        pksm::PKX::getPKM<pksm::Generation::SEVEN>(nullptr, pksm::PK7::BOX_LENGTH);
+    return empty;
+}
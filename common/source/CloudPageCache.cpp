@@ -0,0 +1,90 @@
+/*
+ *   This file is part of PKSM
+ *   Copyright (C) 2016-2022 Bernardo Giordano, Admiral Fish, piepie62
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *   Additional Terms 7.b and 7.c of GPLv3 apply to this file:
+ *       * Requiring preservation of specified reasonable legal notices or
+ *         author attributions in that material or in the Appropriate Legal
+ *         Notices displayed by works containing it.
+ *       * Prohibiting misrepresentation of the origin of that material,
+ *         or requiring that modified versions of such material be marked in
+ *         reasonable ways as different from the original version.
+ */
+
+#include "CloudPageCache.hpp"
+#include <algorithm>
+
+CloudPageCache::CloudPageCache(Loader loader, size_t capacity)
+    : loader(std::move(loader)), maxEntries(std::max<size_t>(capacity, 1))
+{
+}
+
+std::shared_ptr<CloudPageCache::Page> CloudPageCache::get(u32 query, int number)
+{
+    for (auto it = entries.begin(); it != entries.end(); ++it)
+    {
+        if (it->query == query && it->number == number)
+        {
+            if (it->page->downloaded.ready() && !it->page->data)
+            {
+                entries.erase(it);
+                break;
+            }
+            entries.splice(entries.begin(), entries, it);
+            return entries.front().page;
+        }
+    }
+
+    auto page = std::make_shared<Page>();
+    page->downloaded = loader(page, number);
+    entries.push_front({query, number, page});
+    while (entries.size() > maxEntries)
+    {
+        // Anything still downloading stays alive through the loader's reference
+        entries.pop_back();
+    }
+    return page;
+}
+
+void CloudPageCache::prefetch(u32 query, int number, int pages, int radius)
+{
+    if (pages > 1)
+    {
+        // Never let the window evict its own pages
+        radius = std::min({radius, pages / 2, int(maxEntries - 1) / 2});
+        for (int distance = radius; distance > 0; distance--)
+        {
+            get(query, (number - 1 + pages - distance) % pages + 1);
+            get(query, (number - 1 + distance) % pages + 1);
+        }
+    }
+    get(query, number);
+}
+
+void CloudPageCache::invalidate(u32 query, const std::shared_ptr<Page>& keep)
+{
+    std::erase_if(
+        entries, [&](const Entry& entry) { return entry.query == query && entry.page != keep; });
+}
+
+void CloudPageCache::capacity(size_t entries)
+{
+    maxEntries = std::max<size_t>(entries, 1);
+    while (this->entries.size() > maxEntries)
+    {
+        this->entries.pop_back();
+    }
+}
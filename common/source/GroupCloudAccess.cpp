@@ -41,10 +41,8 @@
 #include <format>
 #include <unistd.h>
 
-GroupCloudAccess::Page::~Page() {}
-
-void GroupCloudAccess::downloadGroupPage(std::shared_ptr<Page> page, int number, bool legal,
-    pksm::Generation low, pksm::Generation high, bool LGPE)
+Threads::Future<void> GroupCloudAccess::downloadGroupPage(std::shared_ptr<Page> page,
+    int number, bool legal, pksm::Generation low, pksm::Generation high, bool LGPE)
 {
     std::string* retData       = new std::string;
     struct curl_slist* headers = NULL;
@@ -54,144 +52,81 @@ void GroupCloudAccess::downloadGroupPage(std::shared_ptr<Page> page, int number,
     const auto [url, postData] = GroupCloudAccess::makeURL(number, legal, low, high, LGPE);
     auto fetch                 = Fetch::init(url, true, retData, headers, postData);
     fetch->setopt(CURLOPT_TIMEOUT, 10L);
+    Threads::Promise<void> downloaded;
     Fetch::performAsync(fetch,
-        [page, retData, headers](CURLcode code, std::shared_ptr<Fetch> fetch)
+        [page, retData, headers, downloaded](CURLcode code, std::shared_ptr<Fetch> fetch)
         {
             if (code == CURLE_OK)
             {
                 long status_code;
                 fetch->getinfo(CURLINFO_RESPONSE_CODE, &status_code);
-                switch (status_code)
+                // Error responses carry the site's error code in the same kind of document
+                if (status_code == 200 || status_code == 401)
                 {
-                    case 200:
-                        page->data = std::make_unique<nlohmann::json>(
-                            nlohmann::json::parse(*retData, nullptr, false));
-                        if (!page->data || !pageIsGood(*page->data))
-                        {
-                            page->data = nullptr;
-                        }
-                        break;
-                    case 401:
-                    {
-                        nlohmann::json retJson = nlohmann::json::parse(*retData, nullptr, false);
-                        if (retJson.contains("error_code") &&
-                            retJson["error_code"].is_number_integer())
-                        {
-                            page->siteJsonErrorCode = retJson["error_code"].get<int>();
-                        }
-                    }
-                    break;
-                    default:
-                        break;
+                    readPage(*page, *retData);
                 }
             }
             delete retData;
-            page->available = true;
             curl_slist_free_all(headers);
+            downloaded.setValue();
         });
+    return downloaded.future();
 }
 
-GroupCloudAccess::GroupCloudAccess() : pageNumber(1)
+GroupCloudAccess::GroupCloudAccess(int prefetch)
+    : cache([this](std::shared_ptr<Page> page, int number)
+          { return downloadGroupPage(page, number, legal, low, high, LGPE); }),
+      pageNumber(1)
 {
+    prefetchPages(prefetch);
     refreshPages();
 }
 
+void GroupCloudAccess::readPage(Page& page, const std::string& json)
+{
+    int error              = 0;
+    page.data              = CloudPage::parse(json, CloudPage::Layout::BUNDLES, error);
+    page.siteJsonErrorCode = error;
+}
+
+u32 GroupCloudAccess::query() const
+{
+    return u32(legal) | u32(LGPE) << 1 | (u32(low) & 0xFF) << 4 | (u32(high) & 0xFF) << 12;
+}
+
 void GroupCloudAccess::refreshPages()
 {
-    current            = std::make_shared<Page>();
-    current->data      = std::make_unique<nlohmann::json>(grabPage(pageNumber));
-    current->available = true;
-    if (current->data)
-    {
-        if (pageIsGood(*current->data))
-        {
-            isGood = true;
-        }
-        else
-        {
-            isGood = false;
-            if (current->data->contains("error_code") &&
-                (*current->data)["error_code"].is_number_integer())
-            {
-                current->siteJsonErrorCode = (*current->data)["error_code"].get<int>();
-                current->data              = nullptr;
-            }
-        }
-    }
-    if (isGood && pageNumber >= pages())
+    current = cache.get(query(), pageNumber);
+    settled = false;
+}
+
+void GroupCloudAccess::update()
+{
+    if (settled || loading())
     {
-        pageNumber         = pages();
-        current->data      = std::make_unique<nlohmann::json>(grabPage(pages()));
-        current->available = true;
-        if (current->data)
-        {
-            if (pageIsGood(*current->data))
-            {
-                isGood = true;
-            }
-            else
-            {
-                isGood = false;
-                if (current->data->contains("error_code") &&
-                    (*current->data)["error_code"].is_number_integer())
-                {
-                    current->siteJsonErrorCode = (*current->data)["error_code"].get<int>();
-                    current->data              = nullptr;
-                }
-            }
-        }
+        return;
     }
-    if (isGood)
+    settled = true;
+    if (good())
     {
-        if (pages() > 1)
+        // There may be fewer results than when the page number was chosen
+        if (pages() > 0 && pageNumber > pages())
         {
-            int page = (pageNumber % pages()) + 1;
-            next     = std::make_shared<Page>();
-            downloadGroupPage(next, page, legal, low, high, LGPE);
-            if (pages() > 2)
-            {
-                page = pageNumber - 1 == 0 ? pages() : pageNumber - 1;
-                prev = std::make_shared<Page>();
-                downloadGroupPage(prev, page, legal, low, high, LGPE);
-            }
-            else
-            {
-                prev = next;
-            }
+            pageNumber = pages();
+            refreshPages();
         }
         else
         {
-            next = prev = current;
+            cache.prefetch(query(), pageNumber, pages(), prefetch);
         }
     }
 }
 
-nlohmann::json GroupCloudAccess::grabPage(int num)
+void GroupCloudAccess::prefetchPages(int pages)
 {
-    std::string retData;
-
-    struct curl_slist* headers = NULL;
-    headers = curl_slist_append(headers, "Content-Type: application/json;charset=UTF-8");
-    headers = curl_slist_append(headers, "pksm-mode: yes");
-
-    const auto [url, postData] = GroupCloudAccess::makeURL(num, legal, low, high, LGPE);
-    auto fetch                 = Fetch::init(url, true, &retData, headers, postData);
-    fetch->setopt(CURLOPT_TIMEOUT, 10L);
-    auto res                   = Fetch::perform(fetch);
-    curl_slist_free_all(headers);
-
-    if (res.index() == 0)
-    {
-        return {};
-    }
-    else if (std::get<1>(res) == CURLE_OK)
-    {
-        return nlohmann::json::parse(retData, nullptr, false);
-    }
-    else
-    {
-        return {};
-    }
+    prefetch = std::max(pages, 0);
+    // Leave room for the window of the other filter setting
+    cache.capacity(std::max(CloudPageCache::DEFAULT_CAPACITY, size_t(prefetch) * 4 + 2));
 }
 
 std::pair<std::string, std::string> GroupCloudAccess::makeURL(
@@ -239,95 +174,78 @@ std::pair<std::string, std::string> GroupCloudAccess::makeURL(
 
 std::optional<int> GroupCloudAccess::nextPage()
 {
-    next->available.wait(false);
-    if (!next->data || next->data->is_discarded())
+    if (!settled)
     {
-        isGood = false;
-        return next->siteJsonErrorCode;
+        return std::nullopt;
     }
-    // Update data
-    pageNumber = (pageNumber % pages()) + 1;
-    prev       = current;
-    current    = next;
-    next       = std::make_shared<Page>();
-
-    // Download next page in the background
-    int nextPage = (pageNumber % pages()) + 1;
-    downloadGroupPage(next, nextPage, legal, low, high, LGPE);
-
-    // If there's a mon number desync, also download the previous page again
-    if ((*current->data)["total"] != (*prev->data)["total"])
+    return changePage((pageNumber % pages()) + 1);
+}
+
+std::optional<int> GroupCloudAccess::prevPage()
+{
+    if (!settled)
     {
-        int prevPage = pageNumber - 1 == 0 ? pages() : pageNumber - 1;
-        downloadGroupPage(prev, prevPage, legal, low, high, LGPE);
+        return std::nullopt;
     }
-
-    return std::nullopt;
+    return changePage(pageNumber - 1 == 0 ? pages() : pageNumber - 1);
 }
 
-std::optional<int> GroupCloudAccess::prevPage()
+std::optional<int> GroupCloudAccess::changePage(int number)
 {
-    prev->available.wait(false);
-    if (!prev->data || prev->data->is_discarded())
+    auto page = cache.get(query(), number);
+    page->downloaded.wait();
+    if (!page->data)
     {
-        isGood = false;
-        return prev->siteJsonErrorCode;
+        return page->siteJsonErrorCode;
     }
-    // Update data
-    pageNumber = pageNumber - 1 == 0 ? pages() : pageNumber - 1;
-    next       = current;
-    current    = prev;
-    prev       = std::make_shared<Page>();
-
-    // Download the next page in the background
-    int prevPage = pageNumber - 1 == 0 ? pages() : pageNumber - 1;
-    downloadGroupPage(prev, prevPage, legal, low, high, LGPE);
-
-    // If there's a mon number desync, also download the next page again
-    if ((*current->data)["total"] != (*next->data)["total"])
+
+    // If there's a group number desync, the other pages downloaded with these settings are stale
+    bool desync = page->data->total != current->data->total;
+    pageNumber  = number;
+    current     = page;
+    if (desync)
     {
-        int nextPage = (pageNumber % pages()) + 1;
-        downloadGroupPage(next, nextPage, legal, low, high, LGPE);
+        cache.invalidate(query(), current);
     }
 
+    // Download the pages around this one in the background
+    cache.prefetch(query(), pageNumber, pages(), prefetch);
+
     return std::nullopt;
 }
 
 int GroupCloudAccess::pages() const
 {
-    return (*current->data)["pages"].get<int>();
+    return current->data->pages;
 }
 
-std::unique_ptr<pksm::PKX> GroupCloudAccess::pkm(size_t groupIndex, size_t pokeIndex) const
+std::shared_ptr<const pksm::PKX> GroupCloudAccess::pkmView(
+    size_t groupIndex, size_t pokeIndex) const
 {
-    if (groupIndex < (*current->data)["bundles"].size())
+    if (groupIndex < current->data->groups.size())
     {
-        auto& group = (*current->data)["bundles"][groupIndex];
-        if (pokeIndex < group["count"].get<size_t>())
+        const auto& group = current->data->groups[groupIndex];
+        if (pokeIndex < group.pokemon.size())
         {
-            std::vector<u8> data =
-                base64_decode(group["pokemons"][pokeIndex]["base_64"].get<std::string>());
-            pksm::Generation gen = pksm::Generation::fromString(
-                group["pokemons"][pokeIndex]["generation"].get<std::string>());
-
-            auto ret = pksm::PKX::getPKM(gen, data.data(), data.size());
-            if (ret)
-            {
-                return ret;
-            }
+            return group.pokemon[pokeIndex].view();
         }
     }
-    return pksm::PKX::getPKM<pksm::Generation::SEVEN>(nullptr, pksm::PK7::BOX_LENGTH);
+    return CloudPage::emptyPkm();
+}
+
+std::unique_ptr<pksm::PKX> GroupCloudAccess::pkm(size_t groupIndex, size_t pokeIndex) const
+{
+    return pkmView(groupIndex, pokeIndex)->clone();
 }
 
 bool GroupCloudAccess::isLegal(size_t groupIndex, size_t pokeIndex) const
 {
-    if (groupIndex < (*current->data)["bundles"].size())
+    if (groupIndex < current->data->groups.size())
     {
-        auto& group = (*current->data)["bundles"][groupIndex];
-        if (pokeIndex < group["count"].get<size_t>())
+        const auto& group = current->data->groups[groupIndex];
+        if (pokeIndex < group.pokemon.size())
         {
-            return group["pokemons"][pokeIndex]["legality"].get<bool>();
+            return group.pokemon[pokeIndex].legal;
         }
     }
     return false;
@@ -335,15 +253,15 @@ bool GroupCloudAccess::isLegal(size_t groupIndex, size_t pokeIndex) const
 
 std::unique_ptr<pksm::PKX> GroupCloudAccess::fetchPkm(size_t groupIndex, size_t pokeIndex) const
 {
-    if (groupIndex < (*current->data)["bundles"].size())
+    if (groupIndex < current->data->groups.size())
     {
-        auto& group = (*current->data)["bundles"][groupIndex];
-        if (pokeIndex < group["count"].get<size_t>())
+        const auto& group = current->data->groups[groupIndex];
+        if (pokeIndex < group.pokemon.size())
         {
             auto ret = pkm(groupIndex, pokeIndex);
 
             if (auto fetch = Fetch::init(Configuration::getInstance().apiUrl() + "api/v2/gpss/download/pokemon/" +
-                                             group["download_codes"][pokeIndex].get<std::string>(),
+                                             group.pokemon[pokeIndex].code,
                     true, nullptr, nullptr, ""))
             {
                 Fetch::performAsync(fetch);
@@ -358,10 +276,10 @@ std::unique_ptr<pksm::PKX> GroupCloudAccess::fetchPkm(size_t groupIndex, size_t
 std::vector<std::unique_ptr<pksm::PKX>> GroupCloudAccess::group(size_t groupIndex) const
 {
     std::vector<std::unique_ptr<pksm::PKX>> ret;
-    if (groupIndex < (*current->data)["bundles"].size())
+    if (groupIndex < current->data->groups.size())
     {
-        auto& group = (*current->data)["bundles"][groupIndex];
-        for (int i = 0; i < group["count"].get<int>(); i++)
+        const auto& group = current->data->groups[groupIndex];
+        for (size_t i = 0; i < group.pokemon.size(); i++)
         {
             ret.emplace_back(pkm(groupIndex, i));
         }
@@ -372,17 +290,17 @@ std::vector<std::unique_ptr<pksm::PKX>> GroupCloudAccess::group(size_t groupInde
 std::vector<std::unique_ptr<pksm::PKX>> GroupCloudAccess::fetchGroup(size_t groupIndex) const
 {
     std::vector<std::unique_ptr<pksm::PKX>> ret;
-    if (groupIndex < (*current->data)["bundles"].size())
+    if (groupIndex < current->data->groups.size())
     {
-        auto& group = (*current->data)["bundles"][groupIndex];
-        for (int i = 0; i < group["count"].get<int>(); i++)
+        const auto& group = current->data->groups[groupIndex];
+        for (size_t i = 0; i < group.pokemon.size(); i++)
         {
             // When the full group is downloaded, all the individual download counters will be
             // incremented
             ret.emplace_back(pkm(groupIndex, i));
         }
         if (auto fetch = Fetch::init(Configuration::getInstance().apiUrl() + "api/v2/gpss/download/bundles/" +
-                                         group["download_code"].get<std::string>(),
+                                         group.code,
                 true, nullptr, nullptr, ""))
         {
             Fetch::performAsync(fetch);
@@ -446,6 +364,8 @@ long GroupCloudAccess::group(std::vector<std::unique_ptr<pksm::PKX>> sendMe)
             nlohmann::json retJson = nlohmann::json::parse(writeData, nullptr, false);
             Gui::warn(
                 i18n::localize("SHARE_DOWNLOAD_CODE") + '\n' + retJson["code"].get<std::string>());
+            // Every cached page may have shifted around the new upload
+            cache.clear();
             refreshPages();
         }
         else
@@ -458,33 +378,3 @@ long GroupCloudAccess::group(std::vector<std::unique_ptr<pksm::PKX>> sendMe)
     curl_slist_free_all(headers);
     return ret;
 }
-
-bool GroupCloudAccess::pageIsGood(const nlohmann::json& page)
-{
-    // clang-format off
-    if (!page.is_object() ||
-        !page.contains("total") || !page["total"].is_number_integer() ||
-        !page.contains("pages") || !page["pages"].is_number_integer() ||
-        !page.contains("bundles") || !page["bundles"].is_array())
-    // clang-format on
-    {
-        return false;
-    }
-    else
-    {
-        for (const auto& group : page["bundles"])
-        {
-            // clang-format off
-            if (!group.is_object() ||
-                !group.contains("download_code") || !group["download_code"].is_string() ||
-                !group.contains("count") || !group["count"].is_number_integer() ||
-                !group.contains("download_codes") || !group["download_codes"].is_array() ||
-                !group.contains("pokemons") || !group["pokemons"].is_array())
-            // clang-format on
-            {
-                return false;
-            }
-        }
-    }
-    return true;
-}
@@ -0,0 +1,214 @@
+/*
+ *   This file is part of PKSM
+ *   Copyright (C) 2016-2022 Bernardo Giordano, Admiral Fish, piepie62, Allen Lydiard
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *   Additional Terms 7.b and 7.c of GPLv3 apply to this file:
+ *       * Requiring preservation of specified reasonable legal notices or
+ *         author attributions in that material or in the Appropriate Legal
+ *         Notices displayed by works containing it.
+ *       * Prohibiting misrepresentation of the origin of that material,
+ *         or requiring that modified versions of such material be marked in
+ *         reasonable ways as different from the original version.
+ */
+
+#include "ChunkPipeline.hpp"
+#include "thread.hpp"
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <memory>
+#include <vector>
+
+namespace
+{
+    // Shared between the calling thread and the read-ahead task, which may only get scheduled
+    // after the copy is long over and so must never reach back into the caller's stack
+    struct Pipeline
+    {
+        Pipeline(u64 size, u32 chunkSize, size_t buffers, const ChunkPipeline::ReadFunc& read)
+            : size(size),
+              chunkSize(chunkSize),
+              chunks((size + chunkSize - 1) / chunkSize),
+              read(read),
+              buffers(buffers),
+              readyChunk(new std::atomic<size_t>[buffers])
+        {
+            for (size_t i = 0; i < buffers; i++)
+            {
+                this->buffers[i] = std::unique_ptr<u8[]>(new u8[chunkSize]);
+                readyChunk[i]    = 0;
+            }
+        }
+
+        u32 chunkLength(size_t chunk) const
+        {
+            return std::min<u64>(chunkSize, size - u64(chunk) * chunkSize);
+        }
+
+        u8* buffer(size_t chunk) { return buffers[chunk % buffers.size()].get(); }
+
+        void fail(Result res)
+        {
+            Result expected = 0;
+            error.compare_exchange_strong(expected, res);
+        }
+
+        void readChunk(size_t chunk)
+        {
+            if (error == 0)
+            {
+                Result res = read(u64(chunk) * chunkSize, buffer(chunk), chunkLength(chunk));
+                if (R_FAILED(res))
+                {
+                    fail(res);
+                }
+            }
+            std::atomic<size_t>& ready = readyChunk[chunk % buffers.size()];
+            ready                      = chunk + 1;
+            ready.notify_all();
+        }
+
+        // Run by the read-ahead task
+        void readAhead()
+        {
+            while (true)
+            {
+                // Registered before claiming a chunk, so that finish() can't miss a read that's
+                // about to start
+                busyReaders++;
+                size_t chunk = nextRead.fetch_add(1);
+                if (chunk >= chunks)
+                {
+                    leave();
+                    return;
+                }
+
+                // The chunk that last used this buffer has to be written out first
+                size_t needed = chunk + 1 > buffers.size() ? chunk + 1 - buffers.size() : 0;
+                size_t done;
+                while ((done = written) < needed)
+                {
+                    written.wait(done);
+                }
+                readChunk(chunk);
+                leave();
+            }
+        }
+
+        void leave()
+        {
+            busyReaders--;
+            busyReaders.notify_all();
+        }
+
+        // Run by the calling thread. Reads the chunk itself if nobody has started on it yet.
+        bool waitForChunk(size_t chunk)
+        {
+            size_t expected = chunk;
+            if (nextRead.compare_exchange_strong(expected, chunk + 1))
+            {
+                readChunk(chunk);
+            }
+            else
+            {
+                std::atomic<size_t>& ready = readyChunk[chunk % buffers.size()];
+                size_t current;
+                while ((current = ready) != chunk + 1)
+                {
+                    ready.wait(current);
+                }
+            }
+            return error == 0;
+        }
+
+        // Stops any further reads and waits for those in progress, after which read is never
+        // called again
+        void finish()
+        {
+            nextRead = chunks;
+            written  = std::numeric_limits<size_t>::max();
+            written.notify_all();
+            int busy;
+            while ((busy = busyReaders) != 0)
+            {
+                busyReaders.wait(busy);
+            }
+        }
+
+        const u64 size;
+        const u32 chunkSize;
+        const size_t chunks;
+        const ChunkPipeline::ReadFunc read;
+        std::vector<std::unique_ptr<u8[]>> buffers;
+        // For each buffer, one more than the number of the chunk it last had read into it
+        std::unique_ptr<std::atomic<size_t>[]> readyChunk;
+        std::atomic<size_t> nextRead = 0;
+        std::atomic<size_t> written  = 0;
+        std::atomic<int> busyReaders = 0;
+        std::atomic<Result> error    = 0;
+    };
+}
+
+Result ChunkPipeline::copy(
+    u64 size, const ReadFunc& read, const WriteFunc& write, u32 chunkSize, size_t buffers)
+{
+    chunkSize     = std::max<u32>(chunkSize, 1);
+    size_t chunks = (size + chunkSize - 1) / chunkSize;
+    if (chunks == 0)
+    {
+        return 0;
+    }
+
+    // Nothing to overlap
+    if (chunks == 1 || buffers < 2)
+    {
+        auto buffer = std::unique_ptr<u8[]>(new u8[std::min<u64>(chunkSize, size)]);
+        for (size_t chunk = 0; chunk < chunks; chunk++)
+        {
+            u64 offset = u64(chunk) * chunkSize;
+            u32 length = std::min<u64>(chunkSize, size - offset);
+            Result res = read(offset, buffer.get(), length);
+            if (R_FAILED(res) || R_FAILED(res = write(offset, buffer.get(), length)))
+            {
+                return res;
+            }
+        }
+        return 0;
+    }
+
+    auto pipeline = std::make_shared<Pipeline>(size, chunkSize, std::min(buffers, chunks), read);
+    Threads::executeTask([pipeline] { pipeline->readAhead(); });
+
+    for (size_t chunk = 0; chunk < chunks; chunk++)
+    {
+        if (!pipeline->waitForChunk(chunk))
+        {
+            break;
+        }
+        Result res = write(u64(chunk) * chunkSize, pipeline->buffer(chunk),
+            pipeline->chunkLength(chunk));
+        if (R_FAILED(res))
+        {
+            pipeline->fail(res);
+            break;
+        }
+        pipeline->written = chunk + 1;
+        pipeline->written.notify_all();
+    }
+
+    pipeline->finish();
+    return pipeline->error;
+}
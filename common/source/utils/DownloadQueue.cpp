@@ -0,0 +1,389 @@
+/*
+ *   This file is part of PKSM
+ *   Copyright (C) 2016-2022 Bernardo Giordano, Admiral Fish, piepie62, Allen Lydiard
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *   Additional Terms 7.b and 7.c of GPLv3 apply to this file:
+ *       * Requiring preservation of specified reasonable legal notices or
+ *         author attributions in that material or in the Appropriate Legal
+ *         Notices displayed by works containing it.
+ *       * Prohibiting misrepresentation of the origin of that material,
+ *         or requiring that modified versions of such material be marked in
+ *         reasonable ways as different from the original version.
+ */
+
+#include "DownloadQueue.hpp"
+#include "DataMutex.hpp"
+#include "fetch.hpp"
+#include "utils/crypto.hpp"
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <stdio.h>
+#include <sys/stat.h>
+
+namespace
+{
+    constexpr int MAX_FILE_BUFFER_SIZE = 0x10000;
+
+    enum class Stage
+    {
+        Probe,
+        Download,
+        Done
+    };
+
+    struct Job
+    {
+        DownloadQueue::Item item;
+        Stage stage = Stage::Probe;
+        std::shared_ptr<Fetch> fetch;
+        std::string probeData;
+        FILE* file = nullptr;
+        std::unique_ptr<pksm::crypto::SHA256> sha;
+        long resumeFrom  = 0;
+        bool sawHeaders  = false;
+        bool badResponse = false;
+        bool retried     = false;
+        CURLcode code    = CURLE_OK;
+        Result result    = 0;
+    };
+
+    // Completed transfers, handed from the multi thread to the one in run()
+    struct Completions
+    {
+        DataMutex<std::vector<size_t>> finished;
+        std::atomic<u32> count = 0;
+
+        void push(size_t index)
+        {
+            finished.lock()->emplace_back(index);
+            count++;
+            count.notify_one();
+        }
+    };
+
+    std::string partPath(const Job& job)
+    {
+        return job.item.path + ".part";
+    }
+
+    long fileSize(const std::string& path)
+    {
+        struct stat st;
+        return stat(path.c_str(), &st) == 0 ? st.st_size : -1;
+    }
+
+    // Feeds up to size bytes of file into sha; returns how many were read
+    long hashInto(FILE* file, pksm::crypto::SHA256& sha, long size)
+    {
+        std::unique_ptr<u8[]> buffer(new u8[MAX_FILE_BUFFER_SIZE]);
+        long total = 0;
+        while (total < size)
+        {
+            size_t read =
+                fread(buffer.get(), 1, std::min(long(MAX_FILE_BUFFER_SIZE), size - total), file);
+            if (read == 0)
+            {
+                break;
+            }
+            sha.update({buffer.get(), read});
+            total += read;
+        }
+        return total;
+    }
+
+    std::optional<DownloadQueue::Hash> hashFile(const std::string& path)
+    {
+        FILE* file = fopen(path.c_str(), "rb");
+        if (!file)
+        {
+            return std::nullopt;
+        }
+        pksm::crypto::SHA256 sha;
+        hashInto(file, sha, fileSize(path));
+        fclose(file);
+        return sha.finish();
+    }
+
+    size_t writeCallback(char* data, size_t size, size_t nitems, void* userdata)
+    {
+        Job& job = *(Job*)userdata;
+        if (!job.sawHeaders)
+        {
+            job.sawHeaders = true;
+            long response  = 0;
+            job.fetch->getinfo(CURLINFO_RESPONSE_CODE, &response);
+            if (response >= 300)
+            {
+                job.badResponse = true;
+            }
+            else if (job.resumeFrom > 0 && response != 206)
+            {
+                // The server ignored the range and is sending everything, so start over. Reopened
+                // rather than freopen'd, which newlib doesn't support with a null path
+                fclose(job.file);
+                if ((job.file = fopen(partPath(job).c_str(), "wb")))
+                {
+                    setvbuf(job.file, nullptr, _IOFBF, MAX_FILE_BUFFER_SIZE);
+                }
+                job.sha        = std::make_unique<pksm::crypto::SHA256>();
+                job.resumeFrom = 0;
+            }
+        }
+
+        if (job.badResponse || !job.file)
+        {
+            // Throw error bodies away without failing the transfer
+            return job.file ? size * nitems : 0;
+        }
+
+        job.sha->update({(u8*)data, size * nitems});
+        return fwrite(data, size, nitems, job.file);
+    }
+
+    bool isSSL(const std::string& url)
+    {
+        return url.substr(0, 5) == "https";
+    }
+
+    // Kicks off the next transfer for a job. Returns false if the job finished without one.
+    bool start(Job& job, size_t index, Completions& completions)
+    {
+        auto onFinish = [&completions, &job, index](CURLcode code, std::shared_ptr<Fetch>)
+        {
+            job.code = code;
+            completions.push(index);
+        };
+
+        if (job.stage == Stage::Probe && !job.item.checksumUrl.empty())
+        {
+            const std::string& url = job.item.checksumUrl;
+            // Checksums rarely change, so let the server answer with a 304 when it can
+            job.fetch = Fetch::init(url, isSSL(url), &job.probeData, nullptr, "", true);
+            if (job.fetch)
+            {
+                if (Fetch::performAsync(job.fetch, onFinish) == CURLM_OK)
+                {
+                    return true;
+                }
+            }
+            job.result = -1;
+            job.stage  = Stage::Done;
+            return false;
+        }
+        job.stage = Stage::Download;
+
+        if (job.item.sha256)
+        {
+            if (!job.item.localHash)
+            {
+                job.item.localHash = hashFile(job.item.path);
+            }
+            if (job.item.localHash == job.item.sha256)
+            {
+                job.stage = Stage::Done;
+                return false;
+            }
+        }
+
+        const std::string part = partPath(job);
+        job.resumeFrom         = fileSize(part);
+        job.sha                = std::make_unique<pksm::crypto::SHA256>();
+        if (job.resumeFrom > 0 && (job.file = fopen(part.c_str(), "r+b")))
+        {
+            job.resumeFrom = hashInto(job.file, *job.sha, job.resumeFrom);
+            fseek(job.file, job.resumeFrom, SEEK_SET);
+        }
+        else
+        {
+            job.resumeFrom = 0;
+            job.file       = fopen(part.c_str(), "wb");
+        }
+
+        if (job.file &&
+            (job.fetch = Fetch::init(job.item.url, isSSL(job.item.url), nullptr, nullptr, "")))
+        {
+            setvbuf(job.file, nullptr, _IOFBF, MAX_FILE_BUFFER_SIZE);
+            job.fetch->setopt(CURLOPT_WRITEFUNCTION, writeCallback);
+            job.fetch->setopt(CURLOPT_WRITEDATA, &job);
+            if (job.resumeFrom > 0)
+            {
+                job.fetch->setopt(CURLOPT_RESUME_FROM_LARGE, curl_off_t(job.resumeFrom));
+            }
+            job.sawHeaders  = false;
+            job.badResponse = false;
+            if (Fetch::performAsync(job.fetch, onFinish) == CURLM_OK)
+            {
+                return true;
+            }
+        }
+
+        if (job.file)
+        {
+            fclose(job.file);
+            job.file = nullptr;
+        }
+        job.result = -1;
+        job.stage  = Stage::Done;
+        return false;
+    }
+
+    // Deals with a finished transfer. Returns true if the job wants another one.
+    bool finish(Job& job)
+    {
+        long response = 0;
+        job.fetch->getinfo(CURLINFO_RESPONSE_CODE, &response);
+        job.fetch = nullptr;
+
+        if (job.stage == Stage::Probe)
+        {
+            if (job.code != CURLE_OK || response != 200 || job.probeData.size() < 32)
+            {
+                job.result = job.code != CURLE_OK ? -(job.code + 100) : -1;
+                job.stage  = Stage::Done;
+                return false;
+            }
+            DownloadQueue::Hash hash;
+            std::copy_n(job.probeData.begin(), hash.size(), hash.begin());
+            job.item.sha256 = hash;
+            job.stage       = Stage::Download;
+            return true;
+        }
+
+        if (job.file)
+        {
+            fclose(job.file);
+            job.file = nullptr;
+        }
+        const std::string part   = partPath(job);
+        DownloadQueue::Hash hash = job.sha->finish();
+        bool complete            = job.code == CURLE_OK && !job.badResponse;
+        // A range past the end means the part file was already complete
+        if (response == 416 && job.resumeFrom > 0)
+        {
+            complete = true;
+        }
+
+        if (job.code != CURLE_OK)
+        {
+            // Kept so the next attempt can resume it
+            job.result = -(job.code + 100);
+        }
+        else if (!complete)
+        {
+            remove(part.c_str());
+            job.result = -1;
+        }
+        else if (job.item.sha256 && hash != *job.item.sha256)
+        {
+            remove(part.c_str());
+            if (job.resumeFrom > 0 && !job.retried)
+            {
+                // Whatever was resumed from may not have belonged to this version of the file
+                job.retried = true;
+                return true;
+            }
+            job.result = -1;
+        }
+        else
+        {
+            remove(job.item.path.c_str());
+            job.result = rename(part.c_str(), job.item.path.c_str()) == 0 ? 0 : -1;
+        }
+
+        job.stage = Stage::Done;
+        if (job.item.onFinish)
+        {
+            job.item.onFinish(job.result, hash);
+        }
+        return false;
+    }
+}
+
+void DownloadQueue::add(Item item)
+{
+    items.emplace_back(std::move(item));
+}
+
+Result DownloadQueue::run(const std::function<void(size_t, size_t)>& progress)
+{
+    std::vector<Job> jobs(items.size());
+    for (size_t i = 0; i < items.size(); i++)
+    {
+        jobs[i].item = std::move(items[i]);
+    }
+    items.clear();
+
+    Completions completions;
+    size_t next   = 0;
+    size_t active = 0;
+    size_t done   = 0;
+    while (done < jobs.size())
+    {
+        while (active < maxTransfers && next < jobs.size())
+        {
+            if (start(jobs[next], next, completions))
+            {
+                active++;
+            }
+            else
+            {
+                done++;
+            }
+            next++;
+        }
+
+        if (progress)
+        {
+            progress(done, jobs.size());
+        }
+        if (done == jobs.size())
+        {
+            break;
+        }
+
+        u32 seen = completions.count;
+        std::vector<size_t> finished;
+        completions.finished.lock()->swap(finished);
+        if (finished.empty())
+        {
+            completions.count.wait(seen);
+            continue;
+        }
+
+        for (size_t index : finished)
+        {
+            active--;
+            if (finish(jobs[index]) && start(jobs[index], index, completions))
+            {
+                active++;
+            }
+            else
+            {
+                done++;
+            }
+        }
+    }
+
+    for (const auto& job : jobs)
+    {
+        if (R_FAILED(job.result))
+        {
+            return job.result;
+        }
+    }
+    return 0;
+}
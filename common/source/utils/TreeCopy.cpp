@@ -0,0 +1,392 @@
+/*
+ *   This file is part of PKSM
+ *   Copyright (C) 2016-2022 Bernardo Giordano, Admiral Fish, piepie62, Allen Lydiard
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *   Additional Terms 7.b and 7.c of GPLv3 apply to this file:
+ *       * Requiring preservation of specified reasonable legal notices or
+ *         author attributions in that material or in the Appropriate Legal
+ *         Notices displayed by works containing it.
+ *       * Prohibiting misrepresentation of the origin of that material,
+ *         or requiring that modified versions of such material be marked in
+ *         reasonable ways as different from the original version.
+ */
+
+#include "TreeCopy.hpp"
+#include "DataMutex.hpp"
+#include "thread.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <stdio.h>
+#include <string.h>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace
+{
+    // The manifest is a header followed by one record per finished file, each appended (and
+    // flushed) as soon as its file is done. A record cut short by an interruption is ignored.
+    constexpr char MANIFEST_MAGIC[8] = {'P', 'K', 'S', 'M', 'T', 'C', 'P', 'Y'};
+    constexpr u32 MANIFEST_VERSION   = 1;
+
+    struct RecordHeader
+    {
+        u64 size;
+        u64 stamp;
+        u32 pathLength;
+    };
+
+    // Finished files by path, with the size and stamp they had when copied
+    using Finished = std::unordered_map<std::u16string, std::pair<u64, u64>>;
+
+    bool readManifest(const std::string& path, Finished* finished)
+    {
+        FILE* in = fopen(path.c_str(), "rb");
+        if (!in)
+        {
+            return false;
+        }
+
+        char magic[sizeof(MANIFEST_MAGIC)];
+        u32 version;
+        bool good = fread(magic, 1, sizeof(magic), in) == sizeof(magic) &&
+                    fread(&version, 1, sizeof(version), in) == sizeof(version) &&
+                    !memcmp(magic, MANIFEST_MAGIC, sizeof(magic)) && version == MANIFEST_VERSION;
+
+        RecordHeader header;
+        while (good && finished && fread(&header, 1, sizeof(header), in) == sizeof(header))
+        {
+            std::u16string file(header.pathLength, u'\0');
+            if (fread(file.data(), sizeof(char16_t), file.size(), in) != file.size())
+            {
+                break;
+            }
+            (*finished)[std::move(file)] = {header.size, header.stamp};
+        }
+
+        fclose(in);
+        return good;
+    }
+
+    FILE* openManifest(const std::string& path, bool resume)
+    {
+        if (resume)
+        {
+            return fopen(path.c_str(), "ab");
+        }
+
+        FILE* out = fopen(path.c_str(), "wb");
+        if (out)
+        {
+            fwrite(MANIFEST_MAGIC, 1, sizeof(MANIFEST_MAGIC), out);
+            fwrite(&MANIFEST_VERSION, 1, sizeof(MANIFEST_VERSION), out);
+            fflush(out);
+        }
+        return out;
+    }
+
+    // Brings the destination of a resumed copy back in line with the source listing: anything the
+    // source no longer has is removed, and finished files the destination no longer has, or has
+    // at a different size, are forgotten so that they're copied again. A destination folder that
+    // can't be listed is taken to be empty.
+    Result reconcile(const TreeCopy::Backend& backend, const std::vector<TreeCopy::Entry>& folders,
+        const std::vector<TreeCopy::Entry>& files, Finished& finished)
+    {
+        std::unordered_set<std::u16string> sourceFolders;
+        std::unordered_map<std::u16string, u64> sourceFiles;
+        for (const auto& folder : folders)
+        {
+            sourceFolders.emplace(folder.path);
+        }
+        for (const auto& file : files)
+        {
+            sourceFiles.emplace(file.path, file.size);
+        }
+
+        std::unordered_map<std::u16string, u64> present;
+        std::vector<std::u16string> pending{u""};
+        std::vector<TreeCopy::Entry> listed;
+        while (!pending.empty())
+        {
+            const std::u16string parent = std::move(pending.back());
+            pending.pop_back();
+            listed.clear();
+            if (R_FAILED(backend.listDestination(parent, listed)))
+            {
+                continue;
+            }
+            for (auto& entry : listed)
+            {
+                if (!parent.empty())
+                {
+                    entry.path = parent + u'/' + entry.path;
+                }
+                if (entry.folder ? sourceFolders.contains(entry.path)
+                                 : sourceFiles.contains(entry.path))
+                {
+                    if (entry.folder)
+                    {
+                        pending.emplace_back(std::move(entry.path));
+                    }
+                    else
+                    {
+                        present.emplace(std::move(entry.path), entry.size);
+                    }
+                }
+                else if (Result res = backend.remove(entry); R_FAILED(res))
+                {
+                    return res;
+                }
+            }
+        }
+
+        std::erase_if(finished,
+            [&present](const auto& file)
+            {
+                auto found = present.find(file.first);
+                return found == present.end() || found->second != file.second.first;
+            });
+        return 0;
+    }
+
+    // Shared between the calling thread and the helper tasks. Helpers that only get scheduled
+    // once every file has been claimed find nothing left and leave without touching the backend.
+    struct CopyJob
+    {
+        CopyJob(
+            std::vector<TreeCopy::Entry>&& files, const TreeCopy::Backend& backend, FILE* manifest)
+            : files(std::move(files)),
+              copyFile(backend.copyFile),
+              unfinished(this->files.size()),
+              manifest(manifest)
+        {
+        }
+
+        // Copies files until there are none left to claim. progress is called after every chunk
+        // that this thread copies.
+        void work(const std::function<void()>& progress)
+        {
+            size_t file;
+            while ((file = nextFile.fetch_add(1)) < files.size())
+            {
+                const TreeCopy::Entry& entry = files[file];
+                u64 reported                 = 0;
+                Result res                   = error;
+                if (res == 0)
+                {
+                    res = copyFile(entry,
+                        [&](u64 copied)
+                        {
+                            bytesDone += copied - reported;
+                            reported   = copied;
+                            tick();
+                            if (progress)
+                            {
+                                progress();
+                            }
+                        });
+                }
+
+                if (R_FAILED(res))
+                {
+                    fail(res);
+                }
+                else
+                {
+                    bytesDone += entry.size - reported;
+                    record(entry);
+                    filesDone++;
+                }
+
+                unfinished--;
+                tick();
+            }
+        }
+
+        void fail(Result res)
+        {
+            Result expected = 0;
+            if (error.compare_exchange_strong(expected, res))
+            {
+                // Nothing past this point gets claimed anymore, so count it as finished
+                size_t claimed = std::min(nextFile.exchange(files.size()), files.size());
+                unfinished    -= files.size() - claimed;
+            }
+        }
+
+        void record(const TreeCopy::Entry& entry)
+        {
+            auto lock = manifest.lock();
+            if (*lock)
+            {
+                RecordHeader header{entry.size, entry.stamp, u32(entry.path.size())};
+                fwrite(&header, 1, sizeof(header), *lock);
+                fwrite(entry.path.data(), sizeof(char16_t), entry.path.size(), *lock);
+                fflush(*lock);
+            }
+        }
+
+        void tick()
+        {
+            ticks++;
+            ticks.notify_all();
+        }
+
+        const std::vector<TreeCopy::Entry> files;
+        const std::function<Result(const TreeCopy::Entry&, const std::function<void(u64)>&)>
+            copyFile;
+        std::atomic<size_t> nextFile   = 0;
+        std::atomic<size_t> unfinished = 0;
+        std::atomic<size_t> filesDone  = 0;
+        std::atomic<u64> bytesDone     = 0;
+        std::atomic<u32> ticks         = 0;
+        std::atomic<Result> error      = 0;
+        DataMutex<FILE*> manifest;
+    };
+}
+
+bool TreeCopy::resumable(const std::string& manifestPath)
+{
+    return !manifestPath.empty() && readManifest(manifestPath, nullptr);
+}
+
+Result TreeCopy::run(const Backend& backend, const Options& options)
+{
+    // List the whole tree first, so that progress knows what it's working towards
+    std::vector<Entry> folders;
+    std::vector<Entry> files;
+    std::vector<Entry> listed;
+    for (size_t folder = 0; folder <= folders.size(); folder++)
+    {
+        const std::u16string parent = folder == 0 ? u"" : folders[folder - 1].path;
+        listed.clear();
+        if (Result res = backend.list(parent, listed); R_FAILED(res))
+        {
+            return res;
+        }
+        for (auto& entry : listed)
+        {
+            if (!parent.empty())
+            {
+                entry.path = parent + u'/' + entry.path;
+            }
+            (entry.folder ? folders : files).emplace_back(std::move(entry));
+        }
+    }
+
+    Finished finished;
+    bool resume = !options.manifestPath.empty() && readManifest(options.manifestPath, &finished);
+    if (resume && backend.listDestination && backend.remove)
+    {
+        if (Result res = reconcile(backend, folders, files, finished); R_FAILED(res))
+        {
+            return res;
+        }
+    }
+
+    // Breadth-first, so parents always come before their children
+    if (Result res = backend.makeFolder(u""); R_FAILED(res))
+    {
+        return res;
+    }
+    for (const auto& folder : folders)
+    {
+        if (Result res = backend.makeFolder(folder.path); R_FAILED(res))
+        {
+            return res;
+        }
+    }
+
+    FILE* manifest =
+        options.manifestPath.empty() ? nullptr : openManifest(options.manifestPath, resume);
+
+    Progress progress;
+    progress.filesTotal = files.size();
+    std::vector<Entry> toCopy;
+    for (auto& file : files)
+    {
+        progress.bytesTotal += file.size;
+        auto found           = finished.find(file.path);
+        if (file.stamp != 0 && found != finished.end() &&
+            found->second == std::make_pair(file.size, file.stamp))
+        {
+            progress.bytesDone += file.size;
+            progress.filesDone++;
+        }
+        else
+        {
+            toCopy.emplace_back(std::move(file));
+        }
+    }
+    const u64 resumedBytes   = progress.bytesDone;
+    const size_t resumedFiles = progress.filesDone;
+
+    auto job   = std::make_shared<CopyJob>(std::move(toCopy), backend, manifest);
+    auto start = std::chrono::steady_clock::now();
+    auto last  = start - std::chrono::seconds(1);
+    auto report = [&](bool force)
+    {
+        auto now = std::chrono::steady_clock::now();
+        if (!options.progress || (!force && now - last < std::chrono::milliseconds(100)))
+        {
+            return;
+        }
+        last               = now;
+        progress.bytesDone = resumedBytes + job->bytesDone;
+        progress.filesDone = resumedFiles + job->filesDone;
+        u64 elapsed =
+            std::chrono::duration_cast<std::chrono::milliseconds>(now - start).count();
+        if (elapsed > 0 && job->bytesDone > 0)
+        {
+            progress.bytesPerSecond = job->bytesDone * 1000 / elapsed;
+            progress.secondsLeft    = progress.bytesPerSecond == 0
+                                          ? -1
+                                          : (progress.bytesTotal - progress.bytesDone) /
+                                                progress.bytesPerSecond;
+        }
+        options.progress(progress);
+    };
+
+    size_t helpers = std::min({options.maxParallel, size_t(Threads::cores()), job->files.size()});
+    for (size_t i = 1; i < helpers; i++)
+    {
+        Threads::executeTask([job] { job->work(nullptr); });
+    }
+    job->work([&report] { report(false); });
+
+    while (true)
+    {
+        u32 seen = job->ticks;
+        if (job->unfinished == 0)
+        {
+            break;
+        }
+        report(false);
+        job->ticks.wait(seen);
+    }
+    report(true);
+
+    if (manifest)
+    {
+        fclose(manifest);
+        if (job->error == 0)
+        {
+            remove(options.manifestPath.c_str());
+        }
+    }
+    return job->error;
+}
@@ -43,82 +43,138 @@ namespace
         '4', '5', '6', '7', '8', '9', '+', '/'
     };
     // clang-format on
-    constexpr std::array<char, 256> decoding_table = std::invoke(
+    // Anything that isn't a base64 digit, padding included, decodes as zero
+    constexpr std::array<u8, 256> decoding_table = std::invoke(
         []()
         {
-            std::array<char, 256> ret = {0};
+            std::array<u8, 256> ret = {0};
             for (size_t i = 0; i < encoding_table.size(); i++)
             {
-                ret[encoding_table[i]] = i;
+                ret[(u8)encoding_table[i]] = i;
             }
             return ret;
         });
+
+    u32 decodeQuad(const u8* in)
+    {
+        return u32(decoding_table[in[0]]) << 3 * 6 | u32(decoding_table[in[1]]) << 2 * 6 |
+               u32(decoding_table[in[2]]) << 1 * 6 | u32(decoding_table[in[3]]) << 0 * 6;
+    }
 }
 
-std::vector<u8> base64_decode(std::span<const u8> data)
+size_t base64_decoded_size(std::span<const u8> data)
 {
-    if (data.size() % 4 != 0)
+    if (data.empty() || data.size() % 4 != 0)
     {
-        return {};
+        return 0;
     }
 
-    size_t output_length = data.size() / 4 * 3;
+    size_t ret = data.size() / 4 * 3;
     if (data[data.size() - 1] == '=')
     {
-        output_length--;
+        ret--;
     }
     if (data[data.size() - 2] == '=')
     {
-        output_length--;
+        ret--;
+    }
+    return ret;
+}
+
+size_t base64_decode_into(std::span<const u8> data, std::span<u8> out)
+{
+    const size_t size = base64_decoded_size(data);
+    if (size == 0 || out.size() < size)
+    {
+        return 0;
     }
 
-    std::vector<unsigned char> ret(output_length);
+    const u8* in   = data.data();
+    const u8* last = in + data.size() - 4;
+    u8* dst        = out.data();
 
-    for (size_t i = 0, j = 0; i < data.size();)
+    // Only the last quad can hold padding, so everything before it goes without checks
+    for (; in < last; in += 4, dst += 3)
     {
-        uint32_t sextet_a = data[i] == '=' ? 0 & i++ : decoding_table[(size_t)data[i++]];
-        uint32_t sextet_b = data[i] == '=' ? 0 & i++ : decoding_table[(size_t)data[i++]];
-        uint32_t sextet_c = data[i] == '=' ? 0 & i++ : decoding_table[(size_t)data[i++]];
-        uint32_t sextet_d = data[i] == '=' ? 0 & i++ : decoding_table[(size_t)data[i++]];
+        u32 triple = decodeQuad(in);
+        dst[0]     = triple >> 2 * 8;
+        dst[1]     = triple >> 1 * 8;
+        dst[2]     = triple >> 0 * 8;
+    }
 
-        uint32_t triple =
-            (sextet_a << 3 * 6) + (sextet_b << 2 * 6) + (sextet_c << 1 * 6) + (sextet_d << 0 * 6);
+    u32 triple      = decodeQuad(last);
+    size_t tailSize = size - (dst - out.data());
+    dst[0]          = triple >> 2 * 8;
+    if (tailSize > 1)
+    {
+        dst[1] = triple >> 1 * 8;
+    }
+    if (tailSize > 2)
+    {
+        dst[2] = triple >> 0 * 8;
+    }
 
-        if (j < output_length)
-        {
-            ret[j++] = (triple >> 2 * 8) & 0xFF;
-        }
-        if (j < output_length)
+    return size;
+}
+
+size_t base64_encode_into(std::span<const u8> data, std::span<char> out)
+{
+    const size_t size = base64_encoded_size(data.size());
+    if (out.size() < size)
+    {
+        return 0;
+    }
+
+    const u8* in  = data.data();
+    const u8* end = in + data.size() / 3 * 3;
+    char* dst     = out.data();
+
+    for (; in < end; in += 3, dst += 4)
+    {
+        u32 triple = u32(in[0]) << 0x10 | u32(in[1]) << 0x08 | u32(in[2]);
+        dst[0]     = encoding_table[(triple >> 3 * 6) & 0x3F];
+        dst[1]     = encoding_table[(triple >> 2 * 6) & 0x3F];
+        dst[2]     = encoding_table[(triple >> 1 * 6) & 0x3F];
+        dst[3]     = encoding_table[(triple >> 0 * 6) & 0x3F];
+    }
+
+    switch (data.size() % 3)
+    {
+        case 1:
         {
-            ret[j++] = (triple >> 1 * 8) & 0xFF;
+            u32 triple = u32(in[0]) << 0x10;
+            dst[0]     = encoding_table[(triple >> 3 * 6) & 0x3F];
+            dst[1]     = encoding_table[(triple >> 2 * 6) & 0x3F];
+            dst[2]     = '=';
+            dst[3]     = '=';
         }
-        if (j < output_length)
+        break;
+        case 2:
         {
-            ret[j++] = (triple >> 0 * 8) & 0xFF;
+            u32 triple = u32(in[0]) << 0x10 | u32(in[1]) << 0x08;
+            dst[0]     = encoding_table[(triple >> 3 * 6) & 0x3F];
+            dst[1]     = encoding_table[(triple >> 2 * 6) & 0x3F];
+            dst[2]     = encoding_table[(triple >> 1 * 6) & 0x3F];
+            dst[3]     = '=';
         }
+        break;
+        default:
+            break;
     }
 
+    return size;
+}
+
+std::vector<u8> base64_decode(std::span<const u8> data)
+{
+    std::vector<u8> ret(base64_decoded_size(data));
+    base64_decode_into(data, ret);
     return ret;
 }
 
 std::string base64_encode(std::span<const u8> data)
 {
-    std::string ret(4 * ((data.size() + 2) / 3), '=');
-    size_t out_index = 0;
-
-    for (size_t i = 0, j = 0; i < data.size(); j += 4)
-    {
-        uint32_t octet_a = i < data.size() ? (unsigned char)data[i++] : 0;
-        uint32_t octet_b = i < data.size() ? (unsigned char)data[i++] : 0;
-        uint32_t octet_c = i < data.size() ? (unsigned char)data[i++] : 0;
-
-        uint32_t triple = (octet_a << 0x10) + (octet_b << 0x08) + octet_c;
-
-        ret[out_index++] = encoding_table[(triple >> 3 * 6) & 0x3F];
-        ret[out_index++] = encoding_table[(triple >> 2 * 6) & 0x3F];
-        ret[out_index++] = encoding_table[(triple >> 1 * 6) & 0x3F];
-        ret[out_index++] = encoding_table[(triple >> 0 * 6) & 0x3F];
-    }
-
+    std::string ret(base64_encoded_size(data.size()), '\0');
+    base64_encode_into(data, ret);
     return ret;
 }
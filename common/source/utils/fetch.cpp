@@ -25,13 +25,17 @@
  */
 
 #include "fetch.hpp"
+#include "STDirectory.hpp"
 #include "thread.hpp"
 #include <algorithm>
+#include <array>
 #include <errno.h>
+#include <format>
 #include <stdarg.h>
 #include <stdio.h>
 #include <time.h>
 #include <unistd.h>
+#include <unordered_map>
 
 namespace
 {
@@ -49,14 +53,137 @@ namespace
         std::function<void(std::shared_ptr<Fetch>)> onCancel;
     };
 
+    // A finished transfer, waiting for the completion thread
+    struct CompletedFetch
+    {
+        MultiFetchRecord record;
+        CURLcode result;
+    };
+
     constexpr int MAX_FILE_BUFFER_SIZE = 0x10000;
+    // Completion callbacks parse responses and touch the SD card, which the multi thread's stack
+    // has no room for
+    constexpr size_t COMPLETION_STACK_SIZE = 0x8000;
+    // Upper bound on how long the multi thread sits in curl_multi_poll while transfers are running,
+    // in case curl_multi_wakeup isn't available
+    constexpr int MAX_POLL_MS = 100;
 
     std::atomic<bool> multiThreadInfo = false;
-    std::vector<MultiFetchRecord> fetches;
-    _LOCK_T fetchesMutex;
+    // Only ever touched by the multi thread (or once it has stopped), so neither needs a lock
+    std::unordered_map<CURL*, MultiFetchRecord> fetches;
     CURLM* multiHandle = nullptr;
-    _LOCK_T multiHandleMutex;
-    bool multiInitialized = false;
+    // Handed over to the multi thread by performAsync and cancelAsync
+    std::vector<MultiFetchRecord> pendingFetches;
+    std::vector<std::shared_ptr<Fetch>> pendingCancels;
+    _LOCK_T pendingMutex;
+    // Bumped whenever there's something new for the multi thread to look at
+    std::atomic<u32> multiWakeups = 0;
+    bool multiInitialized         = false;
+
+    // Handed over to the completion thread by the multi thread, so that a slow callback never
+    // holds up other transfers
+    std::vector<CompletedFetch> completedFetches;
+    _LOCK_T completedMutex;
+    std::atomic<u32> completionWakeups     = 0;
+    std::atomic<bool> completionThreadInfo = false;
+    bool completionInitialized             = false;
+
+    void wakeMultiThread()
+    {
+        multiWakeups++;
+        multiWakeups.notify_one();
+        curl_multi_wakeup(multiHandle);
+    }
+
+    void completeFetch(MultiFetchRecord&& record, CURLcode result)
+    {
+        __lock_acquire(completedMutex);
+        completedFetches.emplace_back(std::move(record), result);
+        __lock_release(completedMutex);
+        completionWakeups++;
+        completionWakeups.notify_one();
+    }
+
+    // Finished easy handles are reset and kept for the next Fetch. Together with the share handle
+    // (DNS, TLS sessions and open connections), this lets back-to-back requests to the same host
+    // skip the TCP and TLS handshakes.
+    constexpr size_t MAX_IDLE_HANDLES = 8;
+    std::vector<CURL*> idleHandles;
+    _LOCK_T idleHandlesMutex;
+    std::atomic<bool> handlePoolOpen = false;
+    CURLSH* shareHandle              = nullptr;
+    // The share handle exitMulti is done with, if Fetches that outlived it still use it. Guarded
+    // by idleHandlesMutex.
+    CURLSH* retiredShare = nullptr;
+    std::array<_LOCK_T, CURL_LOCK_DATA_LAST> shareLocks;
+
+    void lockShare(CURL*, curl_lock_data data, curl_lock_access, void*)
+    {
+        __lock_acquire(shareLocks[data]);
+    }
+
+    void unlockShare(CURL*, curl_lock_data data, void*)
+    {
+        __lock_release(shareLocks[data]);
+    }
+
+    // Must be called with idleHandlesMutex held. curl_share_cleanup refuses with CURLSHE_IN_USE
+    // while any easy handle still uses the share, and it takes the share's locks itself, so they
+    // can only be closed once it has succeeded.
+    void releaseShare()
+    {
+        if (retiredShare && curl_share_cleanup(retiredShare) == CURLSHE_OK)
+        {
+            retiredShare = nullptr;
+            for (auto& lock : shareLocks)
+            {
+                __lock_close(lock);
+            }
+        }
+    }
+
+    CURL* takeHandle()
+    {
+        CURL* ret = nullptr;
+        if (handlePoolOpen)
+        {
+            __lock_acquire(idleHandlesMutex);
+            if (!idleHandles.empty())
+            {
+                ret = idleHandles.back();
+                idleHandles.pop_back();
+            }
+            __lock_release(idleHandlesMutex);
+        }
+        return ret ? ret : curl_easy_init();
+    }
+
+    void recycleHandle(CURL* handle)
+    {
+        if (handlePoolOpen)
+        {
+            // Forgets all options, but keeps connections and caches
+            curl_easy_reset(handle);
+            __lock_acquire(idleHandlesMutex);
+            if (handlePoolOpen && idleHandles.size() < MAX_IDLE_HANDLES)
+            {
+                idleHandles.emplace_back(handle);
+                handle = nullptr;
+            }
+            __lock_release(idleHandlesMutex);
+        }
+        if (handle)
+        {
+            curl_easy_cleanup(handle);
+            if (!handlePoolOpen)
+            {
+                // The last Fetch to outlive exitMulti frees the share handle
+                __lock_acquire(idleHandlesMutex);
+                releaseShare();
+                __lock_release(idleHandlesMutex);
+            }
+        }
+    }
 
     size_t string_write_callback(char* ptr, size_t size, size_t nmemb, void* userdata)
     {
@@ -64,16 +191,107 @@ namespace
         str->append(ptr, size * nmemb);
         return size * nmemb;
     }
+
+    // Response cache entries are the time they were stored, the ETag and the Last-Modified value,
+    // one per line, followed by the body. Entries are named after a hash of the URL; it only needs
+    // to be stable. Past MAX_CACHE_ENTRIES, the longest stored are dropped.
+    // The host tests point FETCH_CACHE_DIR somewhere they can write to
+#ifndef FETCH_CACHE_DIR
+#define FETCH_CACHE_DIR "/3ds/PKSM/cache/http"
+#endif
+    constexpr std::string_view CACHE_DIR = FETCH_CACHE_DIR;
+    constexpr size_t MAX_CACHE_ENTRIES   = 32;
+
+    std::string cachePath(const std::string& url)
+    {
+        u64 hash = 0xCBF29CE484222325;
+        auto add = [&hash](std::string_view data)
+        {
+            for (char c : data)
+            {
+                hash ^= u8(c);
+                hash *= 0x100000001B3;
+            }
+        };
+        add(url);
+        return std::format("{}/{:016X}", CACHE_DIR, hash);
+    }
+
+    bool readLine(FILE* file, std::string& out)
+    {
+        out.clear();
+        int c;
+        while ((c = fgetc(file)) != EOF && c != '\n')
+        {
+            out += char(c);
+        }
+        return c == '\n';
+    }
+
+    std::string_view trim(std::string_view str)
+    {
+        while (!str.empty() && (str.front() == ' ' || str.front() == '\t'))
+        {
+            str.remove_prefix(1);
+        }
+        while (!str.empty() && (str.back() == ' ' || str.back() == '\t' || str.back() == '\r' ||
+                                   str.back() == '\n'))
+        {
+            str.remove_suffix(1);
+        }
+        return str;
+    }
+
+    void pruneCache()
+    {
+        STDirectory dir{std::string(CACHE_DIR)};
+        std::vector<std::pair<u64, std::string>> entries;
+        for (size_t i = 0; i < dir.count(); i++)
+        {
+            // Leaves alone .part files, which are still being written
+            if (!dir.folder(i) && dir.item(i).find('.') == std::string::npos)
+            {
+                std::string path = std::string(CACHE_DIR) + '/' + dir.item(i);
+                std::string stored;
+                if (FILE* file = fopen(path.c_str(), "rb"))
+                {
+                    readLine(file, stored);
+                    fclose(file);
+                }
+                entries.emplace_back(strtoull(stored.c_str(), nullptr, 10), std::move(path));
+            }
+        }
+        if (entries.size() <= MAX_CACHE_ENTRIES)
+        {
+            return;
+        }
+
+        std::sort(entries.begin(), entries.end());
+        for (size_t i = 0; i < entries.size() - MAX_CACHE_ENTRIES; i++)
+        {
+            remove(entries[i].second.c_str());
+        }
+    }
+
+    // Header names are case-insensitive
+    bool headerIs(std::string_view name, std::string_view lowercase)
+    {
+        return std::equal(name.begin(), name.end(), lowercase.begin(), lowercase.end(),
+            [](char a, char b) { return (a >= 'A' && a <= 'Z' ? a + ('a' - 'A') : a) == b; });
+    }
 }
 
 std::shared_ptr<Fetch> Fetch::init(const std::string& url, bool ssl, std::string* writeData,
-    struct curl_slist* headers, const std::string& postdata)
+    struct curl_slist* headers, const std::string& postdata, bool useCache)
 {
     auto fetch = std::shared_ptr<Fetch>(new Fetch);
-    fetch->curl =
-        std::unique_ptr<CURL, decltype(curl_easy_cleanup)*>(curl_easy_init(), &curl_easy_cleanup);
+    fetch->curl = std::unique_ptr<CURL, decltype(curl_easy_cleanup)*>(takeHandle(), &recycleHandle);
     if (fetch->curl)
     {
+        if (shareHandle)
+        {
+            fetch->setopt(CURLOPT_SHARE, shareHandle);
+        }
         fetch->setopt(CURLOPT_URL, url.c_str());
         fetch->setopt(CURLOPT_HTTPHEADER, headers);
         if (ssl)
@@ -84,6 +302,10 @@ std::shared_ptr<Fetch> Fetch::init(const std::string& url, bool ssl, std::string
         {
             fetch->setopt(CURLOPT_WRITEDATA, writeData);
             fetch->setopt(CURLOPT_WRITEFUNCTION, string_write_callback);
+            if (useCache && postdata.empty())
+            {
+                fetch->setupCache(url, writeData, headers);
+            }
         }
         if (!postdata.empty())
         {
@@ -148,6 +370,134 @@ Result Fetch::download(const std::string& url, const std::string& path, const st
     return 0;
 }
 
+void Fetch::setupCache(const std::string& url, std::string* writeData, struct curl_slist* headers)
+{
+    cache            = std::make_unique<ResponseCache>();
+    cache->path      = cachePath(url);
+    cache->writeData = writeData;
+
+    struct curl_slist* allHeaders = NULL;
+    for (struct curl_slist* header = headers; header; header = header->next)
+    {
+        allHeaders = curl_slist_append(allHeaders, header->data);
+    }
+
+    if (FILE* file = fopen(cache->path.c_str(), "rb"))
+    {
+        std::string stored, etag, lastModified;
+        if (readLine(file, stored) && readLine(file, etag) && readLine(file, lastModified))
+        {
+            cache->hadEntry = true;
+            if (!etag.empty())
+            {
+                allHeaders = curl_slist_append(allHeaders, ("If-None-Match: " + etag).c_str());
+            }
+            if (!lastModified.empty())
+            {
+                allHeaders =
+                    curl_slist_append(allHeaders, ("If-Modified-Since: " + lastModified).c_str());
+            }
+        }
+        fclose(file);
+    }
+
+    cache->headers.reset(allHeaders);
+    setopt(CURLOPT_HTTPHEADER, allHeaders);
+    setopt(CURLOPT_HEADERFUNCTION, cacheHeaderCallback);
+    setopt(CURLOPT_HEADERDATA, cache.get());
+}
+
+size_t Fetch::cacheHeaderCallback(char* buffer, size_t size, size_t nitems, void* userdata)
+{
+    ResponseCache& cache = *(ResponseCache*)userdata;
+    std::string_view line(buffer, size * nitems);
+    if (line.starts_with("HTTP/"))
+    {
+        // Every response of a redirect chain has its own validators
+        cache.etag.clear();
+        cache.lastModified.clear();
+    }
+    else if (size_t colon = line.find(':'); colon != std::string_view::npos)
+    {
+        std::string_view name  = line.substr(0, colon);
+        std::string_view value = trim(line.substr(colon + 1));
+        if (headerIs(name, "etag"))
+        {
+            cache.etag = value;
+        }
+        else if (headerIs(name, "last-modified"))
+        {
+            cache.lastModified = value;
+        }
+    }
+    return size * nitems;
+}
+
+void Fetch::finishCache(CURLcode result)
+{
+    if (!cache || result != CURLE_OK)
+    {
+        return;
+    }
+
+    long status = 0;
+    curl_easy_getinfo(curl.get(), CURLINFO_RESPONSE_CODE, &status);
+    if (status == 304 && cache->hadEntry)
+    {
+        if (FILE* file = fopen(cache->path.c_str(), "rb"))
+        {
+            std::string line;
+            if (readLine(file, line) && readLine(file, line) && readLine(file, line))
+            {
+                // The body is read straight into the caller's string
+                long start = ftell(file);
+                if (start >= 0 && fseek(file, 0, SEEK_END) == 0)
+                {
+                    long end = ftell(file);
+                    if (end >= start && fseek(file, start, SEEK_SET) == 0)
+                    {
+                        cache->writeData->resize(end - start);
+                        cache->hit = fread(cache->writeData->data(), 1, end - start, file) ==
+                                     size_t(end - start);
+                    }
+                }
+            }
+            fclose(file);
+        }
+        if (!cache->hit)
+        {
+            // Make the next request unconditional so that the entry gets replaced
+            remove(cache->path.c_str());
+        }
+    }
+    else if (status == 200)
+    {
+        if (!cache->etag.empty() || !cache->lastModified.empty())
+        {
+            const std::string temp = cache->path + ".part";
+            if (FILE* file = fopen(temp.c_str(), "wb"))
+            {
+                const std::string& body = *cache->writeData;
+                bool good = fprintf(file, "%llu\n%s\n%s\n", (unsigned long long)time(nullptr),
+                                cache->etag.c_str(), cache->lastModified.c_str()) > 0 &&
+                            fwrite(body.data(), 1, body.size(), file) == body.size();
+                good      = fclose(file) == 0 && good;
+                remove(cache->path.c_str());
+                if (!good || rename(temp.c_str(), cache->path.c_str()) != 0)
+                {
+                    remove(temp.c_str());
+                }
+            }
+            pruneCache();
+        }
+        else if (cache->hadEntry)
+        {
+            // No validators to send anymore, so the old entry would never be used again
+            remove(cache->path.c_str());
+        }
+    }
+}
+
 std::unique_ptr<curl_mime, decltype(curl_mime_free)*> Fetch::mimeInit()
 {
     if (curl)
@@ -163,61 +513,142 @@ void Fetch::multiMainThread()
     int trash;
     while (multiThreadInfo)
     {
-        CURLMcode mc;
+        u32 wakeups = multiWakeups;
 
-        __lock_acquire(multiHandleMutex);
-        mc = curl_multi_perform(multiHandle, &trash);
-        __lock_release(multiHandleMutex);
-        if (mc == CURLM_OK)
+        std::vector<MultiFetchRecord> toAdd;
+        std::vector<std::shared_ptr<Fetch>> toCancel;
+        __lock_acquire(pendingMutex);
+        toAdd.swap(pendingFetches);
+        toCancel.swap(pendingCancels);
+        __lock_release(pendingMutex);
+
+        for (auto& record : toAdd)
         {
-            int numFDs;
-            __lock_acquire(multiHandleMutex);
-            mc = curl_multi_wait(multiHandle, nullptr, 0, 1, &numFDs);
-            __lock_release(multiHandleMutex);
-            if (numFDs == 0)
+            CURL* handle = record.fetch->curl.get();
+            if (curl_multi_add_handle(multiHandle, handle) == CURLM_OK)
+            {
+                fetches.emplace(handle, std::move(record));
+            }
+            else
             {
-                static constexpr timespec sleepTime = {0, 1000000};
-                nanosleep(&sleepTime, nullptr);
+                completeFetch(std::move(record), CURLE_FAILED_INIT);
             }
         }
 
-        __lock_acquire(multiHandleMutex);
-        auto msg = curl_multi_info_read(multiHandle, &trash);
-        while (msg != nullptr)
+        for (const auto& fetch : toCancel)
         {
-            // Find the done handle
-            __lock_acquire(fetchesMutex);
-            auto it = std::find_if(fetches.begin(), fetches.end(),
-                [&msg](const MultiFetchRecord& record)
-                { return record.fetch->curl.get() == msg->easy_handle; });
-            // And delete it
+            auto it = fetches.find(fetch->curl.get());
             if (it != fetches.end())
             {
-                if (it->onFinish)
+                curl_multi_remove_handle(multiHandle, it->first);
+                if (it->second.onCancel)
                 {
-                    it->onFinish(msg->data.result, it->fetch);
+                    it->second.onCancel(it->second.fetch);
                 }
-                curl_multi_remove_handle(multiHandle, it->fetch->curl.get());
                 fetches.erase(it);
             }
-            __lock_release(fetchesMutex);
+        }
+
+        if (fetches.empty())
+        {
+            // Sleep until performAsync or exitMulti has something for us
+            multiWakeups.wait(wakeups);
+            continue;
+        }
+
+        curl_multi_perform(multiHandle, &trash);
 
-            msg = curl_multi_info_read(multiHandle, &trash);
+        CURLMsg* msg;
+        while ((msg = curl_multi_info_read(multiHandle, &trash)) != nullptr)
+        {
+            if (msg->msg != CURLMSG_DONE)
+            {
+                continue;
+            }
+            auto it = fetches.find(msg->easy_handle);
+            if (it != fetches.end())
+            {
+                // Copied out first, since msg is no longer valid once the handle is removed
+                CURLcode result = msg->data.result;
+                curl_multi_remove_handle(multiHandle, it->first);
+                completeFetch(std::move(it->second), result);
+                fetches.erase(it);
+            }
         }
-        __lock_release(multiHandleMutex);
 
-        // Terrible things have happened, but I don't know what to do
+        if (!fetches.empty())
+        {
+            // Returns early on socket activity, curl's own timeouts, or wakeMultiThread
+            curl_multi_poll(multiHandle, nullptr, 0, MAX_POLL_MS, nullptr);
+        }
     }
 
     multiThreadInfo = true;
+    multiThreadInfo.notify_all();
+}
+
+void Fetch::completionThread()
+{
+    while (true)
+    {
+        u32 wakeups = completionWakeups;
+
+        std::vector<CompletedFetch> done;
+        __lock_acquire(completedMutex);
+        done.swap(completedFetches);
+        __lock_release(completedMutex);
+
+        for (auto& completed : done)
+        {
+            completed.record.fetch->finishCache(completed.result);
+            if (completed.record.onFinish)
+            {
+                completed.record.onFinish(completed.result, completed.record.fetch);
+            }
+        }
+
+        if (done.empty())
+        {
+            // Everything handed over before exitMulti asked to stop has been run
+            if (!completionThreadInfo)
+            {
+                break;
+            }
+            completionWakeups.wait(wakeups);
+        }
+    }
+
+    completionThreadInfo = true;
+    completionThreadInfo.notify_all();
 }
 
 Result Fetch::initMulti()
 {
-    __lock_init(fetchesMutex);
-    __lock_init(multiHandleMutex);
-    multiHandle     = curl_multi_init();
-    multiThreadInfo = true;
+    __lock_init(pendingMutex);
+    __lock_init(completedMutex);
+    __lock_init(idleHandlesMutex);
+    for (auto& lock : shareLocks)
+    {
+        __lock_init(lock);
+    }
+    if ((shareHandle = curl_share_init()))
+    {
+        curl_share_setopt(shareHandle, CURLSHOPT_LOCKFUNC, lockShare);
+        curl_share_setopt(shareHandle, CURLSHOPT_UNLOCKFUNC, unlockShare);
+        curl_share_setopt(shareHandle, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+        curl_share_setopt(shareHandle, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+        curl_share_setopt(shareHandle, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+    }
+    handlePoolOpen       = true;
+    completionThreadInfo = true;
+    if (!Threads::create(COMPLETION_STACK_SIZE, Fetch::completionThread))
+    {
+        completionInitialized = false;
+        return -1;
+    }
+    completionInitialized = true;
+    multiHandle           = curl_multi_init();
+    multiThreadInfo       = true;
     if (!Threads::create(8 * 1024, Fetch::multiMainThread))
     {
         multiInitialized = false;
@@ -232,21 +663,54 @@ void Fetch::exitMulti()
     multiThreadInfo = false; // Stop multi thread
     if (multiInitialized)
     {
+        wakeMultiThread();
         multiThreadInfo.wait(false); // Wait for it to be done
         // And finally clean up
-        __lock_acquire(fetchesMutex);
-        __lock_acquire(multiHandleMutex);
         for (const auto& i : fetches)
         {
-            curl_multi_remove_handle(multiHandle, i.fetch->curl.get());
+            curl_multi_remove_handle(multiHandle, i.first);
         }
         fetches.clear();
-        __lock_release(fetchesMutex);
-        __lock_close(fetchesMutex);
+        __lock_acquire(pendingMutex);
+        pendingFetches.clear();
+        pendingCancels.clear();
+        __lock_release(pendingMutex);
+        __lock_close(pendingMutex);
         curl_multi_cleanup(multiHandle);
-        __lock_release(multiHandleMutex);
-        __lock_close(multiHandleMutex);
     }
+    if (completionInitialized)
+    {
+        // Lets it run whatever the multi thread handed over before stopping
+        completionThreadInfo = false;
+        completionWakeups++;
+        completionWakeups.notify_one();
+        completionThreadInfo.wait(false);
+        __lock_close(completedMutex);
+    }
+
+    // Fetches still alive after this clean up their own handles
+    __lock_acquire(idleHandlesMutex);
+    handlePoolOpen = false;
+    for (CURL* handle : idleHandles)
+    {
+        curl_easy_cleanup(handle);
+    }
+    idleHandles.clear();
+    if (shareHandle)
+    {
+        // Only succeeds now if no such Fetches are left; otherwise the last of them does it
+        retiredShare = shareHandle;
+        shareHandle  = nullptr;
+        releaseShare();
+    }
+    else
+    {
+        for (auto& lock : shareLocks)
+        {
+            __lock_close(lock);
+        }
+    }
+    __lock_release(idleHandlesMutex);
 }
 
 CURLMcode Fetch::performAsync(std::shared_ptr<Fetch> fetch,
@@ -255,16 +719,15 @@ CURLMcode Fetch::performAsync(std::shared_ptr<Fetch> fetch,
 {
     if (multiInitialized)
     {
-        __lock_acquire(multiHandleMutex);
-        CURLMcode res = curl_multi_add_handle(multiHandle, fetch->curl.get());
-        __lock_release(multiHandleMutex);
-        if (res == CURLM_OK)
+        if (!fetch || !fetch->curl)
         {
-            __lock_acquire(fetchesMutex);
-            fetches.emplace_back(fetch, std::move(onComplete), std::move(onCancel));
-            __lock_release(fetchesMutex);
+            return CURLM_BAD_EASY_HANDLE;
         }
-        return res;
+        __lock_acquire(pendingMutex);
+        pendingFetches.emplace_back(fetch, std::move(onComplete), std::move(onCancel));
+        __lock_release(pendingMutex);
+        wakeMultiThread();
+        return CURLM_OK;
     }
     else
     {
@@ -276,27 +739,10 @@ void Fetch::cancelAsync(std::shared_ptr<Fetch> fetch)
 {
     if (multiInitialized)
     {
-        __lock_acquire(multiHandleMutex);
-        CURLMcode res = curl_multi_remove_handle(multiHandle, fetch->curl.get());
-        __lock_release(multiHandleMutex);
-        if (res == CURLM_OK)
-        {
-            __lock_acquire(fetchesMutex);
-            for (auto i = fetches.begin(); i != fetches.end(); ++i)
-            {
-                if (i->fetch == fetch)
-                {
-                    if (i->onCancel)
-                    {
-                        i->onCancel(i->fetch);
-                    }
-                    fetches.erase(i);
-                    break;
-                }
-            }
-            __lock_release(fetchesMutex);
-        }
-        // better not fail
+        __lock_acquire(pendingMutex);
+        pendingCancels.emplace_back(fetch);
+        __lock_release(pendingMutex);
+        wakeMultiThread();
     }
 }
 
@@ -311,6 +757,7 @@ std::variant<CURLMcode, CURLcode> Fetch::perform(std::shared_ptr<Fetch> fetch)
             {
                 cres = code;
                 wait.test_and_set();
+                wait.notify_one();
             });
         if (mRes != CURLM_OK)
         {
@@ -0,0 +1,229 @@
+/*
+ *   This file is part of PKSM
+ *   Copyright (C) 2016-2022 Bernardo Giordano, Admiral Fish, piepie62
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *   Additional Terms 7.b and 7.c of GPLv3 apply to this file:
+ *       * Requiring preservation of specified reasonable legal notices or
+ *         author attributions in that material or in the Appropriate Legal
+ *         Notices displayed by works containing it.
+ *       * Prohibiting misrepresentation of the origin of that material,
+ *         or requiring that modified versions of such material be marked in
+ *         reasonable ways as different from the original version.
+ */
+
+// Host backend for Threads, used when building the common code outside of the 3DS (tests,
+// benchmarks, tooling). Mirrors 3ds/source/utils/thread.cpp, with pthreads standing in for libctru
+// threads and a POSIX semaphore standing in for LightSemaphore.
+#if !defined(__3DS__)
+
+#include "thread.hpp"
+#include "MPMCQueue.hpp"
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <limits.h>
+#include <mutex>
+#include <pthread.h>
+#include <semaphore.h>
+#include <thread>
+#include <unistd.h>
+
+namespace
+{
+    struct ThreadStart
+    {
+        void (*entrypoint)(void*);
+        void* arg;
+    };
+
+    std::atomic<int> liveThreads = 0;
+
+    void* threadMain(void* rawStart)
+    {
+        ThreadStart start = *reinterpret_cast<ThreadStart*>(rawStart);
+        delete reinterpret_cast<ThreadStart*>(rawStart);
+        start.entrypoint(start.arg);
+        liveThreads--;
+        return nullptr;
+    }
+
+    struct Task
+    {
+        void (*entrypoint)(void*);
+        void* arg;
+    };
+
+    MPMCQueue<Task, 1024> workerTasks;
+    std::mutex overflowMutex;
+    std::deque<Task> overflowTasks;
+    std::atomic<u32> overflowCount = 0;
+    sem_t moreTasks;
+    std::atomic<u8> numWorkers    = 0;
+    std::atomic<u8> freeWorkers   = 0;
+    std::atomic<bool> exitWorkers = false;
+    u8 maxWorkers                 = 0;
+    u8 minWorkers                 = 0;
+
+    void pushTask(const Task& task)
+    {
+        if (!workerTasks.push(task))
+        {
+            std::lock_guard lock(overflowMutex);
+            overflowTasks.emplace_back(task);
+            overflowCount++;
+        }
+    }
+
+    bool popTask(Task& task)
+    {
+        if (workerTasks.pop(task))
+        {
+            return true;
+        }
+        if (overflowCount > 0)
+        {
+            std::lock_guard lock(overflowMutex);
+            if (!overflowTasks.empty())
+            {
+                task = overflowTasks.front();
+                overflowTasks.pop_front();
+                overflowCount--;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void taskWorkerThread()
+    {
+        numWorkers++;
+        while (!exitWorkers)
+        {
+            if (sem_trywait(&moreTasks) != 0)
+            {
+                if (numWorkers <= minWorkers)
+                {
+                    freeWorkers++;
+                    while (sem_wait(&moreTasks) != 0) {}
+                    freeWorkers--;
+                }
+                else
+                {
+                    break;
+                }
+            }
+
+            Task t{};
+            while (!exitWorkers && !popTask(t))
+            {
+                sched_yield();
+            }
+
+            if (exitWorkers)
+            {
+                break;
+            }
+
+            t.entrypoint(t.arg);
+        }
+        numWorkers--;
+    }
+}
+
+bool Threads::init(u8 min, u8 max)
+{
+    minWorkers  = min;
+    maxWorkers  = max;
+    exitWorkers = false;
+    if (sem_init(&moreTasks, 0, 0) != 0)
+    {
+        return false;
+    }
+    for (int i = 0; i < minWorkers; i++)
+    {
+        if (!Threads::create(WORKER_STACK, taskWorkerThread))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Threads::create(void (*entrypoint)(void*), void* arg, std::optional<size_t> stackSize)
+{
+    if (++liveThreads > Threads::MAX_THREADS)
+    {
+        liveThreads--;
+        return false;
+    }
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_attr_setstacksize(
+        &attr, std::max(stackSize.value_or(DEFAULT_STACK), size_t(PTHREAD_STACK_MIN)));
+
+    pthread_t thread;
+    ThreadStart* start = new ThreadStart{entrypoint, arg};
+    bool ret           = pthread_create(&thread, &attr, threadMain, start) == 0;
+    pthread_attr_destroy(&attr);
+
+    if (!ret)
+    {
+        delete start;
+        liveThreads--;
+    }
+    return ret;
+}
+
+void Threads::executeTask(void (*task)(void*), void* arg)
+{
+    pushTask(Task{task, arg});
+    sem_post(&moreTasks);
+    if (numWorkers < maxWorkers && freeWorkers == 0)
+    {
+        Threads::create(WORKER_STACK, taskWorkerThread);
+    }
+}
+
+u8 Threads::cores()
+{
+    return std::clamp(std::thread::hardware_concurrency(), 1u, unsigned(Threads::MAX_THREADS));
+}
+
+void Threads::exit(void)
+{
+    exitWorkers = true;
+    workerTasks.clear();
+    {
+        std::lock_guard lock(overflowMutex);
+        overflowTasks.clear();
+        overflowCount = 0;
+    }
+    // Like the 3DS reaper, wait for every thread that was started to finish. Keep waking workers,
+    // since one may have been starting up while exitWorkers was set.
+    while (liveThreads > 0)
+    {
+        for (u8 i = 0; i < numWorkers; i++)
+        {
+            sem_post(&moreTasks);
+        }
+        usleep(1000);
+    }
+    sem_destroy(&moreTasks);
+}
+
+#endif
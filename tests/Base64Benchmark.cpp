@@ -0,0 +1,206 @@
+/*
+ *   This file is part of PKSM
+ *   Copyright (C) 2016-2022 Bernardo Giordano, Admiral Fish, piepie62
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *   Additional Terms 7.b and 7.c of GPLv3 apply to this file:
+ *       * Requiring preservation of specified reasonable legal notices or
+ *         author attributions in that material or in the Appropriate Legal
+ *         Notices displayed by works containing it.
+ *       * Prohibiting misrepresentation of the origin of that material,
+ *         or requiring that modified versions of such material be marked in
+ *         reasonable ways as different from the original version.
+ */
+
+#include "base64.hpp"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <functional>
+#include <random>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+// Compares base64_encode and base64_decode, and their _into versions, with the implementation they
+// replaced, from a single Pokémon up to a whole save
+namespace old
+{
+    // clang-format off
+    constexpr std::array<char, 64> encoding_table = {
+        'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H',
+        'I', 'J', 'K', 'L', 'M', 'N', 'O', 'P',
+        'Q', 'R', 'S', 'T', 'U', 'V', 'W', 'X',
+        'Y', 'Z', 'a', 'b', 'c', 'd', 'e', 'f',
+        'g', 'h', 'i', 'j', 'k', 'l', 'm', 'n',
+        'o', 'p', 'q', 'r', 's', 't', 'u', 'v',
+        'w', 'x', 'y', 'z', '0', '1', '2', '3',
+        '4', '5', '6', '7', '8', '9', '+', '/'
+    };
+    // clang-format on
+    constexpr std::array<char, 256> decoding_table = std::invoke(
+        []()
+        {
+            std::array<char, 256> ret = {0};
+            for (size_t i = 0; i < encoding_table.size(); i++)
+            {
+                ret[encoding_table[i]] = i;
+            }
+            return ret;
+        });
+
+    std::vector<u8> base64_decode(std::span<const u8> data)
+    {
+        if (data.size() % 4 != 0)
+        {
+            return {};
+        }
+
+        size_t output_length = data.size() / 4 * 3;
+        if (data[data.size() - 1] == '=')
+        {
+            output_length--;
+        }
+        if (data[data.size() - 2] == '=')
+        {
+            output_length--;
+        }
+
+        std::vector<unsigned char> ret(output_length);
+
+        for (size_t i = 0, j = 0; i < data.size();)
+        {
+            uint32_t sextet_a = data[i] == '=' ? 0 & i++ : decoding_table[(size_t)data[i++]];
+            uint32_t sextet_b = data[i] == '=' ? 0 & i++ : decoding_table[(size_t)data[i++]];
+            uint32_t sextet_c = data[i] == '=' ? 0 & i++ : decoding_table[(size_t)data[i++]];
+            uint32_t sextet_d = data[i] == '=' ? 0 & i++ : decoding_table[(size_t)data[i++]];
+
+            uint32_t triple = (sextet_a << 3 * 6) + (sextet_b << 2 * 6) + (sextet_c << 1 * 6) +
+                              (sextet_d << 0 * 6);
+
+            if (j < output_length)
+            {
+                ret[j++] = (triple >> 2 * 8) & 0xFF;
+            }
+            if (j < output_length)
+            {
+                ret[j++] = (triple >> 1 * 8) & 0xFF;
+            }
+            if (j < output_length)
+            {
+                ret[j++] = (triple >> 0 * 8) & 0xFF;
+            }
+        }
+
+        return ret;
+    }
+
+    std::string base64_encode(std::span<const u8> data)
+    {
+        std::string ret(4 * ((data.size() + 2) / 3), '=');
+        size_t out_index = 0;
+
+        for (size_t i = 0, j = 0; i < data.size(); j += 4)
+        {
+            uint32_t octet_a = i < data.size() ? (unsigned char)data[i++] : 0;
+            uint32_t octet_b = i < data.size() ? (unsigned char)data[i++] : 0;
+            uint32_t octet_c = i < data.size() ? (unsigned char)data[i++] : 0;
+
+            uint32_t triple = (octet_a << 0x10) + (octet_b << 0x08) + octet_c;
+
+            ret[out_index++] = encoding_table[(triple >> 3 * 6) & 0x3F];
+            ret[out_index++] = encoding_table[(triple >> 2 * 6) & 0x3F];
+            ret[out_index++] = encoding_table[(triple >> 1 * 6) & 0x3F];
+            ret[out_index++] = encoding_table[(triple >> 0 * 6) & 0x3F];
+        }
+
+        return ret;
+    }
+}
+
+namespace
+{
+    // Each measurement goes through about this many bytes of raw data
+    constexpr size_t BYTES_PER_RUN = 16 << 20;
+    constexpr int REPEATS          = 3;
+    // A party PK8, an 8 KiB block and a Sun/Moon save. The first isn't a multiple of three, so
+    // padding is included.
+    constexpr std::array<size_t, 3> SIZES = {0x158, 0x2000, 0x6BE00};
+
+    // Keeps the results alive, so that none of the work can be optimised out
+    u64 sink = 0;
+
+    // Best of REPEATS, in megabytes of raw data per second, whichever way it's converted
+    template <typename Func>
+    double throughput(size_t size, Func&& func)
+    {
+        const size_t runs = std::max<size_t>(1, BYTES_PER_RUN / size);
+        double best       = 1e30;
+        for (int i = 0; i < REPEATS; i++)
+        {
+            auto start = std::chrono::steady_clock::now();
+            for (size_t run = 0; run < runs; run++)
+            {
+                sink += func();
+            }
+            std::chrono::duration<double> took = std::chrono::steady_clock::now() - start;
+            best = std::min(best, took.count());
+        }
+        return double(runs * size) / best / 1e6;
+    }
+}
+
+int main()
+{
+    std::mt19937 rng(0x5EED);
+
+    printf("MB/s of raw data, best of %d\n", REPEATS);
+    printf("%8s %10s %10s %12s %10s %10s %12s\n", "bytes", "old enc", "encode", "encode_into",
+        "old dec", "decode", "decode_into");
+    for (size_t size : SIZES)
+    {
+        std::vector<u8> data(size);
+        for (u8& byte : data)
+        {
+            byte = rng();
+        }
+        const std::string encoded = base64_encode(data);
+        const std::span<const u8> text{(const u8*)encoded.data(), encoded.size()};
+        std::vector<char> encodeOut(base64_encoded_size(size));
+        std::vector<u8> decodeOut(size);
+
+        double oldEncode  = throughput(size, [&] { return old::base64_encode(data).back(); });
+        double encode     = throughput(size, [&] { return base64_encode(data).back(); });
+        double encodeInto = throughput(size,
+            [&]
+            {
+                base64_encode_into(data, encodeOut);
+                return encodeOut.back();
+            });
+        double oldDecode  = throughput(size, [&] { return old::base64_decode(text).back(); });
+        double decode     = throughput(size, [&] { return base64_decode(text).back(); });
+        double decodeInto = throughput(size,
+            [&]
+            {
+                base64_decode_into(text, decodeOut);
+                return decodeOut.back();
+            });
+
+        printf("%8zu %10.1f %10.1f %12.1f %10.1f %10.1f %12.1f\n", size, oldEncode, encode,
+            encodeInto, oldDecode, decode, decodeInto);
+    }
+    printf("(checksum %llu)\n", (unsigned long long)sink);
+    return 0;
+}
@@ -0,0 +1,221 @@
+/*
+ *   This file is part of PKSM
+ *   Copyright (C) 2016-2022 Bernardo Giordano, Admiral Fish, piepie62
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *   Additional Terms 7.b and 7.c of GPLv3 apply to this file:
+ *       * Requiring preservation of specified reasonable legal notices or
+ *         author attributions in that material or in the Appropriate Legal
+ *         Notices displayed by works containing it.
+ *       * Prohibiting misrepresentation of the origin of that material,
+ *         or requiring that modified versions of such material be marked in
+ *         reasonable ways as different from the original version.
+ */
+
+#include "base64.hpp"
+#include "check.hpp"
+#include <array>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace
+{
+    // Decodes by the same rules as the implementation base64 had before it was rewritten, one
+    // character at a time, as the reference for what decoding should produce
+    namespace reference
+    {
+        constexpr char encoding_table[] =
+            "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+        u32 decodeChar(u8 c)
+        {
+            for (u32 i = 0; i < 64; i++)
+            {
+                if (u8(encoding_table[i]) == c)
+                {
+                    return i;
+                }
+            }
+            return 0;
+        }
+
+        std::vector<u8> decode(const std::string& data)
+        {
+            if (data.empty() || data.size() % 4 != 0)
+            {
+                return {};
+            }
+
+            size_t output_length = data.size() / 4 * 3;
+            if (data[data.size() - 1] == '=')
+            {
+                output_length--;
+            }
+            if (data[data.size() - 2] == '=')
+            {
+                output_length--;
+            }
+
+            std::vector<u8> ret(output_length);
+            for (size_t i = 0, j = 0; i < data.size(); i += 4)
+            {
+                u32 triple = decodeChar(data[i]) << 3 * 6 | decodeChar(data[i + 1]) << 2 * 6 |
+                             decodeChar(data[i + 2]) << 1 * 6 | decodeChar(data[i + 3]) << 0 * 6;
+                for (int shift = 2; shift >= 0 && j < output_length; shift--)
+                {
+                    ret[j++] = (triple >> shift * 8) & 0xFF;
+                }
+            }
+            return ret;
+        }
+
+        // Emits padding, unlike the old encoder, which overwrote it with 'A'
+        std::string encode(const std::vector<u8>& data)
+        {
+            std::string ret;
+            for (size_t i = 0; i < data.size(); i += 3)
+            {
+                u32 triple = u32(data[i]) << 0x10;
+                if (i + 1 < data.size())
+                {
+                    triple |= u32(data[i + 1]) << 0x08;
+                }
+                if (i + 2 < data.size())
+                {
+                    triple |= u32(data[i + 2]);
+                }
+                ret += encoding_table[(triple >> 3 * 6) & 0x3F];
+                ret += encoding_table[(triple >> 2 * 6) & 0x3F];
+                ret += i + 1 < data.size() ? encoding_table[(triple >> 1 * 6) & 0x3F] : '=';
+                ret += i + 2 < data.size() ? encoding_table[(triple >> 0 * 6) & 0x3F] : '=';
+            }
+            return ret;
+        }
+    }
+
+    std::vector<u8> bytes(const std::string& str)
+    {
+        return std::vector<u8>(str.begin(), str.end());
+    }
+
+    // The test vectors from RFC 4648
+    void knownValues()
+    {
+        const std::array<std::pair<std::string, std::string>, 7> vectors = {
+            {{"", ""}, {"f", "Zg=="}, {"fo", "Zm8="}, {"foo", "Zm9v"}, {"foob", "Zm9vYg=="},
+                {"fooba", "Zm9vYmE="}, {"foobar", "Zm9vYmFy"}}};
+        for (const auto& [plain, encoded] : vectors)
+        {
+            CHECK(base64_encode(bytes(plain)) == encoded);
+            CHECK(base64_decode(encoded) == bytes(plain));
+            CHECK(base64_encoded_size(plain.size()) == encoded.size());
+        }
+    }
+
+    void sizes()
+    {
+        CHECK(base64_decoded_size(bytes("")) == 0);
+        CHECK(base64_decoded_size(bytes("Zm9")) == 0);
+        CHECK(base64_decoded_size(bytes("Zm9vY")) == 0);
+        CHECK(base64_decoded_size(bytes("Zm9v")) == 3);
+        CHECK(base64_decoded_size(bytes("Zm8=")) == 2);
+        CHECK(base64_decoded_size(bytes("Zg==")) == 1);
+        CHECK(base64_decoded_size(bytes("Zm9vZg==")) == 4);
+        CHECK(base64_decode(std::string_view("Zm9vY")).empty());
+    }
+
+    void intoBuffers()
+    {
+        std::array<u8, 6> decoded;
+        CHECK(base64_decode_into(std::string_view("Zm9vYmE="), std::span(decoded)) == 5);
+        CHECK(std::string(decoded.begin(), decoded.begin() + 5) == "fooba");
+        CHECK(base64_decode_into(std::string_view("Zm9vYmE="), std::span(decoded).first(4)) == 0);
+        CHECK(base64_decode_into(std::string_view("Zm9vY"), std::span(decoded)) == 0);
+
+        // Nothing past what was asked for gets written
+        std::array<char, 10> encoded;
+        encoded.fill('#');
+        std::vector<u8> in = bytes("fooba");
+        CHECK(base64_encode_into(in, std::span(encoded)) == 8);
+        CHECK(std::string(encoded.begin(), encoded.end()) == "Zm9vYmE=##");
+        CHECK(base64_encode_into(in, std::span(encoded).first(7)) == 0);
+    }
+
+    void roundTrips(std::mt19937& rng)
+    {
+        for (size_t size = 0; size < 300; size++)
+        {
+            std::vector<u8> data(size);
+            for (u8& byte : data)
+            {
+                byte = rng();
+            }
+            std::string encoded = base64_encode(data);
+            CHECK(encoded == reference::encode(data));
+            CHECK(base64_decode(encoded) == data);
+        }
+    }
+
+    // Decoding anything, padding in odd places and bytes outside the alphabet included, must give
+    // the same result as the old decoder did
+    void fuzzDecode(std::mt19937& rng)
+    {
+        const std::string alphabet =
+            std::string(reference::encoding_table) + "====" + std::string("\0\xff\n -_.", 7);
+        for (int i = 0; i < 20000; i++)
+        {
+            std::string input(4 * (1 + rng() % 16), '\0');
+            for (char& c : input)
+            {
+                c = rng() % 8 == 0 ? char(rng()) : alphabet[rng() % alphabet.size()];
+            }
+            // Most real input ends in padding, so make sure plenty of that is covered
+            switch (rng() % 3)
+            {
+                case 0:
+                    input.back() = '=';
+                    break;
+                case 1:
+                    input[input.size() - 2] = '=';
+                    input.back()            = '=';
+                    break;
+                default:
+                    break;
+            }
+
+            std::vector<u8> expected = reference::decode(input);
+            std::vector<u8> decoded  = base64_decode(input);
+            if (decoded != expected)
+            {
+                fprintf(stderr, "Decoding differs for input %d\n", i);
+            }
+            CHECK(decoded == expected);
+        }
+    }
+}
+
+int main()
+{
+    std::mt19937 rng(0x504B534D);
+
+    knownValues();
+    sizes();
+    intoBuffers();
+    roundTrips(rng);
+    fuzzDecode(rng);
+
+    return checkResult();
+}
@@ -0,0 +1,211 @@
+/*
+ *   This file is part of PKSM
+ *   Copyright (C) 2016-2022 Bernardo Giordano, Admiral Fish, piepie62
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *   Additional Terms 7.b and 7.c of GPLv3 apply to this file:
+ *       * Requiring preservation of specified reasonable legal notices or
+ *         author attributions in that material or in the Appropriate Legal
+ *         Notices displayed by works containing it.
+ *       * Prohibiting misrepresentation of the origin of that material,
+ *         or requiring that modified versions of such material be marked in
+ *         reasonable ways as different from the original version.
+ */
+
+#include "ChunkPipeline.hpp"
+#include "check.hpp"
+#include "thread.hpp"
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    std::vector<u8> randomData(size_t size, u32 seed)
+    {
+        std::mt19937 rng(seed);
+        std::vector<u8> ret(size);
+        for (u8& byte : ret)
+        {
+            byte = rng();
+        }
+        return ret;
+    }
+
+    // Reads that sometimes take a while, so that the read-ahead gets ahead of the writes and falls
+    // behind them in turn
+    void jitter(u64 offset)
+    {
+        if (offset % 3 == 0)
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+    }
+
+    // Writes have to come in order, from the calling thread, one whole chunk at a time. A chunk
+    // size of 0 is taken as 1.
+    bool copies(u64 size, u32 chunkSize, size_t buffers)
+    {
+        const std::vector<u8> in = randomData(size, u32(size * 31 + chunkSize));
+        std::vector<u8> out(size);
+        const auto caller = std::this_thread::get_id();
+        u64 nextOffset    = 0;
+        bool inOrder      = true;
+
+        Result res = ChunkPipeline::copy(
+            size,
+            [&in](u64 offset, void* buffer, u32 length) -> Result
+            {
+                jitter(offset);
+                memcpy(buffer, in.data() + offset, length);
+                return 0;
+            },
+            [&](u64 offset, const void* buffer, u32 length) -> Result
+            {
+                inOrder = inOrder && offset == nextOffset && std::this_thread::get_id() == caller &&
+                          length == std::min<u64>(std::max<u32>(chunkSize, 1), size - offset);
+                memcpy(out.data() + offset, buffer, length);
+                nextOffset = offset + length;
+                return 0;
+            },
+            chunkSize, buffers);
+
+        bool good = res == 0 && inOrder && nextOffset == size && out == in;
+        if (!good)
+        {
+            fprintf(stderr, "Copying %llu bytes in chunks of %u through %zu buffers failed\n",
+                (unsigned long long)size, chunkSize, buffers);
+        }
+        return good;
+    }
+
+    void sizes()
+    {
+        for (size_t buffers : {size_t(0), size_t(1), size_t(2), size_t(3), size_t(8)})
+        {
+            CHECK(copies(0, 16, buffers));
+            CHECK(copies(1, 16, buffers));
+            CHECK(copies(15, 16, buffers));
+            CHECK(copies(16, 16, buffers));
+            CHECK(copies(17, 16, buffers));
+            CHECK(copies(1000, 16, buffers));
+            CHECK(copies(1000, 1, buffers));
+            CHECK(copies(100000, 4096, buffers));
+        }
+        CHECK(copies(100, 0, 2));
+    }
+
+    // After a failure, copy has to return that failure, write nothing more, and never call read
+    // again once it has returned
+    void failures()
+    {
+        constexpr u64 SIZE  = 64 * 100;
+        constexpr u32 CHUNK = 64;
+        for (u64 failAt : {u64(0), u64(CHUNK), u64(CHUNK * 37), u64(SIZE - CHUNK)})
+        {
+            std::atomic<u32> reads = 0;
+            u64 writtenTo          = 0;
+
+            Result res = ChunkPipeline::copy(
+                SIZE,
+                [&reads, failAt](u64 offset, void*, u32) -> Result
+                {
+                    reads++;
+                    jitter(offset);
+                    return offset == failAt ? -5 : 0;
+                },
+                [&writtenTo](u64 offset, const void*, u32 length) -> Result
+                {
+                    writtenTo = offset + length;
+                    return 0;
+                },
+                CHUNK, 4);
+            u32 readsAtReturn = reads;
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            CHECK(res == -5);
+            CHECK(writtenTo <= failAt);
+            CHECK(reads == readsAtReturn);
+        }
+
+        for (u64 failAt : {u64(0), u64(CHUNK * 50), u64(SIZE - CHUNK)})
+        {
+            std::atomic<u32> reads = 0;
+            u64 writes             = 0;
+
+            Result res = ChunkPipeline::copy(
+                SIZE,
+                [&reads](u64 offset, void*, u32) -> Result
+                {
+                    reads++;
+                    jitter(offset);
+                    return 0;
+                },
+                [&writes, failAt](u64 offset, const void*, u32) -> Result
+                {
+                    writes++;
+                    return offset == failAt ? -6 : 0;
+                },
+                CHUNK, 4);
+            u32 readsAtReturn = reads;
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            CHECK(res == -6);
+            CHECK(writes == failAt / CHUNK + 1);
+            CHECK(reads == readsAtReturn);
+        }
+    }
+
+    // With every worker busy copying, there's nobody left to read ahead, so the callers have to
+    // read for themselves
+    void fromWorkers()
+    {
+        constexpr size_t TASKS   = 12;
+        std::atomic<size_t> good = 0;
+        std::atomic<size_t> done = 0;
+        for (size_t task = 0; task < TASKS; task++)
+        {
+            Threads::executeTask(
+                [&good, &done, task]
+                {
+                    if (copies(50000 + task, 512, 3))
+                    {
+                        good++;
+                    }
+                    done++;
+                    done.notify_all();
+                });
+        }
+        size_t seen;
+        while ((seen = done) != TASKS)
+        {
+            done.wait(seen);
+        }
+        CHECK(good == TASKS);
+    }
+}
+
+int main()
+{
+    Threads::init(1, 4);
+
+    sizes();
+    failures();
+    fromWorkers();
+
+    Threads::exit();
+    return checkResult();
+}
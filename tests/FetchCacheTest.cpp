@@ -0,0 +1,228 @@
+/*
+ *   This file is part of PKSM
+ *   Copyright (C) 2016-2022 Bernardo Giordano, Admiral Fish, piepie62
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *   Additional Terms 7.b and 7.c of GPLv3 apply to this file:
+ *       * Requiring preservation of specified reasonable legal notices or
+ *         author attributions in that material or in the Appropriate Legal
+ *         Notices displayed by works containing it.
+ *       * Prohibiting misrepresentation of the origin of that material,
+ *         or requiring that modified versions of such material be marked in
+ *         reasonable ways as different from the original version.
+ */
+
+#include "HttpServer.hpp"
+#include "STDirectory.hpp"
+#include "check.hpp"
+#include "fetch.hpp"
+#include <format>
+#include <map>
+#include <mutex>
+#include <stdio.h>
+#include <string>
+#include <sys/stat.h>
+
+namespace
+{
+    const std::string CACHE_DIR = FETCH_CACHE_DIR;
+
+    // Serves "<path>:<version>" with that as its ETag, answering 304 when asked for the version it
+    // already has. POSTs get "posted", with an ETag all the same. /plain has no validators.
+    class VersionedServer
+    {
+    public:
+        VersionedServer()
+            : server([this](const HttpServer::Request& request) { return answer(request); })
+        {
+        }
+
+        void bump(const std::string& path)
+        {
+            std::lock_guard lock(mutex);
+            versions[path]++;
+        }
+
+        HttpServer server;
+
+    private:
+        HttpServer::Response answer(const HttpServer::Request& request)
+        {
+            if (request.method == "POST")
+            {
+                return {.headers = {{"ETag", "\"posted\""}}, .body = "posted"};
+            }
+            if (request.path == "/plain")
+            {
+                return {.body = "plain"};
+            }
+
+            std::lock_guard lock(mutex);
+            std::string body = request.path + ':' + std::to_string(versions[request.path]);
+            std::string etag = '"' + body + '"';
+            auto sent        = request.headers.find("if-none-match");
+            if (sent != request.headers.end() && sent->second == etag)
+            {
+                return {.status = 304, .headers = {{"ETag", etag}}};
+            }
+            return {.headers = {{"ETag", etag}}, .body = body};
+        }
+
+        std::mutex mutex;
+        std::map<std::string, int> versions;
+    };
+
+    size_t entryCount()
+    {
+        STDirectory dir(CACHE_DIR);
+        return dir.count();
+    }
+
+    bool stored(int time)
+    {
+        struct stat info;
+        return stat(std::format("{}/{:016X}", CACHE_DIR, time).c_str(), &info) == 0;
+    }
+
+    void clearCache()
+    {
+        mkdir(CACHE_DIR.c_str(), 0777);
+        STDirectory dir(CACHE_DIR);
+        for (size_t i = 0; i < dir.count(); i++)
+        {
+            remove((CACHE_DIR + '/' + dir.item(i)).c_str());
+        }
+    }
+
+    // Returns the status the caller sees
+    long fetch(const std::string& url, std::string& out, const std::string& postData = "")
+    {
+        out.clear();
+        auto fetch = Fetch::init(url, false, &out, nullptr, postData, true);
+        CHECK(fetch != nullptr);
+        auto res = Fetch::perform(fetch);
+        CHECK(res.index() == 1 && std::get<1>(res) == CURLE_OK);
+        long status = 0;
+        fetch->getinfo(CURLINFO_RESPONSE_CODE, &status);
+        return status;
+    }
+
+    std::string lastIfNoneMatch(const HttpServer& server)
+    {
+        auto request = server.requests().back();
+        auto header  = request.headers.find("if-none-match");
+        return header == request.headers.end() ? "" : header->second;
+    }
+
+    void revalidation()
+    {
+        clearCache();
+        VersionedServer versioned;
+        HttpServer& server = versioned.server;
+        std::string out;
+
+        // Nothing cached yet, so the first request is unconditional
+        CHECK(fetch(server.url("/a"), out) == 200);
+        CHECK(out == "/a:0");
+        CHECK(lastIfNoneMatch(server) == "");
+        CHECK(entryCount() == 1);
+
+        // A 304 is filled in from the cache and reported as a 200
+        CHECK(fetch(server.url("/a"), out) == 200);
+        CHECK(out == "/a:0");
+        CHECK(lastIfNoneMatch(server) == "\"/a:0\"");
+        CHECK(server.requests().size() == 2);
+
+        // A changed response replaces the entry
+        versioned.bump("/a");
+        CHECK(fetch(server.url("/a"), out) == 200);
+        CHECK(out == "/a:1");
+        CHECK(fetch(server.url("/a"), out) == 200);
+        CHECK(out == "/a:1");
+        CHECK(lastIfNoneMatch(server) == "\"/a:1\"");
+        CHECK(entryCount() == 1);
+
+        // Without validators there is nothing to keep
+        CHECK(fetch(server.url("/plain"), out) == 200);
+        CHECK(out == "plain");
+        CHECK(entryCount() == 1);
+    }
+
+    void postsBypassCache()
+    {
+        clearCache();
+        VersionedServer versioned;
+        HttpServer& server = versioned.server;
+        std::string out;
+
+        CHECK(fetch(server.url("/a"), out) == 200);
+        CHECK(entryCount() == 1);
+
+        // Not made conditional, though /a is cached, and not stored, though it has an ETag
+        CHECK(fetch(server.url("/a"), out, "data") == 200);
+        CHECK(out == "posted");
+        CHECK(server.requests().back().method == "POST");
+        CHECK(lastIfNoneMatch(server) == "");
+        CHECK(fetch(server.url("/b"), out, "data") == 200);
+        CHECK(entryCount() == 1);
+
+        // The GET's entry is untouched
+        CHECK(fetch(server.url("/a"), out) == 200);
+        CHECK(out == "/a:0");
+        CHECK(lastIfNoneMatch(server) == "\"/a:0\"");
+    }
+
+    void eviction()
+    {
+        clearCache();
+        VersionedServer versioned;
+        HttpServer& server = versioned.server;
+        std::string out;
+
+        // A full cache, stored at times 1 to 32 and named after them
+        for (int i = 1; i <= 32; i++)
+        {
+            if (FILE* file = fopen(std::format("{}/{:016X}", CACHE_DIR, i).c_str(), "wb"))
+            {
+                fprintf(file, "%d\n\"old\"\n\nold", i);
+                fclose(file);
+            }
+        }
+        CHECK(entryCount() == 32);
+
+        // The 33rd entry pushes out the one stored first
+        CHECK(fetch(server.url("/new"), out) == 200);
+        CHECK(entryCount() == 32);
+        CHECK(!stored(1));
+        CHECK(stored(2));
+
+        CHECK(fetch(server.url("/new"), out) == 200);
+        CHECK(out == "/new:0");
+        CHECK(lastIfNoneMatch(server) == "\"/new:0\"");
+    }
+}
+
+int main()
+{
+    curl_global_init(CURL_GLOBAL_ALL);
+    CHECK(Fetch::initMulti() == 0);
+    revalidation();
+    postsBypassCache();
+    eviction();
+    Fetch::exitMulti();
+    clearCache();
+    curl_global_cleanup();
+    return checkResult();
+}
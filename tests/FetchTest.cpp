@@ -0,0 +1,177 @@
+/*
+ *   This file is part of PKSM
+ *   Copyright (C) 2016-2022 Bernardo Giordano, Admiral Fish, piepie62
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *   Additional Terms 7.b and 7.c of GPLv3 apply to this file:
+ *       * Requiring preservation of specified reasonable legal notices or
+ *         author attributions in that material or in the Appropriate Legal
+ *         Notices displayed by works containing it.
+ *       * Prohibiting misrepresentation of the origin of that material,
+ *         or requiring that modified versions of such material be marked in
+ *         reasonable ways as different from the original version.
+ */
+
+#include "HttpServer.hpp"
+#include "check.hpp"
+#include "fetch.hpp"
+#include <dlfcn.h>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Fetch's calls to these resolve to the definitions below, which count them and hand over to
+// libcurl's own. So do libcurl's: its connection caches keep an easy handle of their own.
+namespace
+{
+    std::mutex curlCallsMutex;
+    size_t easyInits    = 0;
+    size_t easyCleanups = 0;
+    // Results of curl_share_cleanup, and how many easy handles had been cleaned up at the time
+    std::vector<std::pair<CURLSHcode, size_t>> shareCleanups;
+
+    template <typename Func>
+    Func* real(const char* name)
+    {
+        return (Func*)dlsym(RTLD_NEXT, name);
+    }
+}
+
+extern "C" CURL* curl_easy_init()
+{
+    static auto next = real<CURL*()>("curl_easy_init");
+    std::lock_guard lock(curlCallsMutex);
+    easyInits++;
+    return next();
+}
+
+extern "C" void curl_easy_cleanup(CURL* handle)
+{
+    static auto next = real<void(CURL*)>("curl_easy_cleanup");
+    next(handle);
+    std::lock_guard lock(curlCallsMutex);
+    easyCleanups++;
+}
+
+extern "C" CURLSHcode curl_share_cleanup(CURLSH* share)
+{
+    static auto next = real<CURLSHcode(CURLSH*)>("curl_share_cleanup");
+    CURLSHcode ret   = next(share);
+    std::lock_guard lock(curlCallsMutex);
+    shareCleanups.emplace_back(ret, easyCleanups);
+    return ret;
+}
+
+namespace
+{
+    HttpServer::Response echoPath(const HttpServer::Request& request)
+    {
+        return {.body = request.path};
+    }
+
+    // Counts from here on only Fetch's own handles
+    void initMulti()
+    {
+        CHECK(Fetch::initMulti() == 0);
+        std::lock_guard lock(curlCallsMutex);
+        easyInits = easyCleanups = 0;
+        shareCleanups.clear();
+    }
+
+    std::shared_ptr<Fetch> get(const std::string& url, std::string& out)
+    {
+        auto fetch = Fetch::init(url, false, &out, nullptr, "");
+        CHECK(fetch != nullptr);
+        auto res = Fetch::perform(fetch);
+        CHECK(res.index() == 1 && std::get<1>(res) == CURLE_OK);
+        // The completion thread lets go of it just after perform returns
+        while (fetch.use_count() > 1)
+        {
+            std::this_thread::yield();
+        }
+        return fetch;
+    }
+
+    long newConnections(Fetch& fetch)
+    {
+        long ret = -1;
+        fetch.getinfo(CURLINFO_NUM_CONNECTS, &ret);
+        return ret;
+    }
+
+    // A finished Fetch's easy handle goes back to the pool and is given to the next one, still
+    // connected
+    void handleReuse()
+    {
+        HttpServer server(echoPath);
+        initMulti();
+
+        std::string first, second;
+        CHECK(newConnections(*get(server.url("/first"), first)) == 1);
+        CHECK(first == "/first");
+        auto fetch = get(server.url("/second"), second);
+        CHECK(second == "/second");
+        CHECK(newConnections(*fetch) == 0);
+        CHECK(easyInits == 1);
+        CHECK(server.connections() == 1);
+        fetch = nullptr;
+
+        Fetch::exitMulti();
+        CHECK(easyCleanups == easyInits);
+        CHECK(shareCleanups.size() == 1 && shareCleanups.back().first == CURLSHE_OK);
+    }
+
+    // Fetches alive at the same time have separate easy handles, but the connection is shared.
+    // One of them outlives exitMulti, so the share handle has to wait for it.
+    void connectionSharing()
+    {
+        HttpServer server(echoPath);
+        initMulti();
+
+        std::string first, second;
+        auto held  = get(server.url("/first"), first);
+        auto fetch = get(server.url("/second"), second);
+        CHECK(first == "/first" && second == "/second");
+        CHECK(easyInits == 2);
+        CHECK(newConnections(*fetch) == 0);
+        CHECK(server.connections() == 1);
+        fetch = nullptr;
+
+        Fetch::exitMulti();
+        CHECK(easyCleanups == 1);
+        CHECK(shareCleanups.size() == 1 && shareCleanups.back().first == CURLSHE_IN_USE);
+
+        held = nullptr;
+        CHECK(easyCleanups == 2);
+        CHECK(shareCleanups.size() == 2 && shareCleanups.back().first == CURLSHE_OK);
+        CHECK(shareCleanups.back().second == 2);
+
+        // Nothing is left to free it twice
+        std::string after;
+        auto late = Fetch::init(server.url("/late"), false, &after, nullptr, "");
+        late      = nullptr;
+        CHECK(shareCleanups.size() == 2);
+    }
+}
+
+int main()
+{
+    curl_global_init(CURL_GLOBAL_ALL);
+    handleReuse();
+    connectionSharing();
+    curl_global_cleanup();
+    return checkResult();
+}
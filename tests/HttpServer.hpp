@@ -0,0 +1,224 @@
+/*
+ *   This file is part of PKSM
+ *   Copyright (C) 2016-2022 Bernardo Giordano, Admiral Fish, piepie62
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *   Additional Terms 7.b and 7.c of GPLv3 apply to this file:
+ *       * Requiring preservation of specified reasonable legal notices or
+ *         author attributions in that material or in the Appropriate Legal
+ *         Notices displayed by works containing it.
+ *       * Prohibiting misrepresentation of the origin of that material,
+ *         or requiring that modified versions of such material be marked in
+ *         reasonable ways as different from the original version.
+ */
+
+#ifndef HTTPSERVER_HPP
+#define HTTPSERVER_HPP
+
+#include <arpa/inet.h>
+#include <ctype.h>
+#include <atomic>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <netinet/in.h>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// A stand-in HTTP/1.1 server on the loopback interface, for testing Fetch without the network. It
+// keeps connections alive, so tests can tell from connections() whether curl reused them.
+class HttpServer
+{
+public:
+    struct Request
+    {
+        std::string method;
+        std::string path;
+        // Header names are lowercased
+        std::map<std::string, std::string> headers;
+        std::string body;
+    };
+
+    struct Response
+    {
+        int status = 200;
+        std::vector<std::pair<std::string, std::string>> headers;
+        std::string body;
+    };
+
+    explicit HttpServer(std::function<Response(const Request&)> handler)
+        : handler(std::move(handler))
+    {
+        listener = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in address{};
+        address.sin_family      = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t length        = sizeof(address);
+        bind(listener, (sockaddr*)&address, length);
+        listen(listener, 16);
+        getsockname(listener, (sockaddr*)&address, &length);
+        port         = ntohs(address.sin_port);
+        acceptThread = std::thread(&HttpServer::acceptLoop, this);
+    }
+
+    ~HttpServer()
+    {
+        stopping = true;
+        shutdown(listener, SHUT_RDWR);
+        acceptThread.join();
+        close(listener);
+        // Nothing adds to these once the accept thread is done; the lock is only for the
+        // requests the connection threads record
+        for (int client : clients)
+        {
+            shutdown(client, SHUT_RDWR);
+        }
+        for (std::thread& thread : clientThreads)
+        {
+            thread.join();
+        }
+        for (int client : clients)
+        {
+            close(client);
+        }
+    }
+
+    std::string url(const std::string& path) const
+    {
+        return "http://127.0.0.1:" + std::to_string(port) + path;
+    }
+
+    // How many connections curl has opened so far
+    size_t connections() const { return accepted; }
+
+    std::vector<Request> requests() const
+    {
+        std::lock_guard lock(mutex);
+        return received;
+    }
+
+private:
+    void acceptLoop()
+    {
+        int client;
+        while ((client = accept(listener, nullptr, nullptr)) >= 0 && !stopping)
+        {
+            accepted++;
+            clients.emplace_back(client);
+            clientThreads.emplace_back(&HttpServer::serve, this, client);
+        }
+        if (client >= 0)
+        {
+            close(client);
+        }
+    }
+
+    // Answers requests on one connection until curl closes it
+    void serve(int client)
+    {
+        std::string buffer;
+        char chunk[4096];
+        while (true)
+        {
+            size_t headerEnd;
+            while ((headerEnd = buffer.find("\r\n\r\n")) == std::string::npos)
+            {
+                ssize_t got = recv(client, chunk, sizeof(chunk), 0);
+                if (got <= 0)
+                {
+                    return;
+                }
+                buffer.append(chunk, got);
+            }
+
+            Request request;
+            size_t lineEnd  = buffer.find("\r\n");
+            std::string top = buffer.substr(0, lineEnd);
+            size_t space    = top.find(' ');
+            request.method  = top.substr(0, space);
+            request.path    = top.substr(space + 1, top.find(' ', space + 1) - space - 1);
+            while (lineEnd < headerEnd)
+            {
+                size_t next      = buffer.find("\r\n", lineEnd + 2);
+                std::string line = buffer.substr(lineEnd + 2, next - lineEnd - 2);
+                size_t colon     = line.find(':');
+                std::string name = line.substr(0, colon);
+                for (char& c : name)
+                {
+                    c = tolower(c);
+                }
+                size_t value          = line.find_first_not_of(' ', colon + 1);
+                request.headers[name] = value == std::string::npos ? "" : line.substr(value);
+                lineEnd               = next;
+            }
+            buffer.erase(0, headerEnd + 4);
+
+            size_t bodySize = 0;
+            if (auto length = request.headers.find("content-length");
+                length != request.headers.end())
+            {
+                bodySize = std::stoul(length->second);
+            }
+            while (buffer.size() < bodySize)
+            {
+                ssize_t got = recv(client, chunk, sizeof(chunk), 0);
+                if (got <= 0)
+                {
+                    return;
+                }
+                buffer.append(chunk, got);
+            }
+            request.body = buffer.substr(0, bodySize);
+            buffer.erase(0, bodySize);
+
+            Response response = handler(request);
+            {
+                std::lock_guard lock(mutex);
+                received.emplace_back(std::move(request));
+            }
+            std::string out = "HTTP/1.1 " + std::to_string(response.status) + " " +
+                              (response.status == 304 ? "Not Modified" : "OK") + "\r\n";
+            for (const auto& [name, value] : response.headers)
+            {
+                out += name + ": " + value + "\r\n";
+            }
+            if (response.status != 304)
+            {
+                out += "Content-Length: " + std::to_string(response.body.size()) + "\r\n";
+            }
+            out += "\r\n" + response.body;
+            if (send(client, out.data(), out.size(), MSG_NOSIGNAL) != ssize_t(out.size()))
+            {
+                return;
+            }
+        }
+    }
+
+    std::function<Response(const Request&)> handler;
+    int listener;
+    int port;
+    std::thread acceptThread;
+    std::atomic<bool> stopping   = false;
+    std::atomic<size_t> accepted = 0;
+    mutable std::mutex mutex;
+    std::vector<int> clients;
+    std::vector<std::thread> clientThreads;
+    std::vector<Request> received;
+};
+
+#endif
@@ -0,0 +1,159 @@
+/*
+ *   This file is part of PKSM
+ *   Copyright (C) 2016-2022 Bernardo Giordano, Admiral Fish, piepie62
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *   Additional Terms 7.b and 7.c of GPLv3 apply to this file:
+ *       * Requiring preservation of specified reasonable legal notices or
+ *         author attributions in that material or in the Appropriate Legal
+ *         Notices displayed by works containing it.
+ *       * Prohibiting misrepresentation of the origin of that material,
+ *         or requiring that modified versions of such material be marked in
+ *         reasonable ways as different from the original version.
+ */
+
+#include "MPMCQueue.hpp"
+#include "check.hpp"
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    void fillAndDrain()
+    {
+        MPMCQueue<u32, 8> queue;
+        u32 value = 0;
+        CHECK(!queue.pop(value));
+
+        // Go around the ring several times so that the sequence numbers wrap past the capacity
+        u32 next = 0;
+        for (int round = 0; round < 5; round++)
+        {
+            for (u32 i = 0; i < 8; i++)
+            {
+                CHECK(queue.push(next + i));
+            }
+            CHECK(!queue.push(0xFFFFFFFF));
+            for (u32 i = 0; i < 8; i++)
+            {
+                CHECK(queue.pop(value));
+                CHECK(value == next + i);
+            }
+            CHECK(!queue.pop(value));
+            next += 8;
+        }
+    }
+
+    void interleaved()
+    {
+        MPMCQueue<u32, 4> queue;
+        u32 pushed = 0;
+        u32 popped = 0;
+        u32 value  = 0;
+        for (int i = 0; i < 100; i++)
+        {
+            while (queue.push(pushed))
+            {
+                pushed++;
+            }
+            for (int j = 0; j < 3 && queue.pop(value); j++)
+            {
+                CHECK(value == popped);
+                popped++;
+            }
+        }
+        queue.clear();
+        CHECK(!queue.pop(value));
+        CHECK(queue.push(pushed));
+        CHECK(queue.pop(value) && value == pushed);
+    }
+
+    // Every value has to come out exactly once, and each consumer has to see any one producer's
+    // values in the order they were pushed
+    void concurrent()
+    {
+        constexpr u32 PRODUCERS    = 4;
+        constexpr u32 CONSUMERS    = 4;
+        constexpr u32 PER_PRODUCER = 50000;
+
+        MPMCQueue<u32, 64> queue;
+        std::vector<std::atomic<u8>> seen(PRODUCERS * PER_PRODUCER);
+        std::atomic<u32> consumed    = 0;
+        std::atomic<bool> outOfOrder = false;
+
+        std::vector<std::thread> threads;
+        for (u32 producer = 0; producer < PRODUCERS; producer++)
+        {
+            threads.emplace_back(
+                [&queue, producer]
+                {
+                    for (u32 i = 0; i < PER_PRODUCER; i++)
+                    {
+                        while (!queue.push(producer * PER_PRODUCER + i))
+                        {
+                            std::this_thread::yield();
+                        }
+                    }
+                });
+        }
+        for (u32 consumer = 0; consumer < CONSUMERS; consumer++)
+        {
+            threads.emplace_back(
+                [&]
+                {
+                    std::vector<s64> last(PRODUCERS, -1);
+                    u32 value;
+                    while (consumed < PRODUCERS * PER_PRODUCER)
+                    {
+                        if (!queue.pop(value))
+                        {
+                            std::this_thread::yield();
+                            continue;
+                        }
+                        u32 producer = value / PER_PRODUCER;
+                        if (s64(value % PER_PRODUCER) <= last[producer])
+                        {
+                            outOfOrder = true;
+                        }
+                        last[producer] = value % PER_PRODUCER;
+                        seen[value]++;
+                        consumed++;
+                    }
+                });
+        }
+        for (auto& thread : threads)
+        {
+            thread.join();
+        }
+
+        CHECK(consumed == PRODUCERS * PER_PRODUCER);
+        CHECK(!outOfOrder);
+        size_t wrong = 0;
+        for (const auto& count : seen)
+        {
+            wrong += count != 1;
+        }
+        CHECK(wrong == 0);
+    }
+}
+
+int main()
+{
+    fillAndDrain();
+    interleaved();
+    concurrent();
+    return checkResult();
+}
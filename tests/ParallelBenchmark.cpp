@@ -0,0 +1,113 @@
+/*
+ *   This file is part of PKSM
+ *   Copyright (C) 2016-2022 Bernardo Giordano, Admiral Fish, piepie62
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *   Additional Terms 7.b and 7.c of GPLv3 apply to this file:
+ *       * Requiring preservation of specified reasonable legal notices or
+ *         author attributions in that material or in the Appropriate Legal
+ *         Notices displayed by works containing it.
+ *       * Prohibiting misrepresentation of the origin of that material,
+ *         or requiring that modified versions of such material be marked in
+ *         reasonable ways as different from the original version.
+ */
+
+#include "parallel.hpp"
+#include "thread.hpp"
+#include <algorithm>
+#include <chrono>
+#include <stdio.h>
+#include <thread>
+#include <vector>
+
+// Times parallelFor and parallelReduce with 1 up to hardware_concurrency pool workers. The calling
+// thread always takes its share of the chunks too.
+namespace
+{
+    constexpr size_t ITEMS   = 1 << 22;
+    constexpr size_t GRAIN   = 4096;
+    constexpr int REPEATS    = 5;
+    constexpr int MIX_ROUNDS = 16;
+
+    u32 mix(u32 x)
+    {
+        for (int i = 0; i < MIX_ROUNDS; i++)
+        {
+            x ^= x >> 16;
+            x *= 0x7FEB352D;
+            x ^= x >> 15;
+            x *= 0x846CA68B;
+        }
+        return x;
+    }
+
+    // Best of REPEATS, in milliseconds
+    template <typename Func>
+    double time(Func&& func)
+    {
+        double best = 1e30;
+        for (int i = 0; i < REPEATS; i++)
+        {
+            auto start = std::chrono::steady_clock::now();
+            func();
+            std::chrono::duration<double, std::milli> took =
+                std::chrono::steady_clock::now() - start;
+            best = std::min(best, took.count());
+        }
+        return best;
+    }
+}
+
+int main()
+{
+    const unsigned maxWorkers = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<u32> out(ITEMS);
+    u64 check = 0;
+
+    printf("%zu items, grain %zu, best of %d\n", ITEMS, GRAIN, REPEATS);
+    printf("%8s %14s %8s %14s %8s\n", "workers", "for (ms)", "speedup", "reduce (ms)", "speedup");
+
+    double baseFor    = 0;
+    double baseReduce = 0;
+    for (unsigned workers = 1; workers <= maxWorkers; workers++)
+    {
+        Threads::init(workers, workers);
+
+        double forTime = time(
+            [&out]
+            { Threads::parallelFor(0, ITEMS, GRAIN, [&out](size_t i) { out[i] = mix(i); }); });
+        double reduceTime = time(
+            [&check]
+            {
+                check += Threads::parallelReduce(
+                    0, ITEMS, GRAIN, u64(0), [](size_t i) { return u64(mix(i)); },
+                    [](u64 a, u64 b) { return a + b; });
+            });
+
+        Threads::exit();
+
+        if (workers == 1)
+        {
+            baseFor    = forTime;
+            baseReduce = reduceTime;
+        }
+        printf("%8u %14.2f %7.2fx %14.2f %7.2fx\n", workers, forTime, baseFor / forTime,
+            reduceTime, baseReduce / reduceTime);
+    }
+
+    // Keeps the work from being optimized away
+    printf("checksum %08X\n", u32(check) ^ out[ITEMS / 2]);
+    return 0;
+}
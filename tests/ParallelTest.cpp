@@ -0,0 +1,152 @@
+/*
+ *   This file is part of PKSM
+ *   Copyright (C) 2016-2022 Bernardo Giordano, Admiral Fish, piepie62
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *   Additional Terms 7.b and 7.c of GPLv3 apply to this file:
+ *       * Requiring preservation of specified reasonable legal notices or
+ *         author attributions in that material or in the Appropriate Legal
+ *         Notices displayed by works containing it.
+ *       * Prohibiting misrepresentation of the origin of that material,
+ *         or requiring that modified versions of such material be marked in
+ *         reasonable ways as different from the original version.
+ */
+
+#include "check.hpp"
+#include "parallel.hpp"
+#include "thread.hpp"
+#include <atomic>
+#include <numeric>
+#include <string>
+#include <vector>
+
+namespace
+{
+    // Every index in the range has to be visited exactly once, and nothing outside of it
+    void covers(size_t begin, size_t end, size_t grain)
+    {
+        std::vector<std::atomic<u32>> visits(end + 8);
+        Threads::parallelFor(begin, end, grain, [&visits](size_t i) { visits[i]++; });
+
+        size_t wrong = 0;
+        for (size_t i = 0; i < visits.size(); i++)
+        {
+            wrong += visits[i] != (i >= begin && i < end ? 1 : 0);
+        }
+        if (wrong != 0)
+        {
+            fprintf(stderr, "parallelFor(%zu, %zu, %zu) visited %zu indices wrongly\n", begin, end,
+                grain, wrong);
+        }
+        CHECK(wrong == 0);
+    }
+
+    void reduceSums()
+    {
+        for (size_t grain : {size_t(0), size_t(1), size_t(7), size_t(1000), size_t(50000)})
+        {
+            u64 sum = Threads::parallelReduce(
+                10, 20010, grain, u64(0), [](size_t i) { return u64(i) * i; },
+                [](u64 a, u64 b) { return a + b; });
+            u64 expected = 0;
+            for (u64 i = 10; i < 20010; i++)
+            {
+                expected += i * i;
+            }
+            CHECK(sum == expected);
+        }
+        CHECK(Threads::parallelReduce(
+                  5, 5, 4, u64(42), [](size_t i) { return u64(i); },
+                  [](u64 a, u64 b) { return a + b; }) == 42);
+    }
+
+    // Concatenation is associative but not commutative, so this only comes out right if the
+    // chunks are combined in order
+    void reduceInOrder()
+    {
+        std::string expected;
+        for (size_t i = 0; i < 2000; i++)
+        {
+            expected += char('a' + i % 26);
+        }
+        std::string joined = Threads::parallelReduce(
+            0, 2000, 13, std::string(), [](size_t i) { return std::string(1, char('a' + i % 26)); },
+            [](std::string a, const std::string& b) { return a + b; });
+        CHECK(joined == expected);
+    }
+
+    // With one-index chunks, neighbouring chunks finish at the same time on different threads.
+    // Their results must not share storage, as they would in a std::vector<bool>.
+    void reduceBools()
+    {
+        for (int round = 0; round < 20; round++)
+        {
+            bool all = Threads::parallelReduce(
+                0, 4096, 1, true, [](size_t i) { return i != 5000; },
+                [](bool a, bool b) { return a && b; });
+            bool any = Threads::parallelReduce(
+                0, 4096, 1, false, [](size_t i) { return i == 4095; },
+                [](bool a, bool b) { return a || b; });
+            CHECK(all);
+            CHECK(any);
+        }
+    }
+
+    // The calling thread does its share of the chunks, so this finishes even when every worker is
+    // the caller of another parallelFor
+    void fromWorkers()
+    {
+        constexpr size_t TASKS    = 16;
+        std::atomic<size_t> total = 0;
+        std::atomic<size_t> done  = 0;
+        for (size_t task = 0; task < TASKS; task++)
+        {
+            Threads::executeTask(
+                [&total, &done]
+                {
+                    Threads::parallelFor(0, 1000, 10, [&total](size_t) { total++; });
+                    done++;
+                    done.notify_all();
+                });
+        }
+        size_t seen;
+        while ((seen = done) != TASKS)
+        {
+            done.wait(seen);
+        }
+        CHECK(total == TASKS * 1000);
+    }
+}
+
+int main()
+{
+    Threads::init(2, 8);
+
+    covers(0, 0, 1);
+    covers(5, 3, 1);
+    covers(0, 1, 0);
+    covers(0, 100, 1);
+    covers(0, 100, 7);
+    covers(3, 100, 200);
+    covers(17, 100000, 64);
+
+    reduceSums();
+    reduceInOrder();
+    reduceBools();
+    fromWorkers();
+
+    Threads::exit();
+    return checkResult();
+}
@@ -0,0 +1,261 @@
+/*
+ *   This file is part of PKSM
+ *   Copyright (C) 2016-2022 Bernardo Giordano, Admiral Fish, piepie62
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *   Additional Terms 7.b and 7.c of GPLv3 apply to this file:
+ *       * Requiring preservation of specified reasonable legal notices or
+ *         author attributions in that material or in the Appropriate Legal
+ *         Notices displayed by works containing it.
+ *       * Prohibiting misrepresentation of the origin of that material,
+ *         or requiring that modified versions of such material be marked in
+ *         reasonable ways as different from the original version.
+ */
+
+#include "DataMutex.hpp"
+#include "MPMCQueue.hpp"
+#include "thread.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <semaphore.h>
+#include <stdio.h>
+#include <thread>
+#include <vector>
+
+// Compares the lock-free task queue with the mutex-guarded std::vector that the worker pool used
+// before it: first the queues on their own, then a whole pool running trivial tasks through each
+namespace
+{
+    struct Task
+    {
+        void (*entrypoint)(void*);
+        void* arg;
+    };
+
+    constexpr u32 QUEUE_ITEMS = 1 << 16;
+    constexpr u32 POOL_TASKS  = 20000;
+    constexpr int REPEATS     = 3;
+
+    // The queue the pool had before, as it was used: append at the back, take from the front
+    class VectorQueue
+    {
+    public:
+        bool push(const Task& task)
+        {
+            tasks.lock()->emplace_back(task);
+            return true;
+        }
+
+        bool pop(Task& out)
+        {
+            auto locked = tasks.lock();
+            if (locked->empty())
+            {
+                return false;
+            }
+            out = locked->front();
+            locked->erase(locked->begin());
+            return true;
+        }
+
+    private:
+        DataMutex<std::vector<Task>> tasks;
+    };
+
+    using LockFreeQueue = MPMCQueue<Task, 1024>;
+
+    // Best of REPEATS, in seconds
+    template <typename Func>
+    double time(Func&& func)
+    {
+        double best = 1e30;
+        for (int i = 0; i < REPEATS; i++)
+        {
+            auto start = std::chrono::steady_clock::now();
+            func();
+            std::chrono::duration<double> took = std::chrono::steady_clock::now() - start;
+            best = std::min(best, took.count());
+        }
+        return best;
+    }
+
+    template <typename Queue>
+    double queueThroughput(u32 producers, u32 consumers)
+    {
+        return time(
+            [producers, consumers]
+            {
+                Queue queue;
+                std::atomic<u32> popped = 0;
+                std::vector<std::thread> threads;
+                for (u32 producer = 0; producer < producers; producer++)
+                {
+                    threads.emplace_back(
+                        [&queue, producers]
+                        {
+                            for (u32 i = 0; i < QUEUE_ITEMS / producers; i++)
+                            {
+                                while (!queue.push(Task{nullptr, nullptr}))
+                                {
+                                    std::this_thread::yield();
+                                }
+                            }
+                        });
+                }
+                for (u32 consumer = 0; consumer < consumers; consumer++)
+                {
+                    threads.emplace_back(
+                        [&queue, &popped, producers]
+                        {
+                            const u32 total = QUEUE_ITEMS / producers * producers;
+                            Task task;
+                            while (popped < total)
+                            {
+                                if (queue.pop(task))
+                                {
+                                    popped++;
+                                }
+                                else
+                                {
+                                    std::this_thread::yield();
+                                }
+                            }
+                        });
+                }
+                for (auto& thread : threads)
+                {
+                    thread.join();
+                }
+            });
+    }
+
+    void countTask(void* counter)
+    {
+        std::atomic<u32>& done = *reinterpret_cast<std::atomic<u32>*>(counter);
+        if (++done == POOL_TASKS)
+        {
+            done.notify_all();
+        }
+    }
+
+    void waitFor(std::atomic<u32>& done)
+    {
+        u32 seen;
+        while ((seen = done) != POOL_TASKS)
+        {
+            done.wait(seen);
+        }
+    }
+
+    // The pool as it was: workers sleep on a semaphore and take tasks out of the locked vector
+    double vectorPool(u32 workers)
+    {
+        return time(
+            [workers]
+            {
+                VectorQueue queue;
+                sem_t moreTasks;
+                sem_init(&moreTasks, 0, 0);
+                std::atomic<bool> exit = false;
+                std::vector<std::thread> threads;
+                for (u32 i = 0; i < workers; i++)
+                {
+                    threads.emplace_back(
+                        [&]
+                        {
+                            Task task;
+                            while (true)
+                            {
+                                while (sem_wait(&moreTasks) != 0) {}
+                                if (exit)
+                                {
+                                    return;
+                                }
+                                if (queue.pop(task))
+                                {
+                                    task.entrypoint(task.arg);
+                                }
+                            }
+                        });
+                }
+
+                std::atomic<u32> done = 0;
+                for (u32 i = 0; i < POOL_TASKS; i++)
+                {
+                    queue.push(Task{countTask, &done});
+                    sem_post(&moreTasks);
+                }
+                waitFor(done);
+
+                exit = true;
+                for (u32 i = 0; i < workers; i++)
+                {
+                    sem_post(&moreTasks);
+                }
+                for (auto& thread : threads)
+                {
+                    thread.join();
+                }
+                sem_destroy(&moreTasks);
+            });
+    }
+
+    // The pool as it is now, through the pthread backend of Threads
+    double currentPool(u32 workers)
+    {
+        Threads::init(workers, workers);
+        double ret = time(
+            []
+            {
+                std::atomic<u32> done = 0;
+                for (u32 i = 0; i < POOL_TASKS; i++)
+                {
+                    Threads::executeTask(countTask, &done);
+                }
+                waitFor(done);
+            });
+        Threads::exit();
+        return ret;
+    }
+}
+
+int main()
+{
+    const u32 cores = std::max(1u, std::thread::hardware_concurrency());
+
+    printf("Queues on their own: %u items, millions of items per second, best of %d\n",
+        QUEUE_ITEMS, REPEATS);
+    printf("%9s %9s %12s %12s\n", "producers", "consumers", "vector", "lock-free");
+    for (u32 threads : {1u, 2u, 4u})
+    {
+        double vector   = queueThroughput<VectorQueue>(threads, threads);
+        double lockFree = queueThroughput<LockFreeQueue>(threads, threads);
+        printf("%9u %9u %12.2f %12.2f\n", threads, threads, QUEUE_ITEMS / vector / 1e6,
+            QUEUE_ITEMS / lockFree / 1e6);
+    }
+
+    printf("\nWorker pools: %u trivial tasks, thousands of tasks per second, best of %d\n",
+        POOL_TASKS, REPEATS);
+    printf("%9s %12s %12s\n", "workers", "vector", "lock-free");
+    for (u32 workers = 1; workers <= std::max(cores, 2u); workers *= 2)
+    {
+        double vector   = vectorPool(workers);
+        double lockFree = currentPool(workers);
+        printf("%9u %12.1f %12.1f\n", workers, POOL_TASKS / vector / 1e3,
+            POOL_TASKS / lockFree / 1e3);
+    }
+    return 0;
+}
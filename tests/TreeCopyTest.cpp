@@ -0,0 +1,333 @@
+/*
+ *   This file is part of PKSM
+ *   Copyright (C) 2016-2022 Bernardo Giordano, Admiral Fish, piepie62
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *   Additional Terms 7.b and 7.c of GPLv3 apply to this file:
+ *       * Requiring preservation of specified reasonable legal notices or
+ *         author attributions in that material or in the Appropriate Legal
+ *         Notices displayed by works containing it.
+ *       * Prohibiting misrepresentation of the origin of that material,
+ *         or requiring that modified versions of such material be marked in
+ *         reasonable ways as different from the original version.
+ */
+
+#include "TreeCopy.hpp"
+#include "check.hpp"
+#include "thread.hpp"
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <set>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+namespace
+{
+    const std::string MANIFEST = "TreeCopyTest.manifest";
+
+    struct Tree
+    {
+        std::set<std::u16string> folders;
+        // Contents and stamp of each file
+        std::map<std::u16string, std::pair<std::string, u64>> files;
+
+        bool operator==(const Tree&) const = default;
+    };
+
+    std::u16string parentOf(const std::u16string& path)
+    {
+        size_t slash = path.rfind(u'/');
+        return slash == std::u16string::npos ? u"" : path.substr(0, slash);
+    }
+
+    std::u16string nameOf(const std::u16string& path)
+    {
+        size_t slash = path.rfind(u'/');
+        return slash == std::u16string::npos ? path : path.substr(slash + 1);
+    }
+
+    bool inside(const std::u16string& path, const std::u16string& folder)
+    {
+        return path.size() > folder.size() && path.starts_with(folder) &&
+               path[folder.size()] == u'/';
+    }
+
+    // Copies between two in-memory trees, counting what it does and failing on request
+    struct MemoryCopy
+    {
+        Tree source;
+        Tree destination;
+        std::vector<std::u16string> copied;
+        size_t failAfter = SIZE_MAX;
+        bool reconcile   = true;
+        std::mutex mutex;
+
+        void list(const Tree& tree, const std::u16string& folder, std::vector<TreeCopy::Entry>& out)
+        {
+            for (const auto& path : tree.folders)
+            {
+                if (parentOf(path) == folder)
+                {
+                    out.push_back({nameOf(path), 0, true, 0});
+                }
+            }
+            for (const auto& [path, file] : tree.files)
+            {
+                if (parentOf(path) == folder)
+                {
+                    out.push_back({nameOf(path), file.first.size(), false, file.second});
+                }
+            }
+        }
+
+        TreeCopy::Backend backend()
+        {
+            TreeCopy::Backend backend;
+            backend.list = [this](const std::u16string& folder, std::vector<TreeCopy::Entry>& out)
+            {
+                std::lock_guard lock(mutex);
+                list(source, folder, out);
+                return Result(0);
+            };
+            backend.makeFolder = [this](const std::u16string& folder)
+            {
+                std::lock_guard lock(mutex);
+                if (!folder.empty())
+                {
+                    destination.folders.insert(folder);
+                }
+                return Result(0);
+            };
+            backend.copyFile =
+                [this](const TreeCopy::Entry& file, const std::function<void(u64)>& progress)
+            {
+                std::string data;
+                {
+                    std::lock_guard lock(mutex);
+                    if (copied.size() >= failAfter)
+                    {
+                        return Result(-1);
+                    }
+                    copied.push_back(file.path);
+                    data = source.files.at(file.path).first;
+                }
+                for (u64 done = 0; done < data.size(); done = std::min<u64>(done + 7, data.size()))
+                {
+                    progress(done);
+                }
+                progress(data.size());
+
+                std::lock_guard lock(mutex);
+                destination.files[file.path] = {data, source.files.at(file.path).second};
+                return Result(0);
+            };
+            if (reconcile)
+            {
+                backend.listDestination =
+                    [this](const std::u16string& folder, std::vector<TreeCopy::Entry>& out)
+                {
+                    std::lock_guard lock(mutex);
+                    list(destination, folder, out);
+                    return Result(0);
+                };
+                backend.remove = [this](const TreeCopy::Entry& entry)
+                {
+                    std::lock_guard lock(mutex);
+                    if (entry.folder)
+                    {
+                        std::erase_if(destination.folders,
+                            [&entry](const auto& folder)
+                            { return folder == entry.path || inside(folder, entry.path); });
+                        std::erase_if(destination.files,
+                            [&entry](const auto& file) { return inside(file.first, entry.path); });
+                    }
+                    else
+                    {
+                        destination.files.erase(entry.path);
+                    }
+                    return Result(0);
+                };
+            }
+            return backend;
+        }
+
+        Result run(TreeCopy::Progress* last = nullptr, size_t maxParallel = 4)
+        {
+            copied.clear();
+            TreeCopy::Options options;
+            options.maxParallel  = maxParallel;
+            options.manifestPath = MANIFEST;
+            options.progress     = [last](const TreeCopy::Progress& progress)
+            {
+                if (last)
+                {
+                    *last = progress;
+                }
+            };
+            return TreeCopy::run(backend(), options);
+        }
+    };
+
+    Tree sampleTree()
+    {
+        Tree tree;
+        tree.folders = {u"a", u"a/b", u"a/b/c", u"d", u"empty"};
+        u64 stamp    = 1;
+        for (std::u16string folder : {u"", u"a", u"a/b", u"a/b/c", u"d"})
+        {
+            for (char16_t name = u'0'; name < u'8'; name++)
+            {
+                std::u16string path =
+                    folder.empty() ? std::u16string(1, name) : folder + u'/' + name;
+                std::string data(stamp * 13 % 200, char('A' + stamp % 26));
+                tree.files[path] = {data, stamp++};
+            }
+        }
+        return tree;
+    }
+
+    void freshCopy()
+    {
+        remove(MANIFEST.c_str());
+        MemoryCopy copy;
+        copy.source = sampleTree();
+        TreeCopy::Progress progress;
+        CHECK(copy.run(&progress) == 0);
+        CHECK(copy.destination == copy.source);
+        CHECK(copy.copied.size() == copy.source.files.size());
+        CHECK(progress.filesDone == copy.source.files.size());
+        CHECK(progress.filesTotal == copy.source.files.size());
+        CHECK(progress.bytesDone == progress.bytesTotal);
+        CHECK(!TreeCopy::resumable(MANIFEST));
+    }
+
+    // Files finished before the interruption aren't copied again
+    void interruptedCopy()
+    {
+        remove(MANIFEST.c_str());
+        MemoryCopy copy;
+        copy.source    = sampleTree();
+        copy.failAfter = 10;
+        CHECK(copy.run(nullptr, 1) == -1);
+        CHECK(TreeCopy::resumable(MANIFEST));
+        std::vector<std::u16string> first = copy.copied;
+
+        copy.failAfter = SIZE_MAX;
+        TreeCopy::Progress progress;
+        CHECK(copy.run(&progress, 1) == 0);
+        CHECK(copy.destination == copy.source);
+        CHECK(copy.copied.size() == copy.source.files.size() - first.size());
+        for (const auto& path : first)
+        {
+            CHECK(std::find(copy.copied.begin(), copy.copied.end(), path) == copy.copied.end());
+        }
+        CHECK(progress.filesDone == copy.source.files.size());
+        CHECK(progress.bytesDone == progress.bytesTotal);
+        CHECK(!TreeCopy::resumable(MANIFEST));
+    }
+
+    // Between the runs, the source changes and so does what was already copied. The resumed run
+    // has to end up with an exact copy of the new source all the same.
+    void changedBetweenRuns()
+    {
+        remove(MANIFEST.c_str());
+        MemoryCopy copy;
+        copy.source    = sampleTree();
+        copy.failAfter = 30;
+        CHECK(copy.run(nullptr, 1) == -1);
+        const std::vector<std::u16string> first = copy.copied;
+
+        // Gone from the source: a finished file and a whole folder with finished files in it
+        copy.source.files.erase(first[0]);
+        std::erase_if(copy.source.files, [](const auto& file) { return inside(file.first, u"d"); });
+        copy.source.folders.erase(u"d");
+        // Changed in the source since it was copied, and a new file
+        copy.source.files[first[1]] = {"changed", 1000};
+        copy.source.files[u"a/new"] = {"new", 1001};
+        // Gone from the destination, or cut short there, though the manifest has them
+        copy.destination.files.erase(first[2]);
+        copy.destination.files[first[3]].first.resize(1);
+        // Never in the source at all
+        copy.destination.files[u"a/b/stray"] = {"stray", 5};
+        copy.destination.folders.insert(u"strays");
+        copy.destination.files[u"strays/x"] = {"x", 6};
+
+        CHECK(copy.run() == 0);
+        CHECK(copy.destination == copy.source);
+        for (size_t i = 1; i < 4; i++)
+        {
+            CHECK(std::find(copy.copied.begin(), copy.copied.end(), first[i]) !=
+                  copy.copied.end());
+        }
+        for (size_t i = 4; i < first.size(); i++)
+        {
+            if (copy.source.files.contains(first[i]))
+            {
+                CHECK(std::find(copy.copied.begin(), copy.copied.end(), first[i]) ==
+                      copy.copied.end());
+            }
+        }
+    }
+
+    // A file without a stamp can't be checked for changes, so it's always copied again
+    void unstamped()
+    {
+        remove(MANIFEST.c_str());
+        MemoryCopy copy;
+        copy.source = sampleTree();
+        for (auto& file : copy.source.files)
+        {
+            file.second.second = 0;
+        }
+        copy.failAfter = 20;
+        CHECK(copy.run(nullptr, 1) == -1);
+        copy.failAfter = SIZE_MAX;
+        CHECK(copy.run() == 0);
+        CHECK(copy.copied.size() == copy.source.files.size());
+        CHECK(copy.destination == copy.source);
+    }
+
+    // Without the hooks for the destination, finished files are still skipped
+    void withoutReconcile()
+    {
+        remove(MANIFEST.c_str());
+        MemoryCopy copy;
+        copy.reconcile = false;
+        copy.source    = sampleTree();
+        copy.failAfter = 15;
+        CHECK(copy.run(nullptr, 1) == -1);
+        copy.failAfter = SIZE_MAX;
+        CHECK(copy.run() == 0);
+        CHECK(copy.copied.size() == copy.source.files.size() - 15);
+        CHECK(copy.destination == copy.source);
+    }
+}
+
+int main()
+{
+    Threads::init(1, 4);
+
+    freshCopy();
+    interruptedCopy();
+    changedBetweenRuns();
+    unstamped();
+    withoutReconcile();
+
+    remove(MANIFEST.c_str());
+    Threads::exit();
+    return checkResult();
+}
@@ -0,0 +1,70 @@
+/*
+ *   This file is part of PKSM
+ *   Copyright (C) 2016-2022 Bernardo Giordano, Admiral Fish, piepie62
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, either version 3 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *   Additional Terms 7.b and 7.c of GPLv3 apply to this file:
+ *       * Requiring preservation of specified reasonable legal notices or
+ *         author attributions in that material or in the Appropriate Legal
+ *         Notices displayed by works containing it.
+ *       * Prohibiting misrepresentation of the origin of that material,
+ *         or requiring that modified versions of such material be marked in
+ *         reasonable ways as different from the original version.
+ */
+
+// Stands in for newlib's locks, which DataMutex expects to be declared already, in the host tests.
+// Force-included into everything built there.
+#ifndef SYS_LOCK_H
+#define SYS_LOCK_H
+
+#include <pthread.h>
+
+typedef pthread_mutex_t _LOCK_T;
+typedef pthread_mutex_t _LOCK_RECURSIVE_T;
+
+inline void __lock_init(_LOCK_T& lock)
+{
+    pthread_mutex_init(&lock, nullptr);
+}
+
+inline void __lock_init_recursive(_LOCK_RECURSIVE_T& lock)
+{
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+inline void __lock_acquire(_LOCK_T& lock)
+{
+    pthread_mutex_lock(&lock);
+}
+
+inline void __lock_release(_LOCK_T& lock)
+{
+    pthread_mutex_unlock(&lock);
+}
+
+inline void __lock_close(_LOCK_T& lock)
+{
+    pthread_mutex_destroy(&lock);
+}
+
+#define __lock_acquire_recursive __lock_acquire
+#define __lock_release_recursive __lock_release
+#define __lock_close_recursive   __lock_close
+
+#endif